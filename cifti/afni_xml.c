@@ -50,7 +50,19 @@ static void * safe_realloc(void * ptr , size_t size)
 /* ---------------------------------------------------------------------- */
 /* XML global struct and access functions                                 */
 
-static afni_xml_control gAXD = {
+/* the control struct holds both options and parsing state, so each thread
+   gets its own copy (options set in one thread do not apply to others) */
+#if defined(_MSC_VER)
+#define AXML_TLS __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define AXML_TLS _Thread_local
+#elif defined(__GNUC__)
+#define AXML_TLS __thread
+#else
+#define AXML_TLS
+#endif
+
+static AXML_TLS afni_xml_control gAXD = {
    1,          /* verb, default to 1 (0 means quiet)         */
    1,          /* dstore, flag whether to store data         */
    3,          /* indent, spaces per indent level            */
@@ -4,6 +4,23 @@
 #include "nifti2_io.h"   /* typedefs, prototypes, macros, etc. */
 #include "nifti2_io_version.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>   /* for madvise() on brick arenas */
+#endif
+
+/* vector kernels (byte swapping, float checks) are built for x86_64 with
+   gcc or clang, using target attributes, and are chosen at run time;
+   define NIFTI_NO_SIMD to use only the scalar code */
+#if !defined(NIFTI_NO_SIMD) && defined(__x86_64__) && \
+    ( defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5) )
+#define NIFTI_SIMD_X86
+#include <immintrin.h>
+#endif
+
 /*****===================================================================*****/
 /*****     Sample functions to deal with NIFTI-1,2 and ANALYZE files     *****/
 /*****...................................................................*****/
@@ -405,18 +422,102 @@ static char const * const gni2_history[] =
   "        - cast a few more pedantic void*'s\n"
   "2.1.0.2 - non-release update - 16 Jun, 2022 [rickr]\n"
   "        - add nifti_image_write_status\n",
+  "2.1.0.3 - non-release update - 16 Oct, 2026 [agent]\n"
+  "        - add nifti_set_mmap_data, to map image data in nifti_image_load\n"
+  "        - znzlib: large gzip reads may decompress in parallel\n"
+  "          (see znz_set_nthreads and ZNZ_NUM_THREADS)\n"
+  "        - znzlib: gzip output may be compressed in parallel blocks (pigz)\n"
+  "        - znzlib: index gzip files while reading, for fast seeks\n"
+  "          (see znz_set_index_mode, for FILE.gz.idx sidecar files)\n"
+  "        - add znzpread/znzpwrite and nifti_pread_buffer; image, brick\n"
+  "          and subregion reads no longer seek, so may run concurrently\n"
+  "        - add nifti_set_nthreads, to load large uncompressed data in\n"
+  "          parallel chunks\n"
+  "        - byte swap with SSE2/SSSE3/AVX2/AVX-512 on x86_64, chosen at\n"
+  "          run time; do not truncate the element count to int\n"
+  "        - read, swap and check floats in cache-sized blocks, and add\n"
+  "          nifti_read_buffer2 for a per-call NaN/Inf policy\n"
+  "        - add nifti_fix_nonfinite, vectorized NaN/Inf check and repair\n"
+  "        - add nifti_image_load_as, to read data as scaled float/double\n"
+  "        - nifti_read_subregion_image merges rows into fewer reads\n"
+  "        - add nifti_read_subregions, to read many regions in one pass\n"
+  "        - nifti_read_collapsed_image: iterate over leaves, merging close\n"
+  "          reads into slabs, with parallel reads for many leaves\n"
+  "        - add nifti_read_timeseries, to read many voxel time series\n"
+  "        - add nifti_image_load_bricks_ex, with NIFTI_NBL_ARENA to load\n"
+  "          bricks into one aligned block\n"
+  "        - nifti_copynsort: sort with qsort; read runs of consecutive\n"
+  "          bricks at once, and copy repeated bricks after reading\n"
+  "        - nifti_image_load_bricks: read brick runs in parallel, when\n"
+  "          nifti_set_nthreads() > 1\n"
+  "        - add nifti_volume_reader_open/next/close, to stream volumes\n"
+  "          with background prefetch\n"
+  "        - add nifti_volume_writer_open/append/close, to write volumes\n"
+  "          incrementally, finalizing the header at close\n"
+  "        - add nifti_image_append_volumes, to append volumes to a .nii\n"
+  "          in place, updating only the header dimensions\n"
+  "        - add nifti_context, for per-thread options (the global options\n"
+  "          are the default), with _ctx variants of the main read, load\n"
+  "          and write functions, and per-thread last-error codes\n"
+  "        - guard the mmap list with a mutex\n"
+  "        - add nifti_set_allocator, for image data, extension data, bricks\n"
+  "          and returned buffers, without zero filling buffers to be read\n"
+  "        - image data buffers are aligned (nifti_set_data_align, default\n"
+  "          64 bytes), and huge page aligned and advised when large\n"
+  "        - add nifti_scan_headers, to read many headers on a thread pool,\n"
+  "          finding files from directory listings (znz_read_head in znzlib)\n",
   "----------------------------------------------------------------------\n"
 };
 
-static const char gni_version[] = NIFTI2_IO_SOURCE_VERSION " (16 Jun, 2022)";
+static const char gni_version[] = NIFTI2_IO_SOURCE_VERSION " (16 Oct, 2026)";
+
+/* thread-local storage, for the current context and the last error */
+#if defined(_MSC_VER)
+#define NIFTI_TLS __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define NIFTI_TLS _Thread_local
+#elif defined(__GNUC__)
+#define NIFTI_TLS __thread
+#else
+#define NIFTI_TLS               /* no threads, no thread-local storage */
+#endif
 
 /*! global nifti options structure - init with defaults */
 /*  see 'option accessor functions'                     */
-static nifti_global_options g_opts = {
+static nifti_global_options g_nifti_opts = {
         1, /* debug level                                         */
         0, /* skip_blank_ext    - skip extender if no extensions  */
         1, /* allow_upper_fext  - allow uppercase file extensions */
         0, /* alter_cifti       - alter CIFTI dims to use nx,t,u,v*/
+        0, /* mmap_data         - map image data, NIFTI_MMAP_*    */
+        0, /* nthreads          - threads for reading, 0: znzlib  */
+        0, /* data_align        - image data alignment, 0: 64     */
+};
+
+/*! a context holds its own copy of the options, for threads to use in
+    place of the global ones (see nifti_set_thread_context) */
+struct nifti_context {
+   nifti_global_options opts;
+};
+
+/* the context of this thread (NULL for the global options), and the code
+   of its last failure (NIFTI_ERR_*) */
+static NIFTI_TLS nifti_context * g_cur_ctx = NULL;
+static NIFTI_TLS int             g_last_error = NIFTI_ERR_NONE;
+
+/* the options in effect for this thread: those of its context, if it has
+   one (see nifti_set_thread_context), else the global ones */
+#define NIFTI_OPTS (*(g_cur_ctx ? &g_cur_ctx->opts : &g_nifti_opts))
+
+/* the allocator for image data, extension data and bricks (global, since
+   memory must be freed by the allocator that provided it) */
+static void * nifti_default_alloc  (size_t nbytes, void * ctx);
+static void * nifti_default_alloc_aligned(size_t align, size_t nbytes,
+                                          void * ctx);
+static void   nifti_default_dealloc(void * ptr, void * ctx);
+static nifti_allocator g_nifti_alloc = {
+        nifti_default_alloc, nifti_default_alloc_aligned,
+        nifti_default_dealloc, NULL
 };
 
 char nifti1_magic[4] = { 'n', '+', '1', '\0' };
@@ -485,20 +586,134 @@ static int  nifti_fill_extension(nifti1_extension * ext, const char * data,
                                  int len, int ecode);
 static void compute_strides(int64_t *strides,const int64_t *size,int nbyper);
 
+/* for nifti_read_subregion_image: rows are merged into spans and slabs */
+#define NIFTI_SPAN_GAP   ((int64_t)1<<16)  /* cost of a read call, in bytes */
+#define NIFTI_SPAN_SLAB  ((int64_t)1<<22)  /* largest grouped read         */
+#define NIFTI_SPAN_MAX   1024              /* most spans in a group        */
+
+typedef struct {
+   znzFile       fp;
+   nifti_image * nim;
+   int64_t       max_gap;       /* largest gap to read through          */
+   int64_t       max_slab;      /* largest read of a group of spans     */
+   char        * dest;          /* where the current group goes         */
+   char        * slab;          /* buffer for reading groups            */
+   int64_t       spans[2*NIFTI_SPAN_MAX]; /* offset/length pairs        */
+   int           nspans;
+   int64_t       nreads;        /* number of read calls                 */
+} nifti_span_plan;
+
+static void nifti_span_init(nifti_span_plan * P, znzFile fp,
+                            nifti_image * nim, char * dest);
+static void nifti_span_free(nifti_span_plan * P);
+static int  nifti_span_flush(nifti_span_plan * P);
+static int  nifti_span_add(nifti_span_plan * P, int64_t off, int64_t len);
+/* for nifti_read_subregions: one row of one region */
+typedef struct {
+   int64_t       off;           /* offset of the row in the data        */
+   int64_t       len;           /* bytes in the row                     */
+   char        * dest;          /* where the row goes                   */
+} nifti_roi_row;
+
+static int  nifti_roi_row_compare(const void * a, const void * b);
+
+/* for nifti_read_timeseries: a voxel, and its row in the output */
+#define NIFTI_TS_BATCH  ((int64_t)1<<26)   /* bytes of volumes per read    */
+#define NIFTI_TS_TBLOCK 16                 /* time points per row piece    */
+
+typedef struct {
+   int64_t       index;         /* voxel index within a volume          */
+   int64_t       row;           /* position in the voxel list           */
+} nifti_ts_vox;
+
+static int  nifti_ts_vox_compare(const void * a, const void * b);
+static void nifti_ts_gather(const char * src, char * dst,
+                            const nifti_ts_vox * vox, int64_t nvox,
+                            int64_t nvol, int64_t nt, int64_t t0,
+                            int64_t nb, int nbyper);
+
+/* for nifti_volume_reader: buffers in the ring (one held by the caller) */
+#define NIFTI_VR_NBUF 3
+
+static int64_t nifti_vr_read_batch(nifti_volume_reader * R, int ind);
+
+/* for nifti_volume_writer */
+static void   nifti_vw_range(nifti_volume_writer * W, const void * data,
+                             int64_t nvox);
+static char * nifti_vw_header_bytes(nifti_volume_writer * W, int64_t * len);
+static int64_t nifti_fix_read_buffer(void * dataptr, int64_t ntot,
+                                     const nifti_image * nim, int nan_mode);
+
 /* NBL routines */
 static int  nifti_load_NBL_bricks(nifti_image * nim , const int64_t * slist,
                        const int64_t * sindex, nifti_brick_list * NBL, znzFile fp );
 static int  nifti_alloc_NBL_mem(  nifti_image * nim, int64_t nbricks,
-                                  nifti_brick_list * nbl);
+                                  nifti_brick_list * nbl, int arena);
+static char * nifti_NBL_arena(const nifti_brick_list * nbl);
+static int  nifti_NBL_arena_note(void ** bricks);
+static int  nifti_NBL_arena_forget(void ** bricks);
+
+/* brick arenas: cache line aligned, or huge page aligned when large */
+#define NIFTI_NBL_ALIGN     ((int64_t)64)
+#define NIFTI_NBL_HUGE      ((int64_t)1<<21)  /* 2 MB huge pages         */
+#define NIFTI_NBL_HUGE_MIN  ((int64_t)1<<25)  /* for arenas of >= 32 MB  */
 static int  nifti_copynsort(int64_t nbricks, const int64_t *blist,
                             int64_t **slist, int64_t **sindex);
+static int  nifti_brick_pair_compare(const void * a, const void * b);
 static int  nifti_NBL_matches_nim(const nifti_image *nim,
                                   const nifti_brick_list *NBL);
 
+/* for nifti_load_NBL_bricks: a run of consecutive bricks, read at once */
+typedef struct {
+   int64_t       c, e;          /* list positions covered by the run    */
+   int64_t       src0;          /* first brick of the run               */
+   int64_t       nb;            /* number of bricks                     */
+   char        * dest;          /* read here, or NULL to use a slab     */
+} nifti_NBL_run;
+
+typedef struct {
+   nifti_image       * nim;
+   znzFile             fp;
+   int64_t             offset;  /* file offset of brick 0               */
+   nifti_brick_list  * NBL;
+   const int64_t     * slist, * sindex;
+   nifti_NBL_run     * runs;
+   int64_t             nruns;
+} nifti_NBL_load;
+
+static void nifti_NBL_add_run(nifti_NBL_load * load, int64_t c, int64_t e,
+                              int64_t src0, int64_t nb, char * dest);
+static int  nifti_NBL_read_run(const nifti_NBL_load * load,
+                               const nifti_NBL_run * run, char ** slab,
+                               int64_t * slab_size);
+static int  nifti_NBL_read_runs(const nifti_NBL_load * load);
+static int  nifti_NBL_read_parallel(const nifti_NBL_load * load,
+                                    int nthreads);
+
 /* for nifti_read_collapsed_image: */
 static int  rci_read_data(nifti_image *nim, int64_t *pivots, int64_t *prods,
                           int nprods, const int64_t dims[], char *data,
                           znzFile fp, int64_t base_offset);
+
+/* leaves of a collapsed image: nleaf reads of leaf bytes, at offsets
+   base + sum(ind[lev]*step[lev]), over 0 <= ind[lev] < count[lev]    */
+#define NIFTI_RCI_PAR_LEAVES 256   /* read at least this many in parallel */
+
+typedef struct {
+   nifti_image * nim;
+   znzFile       fp;
+   char        * data;
+   int64_t       base;          /* file offset of the first leaf        */
+   int64_t       step[8];       /* offset step, per level               */
+   int64_t       count[8];      /* number of steps, per level           */
+   int           nlev;
+   int64_t       nleaf;         /* total number of leaves               */
+   int64_t       leaf;          /* bytes per leaf                       */
+} rci_leaf_list;
+
+static int64_t rci_read_leaves(const rci_leaf_list * L, int64_t first,
+                               int64_t nleaf);
+static int64_t rci_read_parallel(const rci_leaf_list * L, int nthreads);
 static int rci_alloc_mem(void **data, const int64_t prods[8], int nprods, int nbyper);
 static int  make_pivot_list(nifti_image * nim, const int64_t dims[],
                             int64_t pivots[], int64_t prods[], int * nprods );
@@ -520,10 +735,35 @@ static char *escapize_string   (const char *str);
 /* consider for export */
 static int  nifti_ext_type_index(nifti_image * nim, int ecode);
 
+/* memory mapped image data */
+static int  nifti_image_load_mmap(nifti_image *nim, znzFile fp, int64_t ntot);
+static int  nifti_mmap_release(void *data);
+static void nifti_set_last_error(int code);
+static nifti_global_options * nifti_ctx_opts(nifti_context * ctx);
+
 /* internal I/O routines */
 static int nifti_image_write_engine(nifti_image *nim, int write_opts,
         const char * opts, znzFile * imgfile, const nifti_brick_list * NBL);
 static znzFile nifti_image_load_prep( nifti_image *nim );
+static int64_t nifti_pread_parallel(znzFile fp, int64_t offset, void * data,
+                                    int64_t ntot, nifti_image * nim,
+                                    int nthreads);
+static int64_t nifti_read_blocks(znzFile fp, int64_t offset, char * data,
+                                 int64_t ntot, const nifti_image * nim,
+                                 int nan_mode, int64_t * nbad);
+
+/* fused read, swap and float check of data (see nifti_read_buffer2) */
+#define NIFTI_READ_BLOCK   ((int64_t)1<<18)  /* 256 KB, a multiple of 16  */
+
+/* image data alignment (see nifti_set_data_align), and large buffers
+   that are huge page aligned and advised (by the default allocator) */
+#define NIFTI_DATA_ALIGN    64
+#define NIFTI_DATA_HUGE     NIFTI_NBL_HUGE
+#define NIFTI_DATA_HUGE_MIN NIFTI_NBL_HUGE_MIN
+
+/* parallel image loads (see nifti_set_nthreads) */
+#define NIFTI_PAR_CHUNK    ((int64_t)1<<23)  /* 8 MB, a multiple of 16    */
+#define NIFTI_PAR_MIN_LOAD ((int64_t)1<<25)  /* load >= 32 MB in parallel */
 static int     has_ascii_header(znzFile fp);
 /*---------------------------------------------------------------------------*/
 
@@ -677,7 +917,7 @@ static void update_nifti_image_for_brick_list( nifti_image * nim ,
 {
    int64_t ndim;
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"+d updating image dimensions for %" PRId64
               " bricks in list\n", nbricks);
       fprintf(stderr,"   ndim = %" PRId64 "\n",nim->ndim);
@@ -700,7 +940,7 @@ static void update_nifti_image_for_brick_list( nifti_image * nim ,
    for( ndim = 4; (ndim > 1) && (nim->dim[ndim] <= 1); ndim-- )
        ;
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"+d ndim = %" PRId64 " -> %" PRId64 "\n",nim->ndim, ndim);
       fprintf(stderr," --> (%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64
               ",%" PRId64 ",%" PRId64 ",%" PRId64 ")\n",
@@ -730,7 +970,7 @@ int nifti_update_dims_from_array( nifti_image * nim )
       return 1;
    }
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"+d updating image dimensions given nim->dim:");
       for( c = 0; c < 8; c++ ) fprintf(stderr," %" PRId64, nim->dim[c]);
       fputc('\n',stderr);
@@ -796,7 +1036,7 @@ int nifti_update_dims_from_array( nifti_image * nim )
    for( ndim = nim->dim[0]; (ndim > 1) && (nim->dim[ndim] <= 1); ndim-- )
        ;
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"+d ndim = %" PRId64 " -> %" PRId64 "\n",nim->ndim, ndim);
       fprintf(stderr," --> (%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64
               ",%" PRId64 ",%" PRId64 ",%" PRId64 ")\n",
@@ -828,6 +1068,33 @@ int nifti_update_dims_from_array( nifti_image * nim )
 *//*--------------------------------------------------------------------*/
 int nifti_image_load_bricks( nifti_image * nim , int64_t nbricks,
                              const int64_t * blist, nifti_brick_list * NBL )
+{
+   return nifti_image_load_bricks_ex(nim, nbricks, blist, NBL, 0);
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! Load the image data from disk into a brick list, with options.
+ *
+ * This is nifti_image_load_bricks, with flags:
+ *
+ *    NIFTI_NBL_ARENA : allocate all bricks as a single contiguous block,
+ *                      with NBL->bricks[i] = NBL->bricks[0] + i*NBL->bsize.
+ *
+ * The arena is 64-byte aligned (huge page aligned and advised, if large),
+ * so NBL->bricks[0] may be used as a dense (nx*ny*nz) x nbricks matrix,
+ * without any copy.  The arena is in the same allocation as NBL->bricks,
+ * and must be released only by nifti_free_NBL (which knows the lists that
+ * hold arenas).
+ *
+ * \return the number of loaded bricks (NBL->nbricks),
+ *    0 on failure, < 0 on error
+ *
+ * \sa nifti_image_load_bricks, nifti_free_NBL
+*//*--------------------------------------------------------------------*/
+int nifti_image_load_bricks_ex( nifti_image * nim , int64_t nbricks,
+                                const int64_t * blist,
+                                nifti_brick_list * NBL, int flags )
 {
    int64_t * slist = NULL, * sindex = NULL;
    int       rv;
@@ -837,18 +1104,22 @@ int nifti_image_load_bricks( nifti_image * nim , int64_t nbricks,
    if( !nim || !NBL ){
       fprintf(stderr,"** nifti_image_load_bricks, bad params (%p,%p)\n",
               (void *)nim, (void *)NBL);
+      nifti_set_last_error(NIFTI_ERR_INPUT);
       return -1;
    }
 
    if( blist && nbricks <= 0 ){
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"-d load_bricks: received blist with nbricks = "
                  "%" PRId64 "," "ignoring blist\n", nbricks);
       blist = NULL; /* pretend nothing was passed */
    }
 
-   if( blist && ! valid_nifti_brick_list(nim, nbricks, blist, g_opts.debug>0) )
+   if( blist && ! valid_nifti_brick_list(nim, nbricks, blist,
+                                         NIFTI_OPTS.debug>0) ){
+      nifti_set_last_error(NIFTI_ERR_INPUT);
       return -1;
+   }
 
    /* for efficiency, let's read the file in order */
    if( blist && nifti_copynsort( nbricks, blist, &slist, &sindex ) != 0 )
@@ -857,7 +1128,7 @@ int nifti_image_load_bricks( nifti_image * nim , int64_t nbricks,
    /* open the file and position the FILE pointer */
    fp = nifti_image_load_prep( nim );
    if( !fp ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** nifti_image_load_bricks, failed load_prep\n");
       if( blist ){ free(slist); free(sindex); }
       return -1;
@@ -865,7 +1136,9 @@ int nifti_image_load_bricks( nifti_image * nim , int64_t nbricks,
 
    /* this will flag to allocate defaults */
    if( !blist ) nbricks = 0;
-   if( nifti_alloc_NBL_mem( nim, nbricks, NBL ) != 0 ){
+   if( nifti_alloc_NBL_mem( nim, nbricks, NBL,
+                            (flags & NIFTI_NBL_ARENA) != 0 ) != 0 ){
+      nifti_set_last_error(NIFTI_ERR_NOMEM);
       if( blist ){ free(slist); free(sindex); }
       znzclose(fp);
       return -1;
@@ -874,6 +1147,7 @@ int nifti_image_load_bricks( nifti_image * nim , int64_t nbricks,
    rv = nifti_load_NBL_bricks(nim, slist, sindex, NBL, fp);
 
    if( rv != 0 ){
+      nifti_set_last_error(NIFTI_ERR_READ);
       nifti_free_NBL( NBL );  /* failure! */
       NBL->nbricks = 0; /* repetitive, but clear */
    }
@@ -888,17 +1162,26 @@ int nifti_image_load_bricks( nifti_image * nim , int64_t nbricks,
 
 /*----------------------------------------------------------------------*/
 /*! nifti_free_NBL      - free all pointers and clear structure
+ *
+ * Brick arenas from nifti_image_load_bricks_ex() are freed with their
+ * pointer list.  Any other list (including one built by the caller)
+ * has each brick freed by nifti_data_free(), and the list by free().
  *
  * note: this does not presume to free the structure pointer
 *//*--------------------------------------------------------------------*/
 void nifti_free_NBL( nifti_brick_list * NBL )
 {
-   int c;
+   int64_t c;
 
    if( NBL->bricks ){
-      for( c = 0; c < NBL->nbricks; c++ )
-         free(NBL->bricks[c]);
-      free(NBL->bricks);
+      /* arena bricks are part of the NBL->bricks allocation */
+      if( nifti_NBL_arena_forget(NBL->bricks) )
+         nifti_data_free(NBL->bricks);
+      else {
+         for( c = 0; c < NBL->nbricks; c++ )
+            nifti_data_free(NBL->bricks[c]);
+         free(NBL->bricks);
+      }
       NBL->bricks = NULL;
    }
 
@@ -909,90 +1192,294 @@ void nifti_free_NBL( nifti_brick_list * NBL )
 /*----------------------------------------------------------------------
  * nifti_load_NBL_bricks      - read the file data into the NBL struct
  *
+ * The bricks are read in file order (slist, or all bricks if slist is
+ * NULL), where sindex[c] is the destination of brick slist[c].  A run of
+ * consecutive bricks is read with a single call, either straight into
+ * its destinations (if they are back to back, as in an arena), or into
+ * a slab buffer of up to NIFTI_SPAN_SLAB bytes, from which the bricks
+ * are copied out.  Repeated bricks are read once, then copied after all
+ * reading is done.
+ *
+ * With nifti_set_nthreads() > 1, the runs of a large uncompressed load
+ * are read by worker threads (long runs are split into NIFTI_PAR_CHUNK
+ * pieces), each with positional reads, and swapping done per run.
+ *
  * return 0 on success, -1 on failure
  *----------------------------------------------------------------------*/
+#undef  NBL_SRC
+#undef  NBL_DEST
+#undef  NBL_IS_DUP
+#define NBL_SRC(c)    (slist ? slist[c] : (c))
+#define NBL_DEST(c)   ((char *)NBL->bricks[sindex ? sindex[c] : (c)])
+#define NBL_IS_DUP(c) ((c) > 0 && NBL_SRC(c) == NBL_SRC((c)-1))
+
 static int nifti_load_NBL_bricks( nifti_image * nim , const int64_t * slist,
                         const int64_t * sindex, nifti_brick_list * NBL, znzFile fp )
 {
-   int64_t oposn, fposn;      /* orig and current file positions */
-   int64_t rv, test;
-   int64_t c;
-   int64_t prev, isrc, idest; /* previous/current sub-brick, and new index */
+   nifti_NBL_load load;
+   int64_t oposn;             /* offset of the first brick */
+   int64_t test;
+   int64_t c, e, nb, piece;   /* run of bricks [c,e), nb of them unique */
+   int64_t src0, nbytes = 0;
+   int64_t bsize = NBL->bsize;
+   char  * dest0;
+   int     contig, isnext, nthreads, rv;
 
    test = znztell(fp);  /* store current file position */
    if( test < 0 ){
       fprintf(stderr,"** NIFTI load bricks: ztell failed??\n");
       return -1;
    }
-   fposn = oposn = test;
+   oposn = test;
 
-   /* first, handle the default case, no passed blist */
-   if( !slist ){
-      for( c = 0; c < NBL->nbricks; c++ ) {
-         rv = nifti_read_buffer(fp, NBL->bricks[c], NBL->bsize, nim);
-         if( rv != NBL->bsize ){
-            fprintf(stderr,"** NIFTI load bricks: cannot read brick %" PRId64
-                    " from '%s'\n",
-                    c, nim->iname ? nim->iname : nim->fname);
-            return -1;
+   if( slist && !sindex ){
+      fprintf(stderr,"** NIFTI load_NBL_bricks: missing index list\n");
+      return -1;
+   }
+
+   load.nim    = nim;
+   load.fp     = fp;
+   load.offset = oposn;
+   load.NBL    = NBL;
+   load.slist  = slist;
+   load.sindex = sindex;
+   load.nruns  = 0;
+   load.runs   = (nifti_NBL_run *)malloc(NBL->nbricks * sizeof(nifti_NBL_run));
+   if( !load.runs ){
+      fprintf(stderr,"** NIFTI load bricks: failed to alloc %" PRId64
+              " runs\n", NBL->nbricks);
+      return -1;
+   }
+
+   nthreads = znz_iscompressed(fp) ? 1 : nifti_get_nthreads();
+   piece    = NIFTI_PAR_CHUNK / bsize > 1 ? NIFTI_PAR_CHUNK / bsize : 1;
+
+   /* plan the runs */
+   for( c = 0; c < NBL->nbricks; c = e ){
+      /* if this sub-brick is the previous one, it is copied later */
+      if( NBL_IS_DUP(c) ) { e = c + 1; continue; }
+
+      /* extend the run over consecutive bricks, either while they are
+         also consecutive in memory, or while they fit in the slab      */
+      /* (a single brick is always read straight to its destination,
+          and a slab run starts only once a second brick fits)         */
+      src0   = NBL_SRC(c);
+      dest0  = NBL_DEST(c);
+      contig = 1;
+      for( e = c + 1, nb = 1; e < NBL->nbricks; e++ ){
+         if( NBL_IS_DUP(e) ) continue;
+         if( NBL_SRC(e) != src0 + nb ) break;
+         isnext = NBL_DEST(e) == dest0 + nb * bsize;
+         if( nb == 1 ){
+            if( !isnext && 2 * bsize > NIFTI_SPAN_SLAB ) break;
+            contig = isnext;
          }
+         if( contig ? !isnext : (nb+1) * bsize > NIFTI_SPAN_SLAB ) break;
+         nb++;
       }
-      if( g_opts.debug > 1 )
-         fprintf(stderr,"+d read %" PRId64 " default %" PRId64
-                 "-byte bricks from file %s\n",
-                 NBL->nbricks, NBL->bsize,
-                 nim->iname ? nim->iname:nim->fname );
-      return 0;
+      nbytes += nb * bsize;
+
+      if( !contig ){
+         nifti_NBL_add_run(&load, c, e, src0, nb, NULL);
+         continue;
+      }
+
+      /* long runs are split into pieces, for threads to share */
+      while( nthreads > 1 && nb > piece ){
+         nifti_NBL_add_run(&load, c, e, src0, piece, dest0);
+         src0  += piece;
+         dest0 += piece * bsize;
+         nb    -= piece;
+      }
+      nifti_NBL_add_run(&load, c, e, src0, nb, dest0);
    }
 
-   if( !sindex ){
-      fprintf(stderr,"** NIFTI load_NBL_bricks: missing index list\n");
+   if( nthreads > 1 && load.nruns > 1 && nbytes >= NIFTI_PAR_MIN_LOAD )
+      rv = nifti_NBL_read_parallel(&load, nthreads);
+   else
+      rv = nifti_NBL_read_runs(&load);
+   free(load.runs);
+   if( rv ) return -1;
+
+   /* copy repeated sub-bricks from the previous one (they are sorted) */
+   for( c = 1; c < NBL->nbricks; c++ )
+      if( NBL_IS_DUP(c) ) memcpy(NBL_DEST(c), NBL_DEST(c-1), bsize);
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d read %" PRId64 " %" PRId64 "-byte bricks in %"
+              PRId64 " reads from file %s\n",
+              NBL->nbricks, bsize, load.nruns,
+              nim->iname ? nim->iname:nim->fname );
+
+   return 0;
+}
+
+/* append a run to the plan (runs never outnumber the unique bricks) */
+static void nifti_NBL_add_run(nifti_NBL_load * load, int64_t c, int64_t e,
+                              int64_t src0, int64_t nb, char * dest)
+{
+   nifti_NBL_run * run = load->runs + load->nruns++;
+
+   run->c    = c;
+   run->e    = e;
+   run->src0 = src0;
+   run->nb   = nb;
+   run->dest = dest;
+}
+
+/*----------------------------------------------------------------------
+ * nifti_NBL_read_run      - read one run of bricks
+ *
+ * A run with a dest is read there, otherwise it is read into *slab
+ * (of *slab_size bytes, grown here to fit the run, if needed), and the
+ * bricks in [c,e) are copied out.
+ *
+ * return 0 on success, -1 on failure
+ *----------------------------------------------------------------------*/
+static int nifti_NBL_read_run(const nifti_NBL_load * load,
+                              const nifti_NBL_run * run, char ** slab,
+                              int64_t * slab_size)
+{
+   const nifti_brick_list * NBL    = load->NBL;
+   const int64_t          * slist  = load->slist;
+   const int64_t          * sindex = load->sindex;
+   int64_t                  bsize  = NBL->bsize, rv, k;
+
+   /* the slab is sized by the run, not by what the planner intends */
+   if( !run->dest && *slab_size < run->nb * bsize ){
+      free(*slab);
+      *slab_size = 0;
+      if( !(*slab = (char *)malloc(run->nb * bsize)) ){
+         fprintf(stderr,"** NIFTI load bricks: failed to alloc %" PRId64
+                 " byte slab\n", run->nb * bsize);
+         return -1;
+      }
+      *slab_size = run->nb * bsize;
+   }
+
+   /* only 10,000 lines later and we're actually reading something! */
+   /* (read at the brick offset, rather than seeking to it)        */
+   rv = nifti_pread_buffer(load->fp, load->offset + run->src0 * bsize,
+                           run->dest ? run->dest : *slab, run->nb * bsize,
+                           load->nim);
+   if( rv != run->nb * bsize ){
+      fprintf(stderr,"** NIFTI: failed to read brick %" PRId64
+              " from file '%s'\n", run->src0,
+              load->nim->iname ? load->nim->iname : load->nim->fname);
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"   (read %" PRId64 " of %" PRId64 " bytes)\n",
+                 rv, run->nb * bsize);
       return -1;
    }
 
-   prev = -1;   /* use prev for previous sub-brick */
-   for( c = 0; c < NBL->nbricks; c++ ){
-       isrc = slist[c];   /* this is original brick index (c is new one) */
-       idest = sindex[c]; /* this is the destination index for this data */
+   if( !run->dest )
+      for( k = run->c; k < run->e; k++ )
+         if( ! NBL_IS_DUP(k) )
+            memcpy(NBL_DEST(k), *slab + (NBL_SRC(k) - run->src0) * bsize,
+                   bsize);
 
-       /* if this sub-brick is not the previous, we must read from disk */
-       if( isrc != prev ){
+   return 0;
+}
 
-          /* if we are not looking at the correct sub-brick, scan forward */
-          if( fposn != (oposn + isrc*NBL->bsize) ){
-             fposn = oposn + isrc*NBL->bsize;
-             /* rcr - znz functions need to handle 64-bit cases, */
-             /* see setting _FILE_OFFSET_BITS                    */
-             if( znzseek(fp, fposn, SEEK_SET) < 0 ){
-                fprintf(stderr,"** NIFTI: failed to locate brick %" PRId64
-                        " in file '%s'\n",
-                        isrc, nim->iname ? nim->iname : nim->fname);
-                return -1;
-             }
-          }
+/* read all runs of the plan, in order */
+static int nifti_NBL_read_runs(const nifti_NBL_load * load)
+{
+   char    * slab = NULL;
+   int64_t   r, slab_size = 0;
+   int       rv = 0;
 
-          /* only 10,000 lines later and we're actually reading something! */
-          rv = nifti_read_buffer(fp, NBL->bricks[idest], NBL->bsize, nim);
-          if( rv != NBL->bsize ){
-             fprintf(stderr,"** NIFTI: failed to read brick %" PRId64
-                     " from file '%s'\n",
-                     isrc, nim->iname ? nim->iname : nim->fname);
-             if( g_opts.debug > 1 )
-                fprintf(stderr,"   (read %" PRId64 " of %" PRId64 " bytes)\n",
-                        rv, NBL->bsize);
-             return -1;
-          }
-          fposn += NBL->bsize;
-       } else {
-          /* we have already read this sub-brick, just copy the previous one */
-          /* note that this works because they are sorted */
-          memcpy(NBL->bricks[idest], NBL->bricks[sindex[c-1]], NBL->bsize);
-       }
+   for( r = 0; r < load->nruns && !rv; r++ )
+      rv = nifti_NBL_read_run(load, load->runs + r, &slab, &slab_size);
+   free(slab);
+
+   return rv;
+}
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+   const nifti_NBL_load * load;
+   nifti_context        * ctx;      /* context of the caller     */
+   pthread_mutex_t        lock;     /* for the fields below      */
+   int64_t                next;     /* next run to be read       */
+   int                    failed;
+} nifti_NBL_par;
 
-       prev = isrc;  /* in any case, note the now previous sub-brick */
+static void * nifti_NBL_worker(void * arg)
+{
+   nifti_NBL_par * job  = (nifti_NBL_par *)arg;
+   char          * slab = NULL;
+   int64_t         r, slab_size = 0;
+   int             rv;
+
+   g_cur_ctx = job->ctx;
+
+   while( 1 ){
+      pthread_mutex_lock(&job->lock);
+      r = job->failed ? job->load->nruns : job->next++;
+      pthread_mutex_unlock(&job->lock);
+      if( r >= job->load->nruns ) break;
+
+      rv = nifti_NBL_read_run(job->load, job->load->runs + r, &slab,
+                              &slab_size);
+
+      if( rv ){
+         pthread_mutex_lock(&job->lock);
+         job->failed = 1;
+         pthread_mutex_unlock(&job->lock);
+      }
    }
+   free(slab);
 
-   return 0;
+   return NULL;
+}
+#endif
+
+/*----------------------------------------------------------------------
+ * nifti_NBL_read_parallel  - read the runs of the plan using nthreads
+ *
+ * return 0 on success, -1 on failure
+ *----------------------------------------------------------------------*/
+static int nifti_NBL_read_parallel(const nifti_NBL_load * load, int nthreads)
+{
+#ifdef HAVE_PTHREAD
+   nifti_NBL_par   job;
+   pthread_t     * tids;
+   int             c, nstarted = 0;
+
+   job.load   = load;
+   job.next   = 0;
+   job.failed = 0;
+
+   if( nthreads > load->nruns ) nthreads = (int)load->nruns;
+   tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+   if( nthreads < 2 || !tids ){
+      free(tids);
+      return nifti_NBL_read_runs(load);
+   }
+
+   job.ctx = g_cur_ctx;
+   pthread_mutex_init(&job.lock, NULL);
+
+   /* this thread is one of the workers */
+   for( c = 1; c < nthreads; c++ )
+      if( pthread_create(tids + nstarted, NULL, nifti_NBL_worker, &job) == 0 )
+         nstarted++;
+   nifti_NBL_worker(&job);
+   for( c = 0; c < nstarted; c++ )
+      pthread_join(tids[c], NULL);
+
+   pthread_mutex_destroy(&job.lock);
+   free(tids);
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d read %" PRId64 " brick runs using %d threads\n",
+              load->nruns, nstarted + 1);
+
+   return job.failed ? -1 : 0;
+#else
+   (void)nthreads;
+   return nifti_NBL_read_runs(load);
+#endif
 }
 
 
@@ -1002,7 +1489,7 @@ static int nifti_load_NBL_bricks( nifti_image * nim , const int64_t * slist,
  * return 0 on success, -1 on failure
  *----------------------------------------------------------------------*/
 static int nifti_alloc_NBL_mem(nifti_image * nim, int64_t nbricks,
-                               nifti_brick_list * nbl)
+                               nifti_brick_list * nbl, int arena)
 {
    int64_t c;
 
@@ -1015,6 +1502,44 @@ static int nifti_alloc_NBL_mem(nifti_image * nim, int64_t nbricks,
    }
 
    nbl->bsize  = nim->nx * nim->ny * nim->nz * nim->nbyper; /* bytes */
+
+   /* an arena follows the pointers, in the same allocation */
+   if( arena && nbl->bsize > 0 ){
+      int64_t total = nbl->nbricks * nbl->bsize;
+      int64_t align = total >= NIFTI_NBL_HUGE_MIN ? NIFTI_NBL_HUGE
+                                                  : NIFTI_NBL_ALIGN;
+      char  * base;
+
+      nbl->bricks = (void **)nifti_data_alloc(nbl->nbricks * sizeof(void *)
+                                              + align - 1 + total);
+      if( ! nbl->bricks ){
+         fprintf(stderr,"** NIFTI NANM: failed to alloc %" PRId64
+                 " byte arena for %" PRId64 " bricks\n", total, nbl->nbricks);
+         nbl->bsize = nbl->nbricks = 0;
+         return -1;
+      }
+      if( nifti_NBL_arena_note(nbl->bricks) ){
+         nifti_data_free(nbl->bricks);
+         nbl->bricks = NULL;
+         nbl->bsize = nbl->nbricks = 0;
+         return -1;
+      }
+      base = nifti_NBL_arena(nbl);
+      for( c = 0; c < nbl->nbricks; c++ )
+         nbl->bricks[c] = base + c * nbl->bsize;
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+      if( align == NIFTI_NBL_HUGE )
+         (void)madvise(base, (size_t)(total & ~(NIFTI_NBL_HUGE-1)),
+                       MADV_HUGEPAGE);
+#endif
+
+      if( NIFTI_OPTS.debug > 2 )
+         fprintf(stderr,"+d NANM: alloc'd %" PRId64 " bricks of %" PRId64
+                 " bytes in a %" PRId64 "-aligned arena\n",
+                 nbl->nbricks, nbl->bsize, align);
+      return 0;
+   }
+
    nbl->bricks = (void **)malloc(nbl->nbricks * sizeof(void *));
 
    if( ! nbl->bricks ){
@@ -1024,14 +1549,15 @@ static int nifti_alloc_NBL_mem(nifti_image * nim, int64_t nbricks,
    }
 
    for( c = 0; c < nbl->nbricks; c++ ){
-      nbl->bricks[c] = malloc(nbl->bsize);
+      nbl->bricks[c] = nifti_data_alloc_aligned(nifti_get_data_align(),
+                                                nbl->bsize);
       if( ! nbl->bricks[c] ){
          fprintf(stderr,"** NIFTI NANM: failed to alloc %" PRId64
                  " bytes for brick %" PRId64 "\n", nbl->bsize, c);
          /* so free and clear everything before returning */
          while( c > 0 ){
             c--;
-            free(nbl->bricks[c]);
+            nifti_data_free(nbl->bricks[c]);
          }
          free(nbl->bricks);
          nbl->bricks = NULL;
@@ -1040,7 +1566,7 @@ static int nifti_alloc_NBL_mem(nifti_image * nim, int64_t nbricks,
       }
    }
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"+d NANM: alloc'd %" PRId64 " bricks of %" PRId64
               " bytes for NBL\n", nbl->nbricks, nbl->bsize);
 
@@ -1048,12 +1574,100 @@ static int nifti_alloc_NBL_mem(nifti_image * nim, int64_t nbricks,
 }
 
 
+/*----------------------------------------------------------------------
+ * nifti_NBL_arena      - where the arena of a brick list would start
+ *
+ * An arena is placed just after the brick pointers, at the first address
+ * aligned as nifti_alloc_NBL_mem would align it.
+ *----------------------------------------------------------------------*/
+static char * nifti_NBL_arena(const nifti_brick_list * nbl)
+{
+   int64_t   align = nbl->nbricks * nbl->bsize >= NIFTI_NBL_HUGE_MIN ?
+                     NIFTI_NBL_HUGE : NIFTI_NBL_ALIGN;
+   uintptr_t posn  = (uintptr_t)(nbl->bricks + nbl->nbricks);
+
+   return (char *)((posn + (uintptr_t)align - 1) & ~((uintptr_t)align - 1));
+}
+
+/*----------------------------------------------------------------------
+ * list of brick pointer arrays that hold an arena, as allocated by
+ * nifti_alloc_NBL_mem, so that nifti_free_NBL knows how to free a list
+ * (any other list, including one built by the caller, has its bricks
+ * allocated separately)
+ *----------------------------------------------------------------------*/
+static void   *** g_arena_list = NULL;
+static int64_t    g_arena_len = 0, g_arena_alloc = 0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t  g_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+#define NIFTI_ARENA_LOCK()   pthread_mutex_lock(&g_arena_lock)
+#define NIFTI_ARENA_UNLOCK() pthread_mutex_unlock(&g_arena_lock)
+#else
+#define NIFTI_ARENA_LOCK()
+#define NIFTI_ARENA_UNLOCK()
+#endif
+
+/* add an arena pointer array to the list, return 0 on success */
+static int nifti_NBL_arena_note(void ** bricks)
+{
+   void *** list;
+   int      rv = 0;
+
+   NIFTI_ARENA_LOCK();
+   if( g_arena_len == g_arena_alloc ){
+      list = (void ***)realloc(g_arena_list, (g_arena_alloc + 16) *
+                                             sizeof(void **));
+      if( list ){
+         g_arena_list   = list;
+         g_arena_alloc += 16;
+      } else
+         rv = -1;
+   }
+   if( !rv ) g_arena_list[g_arena_len++] = bricks;
+   NIFTI_ARENA_UNLOCK();
+
+   if( rv ) fprintf(stderr,"** NIFTI: failed to alloc arena list\n");
+
+   return rv;
+}
+
+/* remove bricks from the arena list, return 1 if it was there, else 0 */
+static int nifti_NBL_arena_forget(void ** bricks)
+{
+   int64_t c;
+   int     found = 0;
+
+   NIFTI_ARENA_LOCK();
+   for( c = g_arena_len - 1; c >= 0; c-- )
+      if( g_arena_list[c] == bricks ){
+         g_arena_list[c] = g_arena_list[--g_arena_len];
+         found = 1;
+         break;
+      }
+   if( g_arena_len == 0 ){
+      free(g_arena_list);
+      g_arena_list  = NULL;
+      g_arena_alloc = 0;
+   }
+   NIFTI_ARENA_UNLOCK();
+
+   return found;
+}
+
+
+/* compare (brick, position) pairs of nifti_copynsort */
+static int nifti_brick_pair_compare(const void * a, const void * b)
+{
+   const int64_t * pa = (const int64_t *)a, * pb = (const int64_t *)b;
+   if( pa[0] != pb[0] ) return pa[0] < pb[0] ? -1 : 1;
+   return (pa[1] > pb[1]) - (pa[1] < pb[1]);
+}
+
 /*----------------------------------------------------------------------
  * nifti_copynsort      - copy int list, and sort with indices
  *
- * 1. duplicate the incoming list
- * 2. create an sindex list, and init with 0..nbricks-1
- * 3. do a slow insertion sort on the small slist, along with sindex list
+ * 1. duplicate the incoming list, as (brick, position) pairs
+ * 2. sort the pairs with qsort, O(n log n) (repeats stay in list order)
+ * 3. split them into slist and sindex
  * 4. check results, just to be positive
  *
  * So slist is sorted, and sindex hold original positions.
@@ -1064,46 +1678,38 @@ static int nifti_copynsort(int64_t nbricks, const int64_t *blist,
                            int64_t ** slist, int64_t ** sindex)
 {
    int64_t * stmp, * itmp;   /* for ease of typing/reading */
-   int64_t   c1, c2, spos, tmp;
+   int64_t * pairs;
+   int64_t   c1;
 
    *slist  = (int64_t *)malloc(nbricks * sizeof(int64_t));
    *sindex = (int64_t *)malloc(nbricks * sizeof(int64_t));
+   pairs   = (int64_t *)malloc(2 * nbricks * sizeof(int64_t));
 
-   if( !*slist || !*sindex ){
+   if( !*slist || !*sindex || !pairs ){
       fprintf(stderr,"** NIFTI NCS: failed to alloc %" PRId64
               " ints for sorting\n", nbricks);
       free(*slist);   /* maybe one succeeded */
       free(*sindex);
+      free(pairs);
       return -1;
    }
 
-   /* init the lists */
+   /* init the pairs, and sort them */
    for( c1 = 0; c1 < nbricks; c1++ ) {
-      (*slist)[c1] = blist[c1];
-      (*sindex)[c1] = c1;
+      pairs[2*c1]   = blist[c1];
+      pairs[2*c1+1] = c1;
    }
+   qsort(pairs, nbricks, 2 * sizeof(int64_t), nifti_brick_pair_compare);
 
-   /* now actually sort slist */
    stmp = *slist;
    itmp = *sindex;
-   for( c1 = 0; c1 < nbricks-1; c1++ ) {
-      /* find smallest value, init to current */
-      spos = c1;
-      for( c2 = c1+1; c2 < nbricks; c2++ )
-         if( stmp[c2] < stmp[spos] ) spos = c2;
-      if( spos != c1 ) /* swap: fine, don't maintain sub-order, see if I care */
-      {
-         tmp        = stmp[c1];      /* first swap the sorting values */
-         stmp[c1]   = stmp[spos];
-         stmp[spos] = tmp;
-
-         tmp        = itmp[c1];      /* then swap the index values */
-         itmp[c1]   = itmp[spos];
-         itmp[spos] = tmp;
-      }
+   for( c1 = 0; c1 < nbricks; c1++ ) {
+      stmp[c1] = pairs[2*c1];
+      itmp[c1] = pairs[2*c1+1];
    }
+   free(pairs);
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,  "+d sorted indexing list:\n");
       fprintf(stderr,  "  orig   : ");
       for( c1 = 0; c1 < nbricks; c1++ ) fprintf(stderr,"  %" PRId64, blist[c1]);
@@ -1123,7 +1729,7 @@ static int nifti_copynsort(int64_t nbricks, const int64_t *blist,
        }
    }
 
-   if( g_opts.debug > 2 ) fprintf(stderr,"-d sorting is okay\n");
+   if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d sorting is okay\n");
 
    return 0;
 }
@@ -1148,19 +1754,19 @@ int valid_nifti_brick_list(nifti_image * nim , int64_t nbricks,
    int64_t c, nsubs;
 
    if( !nim ){
-      if( disp_error || g_opts.debug > 0 )
+      if( disp_error || NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** valid_nifti_brick_list: missing nifti image\n");
       return 0;
    }
 
    if( nbricks <= 0 || !blist ){
-      if( disp_error || g_opts.debug > 1 )
+      if( disp_error || NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"** valid_nifti_brick_list: no brick list to check\n");
       return 0;
    }
 
    if( nim->dim[0] < 3 ){
-      if( disp_error || g_opts.debug > 1 )
+      if( disp_error || NIFTI_OPTS.debug > 1 )
         fprintf(stderr,"** NIFTI: cannot read explicit brick list from %" PRId64
                 "-D dataset\n", nim->dim[0]);
       return 0;
@@ -1179,7 +1785,7 @@ int valid_nifti_brick_list(nifti_image * nim , int64_t nbricks,
 
    for( c = 0; c < nbricks; c++ )
       if( (blist[c] < 0) || (blist[c] >= nsubs) ){
-         if( disp_error || g_opts.debug > 1 )
+         if( disp_error || NIFTI_OPTS.debug > 1 )
             fprintf(stderr,
                "** NIFTI volume index %" PRId64 " (#%" PRId64 ")"
                " is out of range [0,%" PRId64 "]\n", blist[c], c, nsubs-1);
@@ -1203,7 +1809,7 @@ static int nifti_NBL_matches_nim(const nifti_image *nim,
 
 
    if( !nim || !NBL ) {
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** nifti_NBL_matches_nim: NULL pointer(s)\n");
       return 0;
    }
@@ -1220,21 +1826,21 @@ static int nifti_NBL_matches_nim(const nifti_image *nim,
    }
 
    if( volbytes != NBL->bsize ) {
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"** NIFTI NBL/nim mismatch, volbytes = %" PRId64
                         ", %" PRId64 "\n", NBL->bsize, volbytes);
       errs++;
    }
 
    if( nvols != NBL->nbricks ) {
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"** NIFTI NBL/nim mismatch, nvols = %" PRId64
                         ", %" PRId64 "\n", NBL->nbricks, nvols);
       errs++;
    }
 
    if( errs ) return 0;
-   else if ( g_opts.debug > 2 )
+   else if ( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-- nim/NBL agree: nvols = %" PRId64
                      ", nbytes = %" PRId64 "\n", nvols, volbytes);
 
@@ -2994,6 +3600,135 @@ void nifti_mat44_to_orientation( mat44 R , int *icod, int *jcod, int *kcod )
     - 16 at a time:  abcdefghHGFEDCBA -> ABCDEFGHhgfedcba [long double]
 -----------------------------------------------------------------------------*/
 
+/*---------------------------------------------------------------------------*/
+/* Vectorized byte swapping on x86_64.
+
+   Kernels for SSE2, SSSE3, AVX2 and AVX-512BW are compiled with target
+   attributes, so no special flags are needed, and the best one for the
+   current CPU is chosen at run time.  Each kernel swaps whole vectors
+   and returns the number of elements done, leaving the rest to the
+   scalar code below.
+-----------------------------------------------------------------------------*/
+#ifdef NIFTI_SIMD_X86
+
+/* pshufb masks reversing each size-byte group, for 64 bytes */
+#define NSM2  1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14
+#define NSM4  3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12
+#define NSM8  7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8
+#define NSM16 15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0
+static const unsigned char g_swap_masks[4][64] = {
+   { NSM2,  NSM2,  NSM2,  NSM2  },
+   { NSM4,  NSM4,  NSM4,  NSM4  },
+   { NSM8,  NSM8,  NSM8,  NSM8  },
+   { NSM16, NSM16, NSM16, NSM16 } };
+#undef NSM2
+#undef NSM4
+#undef NSM8
+#undef NSM16
+
+static const unsigned char * nifti_swap_mask(int size)
+{
+   switch( size ){
+      case 2:  return g_swap_masks[0];
+      case 4:  return g_swap_masks[1];
+      case 8:  return g_swap_masks[2];
+      default: return g_swap_masks[3];
+   }
+}
+
+/* SSE2 (always present on x86_64): swap 16-bit words, then reorder them */
+static int64_t nifti_swap_sse2(int64_t n, int size, unsigned char * cp)
+{
+   int64_t nbytes = n * size, ii;
+   __m128i v;
+
+   for( ii = 0; ii + 16 <= nbytes; ii += 16 ){
+      v = _mm_loadu_si128((const __m128i *)(cp + ii));
+      if( size >= 4 ){
+         if( size == 4 ) {         /* reverse words in each dword */
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2,3,0,1));
+         } else {                  /* reverse words in each qword */
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0,1,2,3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0,1,2,3));
+            if( size == 16 ) v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2));
+         }
+      }
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      _mm_storeu_si128((__m128i *)(cp + ii), v);
+   }
+
+   return ii / size;
+}
+
+__attribute__((target("ssse3")))
+static int64_t nifti_swap_ssse3(int64_t n, int size, unsigned char * cp)
+{
+   int64_t nbytes = n * size, ii;
+   __m128i mask = _mm_loadu_si128((const __m128i *)nifti_swap_mask(size));
+
+   for( ii = 0; ii + 16 <= nbytes; ii += 16 )
+      _mm_storeu_si128((__m128i *)(cp + ii), _mm_shuffle_epi8(
+               _mm_loadu_si128((const __m128i *)(cp + ii)), mask));
+
+   return ii / size;
+}
+
+__attribute__((target("avx2")))
+static int64_t nifti_swap_avx2(int64_t n, int size, unsigned char * cp)
+{
+   int64_t nbytes = n * size, ii;
+   __m256i mask = _mm256_loadu_si256((const __m256i *)nifti_swap_mask(size));
+
+   for( ii = 0; ii + 32 <= nbytes; ii += 32 )
+      _mm256_storeu_si256((__m256i *)(cp + ii), _mm256_shuffle_epi8(
+               _mm256_loadu_si256((const __m256i *)(cp + ii)), mask));
+
+   return ii / size;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int64_t nifti_swap_avx512(int64_t n, int size, unsigned char * cp)
+{
+   int64_t nbytes = n * size, ii;
+   __m512i mask = _mm512_loadu_si512((const void *)nifti_swap_mask(size));
+
+   for( ii = 0; ii + 64 <= nbytes; ii += 64 )
+      _mm512_storeu_si512((void *)(cp + ii), _mm512_shuffle_epi8(
+               _mm512_loadu_si512((const void *)(cp + ii)), mask));
+
+   return ii / size;
+}
+#endif  /* NIFTI_SIMD_X86 */
+
+/*----------------------------------------------------------------------*/
+/*! swap the leading n sets of size bytes using vector instructions
+ *
+ *  size must be 2, 4, 8 or 16.  The remaining elements are left to the
+ *  caller.
+ *
+ *  \return the number of elements swapped
+*//*--------------------------------------------------------------------*/
+static int64_t nifti_swap_simd( int64_t n , int size , void *ar )
+{
+#ifdef NIFTI_SIMD_X86
+   unsigned char * cp = (unsigned char *)ar;
+
+   if( n * size < 64 ) return 0;   /* not worth it */
+
+   if( __builtin_cpu_supports("avx512bw") )
+      return nifti_swap_avx512(n, size, cp);
+   if( __builtin_cpu_supports("avx2") )
+      return nifti_swap_avx2(n, size, cp);
+   if( __builtin_cpu_supports("ssse3") )
+      return nifti_swap_ssse3(n, size, cp);
+   return nifti_swap_sse2(n, size, cp);
+#else
+   (void)n; (void)size; (void)ar;
+   return 0;
+#endif
+}
+
 /*----------------------------------------------------------------------*/
 /*! swap each byte pair from the given list of n pairs
  *
@@ -3004,11 +3739,11 @@ void nifti_mat44_to_orientation( mat44 R , int *icod, int *jcod, int *kcod )
 *//*--------------------------------------------------------------------*/
 void nifti_swap_2bytes( int64_t n , void *ar )    /* 2 bytes at a time */
 {
-   int64_t ii ;
-   unsigned char * cp1 = (unsigned char *)ar, * cp2 ;
+   int64_t ii = nifti_swap_simd(n, 2, ar) ;    /* vectorized, if possible */
+   unsigned char * cp1 = (unsigned char *)ar + 2*ii, * cp2 ;
    unsigned char   tval;
 
-   for( ii=0 ; ii < n ; ii++ ){
+   for( ; ii < n ; ii++ ){
        cp2 = cp1 + 1;
        tval = *cp1;  *cp1 = *cp2;  *cp2 = tval;
        cp1 += 2;
@@ -3020,11 +3755,11 @@ void nifti_swap_2bytes( int64_t n , void *ar )    /* 2 bytes at a time */
 *//*--------------------------------------------------------------------*/
 void nifti_swap_4bytes( int64_t n , void *ar )    /* 4 bytes at a time */
 {
-   int64_t ii ;
-   unsigned char * cp0 = (unsigned char *)ar, * cp1, * cp2 ;
+   int64_t ii = nifti_swap_simd(n, 4, ar) ;    /* vectorized, if possible */
+   unsigned char * cp0 = (unsigned char *)ar + 4*ii, * cp1, * cp2 ;
    unsigned char tval ;
 
-   for( ii=0 ; ii < n ; ii++ ){
+   for( ; ii < n ; ii++ ){
        cp1 = cp0; cp2 = cp0+3;
        tval = *cp1;  *cp1 = *cp2;  *cp2 = tval;
        cp1++;  cp2--;
@@ -3040,11 +3775,11 @@ void nifti_swap_4bytes( int64_t n , void *ar )    /* 4 bytes at a time */
 *//*--------------------------------------------------------------------*/
 void nifti_swap_8bytes( int64_t n , void *ar )    /* 8 bytes at a time */
 {
-   int64_t ii ;
-   unsigned char * cp0 = (unsigned char *)ar, * cp1, * cp2 ;
+   int64_t ii = nifti_swap_simd(n, 8, ar) ;    /* vectorized, if possible */
+   unsigned char * cp0 = (unsigned char *)ar + 8*ii, * cp1, * cp2 ;
    unsigned char tval ;
 
-   for( ii=0 ; ii < n ; ii++ ){
+   for( ; ii < n ; ii++ ){
        cp1 = cp0;  cp2 = cp0+7;
        while ( cp2 > cp1 )      /* unroll? */
        {
@@ -3060,11 +3795,11 @@ void nifti_swap_8bytes( int64_t n , void *ar )    /* 8 bytes at a time */
 *//*--------------------------------------------------------------------*/
 void nifti_swap_16bytes( int64_t n , void *ar )    /* 16 bytes at a time */
 {
-   int64_t ii ;
-   unsigned char * cp0 = (unsigned char *)ar, * cp1, * cp2 ;
+   int64_t ii = nifti_swap_simd(n, 16, ar) ;   /* vectorized, if possible */
+   unsigned char * cp0 = (unsigned char *)ar + 16*ii, * cp1, * cp2 ;
    unsigned char tval ;
 
-   for( ii=0 ; ii < n ; ii++ ){
+   for( ; ii < n ; ii++ ){
        cp1 = cp0;  cp2 = cp0+15;
        while ( cp2 > cp1 )
        {
@@ -3123,7 +3858,7 @@ void nifti_swap_Nbytes( int64_t n , int size , void *ar )  /* subsuming case */
 *//*---------------------------------------------------------------------- */
 void swap_nifti_header( void * hdr , int ni_ver )
 {
-   if( g_opts.debug > 1 )
+   if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"++ swapping NIFTI header via ni_ver %d\n", ni_ver);
 
    if     ( ni_ver == 0 ) nifti_swap_as_analyze((nifti_analyze75 *)hdr);
@@ -3430,20 +4165,20 @@ int nifti_is_complete_filename(const char* fname)
 
    /* check input file(s) for sanity */
    if( fname == NULL || *fname == '\0' ){
-      if ( g_opts.debug > 1 )
+      if ( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"-- empty filename in nifti_validfilename()\n");
       return 0;
    }
 
    ext = nifti_find_file_extension(fname);
    if ( ext == NULL ) { /*Invalid extension given */
-      if ( g_opts.debug > 0 )
+      if ( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"-- no nifti valid extension for filename '%s'\n", fname);
        return 0;
    }
 
    if ( ext == fname ) {   /* then no filename prefix */
-      if ( g_opts.debug > 0 )
+      if ( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"-- no prefix for filename '%s'\n", fname);
       return 0;
    }
@@ -3474,7 +4209,7 @@ int nifti_validfilename(const char* fname)
 
    /* check input file(s) for sanity */
    if( fname == NULL || *fname == '\0' ){
-      if ( g_opts.debug > 1 )
+      if ( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"-- empty filename in nifti_validfilename()\n");
       return 0;
    }
@@ -3482,7 +4217,7 @@ int nifti_validfilename(const char* fname)
    ext = nifti_find_file_extension(fname);
 
    if ( ext && ext == fname ) {   /* then no filename prefix */
-      if ( g_opts.debug > 0 )
+      if ( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"-- no prefix for filename '%s'\n", fname);
       return 0;
    }
@@ -3531,7 +4266,7 @@ char * nifti_find_file_extension( const char * name )
 
    /* make manipulation copy, and possibly convert to lowercase */
    strcpy(extcopy, ext);
-   if( g_opts.allow_upper_fext ) make_lowercase(extcopy);
+   if( NIFTI_OPTS.allow_upper_fext ) make_lowercase(extcopy);
 
    /* if it look like a basic extension, fail or return it */
    if( compare_strlist(extcopy, elist, 4) >= 0 ) {
@@ -3550,7 +4285,7 @@ char * nifti_find_file_extension( const char * name )
 
    /* make manipulation copy, and possibly convert to lowercase */
    strcpy(extcopy, ext);
-   if( g_opts.allow_upper_fext ) make_lowercase(extcopy);
+   if( NIFTI_OPTS.allow_upper_fext ) make_lowercase(extcopy);
 
    /* go after .gz extensions using the modifiable strings */
    strcat(elist[0], extgz); strcat(elist[1], extgz); strcat(elist[2], extgz);
@@ -3566,7 +4301,7 @@ char * nifti_find_file_extension( const char * name )
 
 #endif
 
-   if( g_opts.debug > 1 )
+   if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"** find_file_ext: failed for name '%s'\n", name);
 
    return NULL;
@@ -3624,10 +4359,13 @@ char * nifti_makebasename(const char* fname)
 
 /*----------------------------------------------------------------------*/
 /* option accessor functions                                            */
+/*                                                                      */
+/* these get and set the options of the current thread: the global      */
+/* ones, unless it has a context (see nifti_set_thread_context)         */
 /*----------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------*/
-/*! set nifti's global debug level, for status reporting
+/*! set nifti's debug level, for status reporting
 
     - 0    : quiet, nothing is printed to the terminal, but errors
     - 1    : normal execution (the default)
@@ -3635,78 +4373,519 @@ char * nifti_makebasename(const char* fname)
 *//*--------------------------------------------------------------------*/
 void nifti_set_debug_level( int level )
 {
-    g_opts.debug = level;
+    nifti_context_set_debug_level(g_cur_ctx, level);
 }
 
 /*----------------------------------------------------------------------*/
-/*! set nifti's global skip_blank_ext flag            5 Sep 2006 [rickr]
+/*! set nifti's skip_blank_ext flag                   5 Sep 2006 [rickr]
 
     explicitly set to 0 or 1
 *//*--------------------------------------------------------------------*/
 void nifti_set_skip_blank_ext( int skip )
 {
-    g_opts.skip_blank_ext = skip ? 1 : 0;
+    nifti_context_set_skip_blank_ext(g_cur_ctx, skip);
 }
 
 /*----------------------------------------------------------------------*/
-/*! set nifti's global allow_upper_fext flag         28 Apr 2009 [rickr]
+/*! set nifti's allow_upper_fext flag                28 Apr 2009 [rickr]
 
     explicitly set to 0 or 1
 *//*--------------------------------------------------------------------*/
 void nifti_set_allow_upper_fext( int allow )
 {
-    g_opts.allow_upper_fext = allow ? 1 : 0;
+    nifti_context_set_allow_upper_fext(g_cur_ctx, allow);
 }
 
 /*----------------------------------------------------------------------*/
-/*! get nifti's global alter_cifti flag              22 Jul 2015 [rickr]
+/*! get nifti's alter_cifti flag                     22 Jul 2015 [rickr]
 *//*--------------------------------------------------------------------*/
 int nifti_get_alter_cifti( void )
 {
-    return g_opts.alter_cifti;
+    return NIFTI_OPTS.alter_cifti;
 }
 
 /*----------------------------------------------------------------------*/
-/*! set nifti's global alter_cifti flag              22 Jul 2015 [rickr]
+/*! set nifti's alter_cifti flag                     22 Jul 2015 [rickr]
 
     explicitly set to 0 or 1
 *//*--------------------------------------------------------------------*/
 void nifti_set_alter_cifti( int alter_cifti )
 {
-    g_opts.alter_cifti = alter_cifti ? 1 : 0;
+    nifti_context_set_alter_cifti(g_cur_ctx, alter_cifti);
 }
 
 /*----------------------------------------------------------------------*/
-/*! check current directory for existing header file
+/*! get nifti's mmap_data mode                       16 Oct 2026
+*//*--------------------------------------------------------------------*/
+int nifti_get_mmap_data( void )
+{
+    return NIFTI_OPTS.mmap_data;
+}
 
-    \return filename of header on success and NULL if no appropriate file
-            could be found
+/*----------------------------------------------------------------------*/
+/*! set nifti's mmap_data mode                       16 Oct 2026
 
-    If fname has an uppercase extension, check for uppercase files.
+    - NIFTI_MMAP_NONE     : read image data into allocated memory (default)
+    - NIFTI_MMAP_READONLY : nim->data is a shared, read-only mapping
+    - NIFTI_MMAP_PRIVATE  : nim->data is a private, copy-on-write mapping
 
-    NB: it allocates memory for hdrname which should be freed
-        when no longer required
-*//*-------------------------------------------------------------------*/
-char * nifti_findhdrname(const char* fname)
+    Mapping applies to nifti_image_load() of uncompressed data that does
+    not need byte swapping.  Other data is read as usual.
+*//*--------------------------------------------------------------------*/
+void nifti_set_mmap_data( int mmap_data )
 {
-   char *basename, *hdrname;
-   const char *ext;
-   char  elist[2][5] = { ".hdr", ".nii" };
-   char  extzip[4]   = ".gz";
-   int   efirst = 1;    /* init to .nii extension */
-   int   eisupper = 0;  /* init to lowercase extensions */
+    nifti_context_set_mmap_data(g_cur_ctx, mmap_data);
+}
 
-   /**- check input file(s) for sanity */
-   if( !nifti_validfilename(fname) ) return NULL;
+/*----------------------------------------------------------------------*/
+/*! get the number of threads nifti uses for reading image data
 
-   basename = nifti_makebasename(fname);
-   if( !basename ) return NULL;   /* only on string alloc failure */
+    If not set by nifti_set_nthreads(), this is znz_get_nthreads(), which
+    defaults to the ZNZ_NUM_THREADS environment variable, else 1.
+*//*--------------------------------------------------------------------*/
+int nifti_get_nthreads( void )
+{
+    return NIFTI_OPTS.nthreads > 0 ? NIFTI_OPTS.nthreads : znz_get_nthreads();
+}
 
-   /**- return filename if it has a valid extension and exists
-         (except if it is an .img file (and maybe .gz)) */
-   ext = nifti_find_file_extension(fname);
+/*----------------------------------------------------------------------*/
+/*! set the number of threads nifti uses for reading image data
 
-   if( ext ) eisupper = is_uppercase(ext);  /* do we look for uppercase? */
+    Large uncompressed images are then read by nifti_image_load() in
+    chunks, on this many threads.  A value < 1 restores the default.
+*//*--------------------------------------------------------------------*/
+void nifti_set_nthreads( int nthreads )
+{
+    nifti_context_set_nthreads(g_cur_ctx, nthreads);
+}
+
+/*----------------------------------------------------------------------*/
+/*! get the alignment of image data buffers, in bytes (default 64)
+*//*--------------------------------------------------------------------*/
+int nifti_get_data_align( void )
+{
+    return NIFTI_OPTS.data_align > 0 ? NIFTI_OPTS.data_align : NIFTI_DATA_ALIGN;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the alignment of image data buffers, in bytes
+
+    This applies to nim->data, bricks and the buffers returned by the
+    load_as, collapsed, subregion and timeseries readers.  The alignment
+    must be a power of 2, at least sizeof(void *).  Other values restore
+    the default of 64 bytes (a cache line, and an AVX-512 vector).
+
+    With the default allocator, buffers of at least 32 MB are also aligned
+    to 2 MB, and advised to use transparent huge pages (where supported).
+*//*--------------------------------------------------------------------*/
+void nifti_set_data_align( int align )
+{
+    nifti_context_set_data_align(g_cur_ctx, align);
+}
+
+/*----------------------------------------------------------------------*/
+/* contexts: per-thread options and errors                              */
+/*----------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------*/
+/*! return a new context, holding a copy of the current global options
+
+    A context gives a thread its own options, separate from the global
+    ones set by nifti_set_debug_level() and the like.  It is used either
+    for single calls, via the _ctx functions (e.g. nifti_image_read_ctx),
+    or for every call in a thread, via nifti_set_thread_context().
+
+    Threads should not share a context while changing its options.
+
+    \return an allocated context, to be freed by nifti_context_free()
+*//*--------------------------------------------------------------------*/
+nifti_context * nifti_context_new( void )
+{
+    nifti_context * ctx = (nifti_context *)malloc(sizeof(nifti_context));
+    if( !ctx ){
+       fprintf(stderr,"** NIFTI: failed to alloc context\n");
+       g_last_error = NIFTI_ERR_NOMEM;
+       return NULL;
+    }
+    ctx->opts = g_nifti_opts;
+    return ctx;
+}
+
+/*----------------------------------------------------------------------*/
+/*! free a context from nifti_context_new()
+
+    It must not be in use by any thread (see nifti_set_thread_context).
+*//*--------------------------------------------------------------------*/
+void nifti_context_free( nifti_context * ctx )
+{
+    free(ctx);
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the context used by all nifti calls from the current thread
+
+    Any threads started by the library (for parallel reads or prefetch)
+    use the context of the thread that started them.  A NULL ctx returns
+    the thread to the global options.  The nifti_get_* and nifti_set_*
+    option functions then report and change the options of this context.
+
+    \return the previous context of this thread (NULL if global)
+*//*--------------------------------------------------------------------*/
+nifti_context * nifti_set_thread_context( nifti_context * ctx )
+{
+    nifti_context * prev = g_cur_ctx;
+    g_cur_ctx = ctx;
+    return prev;
+}
+
+/* return the options of ctx, or the global ones if ctx is NULL */
+static nifti_global_options * nifti_ctx_opts( nifti_context * ctx )
+{
+    return ctx ? &ctx->opts : &g_nifti_opts;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the debug level of a context (NULL for the global options)
+
+    \sa nifti_set_debug_level
+*//*--------------------------------------------------------------------*/
+void nifti_context_set_debug_level( nifti_context * ctx, int level )
+{
+    nifti_ctx_opts(ctx)->debug = level;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the skip_blank_ext flag of a context (NULL for global), as 0 or 1
+*//*--------------------------------------------------------------------*/
+void nifti_context_set_skip_blank_ext( nifti_context * ctx, int skip )
+{
+    nifti_ctx_opts(ctx)->skip_blank_ext = skip ? 1 : 0;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the allow_upper_fext flag of a context (NULL for global), as 0 or 1
+*//*--------------------------------------------------------------------*/
+void nifti_context_set_allow_upper_fext( nifti_context * ctx, int allow )
+{
+    nifti_ctx_opts(ctx)->allow_upper_fext = allow ? 1 : 0;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the alter_cifti flag of a context (NULL for global), as 0 or 1
+*//*--------------------------------------------------------------------*/
+void nifti_context_set_alter_cifti( nifti_context * ctx, int alter )
+{
+    nifti_ctx_opts(ctx)->alter_cifti = alter ? 1 : 0;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the mmap_data mode of a context (NULL for global)
+
+    \sa nifti_set_mmap_data
+*//*--------------------------------------------------------------------*/
+void nifti_context_set_mmap_data( nifti_context * ctx, int mmap_data )
+{
+    if( mmap_data == NIFTI_MMAP_READONLY || mmap_data == NIFTI_MMAP_PRIVATE )
+       nifti_ctx_opts(ctx)->mmap_data = mmap_data;
+    else
+       nifti_ctx_opts(ctx)->mmap_data = NIFTI_MMAP_NONE;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the number of read threads of a context (NULL for global)
+
+    \sa nifti_set_nthreads
+*//*--------------------------------------------------------------------*/
+void nifti_context_set_nthreads( nifti_context * ctx, int nthreads )
+{
+    nifti_ctx_opts(ctx)->nthreads = nthreads > 0 ? nthreads : 0;
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the image data alignment of a context (NULL for global)
+
+    \sa nifti_set_data_align
+*//*--------------------------------------------------------------------*/
+void nifti_context_set_data_align( nifti_context * ctx, int align )
+{
+    if( align >= (int)sizeof(void *) && (align & (align - 1)) == 0 )
+       nifti_ctx_opts(ctx)->data_align = align;
+    else
+       nifti_ctx_opts(ctx)->data_align = 0;
+}
+
+/*----------------------------------------------------------------------*/
+/*! return the code of the last failure in this thread (NIFTI_ERR_*)
+
+    Like errno, the code is set by failures and is not cleared by later
+    successes, see nifti_clear_last_error().  Errors are still printed,
+    subject to the debug level.
+
+    \sa nifti_error_string
+*//*--------------------------------------------------------------------*/
+int nifti_get_last_error( void )
+{
+    return g_last_error;
+}
+
+/*----------------------------------------------------------------------*/
+/*! clear the last error code of this thread
+*//*--------------------------------------------------------------------*/
+void nifti_clear_last_error( void )
+{
+    g_last_error = NIFTI_ERR_NONE;
+}
+
+/*----------------------------------------------------------------------*/
+/*! return a description of a NIFTI_ERR_* code
+*//*--------------------------------------------------------------------*/
+const char * nifti_error_string( int code )
+{
+    static const char * const estr[NIFTI_MAX_ERR+1] = {
+       "no error",
+       "bad function arguments",
+       "dataset file not found",
+       "failed to open file",
+       "failed to read file",
+       "failed to write file",
+       "bad or unsupported header",
+       "out of memory"
+    };
+
+    if( code < 0 || code > NIFTI_MAX_ERR ) return "unknown error";
+    return estr[code];
+}
+
+/* set the last error code of this thread */
+static void nifti_set_last_error( int code )
+{
+    g_last_error = code;
+}
+
+/*----------------------------------------------------------------------*/
+/*! nifti_image_read(), using the options of ctx (NULL for global)
+
+    \sa nifti_context_new, nifti_set_thread_context
+*//*--------------------------------------------------------------------*/
+nifti_image * nifti_image_read_ctx( nifti_context * ctx, const char * hname,
+                                    int read_data )
+{
+    nifti_context * prev = nifti_set_thread_context(ctx);
+    nifti_image   * nim  = nifti_image_read(hname, read_data);
+
+    (void)nifti_set_thread_context(prev);
+    return nim;
+}
+
+/*----------------------------------------------------------------------*/
+/*! nifti_image_load(), using the options of ctx (NULL for global)
+*//*--------------------------------------------------------------------*/
+int nifti_image_load_ctx( nifti_context * ctx, nifti_image * nim )
+{
+    nifti_context * prev = nifti_set_thread_context(ctx);
+    int             rv   = nifti_image_load(nim);
+
+    (void)nifti_set_thread_context(prev);
+    return rv;
+}
+
+/*----------------------------------------------------------------------*/
+/*! nifti_image_write_status(), using the options of ctx (NULL for global)
+*//*--------------------------------------------------------------------*/
+int nifti_image_write_status_ctx( nifti_context * ctx, nifti_image * nim )
+{
+    nifti_context * prev = nifti_set_thread_context(ctx);
+    int             rv   = nifti_image_write_status(nim);
+
+    (void)nifti_set_thread_context(prev);
+    return rv;
+}
+
+/*----------------------------------------------------------------------*/
+/*! nifti_image_read_bricks(), using the options of ctx (NULL for global)
+*//*--------------------------------------------------------------------*/
+nifti_image * nifti_image_read_bricks_ctx( nifti_context * ctx,
+                                           const char * hname,
+                                           int64_t nbricks,
+                                           const int64_t * blist,
+                                           nifti_brick_list * NBL )
+{
+    nifti_context * prev = nifti_set_thread_context(ctx);
+    nifti_image   * nim  = nifti_image_read_bricks(hname, nbricks, blist, NBL);
+
+    (void)nifti_set_thread_context(prev);
+    return nim;
+}
+
+/*----------------------------------------------------------------------*/
+/*! nifti_image_load_bricks(), using the options of ctx (NULL for global)
+*//*--------------------------------------------------------------------*/
+int nifti_image_load_bricks_ctx( nifti_context * ctx, nifti_image * nim,
+                                 int64_t nbricks, const int64_t * blist,
+                                 nifti_brick_list * NBL )
+{
+    nifti_context * prev = nifti_set_thread_context(ctx);
+    int             rv   = nifti_image_load_bricks(nim, nbricks, blist, NBL);
+
+    (void)nifti_set_thread_context(prev);
+    return rv;
+}
+
+/*----------------------------------------------------------------------*/
+/* memory allocator for image data, extension data and brick lists      */
+/*----------------------------------------------------------------------*/
+
+static void * nifti_default_alloc(size_t nbytes, void * ctx)
+{
+    (void)ctx;
+    return malloc(nbytes);
+}
+
+/* aligned memory that free() can release, with huge pages when large */
+static void * nifti_default_alloc_aligned(size_t align, size_t nbytes,
+                                          void * ctx)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+    void * ptr = NULL;
+
+    (void)ctx;
+    if( nbytes >= (size_t)NIFTI_DATA_HUGE_MIN && align < NIFTI_DATA_HUGE )
+       align = NIFTI_DATA_HUGE;
+    if( align < sizeof(void *) ) align = sizeof(void *);
+    if( posix_memalign(&ptr, align, nbytes) != 0 ) return NULL;
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+    if( align >= NIFTI_DATA_HUGE )
+       (void)madvise(ptr, nbytes & ~(size_t)(NIFTI_DATA_HUGE-1),
+                     MADV_HUGEPAGE);
+#endif
+    return ptr;
+#else
+    (void)align;
+    (void)ctx;
+    return malloc(nbytes);    /* only malloc alignment, then */
+#endif
+}
+
+static void nifti_default_dealloc(void * ptr, void * ctx)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+/*----------------------------------------------------------------------*/
+/*! set the allocator used for image data, extension data and bricks
+
+    The allocator is used for all nim->data buffers (nifti_image_load,
+    nifti_make_new_nim), extension edata, brick list bricks, and the
+    buffers allocated for nifti_image_load_as, nifti_read_collapsed_image,
+    nifti_read_subregion_image(s), nifti_read_timeseries and the volume
+    reader.  Such buffers are released with nifti_data_free (as done by
+    nifti_image_free, nifti_free_extensions and nifti_free_NBL).
+
+    A->alloc and A->dealloc are required.  A->alloc_aligned may be NULL,
+    in which case A->alloc is used for aligned requests as well (image
+    data is requested with nifti_get_data_align()).  Each is passed
+    A->ctx.  Buffers are not expected to be zeroed.
+
+    Since memory must be released by the allocator that provided it, set
+    this once, before any images are read or created (and before other
+    threads use the library).  Buffers given to the library to own (e.g.
+    a new nim->data) should then come from nifti_data_alloc().
+
+    \param A  allocator to copy, or NULL to restore the default (malloc(),
+              posix_memalign() and free())
+
+    \return 0 on success, 1 if A is missing functions
+*//*--------------------------------------------------------------------*/
+int nifti_set_allocator( const nifti_allocator * A )
+{
+    if( !A ){
+       g_nifti_alloc.alloc         = nifti_default_alloc;
+       g_nifti_alloc.alloc_aligned = nifti_default_alloc_aligned;
+       g_nifti_alloc.dealloc       = nifti_default_dealloc;
+       g_nifti_alloc.ctx           = NULL;
+       return 0;
+    }
+
+    if( !A->alloc || !A->dealloc ){
+       if( NIFTI_OPTS.debug > 0 )
+          fprintf(stderr,"** nifti_set_allocator: missing alloc or dealloc\n");
+       nifti_set_last_error(NIFTI_ERR_INPUT);
+       return 1;
+    }
+
+    g_nifti_alloc = *A;
+    return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/*! copy the current allocator into A
+*//*--------------------------------------------------------------------*/
+void nifti_get_allocator( nifti_allocator * A )
+{
+    if( A ) *A = g_nifti_alloc;
+}
+
+/*----------------------------------------------------------------------*/
+/*! allocate nbytes (not zeroed) with the nifti allocator
+
+    \sa nifti_set_allocator, nifti_data_free
+*//*--------------------------------------------------------------------*/
+void * nifti_data_alloc( size_t nbytes )
+{
+    return g_nifti_alloc.alloc(nbytes, g_nifti_alloc.ctx);
+}
+
+/*----------------------------------------------------------------------*/
+/*! allocate nbytes (not zeroed), aligned to align bytes if the nifti
+    allocator supports that (align is a power of 2)
+*//*--------------------------------------------------------------------*/
+void * nifti_data_alloc_aligned( size_t align, size_t nbytes )
+{
+    if( g_nifti_alloc.alloc_aligned )
+       return g_nifti_alloc.alloc_aligned(align, nbytes, g_nifti_alloc.ctx);
+    return g_nifti_alloc.alloc(nbytes, g_nifti_alloc.ctx);
+}
+
+/*----------------------------------------------------------------------*/
+/*! free memory from nifti_data_alloc(_aligned) (ptr may be NULL)
+*//*--------------------------------------------------------------------*/
+void nifti_data_free( void * ptr )
+{
+    if( ptr ) g_nifti_alloc.dealloc(ptr, g_nifti_alloc.ctx);
+}
+
+/*----------------------------------------------------------------------*/
+/*! check current directory for existing header file
+
+    \return filename of header on success and NULL if no appropriate file
+            could be found
+
+    If fname has an uppercase extension, check for uppercase files.
+
+    NB: it allocates memory for hdrname which should be freed
+        when no longer required
+*//*-------------------------------------------------------------------*/
+char * nifti_findhdrname(const char* fname)
+{
+   char *basename, *hdrname;
+   const char *ext;
+   char  elist[2][5] = { ".hdr", ".nii" };
+   char  extzip[4]   = ".gz";
+   int   efirst = 1;    /* init to .nii extension */
+   int   eisupper = 0;  /* init to lowercase extensions */
+
+   /**- check input file(s) for sanity */
+   if( !nifti_validfilename(fname) ) return NULL;
+
+   basename = nifti_makebasename(fname);
+   if( !basename ) return NULL;   /* only on string alloc failure */
+
+   /**- return filename if it has a valid extension and exists
+         (except if it is an .img file (and maybe .gz)) */
+   ext = nifti_find_file_extension(fname);
+
+   if( ext ) eisupper = is_uppercase(ext);  /* do we look for uppercase? */
 
    /* if the file exists and is a valid header name (not .img), return it */
    if ( ext && nifti_fileexists(fname) ) {
@@ -3927,7 +5106,8 @@ char * nifti_makehdrname(const char * prefix, int nifti_type, int check,
       return NULL;
    }
 
-   if(g_opts.debug > 2) fprintf(stderr,"+d made header filename '%s'\n", iname);
+   if(NIFTI_OPTS.debug > 2)
+      fprintf(stderr,"+d made header filename '%s'\n", iname);
 
    return iname;
 }
@@ -4002,7 +5182,8 @@ char * nifti_makeimgname(const char * prefix, int nifti_type, int check,
       return NULL;
    }
 
-   if( g_opts.debug > 2 ) fprintf(stderr,"+d made image filename '%s'\n",iname);
+   if( NIFTI_OPTS.debug > 2 )
+      fprintf(stderr,"+d made image filename '%s'\n",iname);
 
    return iname;
 }
@@ -4035,7 +5216,7 @@ int nifti_set_filenames( nifti_image * nim, const char * prefix, int check,
       return -1;
    }
 
-   if( g_opts.debug > 1 )
+   if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"+d modifying output filenames using prefix %s\n", prefix);
 
    /* set and test output filenames */
@@ -4052,7 +5233,7 @@ int nifti_set_filenames( nifti_image * nim, const char * prefix, int check,
    if( nifti_set_type_from_names(nim) < 0 )
       return -1;
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"+d have new filenames %s and %s\n",nim->fname,nim->iname);
 
    return 0;
@@ -4384,7 +5565,7 @@ int nifti_set_type_from_names( nifti_image * nim )
       return -1;
    }
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-d verify nifti_type from filenames: %d",nim->nifti_type);
 
    /* type should be NIFTI_FTYPE_ASCII if extension is .nia */
@@ -4402,9 +5583,9 @@ int nifti_set_type_from_names( nifti_image * nim )
          nim->nifti_type = NIFTI_FTYPE_NIFTI2_2;
    }
 
-   if( g_opts.debug > 2 ) fprintf(stderr," -> %d\n",nim->nifti_type);
+   if( NIFTI_OPTS.debug > 2 ) fprintf(stderr," -> %d\n",nim->nifti_type);
 
-   if( g_opts.debug > 1 )  /* warn user about anything strange */
+   if( NIFTI_OPTS.debug > 1 )  /* warn user about anything strange */
       nifti_type_and_names_match(nim, 1);
 
    if( is_valid_nifti_type(nim->nifti_type) ) return 0;  /* success! */
@@ -4443,7 +5624,7 @@ int is_nifti_file( const char *hname )
 
    tmpname = nifti_findhdrname(hname);
    if( tmpname == NULL ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** NIFTI: no header file found for '%s'\n",hname);
       return -1;
    }
@@ -4714,11 +5895,12 @@ nifti_image* nifti_convert_n1hdr2nim(nifti_1_header nhdr, const char * fname)
      nim->analyze75_orient = (analyze_75_orient_code)c;
      }
    if( doswap ) {
-      if ( g_opts.debug > 3 ) disp_nifti_1_header("-d ni1 pre-swap: ", &nhdr);
+      if ( NIFTI_OPTS.debug > 3 )
+         disp_nifti_1_header("-d ni1 pre-swap: ", &nhdr);
       swap_nifti_header( &nhdr , ni_ver ) ;
    }
 
-   if ( g_opts.debug > 2 ) disp_nifti_1_header("-d nhdr2nim : ", &nhdr);
+   if ( NIFTI_OPTS.debug > 2 ) disp_nifti_1_header("-d nhdr2nim : ", &nhdr);
 
    if( nhdr.datatype == DT_BINARY || nhdr.datatype == DT_UNKNOWN  )
    {
@@ -4820,7 +6002,7 @@ nifti_image* nifti_convert_n1hdr2nim(nifti_1_header nhdr, const char * fname)
 
     nim->qform_code = NIFTI_XFORM_UNKNOWN ;
 
-    if( g_opts.debug > 1 ) fprintf(stderr,"-d no qform provided\n");
+    if( NIFTI_OPTS.debug > 1 ) fprintf(stderr,"-d no qform provided\n");
   } else {
     /**- else NIFTI: use the quaternion-specified transformation */
 
@@ -4842,7 +6024,7 @@ nifti_image* nifti_convert_n1hdr2nim(nifti_1_header nhdr, const char * fname)
 
     nim->qform_code = nhdr.qform_code ;
 
-    if( g_opts.debug > 1 )
+    if( NIFTI_OPTS.debug > 1 )
        nifti_disp_matrix_orient("-d qform orientations:\n", nim->qto_xyz);
   }
 
@@ -4857,7 +6039,7 @@ nifti_image* nifti_convert_n1hdr2nim(nifti_1_header nhdr, const char * fname)
 
     nim->sform_code = NIFTI_XFORM_UNKNOWN ;
 
-    if( g_opts.debug > 1 ) fprintf(stderr,"-d no sform provided\n");
+    if( NIFTI_OPTS.debug > 1 ) fprintf(stderr,"-d no sform provided\n");
 
   } else {
     /**- else set the sto transformation from srow_*[] */
@@ -4886,7 +6068,7 @@ nifti_image* nifti_convert_n1hdr2nim(nifti_1_header nhdr, const char * fname)
 
     nim->sform_code = nhdr.sform_code ;
 
-    if( g_opts.debug > 1 )
+    if( NIFTI_OPTS.debug > 1 )
        nifti_disp_matrix_orient("-d sform orientations:\n", nim->sto_xyz);
   }
 
@@ -4995,11 +6177,12 @@ nifti_image* nifti_convert_n2hdr2nim(nifti_2_header nhdr, const char * fname)
    }
 
    if( doswap ) {
-      if ( g_opts.debug > 3 ) disp_nifti_2_header("-d n2 pre-swap: ", &nhdr);
+      if ( NIFTI_OPTS.debug > 3 )
+         disp_nifti_2_header("-d n2 pre-swap: ", &nhdr);
       swap_nifti_header( &nhdr , ni_ver ) ;
-   } else if ( g_opts.debug > 3 ) fprintf(stderr,"-- n2hdr2nim: no swap\n");
+   } else if ( NIFTI_OPTS.debug > 3 ) fprintf(stderr,"-- n2hdr2nim: no swap\n");
 
-   if ( g_opts.debug > 2 ) disp_nifti_2_header("-d n2hdr2nim : ", &nhdr);
+   if ( NIFTI_OPTS.debug > 2 ) disp_nifti_2_header("-d n2hdr2nim : ", &nhdr);
 
    if( nhdr.datatype == DT_BINARY || nhdr.datatype == DT_UNKNOWN  )
    {
@@ -5090,7 +6273,7 @@ nifti_image* nifti_convert_n2hdr2nim(nifti_2_header nhdr, const char * fname)
 
     nim->qform_code = NIFTI_XFORM_UNKNOWN ;
 
-    if( g_opts.debug > 1 ) fprintf(stderr,"-d no qform provided\n");
+    if( NIFTI_OPTS.debug > 1 ) fprintf(stderr,"-d no qform provided\n");
   } else {
     /**- else NIFTI: use the quaternion-specified transformation */
 
@@ -5112,7 +6295,7 @@ nifti_image* nifti_convert_n2hdr2nim(nifti_2_header nhdr, const char * fname)
 
     nim->qform_code = nhdr.qform_code ;
 
-    if( g_opts.debug > 1 )
+    if( NIFTI_OPTS.debug > 1 )
        nifti_disp_matrix_orient("-d qform orientations:\n", nim->qto_xyz);
   }
 
@@ -5127,7 +6310,7 @@ nifti_image* nifti_convert_n2hdr2nim(nifti_2_header nhdr, const char * fname)
 
     nim->sform_code = NIFTI_XFORM_UNKNOWN ;
 
-    if( g_opts.debug > 1 ) fprintf(stderr,"-d no sform provided\n");
+    if( NIFTI_OPTS.debug > 1 ) fprintf(stderr,"-d no sform provided\n");
 
   } else {
     /**- else set the sto transformation from srow_*[] */
@@ -5156,7 +6339,7 @@ nifti_image* nifti_convert_n2hdr2nim(nifti_2_header nhdr, const char * fname)
 
     nim->sform_code = nhdr.sform_code ;
 
-    if( g_opts.debug > 1 )
+    if( NIFTI_OPTS.debug > 1 )
        nifti_disp_matrix_orient("-d sform orientations:\n", nim->sto_xyz);
   }
 
@@ -5292,15 +6475,16 @@ nifti_1_header * nifti_read_n1_hdr(const char * hname, int *swapped, int check)
    /* determine file name to use for header */
    hfile = nifti_findhdrname(hname);
    if( hfile == NULL ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          LNI_FERR(fname,"failed to find header file for", hname);
       return NULL;
-   } else if( g_opts.debug > 1 )
+   } else if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"-d %s: found header filename '%s'\n",fname,hfile);
 
    fp = znzopen( hfile, "rb", nifti_is_gzfile(hfile) );
    if( znz_isnull(fp) ){
-      if( g_opts.debug > 0 ) LNI_FERR(fname,"failed to open header file",hfile);
+      if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR(fname,"failed to open header file",hfile);
       free(hfile);
       return NULL;
    }
@@ -5309,7 +6493,7 @@ nifti_1_header * nifti_read_n1_hdr(const char * hname, int *swapped, int check)
 
    if( has_ascii_header(fp) == 1 ){
       znzclose( fp );
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          LNI_FERR(fname,"ASCII header type not supported",hname);
       return NULL;
    }
@@ -5319,7 +6503,7 @@ nifti_1_header * nifti_read_n1_hdr(const char * hname, int *swapped, int check)
    znzclose( fp );                      /* we are done with the file now */
 
    if( bytes < (int)sizeof(nhdr) ){
-      if( g_opts.debug > 0 ){
+      if( NIFTI_OPTS.debug > 0 ){
          LNI_FERR(fname,"bad binary header read for file", hname);
          fprintf(stderr,"  - read %d of %d bytes\n",bytes, (int)sizeof(nhdr));
       }
@@ -5333,15 +6517,18 @@ nifti_1_header * nifti_read_n1_hdr(const char * hname, int *swapped, int check)
       return NULL;
    } else if ( lswap < 0 ) {
       lswap = 0;  /* if swapping does not help, don't do it */
-      if(g_opts.debug > 1) fprintf(stderr,"-- swap failure, none applied\n");
+      if(NIFTI_OPTS.debug > 1)
+         fprintf(stderr,"-- swap failure, none applied\n");
    }
 
    if( lswap ) {
-      if ( g_opts.debug > 3 ) disp_nifti_1_header("-d nhdr pre-swap: ", &nhdr);
+      if ( NIFTI_OPTS.debug > 3 )
+         disp_nifti_1_header("-d nhdr pre-swap: ", &nhdr);
       swap_nifti_header( &nhdr , NIFTI_VERSION(nhdr) ) ;
    }
 
-   if ( g_opts.debug > 2 ) disp_nifti_1_header("-d nhdr post-swap: ", &nhdr);
+   if ( NIFTI_OPTS.debug > 2 )
+      disp_nifti_1_header("-d nhdr post-swap: ", &nhdr);
 
    if ( check && ! nifti_hdr1_looks_good(&nhdr) ){
       LNI_FERR(fname,"nifti_1_header looks bad for file", hname);
@@ -5393,15 +6580,15 @@ nifti_2_header * nifti_read_n2_hdr(const char * hname, int * swapped,
    /* determine file name to use for header */
    hfile = nifti_findhdrname(hname);
    if( hfile == NULL ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          LNI_FERR(fname,"failed to find header file for", hname);
       return NULL;
-   } else if( g_opts.debug > 1 )
+   } else if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"-d %s: found N2 header filename '%s'\n",fname,hfile);
 
    fp = znzopen( hfile, "rb", nifti_is_gzfile(hfile) );
    if( znz_isnull(fp) ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          LNI_FERR(fname,"failed to open N2 header file",hfile);
       free(hfile);
       return NULL;
@@ -5411,7 +6598,7 @@ nifti_2_header * nifti_read_n2_hdr(const char * hname, int * swapped,
 
    /* ASCII is not part of standard, but allow */
    if( has_ascii_header(fp) == 1 ){
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"++ reading ASCII header via NIFTI-2 in %s\n", hname);
       nim = nifti_read_ascii_image(fp, hname, -1, 0);
       znzclose(fp) ;
@@ -5430,7 +6617,7 @@ nifti_2_header * nifti_read_n2_hdr(const char * hname, int * swapped,
    znzclose( fp );                      /* we are done with the file now */
 
    if( bytes < (int)sizeof(nhdr) ){
-      if( g_opts.debug > 0 ){
+      if( NIFTI_OPTS.debug > 0 ){
          LNI_FERR(fname,"bad binary header read for N2 file", hname);
          fprintf(stderr,"  - read %d of %d bytes\n",bytes, (int)sizeof(nhdr));
       }
@@ -5440,11 +6627,13 @@ nifti_2_header * nifti_read_n2_hdr(const char * hname, int * swapped,
    /* now just decide on byte swapping */
    lswap = NIFTI2_NEEDS_SWAP(nhdr);
    if( lswap ) {
-      if ( g_opts.debug > 3 ) disp_nifti_2_header("-d n2hdr pre-swap: ", &nhdr);
+      if ( NIFTI_OPTS.debug > 3 )
+         disp_nifti_2_header("-d n2hdr pre-swap: ", &nhdr);
       swap_nifti_header( &nhdr , 2 );  /* use explicit version */
    }
 
-   if ( g_opts.debug > 2 ) disp_nifti_2_header("-d nhdr post-swap: ", &nhdr);
+   if ( NIFTI_OPTS.debug > 2 )
+      disp_nifti_2_header("-d nhdr post-swap: ", &nhdr);
 
    if ( check && ! nifti_hdr2_looks_good(&nhdr) ){
       LNI_FERR(fname,"nifti_2_header looks bad for file", hname);
@@ -5483,7 +6672,7 @@ int nifti_hdr1_looks_good(const nifti_1_header * hdr)
 
    /* check dim[0] and sizeof_hdr */
    if( need_nhdr_swap(hdr->dim[0], hdr->sizeof_hdr) < 0 ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
         fprintf(stderr,"** NIFTI: bad hdr1 fields: dim0, sizeof_hdr = %d, %d\n",
                 hdr->dim[0], hdr->sizeof_hdr);
       errs++;
@@ -5492,7 +6681,7 @@ int nifti_hdr1_looks_good(const nifti_1_header * hdr)
    /* check the valid dimension sizes (maybe dim[0] is bad) */
    for( c = 1; c <= hdr->dim[0] && c <= 7; c++ )
       if( hdr->dim[c] <= 0 ){
-         if( g_opts.debug > 0 )
+         if( NIFTI_OPTS.debug > 0 )
             fprintf(stderr,"** NIFTI: bad nhdr field: dim[%d] = %d\n",
                     c,hdr->dim[c]);
          errs++;
@@ -5503,21 +6692,21 @@ int nifti_hdr1_looks_good(const nifti_1_header * hdr)
    if( ni_ver > 0 ){      /* NIFTI */
 
       if( ! nifti_datatype_is_valid(hdr->datatype, 1) ){
-         if( g_opts.debug > 0 )
+         if( NIFTI_OPTS.debug > 0 )
             fprintf(stderr,"** bad NIFTI datatype in hdr, %d\n",hdr->datatype);
          errs++;
       }
 
    } else {             /* ANALYZE 7.5 */
 
-      if( g_opts.debug > 1 ) { /* maybe tell user it's an ANALYZE hdr */
+      if( NIFTI_OPTS.debug > 1 ) { /* maybe tell user it's an ANALYZE hdr */
          fprintf(stderr,
            "-- nhdr magic field implies ANALYZE: magic = '%.4s' : ",hdr->magic);
          print_hex_vals(hdr->magic, 4, stderr); fputc('\n', stderr);
       }
 
       if( ! nifti_datatype_is_valid(hdr->datatype, 0) ){
-         if( g_opts.debug > 0 )
+         if( NIFTI_OPTS.debug > 0 )
            fprintf(stderr,"** NIFTI: bad ANALYZE datatype in hdr, %d\n",
                    hdr->datatype);
          errs++;
@@ -5526,7 +6715,7 @@ int nifti_hdr1_looks_good(const nifti_1_header * hdr)
 
    if( errs ) return 0;  /* problems */
 
-   if( g_opts.debug > 2 ) fprintf(stderr,"-d nifti header looks good\n");
+   if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d nifti header looks good\n");
 
    return 1;   /* looks good */
 }
@@ -5596,10 +6785,10 @@ int nifti_hdr2_looks_good(const nifti_2_header * hdr)
    if( !hdr ) { fprintf(stderr,"** NIFTI n2hdr: hdr is NULL\n"); return 0; }
 
    /* for now, just warn if the header sizes are not right */
-   if( g_opts.debug > 0 ) (void)nifti_valid_header_size(0, 1);
+   if( NIFTI_OPTS.debug > 0 ) (void)nifti_valid_header_size(0, 1);
 
    if( hdr->sizeof_hdr != sizeof(nifti_2_header) ) {
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** NIFTI bad n2hdr: sizeof_hdr = %d\n",
                  hdr->sizeof_hdr);
       errs++;
@@ -5608,13 +6797,13 @@ int nifti_hdr2_looks_good(const nifti_2_header * hdr)
    /* check the valid dimension sizes (maybe dim[0] is bad) */
    d0 = hdr->dim[0];
    if( d0 < 0 || d0 > 7 ) {
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** NIFTI: bad n2hdr: dim0 = %" PRId64 "\n", d0);
       errs++;
    } else { /* only check dims if d0 is okay */
       for( c = 1; c <= d0; c++ )
          if( hdr->dim[c] <= 0 ){
-           if( g_opts.debug > 0 )
+           if( NIFTI_OPTS.debug > 0 )
              fprintf(stderr,"** NIFTI: bad nhdr field: dim[%d] = %" PRId64 "\n",
                      c, hdr->dim[c]);
            errs++;
@@ -5624,7 +6813,7 @@ int nifti_hdr2_looks_good(const nifti_2_header * hdr)
    ni_ver = NIFTI_VERSION(*hdr);  /* note version */
 
    if( ! nifti_datatype_is_valid(hdr->datatype, ni_ver) ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** bad %s NIFTI datatype in hdr, %d\n",
                  ni_ver ? "NIFTI" : "ANALYZE", hdr->datatype);
       errs++;
@@ -5632,7 +6821,7 @@ int nifti_hdr2_looks_good(const nifti_2_header * hdr)
 
    /* NIFTI_VERSION must return 2, or else sizes will not match */
    if( ni_ver != 2 || memcmp((hdr->magic+4), nifti2_magic+4, 4) != 0 ) {
-      if( g_opts.debug > 0 ) {
+      if( NIFTI_OPTS.debug > 0 ) {
          fprintf(stderr, "-- header magic not NIFTI-2, magic = '%.4s' + ",
                          hdr->magic);
          print_hex_vals(hdr->magic+4, 4, stderr); fputc('\n', stderr);
@@ -5642,7 +6831,7 @@ int nifti_hdr2_looks_good(const nifti_2_header * hdr)
 
    if( errs ) return 0;  /* problems */
 
-   if( g_opts.debug > 2 ) fprintf(stderr,"-d nifti header looks good\n");
+   if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d nifti header looks good\n");
 
    return 1;   /* looks good */
 }
@@ -5668,7 +6857,7 @@ static int need_nhdr_swap( short dim0, int hdrsize )
       nifti_swap_2bytes(1, &d0);        /* swap? */
       if( d0 > 0 && d0 <= 7 ) return 1;
 
-      if( g_opts.debug > 1 ){
+      if( NIFTI_OPTS.debug > 1 ){
          fprintf(stderr,"** NIFTI: bad swapped d0 = %d, unswapped = ", d0);
          nifti_swap_2bytes(1, &d0);        /* swap? */
          fprintf(stderr,"%d\n", d0);
@@ -5683,7 +6872,7 @@ static int need_nhdr_swap( short dim0, int hdrsize )
    nifti_swap_4bytes(1, &hsize);     /* swap? */
    if( hsize == sizeof(nifti_1_header) ) return 1;
 
-   if( g_opts.debug > 1 ){
+   if( NIFTI_OPTS.debug > 1 ){
       fprintf(stderr,"** NIFTI: bad swapped hsize = %d, unswapped = ", hsize);
       nifti_swap_4bytes(1, &hsize);        /* swap? */
       fprintf(stderr,"%d\n", hsize);
@@ -5709,6 +6898,8 @@ static int need_nhdr_swap( short dim0, int hdrsize )
 
         - The data buffer will be byteswapped if necessary.
         - The data buffer will not be scaled.
+        - Large uncompressed data is read in chunks by several threads,
+          if set by nifti_set_nthreads().
         - The data buffer is allocated with calloc().
 
     \param hname filename of the nifti dataset
@@ -5727,7 +6918,7 @@ void * nifti_read_header( const char *hname, int *nver, int check )
    char           *hfile=NULL, *posn;
    int             ii, ni_ver;
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"-d reading header from '%s'",hname);
       fprintf(stderr,", HAVE_ZLIB = %d\n", nifti_compiled_with_zlib());
    }
@@ -5735,10 +6926,10 @@ void * nifti_read_header( const char *hname, int *nver, int check )
    /**- determine filename to use for header */
    hfile = nifti_findhdrname(hname);
    if( hfile == NULL ){
-      if(g_opts.debug > 0)
+      if(NIFTI_OPTS.debug > 0)
          LNI_FERR(fname,"failed to find header file for", hname);
       return NULL;  /* check return */
-   } else if( g_opts.debug > 2 )
+   } else if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-d %s: found header filename '%s'\n",fname,hfile);
 
    h1size = sizeof(nifti_1_header);
@@ -5747,7 +6938,8 @@ void * nifti_read_header( const char *hname, int *nver, int check )
    /**- open file, separate reading of header, extensions and data */
    fp = znzopen(hfile, "rb", nifti_is_gzfile(hfile));
    if( znz_isnull(fp) ){
-      if( g_opts.debug > 0 ) LNI_FERR(fname,"failed to open header file",hfile);
+      if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR(fname,"failed to open header file",hfile);
       free(hfile);
       return NULL;
    }
@@ -5764,7 +6956,7 @@ void * nifti_read_header( const char *hname, int *nver, int check )
    ii = (int)znzread(&n1hdr, 1, h1size, fp);
 
    if( ii < (int)h1size ){      /* failure? */
-      if( g_opts.debug > 0 ){
+      if( NIFTI_OPTS.debug > 0 ){
          LNI_FERR(fname,"bad binary header read for file", hfile);
          fprintf(stderr,"  - read %d of %d bytes\n",ii, (int)h1size);
       }
@@ -5775,7 +6967,7 @@ void * nifti_read_header( const char *hname, int *nver, int check )
 
    /* find out what type of header we have */
    ni_ver = nifti_header_version((char *)&n1hdr, h1size);
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-- %s: NIFTI version = %d\n", fname, ni_ver);
 
    /* maybe set return NIFTI version */
@@ -5783,7 +6975,7 @@ void * nifti_read_header( const char *hname, int *nver, int check )
 
    /* if NIFTI-2, copy and finish reading header */
    if ( ni_ver == 2 ) {
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-- %s: copying and filling NIFTI-2 header...\n",fname);
       memcpy(&n2hdr, &n1hdr, h1size);   /* copy first part */
       remain = h2size - h1size;
@@ -5825,7 +7017,7 @@ void * nifti_read_header( const char *hname, int *nver, int check )
          return hresult;
       }
    } else {
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr, "** %s: bad nifti header version %d\n", hname, ni_ver);
 
       /* return a nifti-1 header anyway */
@@ -5837,7 +7029,7 @@ void * nifti_read_header( const char *hname, int *nver, int check )
       memcpy(hresult, (void *)&n1hdr, h1size);
    }
 
-   if( g_opts.debug > 1 )
+   if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"-- returning NIFTI-%d header in %s\n", ni_ver, hname);
 
    return hresult;
@@ -5870,7 +7062,7 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
    char            fname[] = { "nifti_image_read" };
    char           *hfile=NULL, *posn;
 
-   if( g_opts.debug > 1 ){
+   if( NIFTI_OPTS.debug > 1 ){
       fprintf(stderr,"-d image_read from '%s', read_data = %d",hname,read_data);
       fprintf(stderr,", HAVE_ZLIB = %d\n", nifti_compiled_with_zlib());
    }
@@ -5878,10 +7070,11 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
    /**- determine filename to use for header */
    hfile = nifti_findhdrname(hname);
    if( hfile == NULL ){
-      if(g_opts.debug > 0)
+      if(NIFTI_OPTS.debug > 0)
          LNI_FERR(fname,"failed to find header file for", hname);
+      nifti_set_last_error(NIFTI_ERR_NOFILE);
       return NULL;  /* check return */
-   } else if( g_opts.debug > 1 )
+   } else if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"-d %s: found header filename '%s'\n",fname,hfile);
 
    if( nifti_is_gzfile(hfile) ) filesize = -1;  /* unknown */
@@ -5890,7 +7083,9 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
    /**- open file, separate reading of header, extensions and data */
    fp = znzopen(hfile, "rb", nifti_is_gzfile(hfile));
    if( znz_isnull(fp) ){
-      if( g_opts.debug > 0 ) LNI_FERR(fname,"failed to open header file",hfile);
+      if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR(fname,"failed to open header file",hfile);
+      nifti_set_last_error(NIFTI_ERR_OPEN);
       free(hfile);
       return NULL;
    }
@@ -5898,7 +7093,8 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
    /**- first try to read dataset as ASCII (and return if so) */
    rv = has_ascii_header( fp );
    if( rv < 0 ){
-      if( g_opts.debug > 0 ) LNI_FERR(fname,"short header read",hfile);
+      if( NIFTI_OPTS.debug > 0 ) LNI_FERR(fname,"short header read",hfile);
+      nifti_set_last_error(NIFTI_ERR_READ);
       znzclose( fp );
       free(hfile);
       return NULL;
@@ -5917,10 +7113,11 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
    ii = (int)znzread(&n1hdr, 1, h1size, fp);
 
    if( ii < (int)h1size ){      /* failure? */
-      if( g_opts.debug > 0 ){
+      if( NIFTI_OPTS.debug > 0 ){
          LNI_FERR(fname,"bad binary header read for file", hfile);
          fprintf(stderr,"  - read %d of %d bytes\n",ii, (int)h1size);
       }
+      nifti_set_last_error(NIFTI_ERR_READ);
       znzclose(fp) ;
       free(hfile);
       return NULL;
@@ -5928,7 +7125,7 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
 
    /* find out what type of header we have */
    ni_ver = nifti_header_version((char *)&n1hdr, h1size);
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-- %s: NIFTI version = %d\n", fname, ni_ver);
 
    if( ni_ver == 0 || ni_ver == 1 ) {
@@ -5936,7 +7133,7 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
       onefile = NIFTI_ONEFILE(n1hdr);
    } else if ( ni_ver == 2 ) {
       /* fill nifti-2 header and convert */
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-- %s: copying and filling NIFTI-2 header...\n",fname);
       memcpy(&n2hdr, &n1hdr, h1size);   /* copy first part */
       remain = h2size - h1size;
@@ -5944,25 +7141,28 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
       ii = (int)znzread(posn, 1, remain, fp); /* read remaining part */
       if( ii < (int)remain) {
          LNI_FERR(fname,"short NIFTI-2 header read for file", hfile);
+         nifti_set_last_error(NIFTI_ERR_READ);
          znzclose(fp);  free(hfile);  return NULL;
       }
       nim = nifti_convert_n2hdr2nim(n2hdr,hfile);
       onefile = NIFTI_ONEFILE(n2hdr);
    } else {
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** %s: bad nifti im header version %d\n",fname,ni_ver);
+      nifti_set_last_error(NIFTI_ERR_HEADER);
       znzclose(fp);  free(hfile);  return NULL;
    }
 
    if( nim == NULL ){
       znzclose( fp ) ;                                   /* close the file */
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          LNI_FERR(fname,"cannot create nifti image from header",hfile);
+      nifti_set_last_error(NIFTI_ERR_HEADER);
       free(hfile); /* had to save this for debug message */
       return NULL;
    }
 
-   if( g_opts.debug > 3 ){
+   if( NIFTI_OPTS.debug > 3 ){
       fprintf(stderr,"+d nifti_image_read(), have nifti image:\n");
       nifti_image_infodump(nim);
    }
@@ -5979,7 +7179,7 @@ nifti_image *nifti_image_read( const char *hname , int read_data )
    znzclose( fp ) ;                                      /* close the file */
    free(hfile);
 
-   if ( g_opts.alter_cifti && nifti_looks_like_cifti(nim) )
+   if ( NIFTI_OPTS.alter_cifti && nifti_looks_like_cifti(nim) )
       nifti_alter_cifti_dims(nim);
 
    /**- read the data if desired, then bug out */
@@ -6112,7 +7312,7 @@ nifti_image * nifti_read_ascii_image(znzFile fp, const char *fname, int flen,
      return NULL;
    }
 
-   if( g_opts.debug > 1 )
+   if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"-d %s: have ASCII NIFTI file of size %" PRId64 "\n",
               fname, slen);
 
@@ -6145,7 +7345,7 @@ nifti_image * nifti_read_ascii_image(znzFile fp, const char *fname, int flen,
 
    /* check for nifti_image_load() failure, maybe bail out */
    if( read_data && rv != 0 ){
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"-d failed image_load, free nifti image struct\n");
       free(nim);
       return NULL;
@@ -6175,7 +7375,7 @@ static int nifti_read_extensions( nifti_image *nim, znzFile fp, int64_t remain )
    /* rcr n2 - add and use nifti2_extension type? */
 
    if( !nim || znz_isnull(fp) ) {
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** nifti_read_extensions: bad inputs (%p,%p)\n",
                  (void *)nim, (void *)fp);
       return -1;
@@ -6183,14 +7383,14 @@ static int nifti_read_extensions( nifti_image *nim, znzFile fp, int64_t remain )
 
    posn = znztell(fp);
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-d nre: posn=%" PRId64 ", offset=%" PRId64
                      ", type=%d, remain=%" PRId64 "\n",
                      posn, nim->iname_offset, nim->nifti_type, remain);
 
    if( remain < 16 ){
-      if( g_opts.debug > 2 ){
-         if( g_opts.skip_blank_ext )
+      if( NIFTI_OPTS.debug > 2 ){
+         if( NIFTI_OPTS.skip_blank_ext )
             fprintf(stderr,"-d no extender in '%s' is okay, as "
                            "skip_blank_ext is set\n",nim->fname);
          else
@@ -6203,21 +7403,21 @@ static int nifti_read_extensions( nifti_image *nim, znzFile fp, int64_t remain )
    count = znzread( extdr.extension, 1, 4, fp ); /* get extender */
 
    if( count < 4 ){
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"-d file '%s' is too short for an extender\n",
                  nim->fname);
       return 0;
    }
 
    if( extdr.extension[0] != 1 ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d extender[0] (%d) shows no extensions for '%s'\n",
                  extdr.extension[0], nim->fname);
       return 0;
    }
 
    remain -= 4;
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-d found valid 4-byte extender, remain = %" PRId64 "\n",
               remain);
 
@@ -6229,21 +7429,21 @@ static int nifti_read_extensions( nifti_image *nim, znzFile fp, int64_t remain )
    {
       if( nifti_add_exten_to_list(&extn, &Elist, (int)count+1) < 0 ){
          free(Elist);
-         if( g_opts.debug > 0 )
+         if( NIFTI_OPTS.debug > 0 )
            fprintf(stderr,"** NIFTI: failed adding ext %" PRId64 " to list\n",
                     count);
          return -1;
       }
 
       /* we have a new extension */
-      if( g_opts.debug > 1 ){
+      if( NIFTI_OPTS.debug > 1 ){
          fprintf(stderr,"+d found extension #%" PRId64
                         ", code = 0x%x, size = %d\n",
                  count, extn.ecode, extn.esize);
-         if( extn.ecode == NIFTI_ECODE_AFNI && g_opts.debug > 2 ) /* ~XML */
+         if( extn.ecode == NIFTI_ECODE_AFNI && NIFTI_OPTS.debug > 2 ) /* ~XML */
             fprintf(stderr,"   AFNI extension: %.*s\n",
                     extn.esize-8,extn.edata);
-         else if( extn.ecode == NIFTI_ECODE_COMMENT && g_opts.debug > 2 )
+         else if( extn.ecode == NIFTI_ECODE_COMMENT && NIFTI_OPTS.debug > 2 )
             fprintf(stderr,"   COMMENT extension: %.*s\n",        /* TEXT */
                     extn.esize-8,extn.edata);
       }
@@ -6251,7 +7451,7 @@ static int nifti_read_extensions( nifti_image *nim, znzFile fp, int64_t remain )
       count++;
    }
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"+d found %" PRId64 " extension(s)\n", count);
    /* rcr n2 - allow int64_t num ext? */
    nim->num_ext = (int)count;
@@ -6283,8 +7483,8 @@ int nifti_add_extension(nifti_image *nim, const char * data, int len, int ecode)
    nifti1_extension ext;
 
    /* error are printed in functions */
-   if( nifti_fill_extension(&ext, data, len, ecode) )  { free(ext.edata);   return -1; }
-   if( nifti_add_exten_to_list(&ext, &nim->ext_list, nim->num_ext+1)) { free(ext.edata);   return -1; }
+   if( nifti_fill_extension(&ext, data, len, ecode) )  { nifti_data_free(ext.edata);   return -1; }
+   if( nifti_add_exten_to_list(&ext, &nim->ext_list, nim->num_ext+1)) { nifti_data_free(ext.edata);   return -1; }
 
    nim->num_ext++;  /* success, so increment */
 
@@ -6330,7 +7530,7 @@ static int nifti_add_exten_to_list( nifti1_extension *  new_ext,
    (*list)[new_length-1].ecode = new_ext->ecode;
    (*list)[new_length-1].edata = new_ext->edata;
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"+d allocated and appended extension #%d to list\n",
               new_length);
 
@@ -6364,8 +7564,8 @@ static int nifti_fill_extension( nifti1_extension *ext, const char * data,
    if( esize & 0xf ) esize = (esize + 0xf) & ~0xf;
    ext->esize = esize;
 
-   /* allocate esize-8 (maybe more than len), using calloc for fill */
-   ext->edata = (char *)calloc(esize-8, sizeof(char));
+   /* allocate esize-8 (maybe more than len), to be zero filled */
+   ext->edata = (char *)nifti_data_alloc(esize-8);
    if( !ext->edata ){
       fprintf(stderr,"** NIFTI NFE: failed to alloc %d bytes for extension\n",
               len);
@@ -6373,9 +7573,10 @@ static int nifti_fill_extension( nifti1_extension *ext, const char * data,
    }
 
    memcpy(ext->edata, data, len);  /* copy the data, using len */
+   memset(ext->edata + len, 0, esize-8-len);         /* and zero fill */
    ext->ecode = ecode;             /* set the ecode */
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"+d alloc %d bytes for ext len %d, ecode %d, esize %d\n",
               esize-8, len, ecode, esize);
 
@@ -6403,7 +7604,7 @@ static int nifti_read_next_extension( nifti1_extension * nex, nifti_image *nim,
    nex->edata = NULL;
 
    if( remain < 16 ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d only %d bytes remain, so no extension\n", remain);
       return 0;
    }
@@ -6413,21 +7614,21 @@ static int nifti_read_next_extension( nifti1_extension * nex, nifti_image *nim,
    if( count == 1 ) count += (int)znzread( &code, 4, 1, fp );
 
    if( count != 2 || code == -1 ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d current extension read failed\n");
       znzseek(fp, -4*count, SEEK_CUR); /* back up past any read */
       return 0;                        /* no extension, no error condition */
    }
 
    if( swap ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d pre-swap exts: code %d, size %d\n", code, size);
 
       nifti_swap_4bytes(1, &size);
       nifti_swap_4bytes(1, &code);
    }
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-d potential extension: code %d, size %d\n", code, size);
 
    if( !nifti_check_extension(nim, size, code, remain) ){
@@ -6443,7 +7644,7 @@ static int nifti_read_next_extension( nifti1_extension * nex, nifti_image *nim,
    nex->ecode = code;
 
    size -= 8;  /* subtract space for size and code in extension */
-   nex->edata = (char *)malloc(size * sizeof(char));
+   nex->edata = (char *)nifti_data_alloc(size * sizeof(char));
    if( !nex->edata ){
       fprintf(stderr,"** NIFTI: failed to allocate %d bytes for extension\n",
               size);
@@ -6452,16 +7653,16 @@ static int nifti_read_next_extension( nifti1_extension * nex, nifti_image *nim,
 
    count = (int)znzread(nex->edata, 1, size, fp);
    if( count < size ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"-d read only %d (of %d) bytes for extension\n",
                  count, size);
-      free(nex->edata);
+      nifti_data_free(nex->edata);
       nex->edata = NULL;
       return -1;
    }
 
    /* success! */
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"+d successfully read extension, code %d, size %d\n",
               nex->ecode, nex->esize);
 
@@ -6478,7 +7679,7 @@ int valid_nifti_extensions(const nifti_image * nim)
    int                c, errs;
 
    if( nim->num_ext <= 0 || nim->ext_list == NULL ){
-      if( g_opts.debug > 2 ) fprintf(stderr,"-d empty extension list\n");
+      if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d empty extension list\n");
       return 0;
    }
 
@@ -6487,24 +7688,25 @@ int valid_nifti_extensions(const nifti_image * nim)
    errs = 0;
    for ( c = 0; c < nim->num_ext; c++ ){
       if( ! nifti_is_valid_ecode(ext->ecode) ) {
-         if( g_opts.debug > 1 )
+         if( NIFTI_OPTS.debug > 1 )
             fprintf(stderr,"-d ext %d, invalid code %d\n", c, ext->ecode);
          /* should not be fatal    29 Apr 2015 [rickr] */
       }
 
       if( ext->esize <= 0 ){
-         if( g_opts.debug > 1 )
+         if( NIFTI_OPTS.debug > 1 )
             fprintf(stderr,"-d ext %d, bad size = %d\n", c, ext->esize);
          errs++;
       } else if( ext->esize & 0xf ){
-         if( g_opts.debug > 1 )
+         if( NIFTI_OPTS.debug > 1 )
             fprintf(stderr,"-d ext %d, size %d not multiple of 16\n",
                     c, ext->esize);
          errs++;
       }
 
       if( ext->edata == NULL ){
-         if( g_opts.debug > 1 ) fprintf(stderr,"-d ext %d, missing data\n", c);
+         if( NIFTI_OPTS.debug > 1 )
+            fprintf(stderr,"-d ext %d, missing data\n", c);
          errs++;
       }
 
@@ -6512,7 +7714,7 @@ int valid_nifti_extensions(const nifti_image * nim)
    }
 
    if( errs > 0 ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"-d had %d extension errors, none will be written\n",
                  errs);
       return 0;
@@ -6534,13 +7736,13 @@ int nifti_header_version(const char * buf, size_t nbytes){
    int             sizeof_hdr, sver, nver;
 
    if( !buf ) {
-      if(g_opts.debug > 0)
+      if(NIFTI_OPTS.debug > 0)
          fprintf(stderr,"** %s: have NULL buffer pointer", fname);
       return -1;
    }
 
    if( nbytes < sizeof(nifti_1_header) ) {
-      if(g_opts.debug > 0)
+      if(NIFTI_OPTS.debug > 0)
          fprintf(stderr,"** %s: nbytes=%zu, too small for test", fname, nbytes);
       return -1;
    }
@@ -6563,27 +7765,27 @@ int nifti_header_version(const char * buf, size_t nbytes){
 
    /* now compare and return */
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-- %s: size ver = %d, ni ver = %d\n", fname, sver, nver);
 
    if( sver == 1 ) {
       nver = NIFTI_VERSION(*n1p);
       if( nver == 0 ) return 0;        /* ANALYZE */
       if( nver == 1 ) return 1;        /* NIFTI-1 */
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"** %s: bad NIFTI-1 magic= %.4s", fname, n1p->magic);
       return -1;
    } else if ( sver == 2 ) {
       nver = NIFTI_VERSION(*n2p);
       if( nver == 2 ) return 2;        /* NIFTI-2 */
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"** %s: bad NIFTI-2 magic4= %.4s", fname, n2p->magic);
       return -1;
    }
 
    /* failure */
 
-   if( g_opts.debug > 0 )
+   if( NIFTI_OPTS.debug > 0 )
       fprintf(stderr,"** %s: bad sizeof_hdr = %d\n", fname, n1p->sizeof_hdr);
 
    return -1;
@@ -6614,31 +7816,31 @@ static int nifti_check_extension(nifti_image *nim, int size, int code, int rem)
 {
    /* check for bad code before bad size */
    if( ! nifti_is_valid_ecode(code) ) {
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d invalid extension code %d\n",code);
       /* should not be fatal    29 Apr 2015 [rickr] */
    }
 
    if( size < 16 ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d ext size %d, no extension\n",size);
       return 0;
    }
 
    if( size > rem ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d ext size %d, space %d, no extension\n", size, rem);
       return 0;
    }
 
    if( size & 0xf ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d nifti extension size %d not multiple of 16\n",size);
       return 0;
    }
 
    if( nim->nifti_type == NIFTI_FTYPE_ASCII && size > LNI_MAX_NIA_EXT_LEN ){
-      if( g_opts.debug > 2 )
+      if( NIFTI_OPTS.debug > 2 )
          fprintf(stderr,"-d NVE, bad nifti_type 3 size %d\n", size);
       return 0;
    }
@@ -6667,12 +7869,13 @@ static znzFile nifti_image_load_prep( nifti_image *nim )
    if( nim == NULL      || nim->iname == NULL ||
        nim->nbyper <= 0 || nim->nvox <= 0       )
    {
-      if ( g_opts.debug > 0 ){
+      if ( NIFTI_OPTS.debug > 0 ){
          if( !nim ) fprintf(stderr,"** ERROR: N_image_load: no nifti image\n");
          else fprintf(stderr,"** ERROR: nifti_image_load: bad params (%p,%d,"
                       "%" PRId64 ")\n",
                       (void *)nim->iname, nim->nbyper, nim->nvox);
       }
+      nifti_set_last_error(NIFTI_ERR_INPUT);
       return NULL;
    }
 
@@ -6682,15 +7885,18 @@ static znzFile nifti_image_load_prep( nifti_image *nim )
 
    tmpimgname = nifti_findimgname(nim->iname , nim->nifti_type);
    if( tmpimgname == NULL ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** NIFTI: no image file found for '%s'\n",nim->iname);
+      nifti_set_last_error(NIFTI_ERR_NOFILE);
       return NULL;
    }
 
    fp = znzopen(tmpimgname, "rb", nifti_is_gzfile(tmpimgname));
    if (znz_isnull(fp)){
-       if(g_opts.debug > 0) LNI_FERR(fname,"cannot open data file",tmpimgname);
+       if(NIFTI_OPTS.debug > 0)
+          LNI_FERR(fname,"cannot open data file",tmpimgname);
        free(tmpimgname);
+       nifti_set_last_error(NIFTI_ERR_OPEN);
        return NULL;  /* bad open? */
    }
    free(tmpimgname);
@@ -6698,14 +7904,16 @@ static znzFile nifti_image_load_prep( nifti_image *nim )
    /**- get image offset: a negative offset means to figure from end of file */
    if( nim->iname_offset < 0 ){
      if( nifti_is_gzfile(nim->iname) ){
-        if( g_opts.debug > 0 )
+        if( NIFTI_OPTS.debug > 0 )
            LNI_FERR(fname,"negative offset for compressed file",nim->iname);
+        nifti_set_last_error(NIFTI_ERR_HEADER);
         znzclose(fp);
         return NULL;
      }
      ii = nifti_get_filesize( nim->iname ) ;
      if( ii <= 0 ){
-        if( g_opts.debug > 0 ) LNI_FERR(fname,"empty data file",nim->iname);
+        if( NIFTI_OPTS.debug > 0 ) LNI_FERR(fname,"empty data file",nim->iname);
+        nifti_set_last_error(NIFTI_ERR_READ);
         znzclose(fp);
         return NULL;
      }
@@ -6719,6 +7927,7 @@ static znzFile nifti_image_load_prep( nifti_image *nim )
       fprintf(stderr,"** NIFTI: could not seek to offset %" PRId64
                      " in file '%s'\n",
               ioff, nim->iname);
+      nifti_set_last_error(NIFTI_ERR_READ);
       znzclose(fp);
       return NULL;
    }
@@ -6737,6 +7946,9 @@ static znzFile nifti_image_load_prep( nifti_image *nim )
         - If not yet set, the data buffer is allocated with calloc().
         - The data buffer will be byteswapped if necessary.
         - The data buffer will not be scaled.
+        - If nifti_set_mmap_data() was used to request it, and the data
+          is uncompressed and in native byte order, nim->data will instead
+          point into a memory mapping of the file (see nifti_image_unload).
 
     This function is used to read the image from disk.  It should be used
     after a function such as nifti_image_read(), so that the nifti_image
@@ -6748,42 +7960,59 @@ static znzFile nifti_image_load_prep( nifti_image *nim )
 */
 int nifti_image_load( nifti_image *nim )
 {
-   /* set up data space, open data file and seek, then call nifti_read_buffer */
+   /* set up data space, open data file and seek, then call nifti_pread_buffer */
    int64_t ntot , ii ;
    znzFile fp ;
+   int     nthreads ;
 
    /**- open the file and position the FILE pointer */
    fp = nifti_image_load_prep( nim );
 
    if( fp == NULL ){
-      if( g_opts.debug > 0 )
+      if( NIFTI_OPTS.debug > 0 )
          fprintf(stderr,"** nifti_image_load, failed load_prep\n");
       return -1;
    }
 
    ntot = nifti_get_volsize(nim);
 
+   /**- if requested, try to map the data, rather than reading it */
+   if( nim->data == NULL && NIFTI_OPTS.mmap_data != NIFTI_MMAP_NONE &&
+       nifti_image_load_mmap(nim, fp, ntot) == 0 ){
+      znzclose(fp);
+      return 0;
+   }
+
    /**- if the data pointer is not yet set, get memory space for the image */
 
    if( nim->data == NULL )
    {
-     nim->data = calloc(1,ntot) ;  /* create image memory */
+     /* no need to zero fill, the data will be read over it */
+     nim->data = nifti_data_alloc_aligned(nifti_get_data_align(), ntot) ;
      if( nim->data == NULL ){
-        if( g_opts.debug > 0 )
+        if( NIFTI_OPTS.debug > 0 )
            fprintf(stderr,"** NIFTI: failed to alloc %d bytes for image data\n",
                    (int)ntot);
+        nifti_set_last_error(NIFTI_ERR_NOMEM);
         znzclose(fp);
         return -1;
      }
    }
 
-   /**- now that everything is set up, do the reading */
-   ii = nifti_read_buffer(fp,nim->data,ntot,nim);
+   /**- now that everything is set up, do the reading
+        (large uncompressed data may be read by several threads) */
+   nthreads = nifti_get_nthreads();
+   if( nthreads > 1 && ntot >= NIFTI_PAR_MIN_LOAD &&
+       ! nifti_is_gzfile(nim->iname) )
+      ii = nifti_pread_parallel(fp,znztell(fp),nim->data,ntot,nim,nthreads);
+   else
+      ii = nifti_pread_buffer(fp,znztell(fp),nim->data,ntot,nim);
    if( ii < ntot ){
+      nifti_set_last_error(NIFTI_ERR_READ);
       znzclose(fp) ;
-      free(nim->data) ;
+      nifti_data_free(nim->data) ;
       nim->data = NULL ;
-      return -1 ;  /* errors were printed in nifti_read_buffer() */
+      return -1 ;  /* errors were printed in nifti_pread_buffer() */
    }
 
    /**- close the file */
@@ -6793,1316 +8022,3170 @@ int nifti_image_load( nifti_image *nim )
 }
 
 
-/* 30 Nov 2004 [rickr]
-#undef  ERREX
-#define ERREX(msg)                                               \
- do{ fprintf(stderr,"** ERROR: nifti_read_buffer: %s\n",(msg)) ;  \
-     return 0; } while(0)
-*/
+/*----------------------------------------------------------------------
+ * list of image data pointers that are memory mapped, so that they are
+ * released with znzmunmap() rather than free()
+ *----------------------------------------------------------------------*/
+typedef struct nifti_mmap_ele {
+   void                  * data;     /* as returned by znzmmap()   */
+   size_t                  nbytes;   /* length passed to znzmmap() */
+   struct nifti_mmap_ele * next;
+} nifti_mmap_ele;
+
+static nifti_mmap_ele * g_mmap_list = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t  g_mmap_lock = PTHREAD_MUTEX_INITIALIZER;
+#define NIFTI_MMAP_LOCK()   pthread_mutex_lock(&g_mmap_lock)
+#define NIFTI_MMAP_UNLOCK() pthread_mutex_unlock(&g_mmap_lock)
+#else
+#define NIFTI_MMAP_LOCK()
+#define NIFTI_MMAP_UNLOCK()
+#endif
 
-/*----------------------------------------------------------------------*/
-/*! read ntot bytes of data from an open file and byte swaps if necessary
+/*----------------------------------------------------------------------
+ * nifti_image_load_mmap  - set nim->data to a mapping of the image data
+ *
+ * fp must be open and positioned at the start of the data.  Mapping is
+ * only possible for uncompressed files that do not need byte swapping.
+ * No bad float repair is done, the mapping shows the file contents.
+ *
+ * return 0 on success, 1 if the data cannot be mapped (so read it)
+ *----------------------------------------------------------------------*/
+static int nifti_image_load_mmap(nifti_image *nim, znzFile fp, int64_t ntot)
+{
+   nifti_mmap_ele * ele;
+   int64_t          ioff;
+   void           * data;
+   int              mode;
 
-   note that nifti_image is required for information on datatype, bsize
-   (for any needed byte swapping), etc.
+   if( ! znz_have_mmap() || ntot <= 0 || (int64_t)(size_t)ntot != ntot )
+      return 1;
 
-   This function does not allocate memory, so dataptr must be valid.
-*//*--------------------------------------------------------------------*/
-int64_t nifti_read_buffer(znzFile fp, void* dataptr, int64_t ntot,
-                                nifti_image *nim)
-{
-  int64_t ii;
+   if( nim->nifti_type == NIFTI_FTYPE_ASCII || nifti_is_gzfile(nim->iname) )
+      return 1;
 
-  if( dataptr == NULL ){
-     if( g_opts.debug > 0 )
-        fprintf(stderr,"** ERROR: nifti_read_buffer: NULL dataptr\n");
-     return -1;
-  }
+   if( nim->swapsize > 1 && nim->byteorder != nifti_short_order() ){
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"-d mmap: data needs swapping, reading instead\n");
+      return 1;
+   }
 
-  ii = znzread( dataptr , 1 , ntot , fp ) ;             /* data input */
+   ioff = znztell(fp);
+   if( ioff < 0 ) return 1;
 
-  /* if read was short, fail */
-  if( ii < ntot ){
-    if( g_opts.debug > 0 )
-       fprintf(stderr,"++ WARNING: nifti_read_buffer(%s):\n"
-               "   data bytes needed = %" PRId64 "\n"
-               "   data bytes input  = %" PRId64 "\n"
-               "   number missing    = %" PRId64 " (set to 0)\n",
-               nim->iname , ntot , ii , (ntot-ii) ) ;
-    /* memset( (char *)(dataptr)+ii , 0 , ntot-ii ) ;  now failure [rickr] */
-    return -1 ;
-  }
+   /* do not map beyond the end of the file (it would SIGBUS on access) */
+   if( nifti_get_filesize(nim->iname) < ioff + ntot ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** NIFTI: data file '%s' is short, not mapping\n",
+                 nim->iname);
+      return 1;
+   }
 
-  if( g_opts.debug > 2 )
-    fprintf(stderr,"+d nifti_read_buffer: read %" PRId64 " bytes\n", ii);
+   ele = (nifti_mmap_ele *)malloc(sizeof(nifti_mmap_ele));
+   if( !ele ){
+      fprintf(stderr,"** NIFTI: failed to alloc mmap list element\n");
+      return 1;
+   }
 
-  /* byte swap array if needed */
+   mode = (NIFTI_OPTS.mmap_data == NIFTI_MMAP_PRIVATE) ? ZNZ_MMAP_PRIVATE
+                                                   : ZNZ_MMAP_READONLY;
+   data = znzmmap(fp, (znz_off_t)ioff, (size_t)ntot, mode);
+   if( !data ){
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"-d mmap of '%s' failed, reading instead\n",
+                 nim->iname);
+      free(ele);
+      return 1;
+   }
 
-  /* ntot/swapsize might not fit as int, use int64_t    6 Jul 2010 [rickr] */
-  if( nim->swapsize > 1 && nim->byteorder != nifti_short_order() ) {
-    if( g_opts.debug > 1 )
-       fprintf(stderr,"+d nifti_read_buffer: swapping data bytes...\n");
-    nifti_swap_Nbytes( (int)(ntot / nim->swapsize), nim->swapsize , dataptr ) ;
-  }
+   ele->data   = data;
+   ele->nbytes = (size_t)ntot;
+   NIFTI_MMAP_LOCK();
+   ele->next   = g_mmap_list;
+   g_mmap_list = ele;
+   NIFTI_MMAP_UNLOCK();
 
-#ifdef isfinite
+   nim->data = data;
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d mapped %" PRId64 " bytes at offset %" PRId64
+              " of '%s'\n", ntot, ioff, nim->iname);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------
+ * nifti_mmap_release  - unmap data, if it was mapped by nifti_image_load
+ *
+ * return 1 if data was mapped (and is now released), else 0
+ *----------------------------------------------------------------------*/
+static int nifti_mmap_release(void *data)
 {
-  /* check input float arrays for goodness, and fix bad floats */
-  int fix_count = 0 ;
-
-  switch( nim->datatype ){
-
-    case NIFTI_TYPE_FLOAT32:
-    case NIFTI_TYPE_COMPLEX64:{
-        float *far = (float *)dataptr ; int64_t jj,nj ;
-        nj = ntot / sizeof(float) ;
-        for( jj=0 ; jj < nj ; jj++ )   /* count fixes 30 Nov 2004 [rickr] */
-           if( !IS_GOOD_FLOAT(far[jj]) ){
-              far[jj] = 0 ;
-              fix_count++ ;
-           }
-      }
-      break ;
+   nifti_mmap_ele ** prev, * ele = NULL;
 
-    case NIFTI_TYPE_FLOAT64:
-    case NIFTI_TYPE_COMPLEX128:{
-        double *far = (double *)dataptr ; int64_t jj,nj ;
-        nj = ntot / sizeof(double) ;
-        for( jj=0 ; jj < nj ; jj++ )   /* count fixes 30 Nov 2004 [rickr] */
-           if( !IS_GOOD_FLOAT(far[jj]) ){
-              far[jj] = 0 ;
-              fix_count++ ;
-           }
-      }
-      break ;
+   if( !data ) return 0;
 
+   NIFTI_MMAP_LOCK();
+   for( prev = &g_mmap_list; *prev; prev = &(*prev)->next ){
+      ele = *prev;
+      if( ele->data != data ) continue;
+      *prev = ele->next;
+      break;
+   }
+   NIFTI_MMAP_UNLOCK();
 
-  }
+   if( !ele || ele->data != data ) return 0;
 
-  if( g_opts.debug > 1 )
-     fprintf(stderr,"+d in image, %d bad floats were set to 0\n", fix_count);
-}
-#endif
+   if( znzmunmap(ele->data, ele->nbytes) != 0 )
+      fprintf(stderr,"** NIFTI: failed to unmap image data\n");
+   free(ele);
 
-  return ii;
+   return 1;
 }
 
-/*--------------------------------------------------------------------------*/
-/*! Unload the data in a nifti_image struct, but keep the metadata.
-*//*------------------------------------------------------------------------*/
-void nifti_image_unload( nifti_image *nim )
-{
-   if( nim != NULL && nim->data != NULL ){
-     free(nim->data) ; nim->data = NULL ;
-   }
-   }
 
-/*--------------------------------------------------------------------------*/
-/*! free 'everything' about a nifti_image struct (including the passed struct)
+/* 30 Nov 2004 [rickr]
+#undef  ERREX
+#define ERREX(msg)                                               \
+ do{ fprintf(stderr,"** ERROR: nifti_read_buffer: %s\n",(msg)) ;  \
+     return 0; } while(0)
+*/
 
-    free (only fields which are not NULL):
-      - fname and iname
-      - data
-      - any ext_list[i].edata
-      - ext_list
-      - nim
-*//*------------------------------------------------------------------------*/
-void nifti_image_free( nifti_image *nim )
-{
-   if( nim == NULL ) return ;
-   free(nim->fname) ;
-   free(nim->iname) ;
-   free(nim->data ) ;
-   (void)nifti_free_extensions( nim ) ;
-   free(nim) ; }
+/*---------------------------------------------------------------------------*/
+/* Vectorized checks for non-finite floats on x86_64.
 
+   A float is NaN or Inf exactly when all of its exponent bits are set,
+   so each kernel masks and compares the exponents of a vector of values,
+   counts the matches and (if zero is set) clears them.  The kernels check
+   whole vectors, adding to *nbad, and return the number of values done.
+-----------------------------------------------------------------------------*/
+#ifdef NIFTI_SIMD_X86
+
+static int64_t nifti_nonfinite_f32_sse2(float * far, int64_t n, int zero,
+                                        int64_t * nbad)
+{
+   const __m128i emask = _mm_set1_epi32(0x7f800000);
+   __m128i       v, bad;
+   int64_t       ii;
+   int           m;
+
+   for( ii = 0; ii + 4 <= n; ii += 4 ){
+      v   = _mm_loadu_si128((const __m128i *)(far + ii));
+      bad = _mm_cmpeq_epi32(_mm_and_si128(v, emask), emask);
+      m   = _mm_movemask_ps(_mm_castsi128_ps(bad));
+      if( m ){
+         *nbad += __builtin_popcount(m);
+         if( zero ) _mm_storeu_si128((__m128i *)(far + ii),
+                                     _mm_andnot_si128(bad, v));
+      }
+   }
 
-/*--------------------------------------------------------------------------*/
-/*! free the nifti extensions
+   return ii;
+}
 
-    - If any edata pointer is set in the extension list, free() it.
-    - Free ext_list, if it is set.
-    - Clear num_ext and ext_list from nim.
+static int64_t nifti_nonfinite_f64_sse2(double * dar, int64_t n, int zero,
+                                        int64_t * nbad)
+{
+   /* SSE2 has no 64-bit compare, but the exponent is in the high dword */
+   const __m128i emask = _mm_set1_epi64x(0x7ff0000000000000LL);
+   __m128i       v, bad;
+   int64_t       ii;
+   int           m;
 
-    \return 0 on success, -1 on error
+   for( ii = 0; ii + 2 <= n; ii += 2 ){
+      v   = _mm_loadu_si128((const __m128i *)(dar + ii));
+      bad = _mm_cmpeq_epi32(_mm_and_si128(v, emask), emask);
+      bad = _mm_shuffle_epi32(bad, _MM_SHUFFLE(3,3,1,1));
+      m   = _mm_movemask_pd(_mm_castsi128_pd(bad));
+      if( m ){
+         *nbad += __builtin_popcount(m);
+         if( zero ) _mm_storeu_si128((__m128i *)(dar + ii),
+                                     _mm_andnot_si128(bad, v));
+      }
+   }
 
-    \sa nifti_add_extension, nifti_copy_extensions
-*//*------------------------------------------------------------------------*/
-int nifti_free_extensions( nifti_image *nim )
+   return ii;
+}
+
+__attribute__((target("avx2")))
+static int64_t nifti_nonfinite_f32_avx2(float * far, int64_t n, int zero,
+                                        int64_t * nbad)
 {
-   int c ;
-   if( nim == NULL ) return -1;
-   if( nim->num_ext > 0 && nim->ext_list ){
-      for( c = 0; c < nim->num_ext; c++ )
-         free(nim->ext_list[c].edata);
-      free(nim->ext_list);
+   const __m256i emask = _mm256_set1_epi32(0x7f800000);
+   __m256i       v, bad;
+   int64_t       ii;
+   int           m;
+
+   for( ii = 0; ii + 8 <= n; ii += 8 ){
+      v   = _mm256_loadu_si256((const __m256i *)(far + ii));
+      bad = _mm256_cmpeq_epi32(_mm256_and_si256(v, emask), emask);
+      m   = _mm256_movemask_ps(_mm256_castsi256_ps(bad));
+      if( m ){
+         *nbad += __builtin_popcount(m);
+         if( zero ) _mm256_storeu_si256((__m256i *)(far + ii),
+                                        _mm256_andnot_si256(bad, v));
+      }
    }
-   /* or if it is inconsistent, warn the user (if we are not in quiet mode) */
-   else if ( (nim->num_ext > 0 || nim->ext_list != NULL) && (g_opts.debug > 0) )
-      fprintf(stderr,"** warning: nifti extension num/ptr mismatch (%d,%p)\n",
-              nim->num_ext, (void *)nim->ext_list);
 
-   if( g_opts.debug > 2 )
-      fprintf(stderr,"+d free'd %d extension(s)\n", nim->num_ext);
+   return ii;
+}
 
-   nim->num_ext = 0;
-   nim->ext_list = NULL;
+__attribute__((target("avx2")))
+static int64_t nifti_nonfinite_f64_avx2(double * dar, int64_t n, int zero,
+                                        int64_t * nbad)
+{
+   const __m256i emask = _mm256_set1_epi64x(0x7ff0000000000000LL);
+   __m256i       v, bad;
+   int64_t       ii;
+   int           m;
 
-   return 0;
-}
+   for( ii = 0; ii + 4 <= n; ii += 4 ){
+      v   = _mm256_loadu_si256((const __m256i *)(dar + ii));
+      bad = _mm256_cmpeq_epi64(_mm256_and_si256(v, emask), emask);
+      m   = _mm256_movemask_pd(_mm256_castsi256_pd(bad));
+      if( m ){
+         *nbad += __builtin_popcount(m);
+         if( zero ) _mm256_storeu_si256((__m256i *)(dar + ii),
+                                        _mm256_andnot_si256(bad, v));
+      }
+   }
 
+   return ii;
+}
 
-/*--------------------------------------------------------------------------*/
-/*! Print to stdout some info about a nifti_image struct.
-*//*------------------------------------------------------------------------*/
-void nifti_image_infodump( const nifti_image *nim )
+__attribute__((target("avx512f")))
+static int64_t nifti_nonfinite_f32_avx512(float * far, int64_t n, int zero,
+                                          int64_t * nbad)
 {
-   char *str = nifti_image_to_ascii( nim ) ;
-   /* stdout -> stderr   2 Dec 2004 [rickr] */
-   if( str != NULL ){ fputs(str,stderr) ; free(str) ; }
-   }
+   const __m512i emask = _mm512_set1_epi32(0x7f800000);
+   __m512i       v;
+   __mmask16     m;
+   int64_t       ii;
 
+   for( ii = 0; ii + 16 <= n; ii += 16 ){
+      v = _mm512_loadu_si512((const void *)(far + ii));
+      m = _mm512_cmpeq_epi32_mask(_mm512_and_si512(v, emask), emask);
+      if( m ){
+         *nbad += __builtin_popcount((unsigned)m);
+         if( zero ) _mm512_storeu_si512((void *)(far + ii),
+                          _mm512_mask_mov_epi32(v, m, _mm512_setzero_si512()));
+      }
+   }
 
-/*--------------------------------------------------------------------------
- * nifti_write_buffer just check for a null znzFile and call znzwrite
- *--------------------------------------------------------------------------*/
-/*! \fn int64_t nifti_write_buffer(znzFile fp, void *buffer, int64_t numbytes)
-    \brief write numbytes of buffer to file, fp
+   return ii;
+}
 
-    \param fp           File pointer (from znzopen) to gzippable nifti datafile
-    \param buffer       data buffer to be written
-    \param numbytes     number of bytes in buffer to write
-    \return number of bytes successfully written
-*/
-int64_t nifti_write_buffer(znzFile fp, const void *buffer, int64_t numbytes)
+__attribute__((target("avx512f")))
+static int64_t nifti_nonfinite_f64_avx512(double * dar, int64_t n, int zero,
+                                          int64_t * nbad)
 {
-   /* Write all the image data at once (no swapping here) */
-   int64_t ss;
-   if (znz_isnull(fp)){
-      fprintf(stderr,"** ERROR: nifti_write_buffer: null file pointer\n");
-      return 0;
+   const __m512i emask = _mm512_set1_epi64(0x7ff0000000000000LL);
+   __m512i       v;
+   __mmask8      m;
+   int64_t       ii;
+
+   for( ii = 0; ii + 8 <= n; ii += 8 ){
+      v = _mm512_loadu_si512((const void *)(dar + ii));
+      m = _mm512_cmpeq_epi64_mask(_mm512_and_si512(v, emask), emask);
+      if( m ){
+         *nbad += __builtin_popcount((unsigned)m);
+         if( zero ) _mm512_storeu_si512((void *)(dar + ii),
+                          _mm512_mask_mov_epi64(v, m, _mm512_setzero_si512()));
+      }
    }
-   ss = znzwrite( buffer , 1 , numbytes , fp ) ;
-   return ss;
-}
 
+   return ii;
+}
+#endif  /* NIFTI_SIMD_X86 */
 
 /*----------------------------------------------------------------------*/
-/*! write the nifti_image data to file (from nim->data or from NBL)
+/*! find non-finite (NaN or Inf) values in float data, and perhaps zero them
 
-   If NBL is not NULL, write the data from that structure.  Otherwise,
-   write it out from nim->data.  No swapping is done here.
+    Values are checked with vector instructions where possible.  This is
+    applied to data read from files, but may also be applied to data that
+    is already in memory, e.g.
 
-   \param  fp  : File pointer
-   \param  nim : nifti_image corresponding to the data
-   \param  NBL : optional source of write data (if NULL use nim->data)
+        nifti_fix_nonfinite(nim->data, nim->nvox, nim->datatype,
+                            NIFTI_NAN_ZERO);
 
-   \return 0 on success, -1 on failure
+    \param data     array of nvox values of the given datatype
+    \param nvox     number of values (a complex value counts once)
+    \param datatype NIFTI_TYPE_FLOAT32/64 or COMPLEX64/128 (others are
+                    ignored)
+    \param nan_mode NIFTI_NAN_ZERO to set non-finite values to 0,
+                    NIFTI_NAN_COUNT to only count them (NIFTI_NAN_KEEP
+                    does nothing)
 
-   Note: the nifti_image byte_order is set as that of the current CPU.
-         This is because such a conversion was made to the data upon
-         reading, while byte_order was not set (so the programs would
-         know what format the data was on disk).  Effectively, since
-         byte_order should match what is on disk, it should bet set to
-         that of the current CPU whenever new filenames are assigned.
+    \return the number of non-finite floats (real and imaginary parts
+            are counted separately), or -1 on bad input
 *//*--------------------------------------------------------------------*/
-int nifti_write_all_data(znzFile fp, nifti_image * nim,
-                         const nifti_brick_list * NBL)
+int64_t nifti_fix_nonfinite(void * data, int64_t nvox, int datatype,
+                            int nan_mode)
 {
-   int64_t ss, bnum;
+   int64_t nbad = 0, nvals, ii = 0;
+   int     zero = (nan_mode == NIFTI_NAN_ZERO);
 
-   if( !NBL ){ /* just write one buffer and get out of here */
-      if( nim->data == NULL ){
-         fprintf(stderr,"** NIFTI ERROR (NWAD): no image data to write\n");
-         return -1;
-      }
+   if( nvox <= 0 || nan_mode == NIFTI_NAN_KEEP ) return 0;
+   if( !data ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_fix_nonfinite: no data\n");
+      return -1;
+   }
 
-      ss = nifti_write_buffer(fp,nim->data,nim->nbyper * nim->nvox);
-      if (ss < nim->nbyper * nim->nvox){
-         fprintf(stderr,
-            "** NIFTI ERROR (NWAD): wrote only %" PRId64 " of %" PRId64
-            " bytes to file\n",
-            ss, nim->nbyper * nim->nvox);
-         return -1;
-      }
+   switch( datatype ){
 
-      if( g_opts.debug > 1 )
-         fprintf(stderr,"+d wrote single image of %" PRId64 " bytes\n", ss);
-   } else {
-      if( ! NBL->bricks || NBL->nbricks <= 0 || NBL->bsize <= 0 ){
-         fprintf(stderr,"** NIFTI error (NWAD): no brick data to write (%p,%"
-                        PRId64 ",%" PRId64 ")\n",
-                 (void *)NBL->bricks, NBL->nbricks, NBL->bsize);
-         return -1;
+     case NIFTI_TYPE_FLOAT32:
+     case NIFTI_TYPE_COMPLEX64:{
+        float * far = (float *)data;
+        nvals = (datatype == NIFTI_TYPE_COMPLEX64) ? 2*nvox : nvox;
+#ifdef NIFTI_SIMD_X86
+        if( __builtin_cpu_supports("avx512f") )
+           ii = nifti_nonfinite_f32_avx512(far, nvals, zero, &nbad);
+        else if( __builtin_cpu_supports("avx2") )
+           ii = nifti_nonfinite_f32_avx2(far, nvals, zero, &nbad);
+        else
+           ii = nifti_nonfinite_f32_sse2(far, nvals, zero, &nbad);
+#endif
+        for( ; ii < nvals ; ii++ )     /* count fixes 30 Nov 2004 [rickr] */
+           if( !IS_GOOD_FLOAT(far[ii]) ){
+              if( zero ) far[ii] = 0 ;
+              nbad++ ;
+           }
       }
+      break ;
 
-      for( bnum = 0; bnum < NBL->nbricks; bnum++ ){
-         ss = nifti_write_buffer(fp, NBL->bricks[bnum], NBL->bsize);
-         if( ss < NBL->bsize ){
-            fprintf(stderr,
-            "** NIFTI ERROR (NWAD): wrote only %" PRId64 " of %" PRId64
-            " bytes of brick %" PRId64 " of %" PRId64 " to file\n",
-            ss, NBL->bsize, bnum+1, NBL->nbricks);
-            return -1;
-         }
+     case NIFTI_TYPE_FLOAT64:
+     case NIFTI_TYPE_COMPLEX128:{
+        double * dar = (double *)data;
+        nvals = (datatype == NIFTI_TYPE_COMPLEX128) ? 2*nvox : nvox;
+#ifdef NIFTI_SIMD_X86
+        if( __builtin_cpu_supports("avx512f") )
+           ii = nifti_nonfinite_f64_avx512(dar, nvals, zero, &nbad);
+        else if( __builtin_cpu_supports("avx2") )
+           ii = nifti_nonfinite_f64_avx2(dar, nvals, zero, &nbad);
+        else
+           ii = nifti_nonfinite_f64_sse2(dar, nvals, zero, &nbad);
+#endif
+        for( ; ii < nvals ; ii++ )
+           if( !IS_GOOD_FLOAT(dar[ii]) ){
+              if( zero ) dar[ii] = 0 ;
+              nbad++ ;
+           }
       }
-      if( g_opts.debug > 1 )
-         fprintf(stderr,"+d wrote image of %" PRId64
-                 " brick(s), each of %" PRId64 " bytes\n",
-                 NBL->nbricks, NBL->bsize);
+      break ;
    }
 
-   /* mark as being in this CPU byte order */
-   nim->byteorder = nifti_short_order() ;
+   return nbad;
+}
 
-   return 0;
+/*----------------------------------------------------------------------
+ * nifti_fix_read_buffer  - byte swap and check floats in read data
+ *
+ * (applied to each block by nifti_read_blocks)
+ *
+ * Bad (non-finite) floats are handled according to nan_mode, and the
+ * number of them is returned (always 0 for NIFTI_NAN_KEEP).
+ *----------------------------------------------------------------------*/
+static int64_t nifti_fix_read_buffer(void * dataptr, int64_t ntot,
+                                     const nifti_image * nim, int nan_mode)
+{
+  int64_t fix_count = 0 ;
+
+  /* byte swap array if needed */
+
+  /* ntot/swapsize might not fit as int, use int64_t    6 Jul 2010 [rickr] */
+  /* (and do not cast it to int, either)                16 Oct 2026       */
+  if( nim->swapsize > 1 && nim->byteorder != nifti_short_order() )
+    nifti_swap_Nbytes( ntot / nim->swapsize, nim->swapsize , dataptr ) ;
+
+  /* check input float arrays for goodness, and fix bad floats */
+  if( nim->nbyper > 0 )
+     fix_count = nifti_fix_nonfinite(dataptr, ntot / nim->nbyper,
+                                     nim->datatype, nan_mode) ;
+
+  return fix_count ;
 }
 
-/* return number of extensions written, or -1 on error */
-static int nifti_write_extensions(znzFile fp, nifti_image *nim)
+/*----------------------------------------------------------------------
+ * nifti_read_blocks  - read, swap and check data, a block at a time
+ *
+ * Uncompressed data is read in NIFTI_READ_BLOCK pieces, each of which is
+ * swapped and checked while still in cache, so the data only passes
+ * through memory once.  Compressed data is read at once (so that it may
+ * be decompressed in parallel), and then processed in blocks.
+ *
+ * Read at offset with znzpread(), or at the current position if offset
+ * is negative.  Add the number of bad floats to *nbad.
+ *
+ * return the number of bytes read (short only on failure)
+ *----------------------------------------------------------------------*/
+static int64_t nifti_read_blocks(znzFile fp, int64_t offset, char * data,
+                                 int64_t ntot, const nifti_image * nim,
+                                 int nan_mode, int64_t * nbad)
 {
-   nifti1_extension * list;
-   char               extdr[4] = { 0, 0, 0, 0 };
-   int                c, size, ok;
+   int64_t done = 0, nread, nbytes, posn, bsize;
 
-   if( znz_isnull(fp) || !nim || nim->num_ext < 0 ){
-      if( g_opts.debug > 0 )
-         fprintf(stderr,"** nifti_write_extensions, bad params\n");
-      return -1;
-   }
+   bsize = znz_iscompressed(fp) ? ntot : NIFTI_READ_BLOCK;
 
-   /* if no extensions and user requests it, skip extender */
-   if( g_opts.skip_blank_ext && (nim->num_ext == 0 || ! nim->ext_list ) ){
-      if( g_opts.debug > 1 )
-         fprintf(stderr,"-d no exts and skip_blank_ext set, "
-                        "so skipping 4-byte extender\n");
-      return 0;
-   }
+   while( done < ntot ){
+      nbytes = ntot - done;
+      if( nbytes > bsize ) nbytes = bsize;
 
-   /* if invalid extension list, clear num_ext */
-   if( ! valid_nifti_extensions(nim) ) nim->num_ext = 0;
+      if( offset < 0 )
+         nread = (int64_t)znzread(data + done, 1, (size_t)nbytes, fp);
+      else
+         nread = (int64_t)znzpread(fp, data + done, (size_t)nbytes,
+                                   (znz_off_t)(offset + done));
+      if( nread < nbytes ) return done + (nread > 0 ? nread : 0);
 
-   /* write out extender block */
-   if( nim->num_ext > 0 ) extdr[0] = 1;
-   if( nifti_write_buffer(fp, extdr, 4) != 4 ){
-      fprintf(stderr,"** NIFTI ERROR: failed to write extender\n");
-      return -1;
+      for( posn = done; posn < done + nbytes; posn += NIFTI_READ_BLOCK )
+         *nbad += nifti_fix_read_buffer(data + posn,
+                     (done + nbytes - posn < NIFTI_READ_BLOCK) ?
+                        done + nbytes - posn : NIFTI_READ_BLOCK,
+                     nim, nan_mode);
+
+      done += nbytes;
    }
 
-   list = nim->ext_list;
-   for ( c = 0; c < nim->num_ext; c++ ){
-      size = (int)nifti_write_buffer(fp, &list->esize, sizeof(int));
-      ok = (size == (int)sizeof(int));
-      if( ok ){
-         size = (int)nifti_write_buffer(fp, &list->ecode, sizeof(int));
-         ok = (size == (int)sizeof(int));
-      }
-      if( ok ){
-         size = (int)nifti_write_buffer(fp, list->edata, list->esize - 8);
-         ok = (size == list->esize - 8);
-      }
+   return done;
+}
 
-      if( !ok ){
-         fprintf(stderr,"** NIFTI: failed while writing extension #%d\n",c);
-         return -1;
-      } else if ( g_opts.debug > 2 )
-         fprintf(stderr,"+d wrote extension %d of %d bytes\n", c, size);
+/*----------------------------------------------------------------------*/
+/*! read ntot bytes of data from an open file and byte swaps if necessary
 
-      list++;
-   }
+   note that nifti_image is required for information on datatype, bsize
+   (for any needed byte swapping), etc.
 
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"+d wrote out %d extension(s)\n", nim->num_ext);
+   This function does not allocate memory, so dataptr must be valid.
 
-   return nim->num_ext;
+   Bad floats are set to 0.  To handle them otherwise, or to read at a
+   given offset, use nifti_read_buffer2().
+*//*--------------------------------------------------------------------*/
+int64_t nifti_read_buffer(znzFile fp, void* dataptr, int64_t ntot,
+                                nifti_image *nim)
+{
+  return nifti_read_buffer2(fp, -1, dataptr, ntot, nim, NIFTI_NAN_ZERO, NULL);
 }
 
-
 /*----------------------------------------------------------------------*/
-/*! basic initialization of a nifti_image struct (to a 1x1x1 image)
+/*! read ntot bytes of data at the given file offset, and byte swap if needed
+
+   This is like nifti_read_buffer(), but the data is read with znzpread(),
+   so the file position is neither used nor changed.  Several threads may
+   then read from the same open file at once.
+
+   This function does not allocate memory, so dataptr must be valid.
+
+   \return the number of bytes read (ntot), or -1 on failure
+   \sa nifti_read_buffer, nifti_read_buffer2, znzpread
 *//*--------------------------------------------------------------------*/
-nifti_image* nifti_simple_init_nim(void)
+int64_t nifti_pread_buffer(znzFile fp, int64_t offset, void* dataptr,
+                           int64_t ntot, nifti_image *nim)
 {
-   nifti_image *nim;
-   nifti_2_header nhdr;
-   int nbyper, swapsize;
+  if( offset < 0 ){
+     if( NIFTI_OPTS.debug > 0 )
+        fprintf(stderr,"** ERROR: nifti_pread_buffer: bad offset %" PRId64
+                "\n", offset);
+     return -1;
+  }
 
-   memset(&nhdr,0,sizeof(nhdr)) ;  /* zero out header, to be safe */
+  return nifti_read_buffer2(fp, offset, dataptr, ntot, nim, NIFTI_NAN_ZERO,
+                            NULL);
+}
 
-   nhdr.sizeof_hdr = sizeof(nhdr) ;
+/*----------------------------------------------------------------------*/
+/*! read ntot bytes of data, byte swap and check for bad floats
+
+   The data is read, swapped and checked a block at a time, while each
+   block is in cache, rather than in three passes over the whole buffer.
+
+   \param fp       open file to read from
+   \param offset   file offset to read at (as with nifti_pread_buffer),
+                   or -1 to read at the current position
+   \param dataptr  (allocated) location to store the data
+   \param ntot     number of bytes to read
+   \param nim      image that the data belongs to (for datatype and
+                   byte order)
+   \param nan_mode what to do with non-finite float values:
+                     - NIFTI_NAN_ZERO  : set them to 0 (as nifti_read_buffer)
+                     - NIFTI_NAN_KEEP  : leave them, and do not look
+                     - NIFTI_NAN_COUNT : leave them, but count them
+   \param nbad     if set, return the number of non-finite values here
+
+   \return the number of bytes read (ntot), or -1 on failure
+   \sa nifti_read_buffer, nifti_pread_buffer
+*//*--------------------------------------------------------------------*/
+int64_t nifti_read_buffer2(znzFile fp, int64_t offset, void* dataptr,
+                           int64_t ntot, nifti_image *nim, int nan_mode,
+                           int64_t *nbad)
+{
+  int64_t ii, nfix = 0;
 
-   nhdr.dim[0] = 3 ;
-   nhdr.dim[1] = 1 ; nhdr.dim[2] = 1 ; nhdr.dim[3] = 1 ;
-   nhdr.dim[4] = 0 ;
+  if( nbad ) *nbad = 0;
 
-   nhdr.pixdim[0] = 0.0 ;
-   nhdr.pixdim[1] = 1.0 ; nhdr.pixdim[2] = 1.0 ; nhdr.pixdim[3] = 1.0 ;
+  if( dataptr == NULL ){
+     if( NIFTI_OPTS.debug > 0 )
+        fprintf(stderr,"** ERROR: nifti_read_buffer: NULL dataptr\n");
+     return -1;
+  }
 
-   nhdr.datatype = DT_FLOAT32 ;
-   nifti_datatype_sizes( nhdr.datatype , &nbyper, &swapsize );
-   nhdr.bitpix   = 8 * nbyper ;
+  if( NIFTI_OPTS.debug > 1 && nim->swapsize > 1 &&
+      nim->byteorder != nifti_short_order() )
+     fprintf(stderr,"+d nifti_read_buffer: swapping data bytes...\n");
 
-   memcpy(nhdr.magic, nifti2_magic, 8);  /* init to single file */
+  ii = nifti_read_blocks(fp, offset, (char *)dataptr, ntot, nim, nan_mode,
+                         &nfix);
 
-   nim = nifti_convert_n2hdr2nim(nhdr,NULL);
-   nim->fname = NULL;
-   nim->iname = NULL;
-   return nim;
-}
+  /* if read was short, fail */
+  if( ii < ntot ){
+    if( NIFTI_OPTS.debug > 0 )
+       fprintf(stderr,"++ WARNING: nifti_read_buffer(%s):\n"
+               "   data offset       = %" PRId64 "\n"
+               "   data bytes needed = %" PRId64 "\n"
+               "   data bytes input  = %" PRId64 "\n"
+               "   number missing    = %" PRId64 "\n",
+               nim->iname , offset , ntot , ii , (ntot-ii) ) ;
+    /* memset( (char *)(dataptr)+ii , 0 , ntot-ii ) ;  now failure [rickr] */
+    return -1 ;
+  }
 
+  if( NIFTI_OPTS.debug > 2 )
+    fprintf(stderr,"+d nifti_read_buffer: read %" PRId64 " bytes\n", ii);
 
-/*----------------------------------------------------------------------*/
-/*! basic initialization of a nifti_2_header struct (with given dimensions)
+#ifdef isfinite
+  if( NIFTI_OPTS.debug > 1 && nan_mode != NIFTI_NAN_KEEP )
+     fprintf(stderr,"+d in image, %" PRId64 " bad floats were %s\n", nfix,
+             nan_mode == NIFTI_NAN_COUNT ? "found" : "set to 0");
+#endif
 
-   Return an allocated nifti_2_header struct, based on the given
-   dimensions and datatype.
+  if( nbad ) *nbad = nfix;
 
-   \param arg_dims  : optional dim[8] array (default {3,1,1,1,0,0,0,0})
-   \param arg_dtype : optional datatype (default DT_FLOAT32)
+  return ii;
+}
 
-   \return pointer to allocated nifti_2_header struct
-*//*--------------------------------------------------------------------*/
-nifti_2_header * nifti_make_new_n2_header(const int64_t arg_dims[],
-                                          int arg_dtype)
-{
-   nifti_2_header * nhdr;
-   const int64_t    default_dims[8] = { 3, 1, 1, 1, 0, 0, 0, 0 };
-   const int64_t  * dim;  /* either passed or default dims  */
-   int              dtype; /* either passed or default dtype */
-   int              c, nbyper, swapsize;
+/*----------------------------------------------------------------------
+ * parallel loading of large, uncompressed image data
+ *
+ * The data is split into NIFTI_PAR_CHUNK byte chunks, which the threads
+ * take in turn.  Each chunk is read with nifti_read_blocks(), so it is
+ * swapped and fixed while still in cache.
+ *----------------------------------------------------------------------*/
+#ifdef HAVE_PTHREAD
+typedef struct {
+   znzFile             fp;
+   int64_t             offset;   /* file offset of the data   */
+   char              * data;
+   int64_t             ntot;
+   const nifti_image * nim;
+   nifti_context     * ctx;      /* context of the caller     */
+   pthread_mutex_t     lock;     /* for the fields below      */
+   int64_t             next;     /* next chunk to be read     */
+   int64_t             nchunks;
+   int64_t             nfixed;   /* bad floats that were set 0 */
+   int                 failed;
+} nifti_par_load;
+
+static void * nifti_par_load_worker(void * arg)
+{
+   nifti_par_load * job = (nifti_par_load *)arg;
+   int64_t          c, posn, nbytes, nread, nfixed;
+
+   g_cur_ctx = job->ctx;
+
+   while( 1 ){
+      pthread_mutex_lock(&job->lock);
+      c = job->failed ? job->nchunks : job->next++;
+      pthread_mutex_unlock(&job->lock);
+      if( c >= job->nchunks ) break;
+
+      posn   = c * NIFTI_PAR_CHUNK;
+      nbytes = job->ntot - posn;
+      if( nbytes > NIFTI_PAR_CHUNK ) nbytes = NIFTI_PAR_CHUNK;
+
+      nfixed = 0;
+      nread  = nifti_read_blocks(job->fp, job->offset + posn,
+                                 job->data + posn, nbytes, job->nim,
+                                 NIFTI_NAN_ZERO, &nfixed);
+
+      pthread_mutex_lock(&job->lock);
+      if( nread != nbytes ) job->failed = 1;
+      else                  job->nfixed += nfixed;
+      pthread_mutex_unlock(&job->lock);
+   }
 
-   /* if arg_dims is passed, apply it */
-   if( arg_dims ) dim = arg_dims;
-   else           dim = default_dims;
+   return NULL;
+}
+#endif
 
-   /* validate dim: if there is any problem, apply default_dims */
-   if( dim[0] < 1 || dim[0] > 7 ) {
-      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dim[0]=%" PRId64 "\n",
-              dim[0]);
-      dim = default_dims;
-   } else {
-      for( c = 1; c <= dim[0]; c++ )
-         if( dim[c] < 1 )
-         {
-            fprintf(stderr,
-                "** nifti_simple_hdr_with_dims: bad dim[%d]=%" PRId64 "\n",
-                c, dim[c]);
-            dim = default_dims;
-            break;
-         }
+/*----------------------------------------------------------------------
+ * nifti_pread_parallel  - read ntot bytes at offset using nthreads
+ *
+ * This is nifti_pread_buffer(), split over threads.
+ *
+ * return ntot on success, -1 on failure
+ *----------------------------------------------------------------------*/
+static int64_t nifti_pread_parallel(znzFile fp, int64_t offset, void * data,
+                                    int64_t ntot, nifti_image * nim,
+                                    int nthreads)
+{
+#ifdef HAVE_PTHREAD
+   nifti_par_load   job;
+   pthread_t      * tids;
+   int              c, nstarted = 0;
+
+   job.fp      = fp;
+   job.offset  = offset;
+   job.data    = (char *)data;
+   job.ntot    = ntot;
+   job.nim     = nim;
+   job.next    = 0;
+   job.nchunks = (ntot + NIFTI_PAR_CHUNK - 1) / NIFTI_PAR_CHUNK;
+   job.nfixed  = 0;
+   job.failed  = 0;
+
+   if( nthreads > job.nchunks ) nthreads = (int)job.nchunks;
+   tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+   if( nthreads < 2 || !tids ){
+      free(tids);
+      return nifti_pread_buffer(fp, offset, data, ntot, nim);
+   }
+
+   job.ctx = g_cur_ctx;
+   pthread_mutex_init(&job.lock, NULL);
+
+   /* this thread is one of the workers */
+   for( c = 1; c < nthreads; c++ )
+      if( pthread_create(tids + nstarted, NULL, nifti_par_load_worker,
+                         &job) == 0 )
+         nstarted++;
+   nifti_par_load_worker(&job);
+   for( c = 0; c < nstarted; c++ )
+      pthread_join(tids[c], NULL);
+
+   pthread_mutex_destroy(&job.lock);
+   free(tids);
+
+   if( job.failed ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** NIFTI: failed parallel read of %" PRId64
+                 " bytes from '%s'\n", ntot, nim->iname);
+      return -1;
    }
 
-   /* validate dtype, too */
-   dtype = arg_dtype;
-   if( ! nifti_is_valid_datatype(dtype) ) {
-      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dtype %d\n",dtype);
-      dtype = DT_FLOAT32;
+   if( NIFTI_OPTS.debug > 1 ){
+      fprintf(stderr,"+d read %" PRId64 " chunks of data using %d threads\n",
+              job.nchunks, nstarted + 1);
+#ifdef isfinite
+      fprintf(stderr,"+d in image, %" PRId64 " bad floats were set to 0\n",
+              job.nfixed);
+#endif
    }
 
-   /* now populate the header struct */
+   return ntot;
+#else
+   (void)nthreads;
+   return nifti_pread_buffer(fp, offset, data, ntot, nim);
+#endif
+}
 
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"+d make_new_n2_header, dim[0] = %" PRId64
-              ", datatype = %d\n",
-              dim[0], dtype);
+/*----------------------------------------------------------------------
+ * conversion of image values to float or double, with optional scaling
+ *
+ * NIFTI_CONVERT_LOOP converts n values of type stype at src into
+ * dtype at dst, as v*slope+inter.  The loops are simple enough for the
+ * compiler to vectorize, and the common int16 and uint8 to float32 cases
+ * also have AVX2 kernels (widen, convert, then FMA).
+ *----------------------------------------------------------------------*/
+#define NIFTI_CONVERT_LOOP(stype, dtype, src, dst, n, slope, inter)      \
+   do { const stype * sp = (const stype *)(src);                         \
+        dtype * dp = (dtype *)(dst); int64_t jj;                         \
+        for( jj = 0; jj < (n); jj++ )                                    \
+           dp[jj] = (dtype)(sp[jj] * (slope) + (inter)); } while(0)
+
+#define NIFTI_CONVERT_SRC(dtype, stype_code, src, dst, n, slope, inter)   \
+   switch( stype_code ){                                                 \
+     case NIFTI_TYPE_UINT8:                                              \
+       NIFTI_CONVERT_LOOP(unsigned char, dtype, src,dst,n,slope,inter);  \
+       break;                                                            \
+     case NIFTI_TYPE_INT8:                                               \
+       NIFTI_CONVERT_LOOP(signed char, dtype, src,dst,n,slope,inter);    \
+       break;                                                            \
+     case NIFTI_TYPE_INT16:                                              \
+       NIFTI_CONVERT_LOOP(short, dtype, src,dst,n,slope,inter); break;   \
+     case NIFTI_TYPE_UINT16:                                             \
+       NIFTI_CONVERT_LOOP(unsigned short, dtype, src,dst,n,slope,inter); \
+       break;                                                            \
+     case NIFTI_TYPE_INT32:                                              \
+       NIFTI_CONVERT_LOOP(int, dtype, src,dst,n,slope,inter); break;     \
+     case NIFTI_TYPE_UINT32:                                             \
+       NIFTI_CONVERT_LOOP(unsigned int, dtype, src,dst,n,slope,inter);   \
+       break;                                                            \
+     case NIFTI_TYPE_INT64:                                              \
+       NIFTI_CONVERT_LOOP(int64_t, dtype, src,dst,n,slope,inter); break; \
+     case NIFTI_TYPE_UINT64:                                             \
+       NIFTI_CONVERT_LOOP(uint64_t, dtype, src,dst,n,slope,inter); break;\
+     case NIFTI_TYPE_FLOAT32:                                            \
+       NIFTI_CONVERT_LOOP(float, dtype, src,dst,n,slope,inter); break;   \
+     case NIFTI_TYPE_FLOAT64:                                            \
+       NIFTI_CONVERT_LOOP(double, dtype, src,dst,n,slope,inter); break;  \
+   }
+
+#ifdef NIFTI_SIMD_X86
+/* int16 or uint8 to float32, as v*slope+inter: return number converted */
+__attribute__((target("avx2,fma")))
+static int64_t nifti_convert_avx2(const void * src, int stype, float * dst,
+                                  int64_t n, float slope, float inter)
+{
+   const __m256 vs = _mm256_set1_ps(slope), vi = _mm256_set1_ps(inter);
+   __m256i      iv;
+   int64_t      ii;
 
-   nhdr = (nifti_2_header *)calloc(1,sizeof(nifti_2_header));
-   if( !nhdr ){
-      fprintf(stderr,"** NIFTI make_new_n2_header: failed to alloc hdr\n");
-      return NULL;
+   for( ii = 0; ii + 8 <= n; ii += 8 ){
+      if( stype == NIFTI_TYPE_INT16 )
+         iv = _mm256_cvtepi16_epi32(
+                 _mm_loadu_si128((const __m128i *)((const short *)src + ii)));
+      else
+         iv = _mm256_cvtepu8_epi32(
+                 _mm_loadl_epi64((const __m128i *)
+                                 ((const unsigned char *)src + ii)));
+      _mm256_storeu_ps(dst + ii,
+                       _mm256_fmadd_ps(_mm256_cvtepi32_ps(iv), vs, vi));
    }
 
-   nhdr->sizeof_hdr = sizeof(nifti_2_header) ;
+   return ii;
+}
+#endif
 
-   /* init dim and pixdim */
-   nhdr->dim[0] = dim[0];
-   nhdr->pixdim[0] = 0.0;
-   for( c = 1; c <= dim[0]; c++ ) {
-      nhdr->dim[c] = dim[c];
-      nhdr->pixdim[c] = 1.0;
+/* return whether nifti_convert_vals() handles the source type */
+static int nifti_can_convert(int stype)
+{
+   switch( stype ){
+      case NIFTI_TYPE_UINT8:   case NIFTI_TYPE_INT8:
+      case NIFTI_TYPE_INT16:   case NIFTI_TYPE_UINT16:
+      case NIFTI_TYPE_INT32:   case NIFTI_TYPE_UINT32:
+      case NIFTI_TYPE_INT64:   case NIFTI_TYPE_UINT64:
+      case NIFTI_TYPE_FLOAT32: case NIFTI_TYPE_FLOAT64:
+         return 1;
    }
+   return 0;
+}
 
-   nhdr->datatype = dtype ;
-   nifti_datatype_sizes( nhdr->datatype , &nbyper, &swapsize );
-   nhdr->bitpix   = 8 * nbyper ;
-
-   memcpy(nhdr->magic, nifti2_magic, 8);  /* init to single file */
-
-   return nhdr;
+/*----------------------------------------------------------------------
+ * nifti_convert_vals  - convert n values from stype to dtype (FLOAT32/64)
+ *
+ * (stype must be valid for nifti_can_convert)
+ *----------------------------------------------------------------------*/
+static void nifti_convert_vals(const void * src, int stype, void * dst,
+                               int dtype, int64_t n, double slope,
+                               double inter)
+{
+   if( dtype == NIFTI_TYPE_FLOAT32 ){
+      float   fslope = (float)slope, finter = (float)inter;
+      int64_t done = 0;
+#ifdef NIFTI_SIMD_X86
+      if( n > 0 && (stype == NIFTI_TYPE_INT16 || stype == NIFTI_TYPE_UINT8) &&
+          __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") )
+         done = nifti_convert_avx2(src, stype, (float *)dst, n, fslope,
+                                   finter);
+#endif
+      /* only int16 and uint8 data get here with done > 0 */
+      src = (const char *)src + done * (stype == NIFTI_TYPE_INT16 ? 2 : 1);
+      dst = (float *)dst + done;
+      n  -= done;
+      if( stype == NIFTI_TYPE_INT64 || stype == NIFTI_TYPE_UINT64 ||
+          stype == NIFTI_TYPE_INT32 || stype == NIFTI_TYPE_UINT32 ||
+          stype == NIFTI_TYPE_FLOAT64 ) {
+         /* compute wide values in double precision */
+         NIFTI_CONVERT_SRC(float, stype, src, dst, n, slope, inter)
+      } else {
+         NIFTI_CONVERT_SRC(float, stype, src, dst, n, fslope, finter)
+      }
+   } else {
+      NIFTI_CONVERT_SRC(double, stype, src, dst, n, slope, inter)
+   }
 }
 
+#undef NIFTI_CONVERT_SRC
+#undef NIFTI_CONVERT_LOOP
 
 /*----------------------------------------------------------------------*/
-/*! basic initialization of a nifti_1_header struct (with given dimensions)
-
-   Return an allocated nifti_1_header struct, based on the given
-   dimensions and datatype.
+/*! load the image data as float or double, converting while reading
 
-   \param arg_dims  : optional dim[8] array (default {3,1,1,1,0,0,0,0})
-   \param arg_dtype : optional datatype (default DT_FLOAT32)
+    The data of nim is read a block at a time, and each block is swapped,
+    checked for non-finite floats (set to 0), scaled (if requested) and
+    converted into the output buffer.  This avoids keeping a copy of the
+    data in the file type.  If nim->data is already loaded, it is just
+    converted.
 
-   \return pointer to allocated nifti_1_header struct
-*//*--------------------------------------------------------------------*/
-nifti_1_header * nifti_make_new_n1_header(const int64_t arg_dims[],
-                                          int arg_dtype)
-{
-   nifti_1_header * nhdr;
-   const int64_t    default_dims[8] = { 3, 1, 1, 1, 0, 0, 0, 0 };
-   const int64_t  * dim;  /* either passed or default dims  */
-   int              dtype; /* either passed or default dtype */
-   int              c, nbyper, swapsize;
+    \param nim      image to read (nim->data is not altered)
+    \param datatype NIFTI_TYPE_FLOAT32 or NIFTI_TYPE_FLOAT64
+    \param apply_scaling if set, and scl_slope is non-zero, values are
+                    computed as v*scl_slope + scl_inter
+    \param data     if *data is set, it should have room for nim->nvox
+                    values of datatype; otherwise it is allocated (to be
+                    freed by the caller)
 
-   /* if arg_dims is passed, apply it */
-   if( arg_dims ) dim = arg_dims;
-   else           dim = default_dims;
+    Complex and RGB data are not handled.
 
-   /* validate dim: if there is any problem, apply default_dims */
-   if( dim[0] < 1 || dim[0] > 7 ) {
-      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dim[0]=%" PRId64 "\n",
-              dim[0]);
-      dim = default_dims;
-   } else {
-      for( c = 1; c <= dim[0]; c++ )
-         if( dim[c] < 1 )
-         {
-            fprintf(stderr,
-                "** nifti_simple_hdr_with_dims: bad dim[%d]=%" PRId64 "\n",                     c, dim[c]);
-            dim = default_dims;
-            break;
-         }
+    \return 0 on success, -1 on failure
+    \sa nifti_image_load, nifti_read_buffer2
+*//*--------------------------------------------------------------------*/
+int nifti_image_load_as( nifti_image * nim, int datatype, int apply_scaling,
+                         void ** data )
+{
+   znzFile  fp;
+   char   * sbuf = NULL, * dst;
+   int64_t  ntot, offset, bsize, done, nbytes, nbad;
+   double   slope = 1.0, inter = 0.0;
+   int      dsize, alloced = 0, rv = 0;
+
+   if( !nim || !data ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_image_load_as: missing nim or data\n");
+      return -1;
    }
-
-   /* validate dtype, too */
-   dtype = arg_dtype;
-   if( ! nifti_is_valid_datatype(dtype) ) {
-      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dtype %d\n",dtype);
-      dtype = DT_FLOAT32;
+   if( datatype != NIFTI_TYPE_FLOAT32 && datatype != NIFTI_TYPE_FLOAT64 ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_image_load_as: bad output type %s\n",
+                 nifti_datatype_to_string(datatype));
+      return -1;
+   }
+   if( ! nifti_can_convert(nim->datatype) ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_image_load_as: cannot convert from %s\n",
+                 nifti_datatype_to_string(nim->datatype));
+      return -1;
    }
 
-   /* now populate the header struct */
+   if( apply_scaling && nim->scl_slope != 0.0 ){
+      slope = nim->scl_slope;
+      inter = nim->scl_inter;
+   }
 
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"+d make_new_n1_header, dim[0] = %" PRId64
-              ", datatype = %d\n",
-              dim[0], dtype);
+   dsize = (datatype == NIFTI_TYPE_FLOAT32) ? 4 : 8;
+   if( ! *data ){
+      *data = nifti_data_alloc_aligned(nifti_get_data_align(),
+                                       (size_t)(nim->nvox * dsize));
+      if( ! *data ){
+         fprintf(stderr,"** nifti_image_load_as: failed to alloc %" PRId64
+                 " values\n", nim->nvox);
+         return -1;
+      }
+      alloced = 1;
+   }
+   dst = (char *)*data;
 
-   nhdr = (nifti_1_header *)calloc(1,sizeof(nifti_1_header));
-   if( !nhdr ){
-      fprintf(stderr,"** NIFTI make_new_n1_header: failed to alloc hdr\n");
-      return NULL;
+   /* data already in memory only needs conversion */
+   if( nim->data ){
+      nifti_convert_vals(nim->data, nim->datatype, dst, datatype, nim->nvox,
+                         slope, inter);
+      return 0;
    }
 
-   nhdr->sizeof_hdr = sizeof(nifti_1_header) ;
-   nhdr->regular    = 'r' ;           /* for some stupid reason */
+   fp = nifti_image_load_prep( nim );
+   if( fp == NULL ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_image_load_as, failed load_prep\n");
+      if( alloced ){ nifti_data_free(*data); *data = NULL; }
+      return -1;
+   }
+   ntot   = nifti_get_volsize(nim);
+   offset = znztell(fp);
 
-   /* init dim and pixdim */
-   nhdr->dim[0] = (int)dim[0]; /* rcr n2 - check dim sizes for nifti-1 */
-                               /* (verify vals are < 2^15) */
-   nhdr->pixdim[0] = 0.0F;
-   for( c = 1; c <= dim[0]; c++ ) {
-      nhdr->dim[c] = (int)dim[c];
-      nhdr->pixdim[c] = 1.0F;
+   /* read a block of whole values at a time (larger for compressed data,
+      so that it may be decompressed in parallel) */
+   bsize = znz_iscompressed(fp) ? NIFTI_PAR_CHUNK * 4 : NIFTI_READ_BLOCK;
+   bsize -= bsize % nim->nbyper;
+   if( bsize > ntot ) bsize = ntot;
+   sbuf = (char *)malloc((size_t)bsize);
+   if( !sbuf ){
+      fprintf(stderr,"** nifti_image_load_as: failed to alloc buffer\n");
+      rv = -1;
+   }
+
+   for( done = 0; rv == 0 && done < ntot; done += nbytes ){
+      nbytes = ntot - done;
+      if( nbytes > bsize ) nbytes = bsize;
+      nbad = 0;
+      if( nifti_read_blocks(fp, offset + done, sbuf, nbytes, nim,
+                            NIFTI_NAN_ZERO, &nbad) != nbytes ){
+         if( NIFTI_OPTS.debug > 0 )
+            fprintf(stderr,"** nifti_image_load_as: failed to read %" PRId64
+                    " bytes at %" PRId64 " from '%s'\n",
+                    nbytes, offset + done, nim->iname);
+         rv = -1;
+         break;
+      }
+      nifti_convert_vals(sbuf, nim->datatype,
+                         dst + (done / nim->nbyper) * dsize, datatype,
+                         nbytes / nim->nbyper, slope, inter);
    }
 
-   nhdr->datatype = dtype ;
-   nifti_datatype_sizes( nhdr->datatype , &nbyper, &swapsize );
-   nhdr->bitpix   = 8 * nbyper ;
+   free(sbuf);
+   znzclose(fp);
 
-   strcpy(nhdr->magic, "n+1");  /* init to single file */
+   if( rv && alloced ){ nifti_data_free(*data); *data = NULL; }
 
-   return nhdr;
+   return rv;
 }
 
+/*--------------------------------------------------------------------------*/
+/*! Unload the data in a nifti_image struct, but keep the metadata.
 
-/*----------------------------------------------------------------------*/
-/*! basic creation of a nifti_image struct
+    Data mapped by nifti_image_load() is unmapped, rather than freed.
+*//*------------------------------------------------------------------------*/
+void nifti_image_unload( nifti_image *nim )
+{
+   if( nim != NULL && nim->data != NULL ){
+     if( ! nifti_mmap_release(nim->data) ) nifti_data_free(nim->data) ;
+     nim->data = NULL ;
+   }
+   }
 
-   Create a nifti_image from the given dimensions and data type.
-   Optionally, allocate zero-filled data.
-
-   \param dims      : optional dim[8]   (default {3,1,1,1,0,0,0,0})
-   \param datatype  : optional datatype (default DT_FLOAT32)
-   \param data_fill : if flag is set, allocate zero-filled data for image
+/*--------------------------------------------------------------------------*/
+/*! free 'everything' about a nifti_image struct (including the passed struct)
 
-   \return pointer to allocated nifti_image struct
-*//*--------------------------------------------------------------------*/
-nifti_image * nifti_make_new_nim(const int64_t dims[], int datatype,
-                                 int data_fill)
+    free (only fields which are not NULL):
+      - fname and iname
+      - data (or unmap it, see nifti_image_unload)
+      - any ext_list[i].edata
+      - ext_list
+      - nim
+*//*------------------------------------------------------------------------*/
+void nifti_image_free( nifti_image *nim )
 {
-   nifti_image    * nim;
-   nifti_2_header * nhdr;
+   if( nim == NULL ) return ;
+   free(nim->fname) ;
+   free(nim->iname) ;
+   nifti_image_unload( nim ) ;
+   (void)nifti_free_extensions( nim ) ;
+   free(nim) ; }
 
-   nhdr = nifti_make_new_n2_header(dims, datatype);
-   if( !nhdr ) return NULL;  /* error already printed */
 
-   nim = nifti_convert_n2hdr2nim(*nhdr,NULL);
-   free(nhdr);               /* in any case, we are done with this */
-   if( !nim ){
-      fprintf(stderr,"** NMNN: nifti_convert_n2hdr2nim failure\n");
-      return NULL;
-   }
+/*--------------------------------------------------------------------------*/
+/*! free the nifti extensions
 
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"+d nifti_make_new_nim, data_fill = %d\n",data_fill);
+    - If any edata pointer is set in the extension list, free() it.
+    - Free ext_list, if it is set.
+    - Clear num_ext and ext_list from nim.
 
-   if( data_fill ) {
-      nim->data = calloc(nim->nvox, nim->nbyper);
+    \return 0 on success, -1 on error
 
-      /* if we cannot allocate data, take ball and go home */
-      if( !nim->data ) {
-         fprintf(stderr,"** NIFTI NMNN: failed to alloc %" PRId64
-                        " bytes for data\n", nim->nvox*nim->nbyper);
-         nifti_image_free(nim);
-         nim = NULL;
-      }
+    \sa nifti_add_extension, nifti_copy_extensions
+*//*------------------------------------------------------------------------*/
+int nifti_free_extensions( nifti_image *nim )
+{
+   int c ;
+   if( nim == NULL ) return -1;
+   if( nim->num_ext > 0 && nim->ext_list ){
+      for( c = 0; c < nim->num_ext; c++ )
+         nifti_data_free(nim->ext_list[c].edata);
+      free(nim->ext_list);
    }
+   /* or if it is inconsistent, warn the user (if we are not in quiet mode) */
+   else if ( (nim->num_ext > 0 || nim->ext_list != NULL) &&
+             (NIFTI_OPTS.debug > 0) )
+      fprintf(stderr,"** warning: nifti extension num/ptr mismatch (%d,%p)\n",
+              nim->num_ext, (void *)nim->ext_list);
 
-   return nim;
-}
+   if( NIFTI_OPTS.debug > 2 )
+      fprintf(stderr,"+d free'd %d extension(s)\n", nim->num_ext);
 
-#undef N_CHECK_2BYTE_VAL
-#define N_CHECK_2BYTE_VAL(fn) do { if( ! NIFTI_IS_16_BIT_INT(nim->fn) ) { \
-   fprintf(stderr,"** nim->%s = %" PRId64                                 \
-           " does not fit into NIFTI-1 header\n",                         \
-           #fn, (int64_t)nim->fn); return 1; } } while(0)
+   nim->num_ext = 0;
+   nim->ext_list = NULL;
 
+   return 0;
+}
 
-/*----------------------------------------------------------------------*/
-/*! convert a nifti_image structure to a nifti_1_header struct
 
-    No allocation is done, this should be used via structure copy.
-    As in:
-    <pre>
-    nifti_1_header my_header;
-    my_header = nifti_convert_nim2n1hdr(my_nim_pointer);
-    </pre>
-*//*--------------------------------------------------------------------*/
-int nifti_convert_nim2n1hdr(const nifti_image * nim, nifti_1_header * hdr)
+/*--------------------------------------------------------------------------*/
+/*! Print to stdout some info about a nifti_image struct.
+*//*------------------------------------------------------------------------*/
+void nifti_image_infodump( const nifti_image *nim )
 {
-   nifti_1_header nhdr;
+   char *str = nifti_image_to_ascii( nim ) ;
+   /* stdout -> stderr   2 Dec 2004 [rickr] */
+   if( str != NULL ){ fputs(str,stderr) ; free(str) ; }
+   }
 
-   if( !hdr ) {
-      fprintf(stderr,"** nifti_CN2N1hdr: no hdr to fill\n");
-      return 1;
+
+/*--------------------------------------------------------------------------
+ * nifti_write_buffer just check for a null znzFile and call znzwrite
+ *--------------------------------------------------------------------------*/
+/*! \fn int64_t nifti_write_buffer(znzFile fp, void *buffer, int64_t numbytes)
+    \brief write numbytes of buffer to file, fp
+
+    \param fp           File pointer (from znzopen) to gzippable nifti datafile
+    \param buffer       data buffer to be written
+    \param numbytes     number of bytes in buffer to write
+    \return number of bytes successfully written
+*/
+int64_t nifti_write_buffer(znzFile fp, const void *buffer, int64_t numbytes)
+{
+   /* Write all the image data at once (no swapping here) */
+   int64_t ss;
+   if (znz_isnull(fp)){
+      fprintf(stderr,"** ERROR: nifti_write_buffer: null file pointer\n");
+      return 0;
    }
+   ss = znzwrite( buffer , 1 , numbytes , fp ) ;
+   return ss;
+}
 
-   memset(&nhdr,0,sizeof(nhdr)) ;  /* zero out header, to be safe */
 
+/*----------------------------------------------------------------------*/
+/*! write the nifti_image data to file (from nim->data or from NBL)
 
-   /**- load the ANALYZE-7.5 generic parts of the header struct */
+   If NBL is not NULL, write the data from that structure.  Otherwise,
+   write it out from nim->data.  No swapping is done here.
 
-   nhdr.sizeof_hdr = sizeof(nhdr) ;
-   nhdr.regular    = 'r' ;             /* for some stupid reason */
+   \param  fp  : File pointer
+   \param  nim : nifti_image corresponding to the data
+   \param  NBL : optional source of write data (if NULL use nim->data)
 
-   N_CHECK_2BYTE_VAL(ndim);
-   N_CHECK_2BYTE_VAL(nx);
-   N_CHECK_2BYTE_VAL(ny);
-   N_CHECK_2BYTE_VAL(nz);
-   N_CHECK_2BYTE_VAL(nt);
-   N_CHECK_2BYTE_VAL(nu);
-   N_CHECK_2BYTE_VAL(nv);
-   N_CHECK_2BYTE_VAL(nw);
-   N_CHECK_2BYTE_VAL(datatype);
-   N_CHECK_2BYTE_VAL(nbyper);
+   \return 0 on success, -1 on failure
 
-   nhdr.dim[0] = nim->ndim ;
-   nhdr.dim[1] = nim->nx ; nhdr.dim[2] = nim->ny ; nhdr.dim[3] = nim->nz ;
-   nhdr.dim[4] = nim->nt ; nhdr.dim[5] = nim->nu ; nhdr.dim[6] = nim->nv ;
-   nhdr.dim[7] = nim->nw ;
+   Note: the nifti_image byte_order is set as that of the current CPU.
+         This is because such a conversion was made to the data upon
+         reading, while byte_order was not set (so the programs would
+         know what format the data was on disk).  Effectively, since
+         byte_order should match what is on disk, it should bet set to
+         that of the current CPU whenever new filenames are assigned.
+*//*--------------------------------------------------------------------*/
+int nifti_write_all_data(znzFile fp, nifti_image * nim,
+                         const nifti_brick_list * NBL)
+{
+   int64_t ss, bnum;
 
-   nhdr.pixdim[0] = 0.0F ;
-   nhdr.pixdim[1] = nim->dx ; nhdr.pixdim[2] = nim->dy ;
-   nhdr.pixdim[3] = nim->dz ; nhdr.pixdim[4] = nim->dt ;
-   nhdr.pixdim[5] = nim->du ; nhdr.pixdim[6] = nim->dv ;
-   nhdr.pixdim[7] = nim->dw ;
+   if( !NBL ){ /* just write one buffer and get out of here */
+      if( nim->data == NULL ){
+         fprintf(stderr,"** NIFTI ERROR (NWAD): no image data to write\n");
+         return -1;
+      }
 
-   nhdr.datatype = nim->datatype ;
-   nhdr.bitpix   = 8 * nim->nbyper ;
+      ss = nifti_write_buffer(fp,nim->data,nim->nbyper * nim->nvox);
+      if (ss < nim->nbyper * nim->nvox){
+         fprintf(stderr,
+            "** NIFTI ERROR (NWAD): wrote only %" PRId64 " of %" PRId64
+            " bytes to file\n",
+            ss, nim->nbyper * nim->nvox);
+         return -1;
+      }
 
-   if( nim->cal_max > nim->cal_min ){
-     nhdr.cal_max = nim->cal_max ;
-     nhdr.cal_min = nim->cal_min ;
-   }
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"+d wrote single image of %" PRId64 " bytes\n", ss);
+   } else {
+      if( ! NBL->bricks || NBL->nbricks <= 0 || NBL->bsize <= 0 ){
+         fprintf(stderr,"** NIFTI error (NWAD): no brick data to write (%p,%"
+                        PRId64 ",%" PRId64 ")\n",
+                 (void *)NBL->bricks, NBL->nbricks, NBL->bsize);
+         return -1;
+      }
 
-   if( nim->scl_slope != 0.0 ){
-     nhdr.scl_slope = nim->scl_slope ;
-     nhdr.scl_inter = nim->scl_inter ;
+      for( bnum = 0; bnum < NBL->nbricks; bnum++ ){
+         ss = nifti_write_buffer(fp, NBL->bricks[bnum], NBL->bsize);
+         if( ss < NBL->bsize ){
+            fprintf(stderr,
+            "** NIFTI ERROR (NWAD): wrote only %" PRId64 " of %" PRId64
+            " bytes of brick %" PRId64 " of %" PRId64 " to file\n",
+            ss, NBL->bsize, bnum+1, NBL->nbricks);
+            return -1;
+         }
+      }
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"+d wrote image of %" PRId64
+                 " brick(s), each of %" PRId64 " bytes\n",
+                 NBL->nbricks, NBL->bsize);
    }
 
-   if( nim->descrip[0] != '\0' ){
-     memcpy(nhdr.descrip ,nim->descrip ,79) ; nhdr.descrip[79] = '\0' ;
-   }
-   if( nim->aux_file[0] != '\0' ){
-     memcpy(nhdr.aux_file ,nim->aux_file ,23) ; nhdr.aux_file[23] = '\0' ;
-   }
+   /* mark as being in this CPU byte order */
+   nim->byteorder = nifti_short_order() ;
 
-   /**- Load NIFTI specific stuff into the header */
+   return 0;
+}
 
-   if( nim->nifti_type > NIFTI_FTYPE_ANALYZE ){ /* then not ANALYZE */
+/* return number of extensions written, or -1 on error */
+static int nifti_write_extensions(znzFile fp, nifti_image *nim)
+{
+   nifti1_extension * list;
+   char               extdr[4] = { 0, 0, 0, 0 };
+   int                c, size, ok;
 
-     if( nim->nifti_type == NIFTI_FTYPE_NIFTI1_1 ) strcpy(nhdr.magic,"n+1") ;
-     else                                          strcpy(nhdr.magic,"ni1") ;
+   if( znz_isnull(fp) || !nim || nim->num_ext < 0 ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_write_extensions, bad params\n");
+      return -1;
+   }
 
-     nhdr.pixdim[1] = (float)fabs(nhdr.pixdim[1]) ;
-     nhdr.pixdim[2] = (float)fabs(nhdr.pixdim[2]) ;
-     nhdr.pixdim[3] = (float)fabs(nhdr.pixdim[3]) ;
-     nhdr.pixdim[4] = (float)fabs(nhdr.pixdim[4]) ;
-     nhdr.pixdim[5] = (float)fabs(nhdr.pixdim[5]) ;
-     nhdr.pixdim[6] = (float)fabs(nhdr.pixdim[6]) ;
-     nhdr.pixdim[7] = (float)fabs(nhdr.pixdim[7]) ;
+   /* if no extensions and user requests it, skip extender */
+   if( NIFTI_OPTS.skip_blank_ext && (nim->num_ext == 0 || ! nim->ext_list ) ){
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"-d no exts and skip_blank_ext set, "
+                        "so skipping 4-byte extender\n");
+      return 0;
+   }
 
-     N_CHECK_2BYTE_VAL(intent_code);
-     N_CHECK_2BYTE_VAL(qform_code);
-     N_CHECK_2BYTE_VAL(sform_code);
+   /* if invalid extension list, clear num_ext */
+   if( ! valid_nifti_extensions(nim) ) nim->num_ext = 0;
 
-     nhdr.intent_code = nim->intent_code ;
-     nhdr.intent_p1   = nim->intent_p1 ;
-     nhdr.intent_p2   = nim->intent_p2 ;
-     nhdr.intent_p3   = nim->intent_p3 ;
-     if( nim->intent_name[0] != '\0' ){
-       memcpy(nhdr.intent_name,nim->intent_name,15) ;
-       nhdr.intent_name[15] = '\0' ;
-     }
+   /* write out extender block */
+   if( nim->num_ext > 0 ) extdr[0] = 1;
+   if( nifti_write_buffer(fp, extdr, 4) != 4 ){
+      fprintf(stderr,"** NIFTI ERROR: failed to write extender\n");
+      return -1;
+   }
 
-     nhdr.vox_offset  = (float) nim->iname_offset ;
+   list = nim->ext_list;
+   for ( c = 0; c < nim->num_ext; c++ ){
+      size = (int)nifti_write_buffer(fp, &list->esize, sizeof(int));
+      ok = (size == (int)sizeof(int));
+      if( ok ){
+         size = (int)nifti_write_buffer(fp, &list->ecode, sizeof(int));
+         ok = (size == (int)sizeof(int));
+      }
+      if( ok ){
+         size = (int)nifti_write_buffer(fp, list->edata, list->esize - 8);
+         ok = (size == list->esize - 8);
+      }
+
+      if( !ok ){
+         fprintf(stderr,"** NIFTI: failed while writing extension #%d\n",c);
+         return -1;
+      } else if ( NIFTI_OPTS.debug > 2 )
+         fprintf(stderr,"+d wrote extension %d of %d bytes\n", c, size);
+
+      list++;
+   }
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d wrote out %d extension(s)\n", nim->num_ext);
+
+   return nim->num_ext;
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! basic initialization of a nifti_image struct (to a 1x1x1 image)
+*//*--------------------------------------------------------------------*/
+nifti_image* nifti_simple_init_nim(void)
+{
+   nifti_image *nim;
+   nifti_2_header nhdr;
+   int nbyper, swapsize;
+
+   memset(&nhdr,0,sizeof(nhdr)) ;  /* zero out header, to be safe */
+
+   nhdr.sizeof_hdr = sizeof(nhdr) ;
+
+   nhdr.dim[0] = 3 ;
+   nhdr.dim[1] = 1 ; nhdr.dim[2] = 1 ; nhdr.dim[3] = 1 ;
+   nhdr.dim[4] = 0 ;
+
+   nhdr.pixdim[0] = 0.0 ;
+   nhdr.pixdim[1] = 1.0 ; nhdr.pixdim[2] = 1.0 ; nhdr.pixdim[3] = 1.0 ;
+
+   nhdr.datatype = DT_FLOAT32 ;
+   nifti_datatype_sizes( nhdr.datatype , &nbyper, &swapsize );
+   nhdr.bitpix   = 8 * nbyper ;
+
+   memcpy(nhdr.magic, nifti2_magic, 8);  /* init to single file */
+
+   nim = nifti_convert_n2hdr2nim(nhdr,NULL);
+   nim->fname = NULL;
+   nim->iname = NULL;
+   return nim;
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! basic initialization of a nifti_2_header struct (with given dimensions)
+
+   Return an allocated nifti_2_header struct, based on the given
+   dimensions and datatype.
+
+   \param arg_dims  : optional dim[8] array (default {3,1,1,1,0,0,0,0})
+   \param arg_dtype : optional datatype (default DT_FLOAT32)
+
+   \return pointer to allocated nifti_2_header struct
+*//*--------------------------------------------------------------------*/
+nifti_2_header * nifti_make_new_n2_header(const int64_t arg_dims[],
+                                          int arg_dtype)
+{
+   nifti_2_header * nhdr;
+   const int64_t    default_dims[8] = { 3, 1, 1, 1, 0, 0, 0, 0 };
+   const int64_t  * dim;  /* either passed or default dims  */
+   int              dtype; /* either passed or default dtype */
+   int              c, nbyper, swapsize;
+
+   /* if arg_dims is passed, apply it */
+   if( arg_dims ) dim = arg_dims;
+   else           dim = default_dims;
+
+   /* validate dim: if there is any problem, apply default_dims */
+   if( dim[0] < 1 || dim[0] > 7 ) {
+      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dim[0]=%" PRId64 "\n",
+              dim[0]);
+      dim = default_dims;
+   } else {
+      for( c = 1; c <= dim[0]; c++ )
+         if( dim[c] < 1 )
+         {
+            fprintf(stderr,
+                "** nifti_simple_hdr_with_dims: bad dim[%d]=%" PRId64 "\n",
+                c, dim[c]);
+            dim = default_dims;
+            break;
+         }
+   }
+
+   /* validate dtype, too */
+   dtype = arg_dtype;
+   if( ! nifti_is_valid_datatype(dtype) ) {
+      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dtype %d\n",dtype);
+      dtype = DT_FLOAT32;
+   }
+
+   /* now populate the header struct */
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d make_new_n2_header, dim[0] = %" PRId64
+              ", datatype = %d\n",
+              dim[0], dtype);
+
+   nhdr = (nifti_2_header *)calloc(1,sizeof(nifti_2_header));
+   if( !nhdr ){
+      fprintf(stderr,"** NIFTI make_new_n2_header: failed to alloc hdr\n");
+      return NULL;
+   }
+
+   nhdr->sizeof_hdr = sizeof(nifti_2_header) ;
+
+   /* init dim and pixdim */
+   nhdr->dim[0] = dim[0];
+   nhdr->pixdim[0] = 0.0;
+   for( c = 1; c <= dim[0]; c++ ) {
+      nhdr->dim[c] = dim[c];
+      nhdr->pixdim[c] = 1.0;
+   }
+
+   nhdr->datatype = dtype ;
+   nifti_datatype_sizes( nhdr->datatype , &nbyper, &swapsize );
+   nhdr->bitpix   = 8 * nbyper ;
+
+   memcpy(nhdr->magic, nifti2_magic, 8);  /* init to single file */
+
+   return nhdr;
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! basic initialization of a nifti_1_header struct (with given dimensions)
+
+   Return an allocated nifti_1_header struct, based on the given
+   dimensions and datatype.
+
+   \param arg_dims  : optional dim[8] array (default {3,1,1,1,0,0,0,0})
+   \param arg_dtype : optional datatype (default DT_FLOAT32)
+
+   \return pointer to allocated nifti_1_header struct
+*//*--------------------------------------------------------------------*/
+nifti_1_header * nifti_make_new_n1_header(const int64_t arg_dims[],
+                                          int arg_dtype)
+{
+   nifti_1_header * nhdr;
+   const int64_t    default_dims[8] = { 3, 1, 1, 1, 0, 0, 0, 0 };
+   const int64_t  * dim;  /* either passed or default dims  */
+   int              dtype; /* either passed or default dtype */
+   int              c, nbyper, swapsize;
+
+   /* if arg_dims is passed, apply it */
+   if( arg_dims ) dim = arg_dims;
+   else           dim = default_dims;
+
+   /* validate dim: if there is any problem, apply default_dims */
+   if( dim[0] < 1 || dim[0] > 7 ) {
+      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dim[0]=%" PRId64 "\n",
+              dim[0]);
+      dim = default_dims;
+   } else {
+      for( c = 1; c <= dim[0]; c++ )
+         if( dim[c] < 1 )
+         {
+            fprintf(stderr,
+                "** nifti_simple_hdr_with_dims: bad dim[%d]=%" PRId64 "\n",                     c, dim[c]);
+            dim = default_dims;
+            break;
+         }
+   }
+
+   /* validate dtype, too */
+   dtype = arg_dtype;
+   if( ! nifti_is_valid_datatype(dtype) ) {
+      fprintf(stderr,"** nifti_simple_hdr_with_dims: bad dtype %d\n",dtype);
+      dtype = DT_FLOAT32;
+   }
+
+   /* now populate the header struct */
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d make_new_n1_header, dim[0] = %" PRId64
+              ", datatype = %d\n",
+              dim[0], dtype);
+
+   nhdr = (nifti_1_header *)calloc(1,sizeof(nifti_1_header));
+   if( !nhdr ){
+      fprintf(stderr,"** NIFTI make_new_n1_header: failed to alloc hdr\n");
+      return NULL;
+   }
+
+   nhdr->sizeof_hdr = sizeof(nifti_1_header) ;
+   nhdr->regular    = 'r' ;           /* for some stupid reason */
+
+   /* init dim and pixdim */
+   nhdr->dim[0] = (int)dim[0]; /* rcr n2 - check dim sizes for nifti-1 */
+                               /* (verify vals are < 2^15) */
+   nhdr->pixdim[0] = 0.0F;
+   for( c = 1; c <= dim[0]; c++ ) {
+      nhdr->dim[c] = (int)dim[c];
+      nhdr->pixdim[c] = 1.0F;
+   }
+
+   nhdr->datatype = dtype ;
+   nifti_datatype_sizes( nhdr->datatype , &nbyper, &swapsize );
+   nhdr->bitpix   = 8 * nbyper ;
+
+   strcpy(nhdr->magic, "n+1");  /* init to single file */
+
+   return nhdr;
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! basic creation of a nifti_image struct
+
+   Create a nifti_image from the given dimensions and data type.
+   Optionally, allocate zero-filled data.
+
+   \param dims      : optional dim[8]   (default {3,1,1,1,0,0,0,0})
+   \param datatype  : optional datatype (default DT_FLOAT32)
+   \param data_fill : if flag is set, allocate zero-filled data for image
+
+   \return pointer to allocated nifti_image struct
+*//*--------------------------------------------------------------------*/
+nifti_image * nifti_make_new_nim(const int64_t dims[], int datatype,
+                                 int data_fill)
+{
+   nifti_image    * nim;
+   nifti_2_header * nhdr;
+
+   nhdr = nifti_make_new_n2_header(dims, datatype);
+   if( !nhdr ) return NULL;  /* error already printed */
+
+   nim = nifti_convert_n2hdr2nim(*nhdr,NULL);
+   free(nhdr);               /* in any case, we are done with this */
+   if( !nim ){
+      fprintf(stderr,"** NMNN: nifti_convert_n2hdr2nim failure\n");
+      return NULL;
+   }
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d nifti_make_new_nim, data_fill = %d\n",data_fill);
+
+   if( data_fill ) {
+      nim->data = nifti_data_alloc_aligned(nifti_get_data_align(),
+                                           nim->nvox * nim->nbyper);
+      if( nim->data ) memset(nim->data, 0, nim->nvox * nim->nbyper);
+
+      /* if we cannot allocate data, take ball and go home */
+      if( !nim->data ) {
+         fprintf(stderr,"** NIFTI NMNN: failed to alloc %" PRId64
+                        " bytes for data\n", nim->nvox*nim->nbyper);
+         nifti_image_free(nim);
+         nim = NULL;
+      }
+   }
+
+   return nim;
+}
+
+#undef N_CHECK_2BYTE_VAL
+#define N_CHECK_2BYTE_VAL(fn) do { if( ! NIFTI_IS_16_BIT_INT(nim->fn) ) { \
+   fprintf(stderr,"** nim->%s = %" PRId64                                 \
+           " does not fit into NIFTI-1 header\n",                         \
+           #fn, (int64_t)nim->fn); return 1; } } while(0)
+
+
+/*----------------------------------------------------------------------*/
+/*! convert a nifti_image structure to a nifti_1_header struct
+
+    No allocation is done, this should be used via structure copy.
+    As in:
+    <pre>
+    nifti_1_header my_header;
+    my_header = nifti_convert_nim2n1hdr(my_nim_pointer);
+    </pre>
+*//*--------------------------------------------------------------------*/
+int nifti_convert_nim2n1hdr(const nifti_image * nim, nifti_1_header * hdr)
+{
+   nifti_1_header nhdr;
+
+   if( !hdr ) {
+      fprintf(stderr,"** nifti_CN2N1hdr: no hdr to fill\n");
+      return 1;
+   }
+
+   memset(&nhdr,0,sizeof(nhdr)) ;  /* zero out header, to be safe */
+
+
+   /**- load the ANALYZE-7.5 generic parts of the header struct */
+
+   nhdr.sizeof_hdr = sizeof(nhdr) ;
+   nhdr.regular    = 'r' ;             /* for some stupid reason */
+
+   N_CHECK_2BYTE_VAL(ndim);
+   N_CHECK_2BYTE_VAL(nx);
+   N_CHECK_2BYTE_VAL(ny);
+   N_CHECK_2BYTE_VAL(nz);
+   N_CHECK_2BYTE_VAL(nt);
+   N_CHECK_2BYTE_VAL(nu);
+   N_CHECK_2BYTE_VAL(nv);
+   N_CHECK_2BYTE_VAL(nw);
+   N_CHECK_2BYTE_VAL(datatype);
+   N_CHECK_2BYTE_VAL(nbyper);
+
+   nhdr.dim[0] = nim->ndim ;
+   nhdr.dim[1] = nim->nx ; nhdr.dim[2] = nim->ny ; nhdr.dim[3] = nim->nz ;
+   nhdr.dim[4] = nim->nt ; nhdr.dim[5] = nim->nu ; nhdr.dim[6] = nim->nv ;
+   nhdr.dim[7] = nim->nw ;
+
+   nhdr.pixdim[0] = 0.0F ;
+   nhdr.pixdim[1] = nim->dx ; nhdr.pixdim[2] = nim->dy ;
+   nhdr.pixdim[3] = nim->dz ; nhdr.pixdim[4] = nim->dt ;
+   nhdr.pixdim[5] = nim->du ; nhdr.pixdim[6] = nim->dv ;
+   nhdr.pixdim[7] = nim->dw ;
+
+   nhdr.datatype = nim->datatype ;
+   nhdr.bitpix   = 8 * nim->nbyper ;
+
+   if( nim->cal_max > nim->cal_min ){
+     nhdr.cal_max = nim->cal_max ;
+     nhdr.cal_min = nim->cal_min ;
+   }
+
+   if( nim->scl_slope != 0.0 ){
+     nhdr.scl_slope = nim->scl_slope ;
+     nhdr.scl_inter = nim->scl_inter ;
+   }
+
+   if( nim->descrip[0] != '\0' ){
+     memcpy(nhdr.descrip ,nim->descrip ,79) ; nhdr.descrip[79] = '\0' ;
+   }
+   if( nim->aux_file[0] != '\0' ){
+     memcpy(nhdr.aux_file ,nim->aux_file ,23) ; nhdr.aux_file[23] = '\0' ;
+   }
+
+   /**- Load NIFTI specific stuff into the header */
+
+   if( nim->nifti_type > NIFTI_FTYPE_ANALYZE ){ /* then not ANALYZE */
+
+     if( nim->nifti_type == NIFTI_FTYPE_NIFTI1_1 ) strcpy(nhdr.magic,"n+1") ;
+     else                                          strcpy(nhdr.magic,"ni1") ;
+
+     nhdr.pixdim[1] = (float)fabs(nhdr.pixdim[1]) ;
+     nhdr.pixdim[2] = (float)fabs(nhdr.pixdim[2]) ;
+     nhdr.pixdim[3] = (float)fabs(nhdr.pixdim[3]) ;
+     nhdr.pixdim[4] = (float)fabs(nhdr.pixdim[4]) ;
+     nhdr.pixdim[5] = (float)fabs(nhdr.pixdim[5]) ;
+     nhdr.pixdim[6] = (float)fabs(nhdr.pixdim[6]) ;
+     nhdr.pixdim[7] = (float)fabs(nhdr.pixdim[7]) ;
+
+     N_CHECK_2BYTE_VAL(intent_code);
+     N_CHECK_2BYTE_VAL(qform_code);
+     N_CHECK_2BYTE_VAL(sform_code);
+
+     nhdr.intent_code = nim->intent_code ;
+     nhdr.intent_p1   = nim->intent_p1 ;
+     nhdr.intent_p2   = nim->intent_p2 ;
+     nhdr.intent_p3   = nim->intent_p3 ;
+     if( nim->intent_name[0] != '\0' ){
+       memcpy(nhdr.intent_name,nim->intent_name,15) ;
+       nhdr.intent_name[15] = '\0' ;
+     }
+
+     nhdr.vox_offset  = (float) nim->iname_offset ;
      nhdr.xyzt_units  = SPACE_TIME_TO_XYZT( nim->xyz_units, nim->time_units ) ;
      nhdr.toffset     = nim->toffset ;
 
-     if( nim->qform_code > 0 ){
-       nhdr.qform_code = nim->qform_code ;
-       nhdr.quatern_b  = nim->quatern_b ;
-       nhdr.quatern_c  = nim->quatern_c ;
-       nhdr.quatern_d  = nim->quatern_d ;
-       nhdr.qoffset_x  = nim->qoffset_x ;
-       nhdr.qoffset_y  = nim->qoffset_y ;
-       nhdr.qoffset_z  = nim->qoffset_z ;
-       nhdr.pixdim[0]  = (nim->qfac >= 0.0) ? 1.0F : -1.0F ;
-     }
+     if( nim->qform_code > 0 ){
+       nhdr.qform_code = nim->qform_code ;
+       nhdr.quatern_b  = nim->quatern_b ;
+       nhdr.quatern_c  = nim->quatern_c ;
+       nhdr.quatern_d  = nim->quatern_d ;
+       nhdr.qoffset_x  = nim->qoffset_x ;
+       nhdr.qoffset_y  = nim->qoffset_y ;
+       nhdr.qoffset_z  = nim->qoffset_z ;
+       nhdr.pixdim[0]  = (nim->qfac >= 0.0) ? 1.0F : -1.0F ;
+     }
+
+     if( nim->sform_code > 0 ){
+       nhdr.sform_code = nim->sform_code ;
+       nhdr.srow_x[0]  = nim->sto_xyz.m[0][0] ;
+       nhdr.srow_x[1]  = nim->sto_xyz.m[0][1] ;
+       nhdr.srow_x[2]  = nim->sto_xyz.m[0][2] ;
+       nhdr.srow_x[3]  = nim->sto_xyz.m[0][3] ;
+       nhdr.srow_y[0]  = nim->sto_xyz.m[1][0] ;
+       nhdr.srow_y[1]  = nim->sto_xyz.m[1][1] ;
+       nhdr.srow_y[2]  = nim->sto_xyz.m[1][2] ;
+       nhdr.srow_y[3]  = nim->sto_xyz.m[1][3] ;
+       nhdr.srow_z[0]  = nim->sto_xyz.m[2][0] ;
+       nhdr.srow_z[1]  = nim->sto_xyz.m[2][1] ;
+       nhdr.srow_z[2]  = nim->sto_xyz.m[2][2] ;
+       nhdr.srow_z[3]  = nim->sto_xyz.m[2][3] ;
+     }
+
+     N_CHECK_2BYTE_VAL(sform_code);
+     N_CHECK_2BYTE_VAL(slice_start);
+     N_CHECK_2BYTE_VAL(slice_end);
+
+     nhdr.dim_info = FPS_INTO_DIM_INFO( nim->freq_dim ,
+                                        nim->phase_dim , nim->slice_dim ) ;
+     nhdr.slice_code     = nim->slice_code ;
+     nhdr.slice_start    = nim->slice_start ;
+     nhdr.slice_end      = nim->slice_end ;
+     nhdr.slice_duration = nim->slice_duration ;
+   }
+
+   memcpy(hdr, &nhdr, sizeof(nhdr));
+
+   return 0;
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! convert a nifti_image structure to a nifti_2_header struct
+
+    No allocation is done, this should be used via structure copy.
+    As in:
+    <pre>
+    nifti_2_header my_header;
+    my_header = nifti_convert_nim2n2hdr(my_nim_pointer);
+    </pre>
+*//*--------------------------------------------------------------------*/
+int nifti_convert_nim2n2hdr(const nifti_image * nim, nifti_2_header * hdr)
+{
+   nifti_2_header nhdr;
+
+   if( !hdr ) {
+      fprintf(stderr,"** nifti_CN2N2hdr: no hdr to fill\n");
+      return 1;
+   }
+
+   memset(&nhdr,0,sizeof(nhdr)) ;  /* zero out header, to be safe */
+
+
+   /**- load the ANALYZE-7.5 generic parts of the header struct */
+
+   nhdr.sizeof_hdr = sizeof(nhdr) ;
+   memcpy(nhdr.magic, nifti2_magic, 8);
+   if( nim->nifti_type == NIFTI_FTYPE_NIFTI2_2 ) nhdr.magic[1] = 'i';
+
+   nhdr.datatype = nim->datatype ;
+   nhdr.bitpix   = 8 * nim->nbyper ;
+
+   nhdr.dim[0] = nim->ndim ;
+   nhdr.dim[1] = nim->nx ; nhdr.dim[2] = nim->ny ; nhdr.dim[3] = nim->nz ;
+   nhdr.dim[4] = nim->nt ; nhdr.dim[5] = nim->nu ; nhdr.dim[6] = nim->nv ;
+   nhdr.dim[7] = nim->nw ;
+
+   nhdr.intent_p1 = nim->intent_p1 ;
+   nhdr.intent_p2 = nim->intent_p2 ;
+   nhdr.intent_p3 = nim->intent_p3 ;
+
+   nhdr.pixdim[0] = 0.0 ;
+   nhdr.pixdim[1] = fabs(nim->dx) ; nhdr.pixdim[2] = fabs(nim->dy) ;
+   nhdr.pixdim[3] = fabs(nim->dz) ; nhdr.pixdim[4] = fabs(nim->dt) ;
+   nhdr.pixdim[5] = fabs(nim->du) ; nhdr.pixdim[6] = fabs(nim->dv) ;
+   nhdr.pixdim[7] = fabs(nim->dw) ;
+
+   nhdr.vox_offset  = nim->iname_offset ;
+
+   nhdr.scl_slope = nim->scl_slope ;
+   nhdr.scl_inter = nim->scl_inter ;
+
+   nhdr.cal_max = nim->cal_max ;
+   nhdr.cal_min = nim->cal_min ;
+
+   nhdr.slice_duration = nim->slice_duration ;
+   nhdr.toffset        = nim->toffset ;
+   nhdr.slice_start    = nim->slice_start ;
+   nhdr.slice_end      = nim->slice_end ;
+
+   if( nim->descrip[0] != '\0' ){
+     memcpy(nhdr.descrip ,nim->descrip ,79) ; nhdr.descrip[79] = '\0' ;
+   }
+   if( nim->aux_file[0] != '\0' ){
+     memcpy(nhdr.aux_file ,nim->aux_file ,23) ; nhdr.aux_file[23] = '\0' ;
+   }
+
+   if( nim->qform_code > 0 ){
+     nhdr.qform_code = nim->qform_code ;
+     nhdr.quatern_b  = nim->quatern_b ;
+     nhdr.quatern_c  = nim->quatern_c ;
+     nhdr.quatern_d  = nim->quatern_d ;
+     nhdr.qoffset_x  = nim->qoffset_x ;
+     nhdr.qoffset_y  = nim->qoffset_y ;
+     nhdr.qoffset_z  = nim->qoffset_z ;
+     nhdr.pixdim[0]  = (nim->qfac >= 0.0) ? 1.0F : -1.0F ;
+   }
+
+   if( nim->sform_code > 0 ){
+     nhdr.sform_code = nim->sform_code ;
+     nhdr.srow_x[0]  = nim->sto_xyz.m[0][0] ;
+     nhdr.srow_x[1]  = nim->sto_xyz.m[0][1] ;
+     nhdr.srow_x[2]  = nim->sto_xyz.m[0][2] ;
+     nhdr.srow_x[3]  = nim->sto_xyz.m[0][3] ;
+     nhdr.srow_y[0]  = nim->sto_xyz.m[1][0] ;
+     nhdr.srow_y[1]  = nim->sto_xyz.m[1][1] ;
+     nhdr.srow_y[2]  = nim->sto_xyz.m[1][2] ;
+     nhdr.srow_y[3]  = nim->sto_xyz.m[1][3] ;
+     nhdr.srow_z[0]  = nim->sto_xyz.m[2][0] ;
+     nhdr.srow_z[1]  = nim->sto_xyz.m[2][1] ;
+     nhdr.srow_z[2]  = nim->sto_xyz.m[2][2] ;
+     nhdr.srow_z[3]  = nim->sto_xyz.m[2][3] ;
+   }
+
+   nhdr.slice_code  = nim->slice_code ;
+   nhdr.xyzt_units  = SPACE_TIME_TO_XYZT( nim->xyz_units, nim->time_units ) ;
+   nhdr.intent_code = nim->intent_code ;
+   if( nim->intent_name[0] != '\0' ){
+     memcpy(nhdr.intent_name,nim->intent_name,15) ;
+     nhdr.intent_name[15] = '\0' ;
+   }
+
+   nhdr.dim_info = FPS_INTO_DIM_INFO( nim->freq_dim ,
+                                      nim->phase_dim , nim->slice_dim ) ;
+
+   nhdr.unused_str[0] = '\0' ;  /* not needed, but complete */
+
+   memcpy(hdr, &nhdr, sizeof(nhdr));
+
+   return 0;
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! \fn int nifti_copy_extensions(nifti_image * nim_dest, nifti_image * nim_src)
+    \brief copy the nifti1_extension list from src to dest
+
+    Duplicate the list of nifti1_extensions.  The dest structure must
+    be clear of extensions.
+    \return 0 on success, -1 on failure
+
+    \sa nifti_add_extension, nifti_free_extensions
+*/
+int nifti_copy_extensions(nifti_image * nim_dest, const nifti_image * nim_src)
+{
+   char   * data;
+   int64_t  bytes;
+   int      c, size, old_size;
+
+   if( nim_dest->num_ext > 0 || nim_dest->ext_list != NULL ){
+      fprintf(stderr,"** NIFTI: will not copy over existing extensions\n");
+      return -1;
+   }
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d duplicating %d extension(s)\n", nim_src->num_ext);
+
+   if( nim_src->num_ext <= 0 ) return 0;
+
+   bytes = nim_src->num_ext * sizeof(nifti1_extension);  /* I'm lazy */
+   nim_dest->ext_list = (nifti1_extension *)malloc(bytes);
+   if( !nim_dest->ext_list ){
+      fprintf(stderr,"** failed to allocate %d nifti1_extension structs\n",
+              nim_src->num_ext);
+      return -1;
+   }
+
+   /* copy the extension data */
+   nim_dest->num_ext = 0;
+   for( c = 0; c < nim_src->num_ext; c++ ){
+      size = old_size = nim_src->ext_list[c].esize;
+      if( size & 0xf ) size = (size + 0xf) & ~0xf; /* make multiple of 16 */
+      if( NIFTI_OPTS.debug > 2 )
+         fprintf(stderr,"+d dup'ing ext #%d of size %d (from size %d)\n",
+                 c, size, old_size);
+      /* data length is size-8, as esize includes space for esize and ecode */
+      data = (char *)nifti_data_alloc(size-8);         /* maybe size > old */
+      if( !data ){
+         fprintf(stderr,"** NIFTI: failed to alloc %d bytes for extension\n",
+                 size);
+         if( c == 0 ) { free(nim_dest->ext_list); nim_dest->ext_list = NULL; }
+         /* otherwise, keep what we have (a.o.t. deleting them all) */
+         return -1;
+      }
+      /* finally, fill the new structure */
+      nim_dest->ext_list[c].esize = size;
+      nim_dest->ext_list[c].ecode = nim_src->ext_list[c].ecode;
+      nim_dest->ext_list[c].edata = data;
+      memcpy(data, nim_src->ext_list[c].edata, old_size-8);
+      memset(data + old_size-8, 0, size-old_size);
+
+      nim_dest->num_ext++;
+   }
 
-     if( nim->sform_code > 0 ){
-       nhdr.sform_code = nim->sform_code ;
-       nhdr.srow_x[0]  = nim->sto_xyz.m[0][0] ;
-       nhdr.srow_x[1]  = nim->sto_xyz.m[0][1] ;
-       nhdr.srow_x[2]  = nim->sto_xyz.m[0][2] ;
-       nhdr.srow_x[3]  = nim->sto_xyz.m[0][3] ;
-       nhdr.srow_y[0]  = nim->sto_xyz.m[1][0] ;
-       nhdr.srow_y[1]  = nim->sto_xyz.m[1][1] ;
-       nhdr.srow_y[2]  = nim->sto_xyz.m[1][2] ;
-       nhdr.srow_y[3]  = nim->sto_xyz.m[1][3] ;
-       nhdr.srow_z[0]  = nim->sto_xyz.m[2][0] ;
-       nhdr.srow_z[1]  = nim->sto_xyz.m[2][1] ;
-       nhdr.srow_z[2]  = nim->sto_xyz.m[2][2] ;
-       nhdr.srow_z[3]  = nim->sto_xyz.m[2][3] ;
-     }
+   return 0;
+}
 
-     N_CHECK_2BYTE_VAL(sform_code);
-     N_CHECK_2BYTE_VAL(slice_start);
-     N_CHECK_2BYTE_VAL(slice_end);
 
-     nhdr.dim_info = FPS_INTO_DIM_INFO( nim->freq_dim ,
-                                        nim->phase_dim , nim->slice_dim ) ;
-     nhdr.slice_code     = nim->slice_code ;
-     nhdr.slice_start    = nim->slice_start ;
-     nhdr.slice_end      = nim->slice_end ;
-     nhdr.slice_duration = nim->slice_duration ;
+/*----------------------------------------------------------------------*/
+/*! compute the total size of all extensions
+
+    \return the total of all esize fields
+
+    Note that each esize includes 4 bytes for ecode, 4 bytes for esize,
+    and the bytes used for the data.  Each esize also needs to be a
+    multiple of 16, so it may be greater than the sum of its 3 parts.
+*//*--------------------------------------------------------------------*/
+static int nifti_extension_size(nifti_image *nim)
+{
+   int c, size = 0;
+
+   if( !nim || nim->num_ext <= 0 ) return 0;
+
+   if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d ext sizes:");
+
+   for ( c = 0; c < nim->num_ext; c++ ){
+      size += nim->ext_list[c].esize;
+      if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"  %d",nim->ext_list[c].esize);
    }
 
-   memcpy(hdr, &nhdr, sizeof(nhdr));
+   if( NIFTI_OPTS.debug > 2 ) fprintf(stderr," (total = %d)\n",size);
 
-   return 0;
+   return size;
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! set the nifti_image iname_offset field, based on nifti_type
+
+    - use nifti_ver to determine the size of the header
+      (0: default, else NIFTI-version)
+    - if writing to 2 files, set offset to 0
+    - if writing to a single NIFTI-1 file, set the offset to
+         352 + total extension size, then align to 16-byte boundary
+    - if writing an ASCII header, set offset to -1
+*//*--------------------------------------------------------------------*/
+void nifti_set_iname_offset(nifti_image *nim, int nifti_ver)
+{
+   int64_t offset;
+   int64_t hsize = sizeof(nifti_1_header);  /* default */
+
+   if( nifti_ver < 0 || nifti_ver > 2 ) {
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** invalid nifti_ver = %d for set_iname_offset\n",
+                 nifti_ver);
+      /* but stick with the default */
+   } else if( nifti_ver == 2 ) {
+      hsize = sizeof(nifti_2_header);
+   }
+
+   switch( nim->nifti_type ){
+
+     default:  /* writing into 2 files */
+       /* we only write files with 0 offset in the 2 file format */
+       nim->iname_offset = 0 ;
+     break ;
+
+     /* NIFTI-1 single binary file - always update */
+     case NIFTI_FTYPE_NIFTI1_1:
+     case NIFTI_FTYPE_NIFTI2_1:
+       offset = nifti_extension_size(nim) + hsize + 4;
+       /* be sure offset is aligned to a 16 byte boundary */
+       if ( ( offset % 16 ) != 0 )  offset = ((offset + 0xf) & ~0xf);
+       if( nim->iname_offset != offset ){
+          if( NIFTI_OPTS.debug > 1 )
+             fprintf(stderr,"+d changing offset from %" PRId64 " to %" PRId64
+                     "\n", nim->iname_offset, offset);
+          nim->iname_offset = offset;
+       }
+     break ;
+
+     /* non-standard case: NIFTI-1 ASCII header + binary data (single file) */
+     case NIFTI_FTYPE_ASCII:
+       nim->iname_offset = -1 ;             /* compute offset from filesize */
+     break ;
+   }
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! write the nifti_image dataset to disk, optionally including data
+
+   This is just a front-end for nifti_image_write_hdr_img2.
+
+   \param nim        nifti_image to write to disk
+   \param write_data write options (see nifti_image_write_hdr_img2)
+   \param opts       file open options ("wb" from nifti_image_write)
+
+   \sa nifti_image_write, nifti_image_write_hdr_img2, nifti_image_free,
+       nifti_set_filenames
+*//*--------------------------------------------------------------------*/
+znzFile nifti_image_write_hdr_img( nifti_image *nim , int write_data ,
+                                          const char* opts )
+{
+  return nifti_image_write_hdr_img2(nim,write_data,opts,NULL,NULL);
+}
+
+
+/*----------------------------------------------------------------------*/
+/*! This writes the header (and optionally the image data) to file.
+ *
+ * This is now just a front-end for nifti_image_write_engine, but the
+ * engine will return a status (for success of write), which is promptly
+ * ignored by this function.
+ *
+ * \sa nifti_image_write_engine
+*//*--------------------------------------------------------------------*/
+znzFile nifti_image_write_hdr_img2(nifti_image *nim, int write_opts,
+               const char * opts, znzFile imgfile, const nifti_brick_list * NBL)
+{
+   znzFile loc_img = imgfile;   /* might be NULL, might point to open struct */
+   (void)nifti_image_write_engine(nim, write_opts, opts, &loc_img, NBL);
+   return loc_img;
 }
 
+#undef  ERREX
+#define ERREX(msg)                                                      \
+ do{ fprintf(stderr,"** ERROR: nifti_image_write_engine: %s\n",(msg)) ; \
+     if( imgfile ) *imgfile = fp;                                       \
+     return 1 ; } while(0)
+
+/* set the error code, then ERREX */
+#undef  ERREX_CODE
+#define ERREX_CODE(code,msg) \
+ do{ nifti_set_last_error(code); ERREX(msg); } while(0)
+
+
+/* ----------------------------------------------------------------------*/
+/*! This writes the header (and optionally the image data) to file
+ *
+ * If imgfile points to a NULL znzFile, it modifies it to a valid and open
+ * handle.  If it points to an non-NULL znzFile, it uses that as the open
+ * image and simply modifies that structure.  This also depends on write_opts.
+ *
+ * \param nim        nifti_image to write to disk
+ * \param write_opts flags whether to write data and/or close file (see below)
+ * \param opts       file-open options, probably "wb" from nifti_image_write()
+ * \param imgfile    pointer to optionally open znzFile, for writing image data
+                     (must not be NULL, contents might be NULL)
+ * \param NBL        optional nifti_brick_list, containing the image data
+                     (may be NULL)
+ *
+ * Values for write_opts mode are based on two binary flags
+ * ( 0/1 for no-write/write data, and 0/2 for close/leave-open files ) :
+ *    -   0 = do not write data and close (do not open data file)
+ *    -   1 = write data        and close
+ *    -   2 = do not write data and leave data file open
+ *    -   3 = write data        and leave data file open
+ *
+ * \sa nifti_image_write, nifti_image_write_hdr_img, nifti_image_free,
+ *     nifti_set_filenames
+*//*---------------------------------------------------------------------*/
+static int nifti_image_write_engine(nifti_image *nim, int write_opts,
+        const char * opts, znzFile * imgfile, const nifti_brick_list * NBL)
+{
+   nifti_1_header n1hdr ;
+   nifti_2_header n2hdr ;
+   znzFile        fp=NULL;
+   int64_t        ss ;
+   int            write_data, leave_open;
+   int            nver, hsize;
+   char           func[] = { "nifti_image_write_engine" };
+
+   write_data = write_opts & 1;  /* just separate the bits now */
+   leave_open = write_opts & 2;
+
+   /* check for valid input */
+   if( ! nim || ! imgfile                 )
+      ERREX_CODE(NIFTI_ERR_INPUT, "NULL input") ;
+   if( ! nifti_validfilename(nim->fname)  )
+      ERREX_CODE(NIFTI_ERR_INPUT, "bad fname input") ;
+   if( write_data && ! nim->data && ! NBL )
+      ERREX_CODE(NIFTI_ERR_INPUT, "no image data") ;
+
+   if( write_data && NBL && ! nifti_NBL_matches_nim(nim, NBL) )
+      ERREX_CODE(NIFTI_ERR_INPUT, "NBL does not match nim");
+
+   /* chit-chat */
+   if( NIFTI_OPTS.debug > 1 ){
+      fprintf(stderr,"-d writing nifti file '%s'...\n", nim->fname);
+      if( NIFTI_OPTS.debug > 2 )
+         fprintf(stderr,"-d nifti type %d, offset %" PRId64 "\n",
+                 nim->nifti_type, nim->iname_offset);
+   }
+
+   /* get to work */
+
+   /* if non-standard ASCII, just write output and return */
+   if( nim->nifti_type == NIFTI_FTYPE_ASCII ) {
+      *imgfile = nifti_write_ascii_image(nim,NBL,opts,write_data,leave_open);
+      return 0; /* write_ascii has no status, either */
+   }
+
+   /* create a header structure to write out */
+   if( nim->nifti_type == NIFTI_FTYPE_NIFTI2_1 ||
+            nim->nifti_type == NIFTI_FTYPE_NIFTI2_2 ) {
+      nifti_set_iname_offset(nim, 2);
+      if( nifti_convert_nim2n2hdr(nim, &n2hdr) ) {
+         nifti_set_last_error(NIFTI_ERR_HEADER);
+         *imgfile = NULL;
+         return 1;
+      }
+      nver = 2; /* we will write NIFTI-2 */
+      hsize = (int)sizeof(nifti_2_header);
+   } else {
+      nifti_set_iname_offset(nim, 1);
+      if( nifti_convert_nim2n1hdr(nim, &n1hdr) ) {
+         nifti_set_last_error(NIFTI_ERR_HEADER);
+         *imgfile = NULL;
+         return 1;
+      }
+      nver = 1;
+      hsize = (int)sizeof(nifti_1_header);  /* 5 Aug 2015 */
+   }
+
+   /* if writing to 2 files, make sure iname is set and different from fname */
+   if( (nim->nifti_type != NIFTI_FTYPE_NIFTI1_1) &&
+       (nim->nifti_type != NIFTI_FTYPE_NIFTI2_1) ){
+       if( nim->iname && strcmp(nim->iname,nim->fname) == 0 ){
+         free(nim->iname) ; nim->iname = NULL ;
+       }
+       if( nim->iname == NULL ){ /* then make a new one */
+         nim->iname = nifti_makeimgname(nim->fname,nim->nifti_type,0,0);
+         if( nim->iname == NULL ) {
+            nifti_set_last_error(NIFTI_ERR_NOMEM);
+            *imgfile = NULL;
+            return 1;
+         }
+       }
+   }
+
+   /* if we have an imgfile and will also write the header there, use it */
+   if( ! znz_isnull(*imgfile) && (nim->nifti_type == NIFTI_FTYPE_NIFTI1_1 ||
+                                  nim->nifti_type == NIFTI_FTYPE_NIFTI2_1) ){
+      if( NIFTI_OPTS.debug > 2 )
+         fprintf(stderr,"+d using passed file for hdr\n");
+      fp = *imgfile;
+   } else {
+      /* we will write the header to a new file */
+      if( NIFTI_OPTS.debug > 2 )
+         fprintf(stderr,"+d opening output file %s [%s]\n",nim->fname,opts);
+      fp = znzopen( nim->fname , opts , nifti_is_gzfile(nim->fname) ) ;
+      if( znz_isnull(fp) ){
+         LNI_FERR(func,"cannot open output file",nim->fname);
+         nifti_set_last_error(NIFTI_ERR_OPEN);
+         *imgfile = fp;
+         return 1;
+      }
+   }
 
-/*----------------------------------------------------------------------*/
-/*! convert a nifti_image structure to a nifti_2_header struct
+   /* write the header and extensions */
 
-    No allocation is done, this should be used via structure copy.
-    As in:
-    <pre>
-    nifti_2_header my_header;
-    my_header = nifti_convert_nim2n2hdr(my_nim_pointer);
-    </pre>
-*//*--------------------------------------------------------------------*/
-int nifti_convert_nim2n2hdr(const nifti_image * nim, nifti_2_header * hdr)
-{
-   nifti_2_header nhdr;
+   if( nver == 2 ) ss = znzwrite(&n2hdr , 1 , hsize , fp); /* write header */
+   else            ss = znzwrite(&n1hdr , 1 , hsize , fp); /* write header */
 
-   if( !hdr ) {
-      fprintf(stderr,"** nifti_CN2N2hdr: no hdr to fill\n");
-      return 1;
+   if( ss < hsize ){
+      LNI_FERR(func,"bad header write to output file",nim->fname);
+      nifti_set_last_error(NIFTI_ERR_WRITE);
+      znzclose(fp); *imgfile = fp; return 1;
    }
 
-   memset(&nhdr,0,sizeof(nhdr)) ;  /* zero out header, to be safe */
-
+   /* write extensions; any errors will be printed */
+   if( nim->nifti_type != NIFTI_FTYPE_ANALYZE )
+      if( nifti_write_extensions(fp,nim) < 0 ) {
+         nifti_set_last_error(NIFTI_ERR_WRITE);
+         znzclose(fp); *imgfile = fp; return 1;
+      }
 
-   /**- load the ANALYZE-7.5 generic parts of the header struct */
+   /* if the header is all we want, we are done */
+   if( ! write_data && ! leave_open ){
+      if( NIFTI_OPTS.debug > 2 )
+         fprintf(stderr,"-d header is all we want: done\n");
+      znzclose(fp); *imgfile = fp; return 0;
+   }
 
-   nhdr.sizeof_hdr = sizeof(nhdr) ;
-   memcpy(nhdr.magic, nifti2_magic, 8);
-   if( nim->nifti_type == NIFTI_FTYPE_NIFTI2_2 ) nhdr.magic[1] = 'i';
+   /* if multiple files (hdr/img), close fp and use (any) *imgfile for data */
+   if( (nim->nifti_type != NIFTI_FTYPE_NIFTI1_1) &&
+       (nim->nifti_type != NIFTI_FTYPE_NIFTI2_1) ){ /* get a new file pointer */
+      znzclose(fp);         /* first, close header file */
+      /* use any valid *imgfile for img */
+      if( ! znz_isnull(*imgfile) ){
+         if(NIFTI_OPTS.debug > 2)
+            fprintf(stderr,"+d using passed file for img\n");
+         fp = *imgfile;
+      } else {
+         /* else we need a new img file pointer */
+         if( NIFTI_OPTS.debug > 2 )
+            fprintf(stderr,"+d opening img file '%s'\n", nim->iname);
+         fp = znzopen( nim->iname , opts , nifti_is_gzfile(nim->iname) ) ;
+         if( znz_isnull(fp) )
+            ERREX_CODE(NIFTI_ERR_OPEN, "cannot open image file") ;
+      }
+   }
 
-   nhdr.datatype = nim->datatype ;
-   nhdr.bitpix   = 8 * nim->nbyper ;
+   /* have image pointer, ready to write */
 
-   nhdr.dim[0] = nim->ndim ;
-   nhdr.dim[1] = nim->nx ; nhdr.dim[2] = nim->ny ; nhdr.dim[3] = nim->nz ;
-   nhdr.dim[4] = nim->nt ; nhdr.dim[5] = nim->nu ; nhdr.dim[6] = nim->nv ;
-   nhdr.dim[7] = nim->nw ;
+   znzseek(fp, nim->iname_offset, SEEK_SET);  /* in any case, seek to offset */
 
-   nhdr.intent_p1 = nim->intent_p1 ;
-   nhdr.intent_p2 = nim->intent_p2 ;
-   nhdr.intent_p3 = nim->intent_p3 ;
+   if( write_data && nifti_write_all_data(fp,nim,NBL) < 0 ){
+      nifti_set_last_error(NIFTI_ERR_WRITE);
+      znzclose(fp); *imgfile = fp; return 1;
+   }
+   if( ! leave_open ) znzclose(fp);
 
-   nhdr.pixdim[0] = 0.0 ;
-   nhdr.pixdim[1] = fabs(nim->dx) ; nhdr.pixdim[2] = fabs(nim->dy) ;
-   nhdr.pixdim[3] = fabs(nim->dz) ; nhdr.pixdim[4] = fabs(nim->dt) ;
-   nhdr.pixdim[5] = fabs(nim->du) ; nhdr.pixdim[6] = fabs(nim->dv) ;
-   nhdr.pixdim[7] = fabs(nim->dw) ;
+   *imgfile = fp;
 
-   nhdr.vox_offset  = nim->iname_offset ;
+   return 0;
+}
 
-   nhdr.scl_slope = nim->scl_slope ;
-   nhdr.scl_inter = nim->scl_inter ;
 
-   nhdr.cal_max = nim->cal_max ;
-   nhdr.cal_min = nim->cal_min ;
+/*----------------------------------------------------------------------*/
+/*! write a nifti_image to disk in ASCII format
+*//*--------------------------------------------------------------------*/
+znzFile nifti_write_ascii_image(nifti_image *nim, const nifti_brick_list * NBL,
+                              const char *opts, int write_data, int leave_open)
+{
+   znzFile   fp;
+   char    * hstr;
 
-   nhdr.slice_duration = nim->slice_duration ;
-   nhdr.toffset        = nim->toffset ;
-   nhdr.slice_start    = nim->slice_start ;
-   nhdr.slice_end      = nim->slice_end ;
+   hstr = nifti_image_to_ascii( nim ) ;  /* get header in ASCII form */
+   if( ! hstr ){ fprintf(stderr,"** failed image_to_ascii()\n"); return NULL; }
 
-   if( nim->descrip[0] != '\0' ){
-     memcpy(nhdr.descrip ,nim->descrip ,79) ; nhdr.descrip[79] = '\0' ;
-   }
-   if( nim->aux_file[0] != '\0' ){
-     memcpy(nhdr.aux_file ,nim->aux_file ,23) ; nhdr.aux_file[23] = '\0' ;
+   fp = znzopen( nim->fname , opts , nifti_is_gzfile(nim->fname) ) ;
+   if( znz_isnull(fp) ){
+      free(hstr);
+      fprintf(stderr,"** NIFTI: failed to open '%s' for ascii write\n",
+              nim->fname);
+      return fp;
    }
 
-   if( nim->qform_code > 0 ){
-     nhdr.qform_code = nim->qform_code ;
-     nhdr.quatern_b  = nim->quatern_b ;
-     nhdr.quatern_c  = nim->quatern_c ;
-     nhdr.quatern_d  = nim->quatern_d ;
-     nhdr.qoffset_x  = nim->qoffset_x ;
-     nhdr.qoffset_y  = nim->qoffset_y ;
-     nhdr.qoffset_z  = nim->qoffset_z ;
-     nhdr.pixdim[0]  = (nim->qfac >= 0.0) ? 1.0F : -1.0F ;
-   }
+   znzputs(hstr,fp);                                               /* header */
+   nifti_write_extensions(fp,nim);                             /* extensions */
 
-   if( nim->sform_code > 0 ){
-     nhdr.sform_code = nim->sform_code ;
-     nhdr.srow_x[0]  = nim->sto_xyz.m[0][0] ;
-     nhdr.srow_x[1]  = nim->sto_xyz.m[0][1] ;
-     nhdr.srow_x[2]  = nim->sto_xyz.m[0][2] ;
-     nhdr.srow_x[3]  = nim->sto_xyz.m[0][3] ;
-     nhdr.srow_y[0]  = nim->sto_xyz.m[1][0] ;
-     nhdr.srow_y[1]  = nim->sto_xyz.m[1][1] ;
-     nhdr.srow_y[2]  = nim->sto_xyz.m[1][2] ;
-     nhdr.srow_y[3]  = nim->sto_xyz.m[1][3] ;
-     nhdr.srow_z[0]  = nim->sto_xyz.m[2][0] ;
-     nhdr.srow_z[1]  = nim->sto_xyz.m[2][1] ;
-     nhdr.srow_z[2]  = nim->sto_xyz.m[2][2] ;
-     nhdr.srow_z[3]  = nim->sto_xyz.m[2][3] ;
-   }
+   if ( write_data   ) { nifti_write_all_data(fp,nim,NBL); }         /* data */
+   if ( ! leave_open ) { znzclose(fp); }
+   free(hstr);
+   return fp;  /* returned but may be closed */
+}
 
-   nhdr.slice_code  = nim->slice_code ;
-   nhdr.xyzt_units  = SPACE_TIME_TO_XYZT( nim->xyz_units, nim->time_units ) ;
-   nhdr.intent_code = nim->intent_code ;
-   if( nim->intent_name[0] != '\0' ){
-     memcpy(nhdr.intent_name,nim->intent_name,15) ;
-     nhdr.intent_name[15] = '\0' ;
-   }
 
-   nhdr.dim_info = FPS_INTO_DIM_INFO( nim->freq_dim ,
-                                      nim->phase_dim , nim->slice_dim ) ;
+/*--------------------------------------------------------------------------*/
+/*! Write a nifti_image to disk.
 
-   nhdr.unused_str[0] = '\0' ;  /* not needed, but complete */
+   Since data is properly byte-swapped upon reading, it is assumed
+   to be in the byte-order of the current CPU at write time.  Thus,
+   nim->byte_order should match that of the current CPU.  Note that
+   the nifti_set_filenames() function takes the flag, set_byte_order.
 
-   memcpy(hdr, &nhdr, sizeof(nhdr));
+   The following fields of nim affect how the output appears:
+    - nifti_type = 0 ==> ANALYZE-7.5 format file pair will be written
+    - nifti_type = 1 ==> NIFTI-1 format single file will be written
+                         (data offset will be 352+extensions)
+    - nifti_type = 2 ==> NIFTI_1 format file pair will be written
+    - nifti_type = 3 ==> NIFTI_1 ASCII single file will be written
+    - fname is the name of the output file (header or header+data)
+    - if a file pair is being written, iname is the name of the data file
+    - existing files WILL be overwritten with extreme prejudice
+    - if qform_code > 0, the quatern_*, qoffset_*, and qfac fields determine
+      the qform output, NOT the qto_xyz matrix; if you want to compute these
+      fields from the qto_xyz matrix, you can use the utility function
+      nifti_mat44_to_quatern()
 
-   return 0;
+   \sa nifti_image_write_bricks, nifti_image_free, nifti_set_filenames,
+       nifti_image_write_hdr_img
+*//*------------------------------------------------------------------------*/
+void nifti_image_write( nifti_image *nim )
+{
+   (void)nifti_image_write_status(nim);
 }
 
 
-/*----------------------------------------------------------------------*/
-/*! \fn int nifti_copy_extensions(nifti_image * nim_dest, nifti_image * nim_src)
-    \brief copy the nifti1_extension list from src to dest
+/*--------------------------------------------------------------------------*/
+/*! Write a nifti_image to disk, returning 0 on success, else failure.
 
-    Duplicate the list of nifti1_extensions.  The dest structure must
-    be clear of extensions.
-    \return 0 on success, -1 on failure
+    This simple write function takes a nifti_image as input and returns
+    the status of the operation.  It is akin to nifti_image_write, but
+    returns the status.  Changing nifti_image_write from void to int
+    would have backward compatibility ramifications.
 
-    \sa nifti_add_extension, nifti_free_extensions
-*/
-int nifti_copy_extensions(nifti_image * nim_dest, const nifti_image * nim_src)
+   \sa nifti_image_write_bricks, nifti_image_free, nifti_set_filenames,
+       nifti_image_write_engine, nifti_image_write
+*//*------------------------------------------------------------------------*/
+int nifti_image_write_status( nifti_image *nim )
 {
-   char   * data;
-   int64_t  bytes;
-   int      c, size, old_size;
+   znzFile fp=NULL;   /* required for _engine, but promptly ignored */
+   int     rv;
 
-   if( nim_dest->num_ext > 0 || nim_dest->ext_list != NULL ){
-      fprintf(stderr,"** NIFTI: will not copy over existing extensions\n");
-      return -1;
+   rv = nifti_image_write_engine(nim, 1, "wb", &fp, NULL);
+
+   if( fp ){ /* this should not happen, as we requested file closure */
+      if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d niw: done with znzFile\n");
+      free(fp);
    }
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"-d nifti_image_write_status: done, status %d\n", rv);
 
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"+d duplicating %d extension(s)\n", nim_src->num_ext);
+   return rv;
+}
 
-   if( nim_src->num_ext <= 0 ) return 0;
 
-   bytes = nim_src->num_ext * sizeof(nifti1_extension);  /* I'm lazy */
-   nim_dest->ext_list = (nifti1_extension *)malloc(bytes);
-   if( !nim_dest->ext_list ){
-      fprintf(stderr,"** failed to allocate %d nifti1_extension structs\n",
-              nim_src->num_ext);
-      return -1;
-   }
+/*----------------------------------------------------------------------*/
+/*! similar to nifti_image_write_status, but data is in NBL struct,
+    not nim->data
 
-   /* copy the extension data */
-   nim_dest->num_ext = 0;
-   for( c = 0; c < nim_src->num_ext; c++ ){
-      size = old_size = nim_src->ext_list[c].esize;
-      if( size & 0xf ) size = (size + 0xf) & ~0xf; /* make multiple of 16 */
-      if( g_opts.debug > 2 )
-         fprintf(stderr,"+d dup'ing ext #%d of size %d (from size %d)\n",
-                 c, size, old_size);
-      /* data length is size-8, as esize includes space for esize and ecode */
-      data = (char *)calloc(size-8,sizeof(char));      /* maybe size > old */
-      if( !data ){
-         fprintf(stderr,"** NIFTI: failed to alloc %d bytes for extension\n",
-                 size);
-         if( c == 0 ) { free(nim_dest->ext_list); nim_dest->ext_list = NULL; }
-         /* otherwise, keep what we have (a.o.t. deleting them all) */
-         return -1;
-      }
-      /* finally, fill the new structure */
-      nim_dest->ext_list[c].esize = size;
-      nim_dest->ext_list[c].ecode = nim_src->ext_list[c].ecode;
-      nim_dest->ext_list[c].edata = data;
-      memcpy(data, nim_src->ext_list[c].edata, old_size-8);
+   \return 0 on success, 1 on error
+
+   \sa nifti_image_write, nifti_image_free, nifti_set_filenames, nifti_free_NBL
+*//*--------------------------------------------------------------------*/
+int nifti_image_write_bricks_status( nifti_image *nim,
+                                     const nifti_brick_list * NBL )
+{
+   znzFile fp=NULL;
+   int     rv;
 
-      nim_dest->num_ext++;
+   rv = nifti_image_write_engine(nim, 1, "wb", &fp, NBL);
+   if( fp ){
+      if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d niwb: done with znzFile\n");
+      free(fp);
    }
-
-   return 0;
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"-d niwb: done writing bricks, status %d\n", rv);
+   return rv;
 }
 
 
 /*----------------------------------------------------------------------*/
-/*! compute the total size of all extensions
-
-    \return the total of all esize fields
+/*! similar to nifti_image_write, but data is in NBL struct, not nim->data
 
-    Note that each esize includes 4 bytes for ecode, 4 bytes for esize,
-    and the bytes used for the data.  Each esize also needs to be a
-    multiple of 16, so it may be greater than the sum of its 3 parts.
+   \sa nifti_image_write, nifti_image_free, nifti_set_filenames, nifti_free_NBL
 *//*--------------------------------------------------------------------*/
-static int nifti_extension_size(nifti_image *nim)
+void nifti_image_write_bricks( nifti_image *nim, const nifti_brick_list * NBL )
 {
-   int c, size = 0;
+   (void)nifti_image_write_bricks_status(nim, NBL);
+}
 
-   if( !nim || nim->num_ext <= 0 ) return 0;
 
-   if( g_opts.debug > 2 ) fprintf(stderr,"-d ext sizes:");
+/*----------------------------------------------------------------------
+ * volume writer: write an image incrementally, then finalize the header
+ *
+ * The header is written when the writer is opened, using the template
+ * dimensions, and rewritten at close, once the number of volumes and the
+ * data range are known.  A .nii header (with extensions) is rewritten in
+ * place.  For a .nii.gz, the header is written as a separate gzip member
+ * of stored blocks, whose size does not depend on its contents, so it can
+ * also be rewritten in place, while the data is compressed as the next
+ * member.  For .hdr/.img pairs, the header file is just written again.
+ *----------------------------------------------------------------------*/
+struct nifti_volume_writer {
+   nifti_image * nim;           /* copy of the template                 */
+   znzFile       fp;            /* data file, open for writing          */
+   int           nver;          /* NIFTI version of the header          */
+   int           single;        /* header and data in one file          */
+   long          gzhsize;       /* size of a stored gzip header member  */
+   int64_t       nvox;          /* voxels written                       */
+   int           have_range;    /* data range is known                  */
+   double        dmin, dmax;
+   int           failed;
+};
+
+/* update the data range of W with nvox values of data */
+#undef  NIFTI_VW_RANGE
+#define NIFTI_VW_RANGE(type)                                                 \
+   do { const type * d_ = (const type *)data;                                \
+        for( c = 0; c < nvox; c++ ){                                         \
+           v = (double)d_[c];                                                \
+           if( v != v || v - v != 0 ) continue;   /* not finite */           \
+           if( ! W->have_range ){ W->dmin = W->dmax = v; W->have_range = 1; }\
+           else if( v < W->dmin ) W->dmin = v;                               \
+           else if( v > W->dmax ) W->dmax = v;                               \
+        } } while(0)
+
+static void nifti_vw_range(nifti_volume_writer * W, const void * data,
+                           int64_t nvox)
+{
+   int64_t c;
+   double  v;
+
+   switch( W->nim->datatype ){
+      case NIFTI_TYPE_UINT8:   NIFTI_VW_RANGE(uint8_t);  break;
+      case NIFTI_TYPE_INT8:    NIFTI_VW_RANGE(int8_t);   break;
+      case NIFTI_TYPE_UINT16:  NIFTI_VW_RANGE(uint16_t); break;
+      case NIFTI_TYPE_INT16:   NIFTI_VW_RANGE(int16_t);  break;
+      case NIFTI_TYPE_UINT32:  NIFTI_VW_RANGE(uint32_t); break;
+      case NIFTI_TYPE_INT32:   NIFTI_VW_RANGE(int32_t);  break;
+      case NIFTI_TYPE_UINT64:  NIFTI_VW_RANGE(uint64_t); break;
+      case NIFTI_TYPE_INT64:   NIFTI_VW_RANGE(int64_t);  break;
+      case NIFTI_TYPE_FLOAT32: NIFTI_VW_RANGE(float);    break;
+      case NIFTI_TYPE_FLOAT64: NIFTI_VW_RANGE(double);   break;
+      default: break;       /* no range for complex or RGB data */
+   }
+}
+
+/* return the header and extensions of a single file image, as the bytes
+   before the data (iname_offset of them), or NULL on failure */
+static char * nifti_vw_header_bytes(nifti_volume_writer * W, int64_t * len)
+{
+   nifti_image      * nim = W->nim;
+   nifti_1_header     n1hdr;
+   nifti_2_header     n2hdr;
+   nifti1_extension * ext;
+   char             * buf;
+   int64_t            posn;
+   int                c;
+
+   nifti_set_iname_offset(nim, W->nver);
+   if( W->nver == 2 ? nifti_convert_nim2n2hdr(nim, &n2hdr)
+                    : nifti_convert_nim2n1hdr(nim, &n1hdr) )
+      return NULL;
 
-   for ( c = 0; c < nim->num_ext; c++ ){
-      size += nim->ext_list[c].esize;
-      if( g_opts.debug > 2 ) fprintf(stderr,"  %d",nim->ext_list[c].esize);
+   if( !(buf = (char *)calloc(1, nim->iname_offset)) ){
+      fprintf(stderr,"** NIFTI: failed to alloc %" PRId64 " header bytes\n",
+              nim->iname_offset);
+      return NULL;
    }
 
-   if( g_opts.debug > 2 ) fprintf(stderr," (total = %d)\n",size);
+   if( W->nver == 2 ){ memcpy(buf, &n2hdr, sizeof(n2hdr)); posn = sizeof(n2hdr); }
+   else              { memcpy(buf, &n1hdr, sizeof(n1hdr)); posn = sizeof(n1hdr); }
 
-   return size;
+   /* the extender and extensions, as nifti_write_extensions writes them */
+   if( ! valid_nifti_extensions(nim) ) nim->num_ext = 0;
+   if( nim->num_ext > 0 ) buf[posn] = 1;
+   posn += 4;
+   for( c = 0, ext = nim->ext_list; c < nim->num_ext; c++, ext++ ){
+      memcpy(buf + posn,     &ext->esize, sizeof(int));
+      memcpy(buf + posn + 4, &ext->ecode, sizeof(int));
+      memcpy(buf + posn + 8, ext->edata,  ext->esize - 8);
+      posn += ext->esize;
+   }
+
+   *len = nim->iname_offset;
+   return buf;
 }
 
+/*---------------------------------------------------------------------------*/
+/*! open a writer, to write an image a volume (or any part) at a time
+
+    The template nim gives the file name, type and header fields (the data
+    and the number of volumes are not needed).  Data is given in order, by
+    nifti_volume_writer_append, in the CPU byte order, and the header is
+    finalized by nifti_volume_writer_close.  At that point, dim[4..7] are
+    set from the number of volumes written (if it differs from the
+    template), and cal_min/cal_max are set from the data range (if the
+    template has them both 0).
+
+    Output may be .nii or .nii.gz (NIFTI-1 or NIFTI-2), or .hdr/.img pairs.
+
+    e.g. { nifti_volume_writer * W = nifti_volume_writer_open(nim);
+           for( t = 0; t < nt; t++ )
+              nifti_volume_writer_append(W, make_volume(t), nvox_per_vol);
+           if( nifti_volume_writer_close(W) ) handle_error();
+         }
 
-/*----------------------------------------------------------------------*/
-/*! set the nifti_image iname_offset field, based on nifti_type
+    \param nim  template nifti_image (not changed, and may be freed)
 
-    - use nifti_ver to determine the size of the header
-      (0: default, else NIFTI-version)
-    - if writing to 2 files, set offset to 0
-    - if writing to a single NIFTI-1 file, set the offset to
-         352 + total extension size, then align to 16-byte boundary
-    - if writing an ASCII header, set offset to -1
-*//*--------------------------------------------------------------------*/
-void nifti_set_iname_offset(nifti_image *nim, int nifti_ver)
+    \return the writer, or NULL on failure
+
+    \sa nifti_volume_writer_append, nifti_volume_writer_close,
+        nifti_image_write
+*//*-------------------------------------------------------------------------*/
+nifti_volume_writer * nifti_volume_writer_open(const nifti_image * nim)
 {
-   int64_t offset;
-   int64_t hsize = sizeof(nifti_1_header);  /* default */
+   nifti_volume_writer * W;
+   char                * hbuf;
+   int64_t               hlen;
 
-   if( nifti_ver < 0 || nifti_ver > 2 ) {
-      if( g_opts.debug > 0 )
-         fprintf(stderr,"** invalid nifti_ver = %d for set_iname_offset\n",
-                 nifti_ver);
-      /* but stick with the default */
-   } else if( nifti_ver == 2 ) {
-      hsize = sizeof(nifti_2_header);
+   if( !nim || ! nifti_validfilename(nim->fname) ||
+       nim->nifti_type == NIFTI_FTYPE_ASCII || nim->nbyper <= 0 ){
+      fprintf(stderr,"** nifti_volume_writer_open: bad template\n");
+      return NULL;
    }
 
-   switch( nim->nifti_type ){
+   W = (nifti_volume_writer *)calloc(1, sizeof(nifti_volume_writer));
+   if( !W || !(W->nim = nifti_copy_nim_info(nim)) ){
+      fprintf(stderr,"** nifti_volume_writer_open: failed to alloc writer\n");
+      free(W);
+      return NULL;
+   }
+   W->nim->byteorder = nifti_short_order();  /* data is written as given */
+   W->nver   = (nim->nifti_type == NIFTI_FTYPE_NIFTI2_1 ||
+                nim->nifti_type == NIFTI_FTYPE_NIFTI2_2) ? 2 : 1;
+   W->single = nim->nifti_type == NIFTI_FTYPE_NIFTI1_1 ||
+               nim->nifti_type == NIFTI_FTYPE_NIFTI2_1;
+
+   if( W->single && nifti_is_gzfile(nim->fname) ){
+      /* a stored header member, then the data as the next member */
+      hbuf = nifti_vw_header_bytes(W, &hlen);
+      if( hbuf ){
+         W->gzhsize = znz_write_gz_stored(W->nim->fname, hbuf, hlen, "wb");
+         free(hbuf);
+         if( W->gzhsize > 0 ) W->fp = znzopen(W->nim->fname, "ab", 1);
+      }
+   } else
+      /* write the header, and leave the data file open at its offset */
+      nifti_image_write_engine(W->nim, 2, "wb", &W->fp, NULL);
 
-     default:  /* writing into 2 files */
-       /* we only write files with 0 offset in the 2 file format */
-       nim->iname_offset = 0 ;
-     break ;
+   if( znz_isnull(W->fp) ){
+      fprintf(stderr,"** nifti_volume_writer_open: failed to open '%s'\n",
+              nim->fname);
+      nifti_image_free(W->nim);
+      free(W);
+      return NULL;
+   }
 
-     /* NIFTI-1 single binary file - always update */
-     case NIFTI_FTYPE_NIFTI1_1:
-     case NIFTI_FTYPE_NIFTI2_1:
-       offset = nifti_extension_size(nim) + hsize + 4;
-       /* be sure offset is aligned to a 16 byte boundary */
-       if ( ( offset % 16 ) != 0 )  offset = ((offset + 0xf) & ~0xf);
-       if( nim->iname_offset != offset ){
-          if( g_opts.debug > 1 )
-             fprintf(stderr,"+d changing offset from %" PRId64 " to %" PRId64
-                     "\n", nim->iname_offset, offset);
-          nim->iname_offset = offset;
-       }
-     break ;
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d opened volume writer for '%s'\n", W->nim->fname);
 
-     /* non-standard case: NIFTI-1 ASCII header + binary data (single file) */
-     case NIFTI_FTYPE_ASCII:
-       nim->iname_offset = -1 ;             /* compute offset from filesize */
-     break ;
-   }
+   return W;
 }
 
+/*---------------------------------------------------------------------------*/
+/*! append nvox voxels of data to a volume writer
 
-/*----------------------------------------------------------------------*/
-/*! write the nifti_image dataset to disk, optionally including data
-
-   This is just a front-end for nifti_image_write_hdr_img2.
+    The data continues where the last call left off, so it may be given as
+    whole volumes (nx*ny*nz voxels each), or in smaller pieces, such as
+    slabs of slices.
 
-   \param nim        nifti_image to write to disk
-   \param write_data write options (see nifti_image_write_hdr_img2)
-   \param opts       file open options ("wb" from nifti_image_write)
+    \return 0 on success, 1 on failure (after which close will fail)
 
-   \sa nifti_image_write, nifti_image_write_hdr_img2, nifti_image_free,
-       nifti_set_filenames
-*//*--------------------------------------------------------------------*/
-znzFile nifti_image_write_hdr_img( nifti_image *nim , int write_data ,
-                                          const char* opts )
+    \sa nifti_volume_writer_open, nifti_volume_writer_close
+*//*-------------------------------------------------------------------------*/
+int nifti_volume_writer_append(nifti_volume_writer * W, const void * data,
+                               int64_t nvox)
 {
-  return nifti_image_write_hdr_img2(nim,write_data,opts,NULL,NULL);
+   int64_t nbytes;
+
+   if( !W || W->failed ) return 1;
+   if( !data || nvox < 0 ){ W->failed = 1; return 1; }
+
+   nbytes = nvox * W->nim->nbyper;
+   if( nifti_write_buffer(W->fp, data, nbytes) != nbytes ){
+      fprintf(stderr,"** NIFTI: failed to append %" PRId64 " bytes to '%s'\n",
+              nbytes, W->nim->fname);
+      W->failed = 1;
+      return 1;
+   }
+   nifti_vw_range(W, data, nvox);
+   W->nvox += nvox;
+
+   return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/*! finalize the header of a volume writer, close its files and free it
 
-/*----------------------------------------------------------------------*/
-/*! This writes the header (and optionally the image data) to file.
- *
- * This is now just a front-end for nifti_image_write_engine, but the
- * engine will return a status (for success of write), which is promptly
- * ignored by this function.
- *
- * \sa nifti_image_write_engine
-*//*--------------------------------------------------------------------*/
-znzFile nifti_image_write_hdr_img2(nifti_image *nim, int write_opts,
-               const char * opts, znzFile imgfile, const nifti_brick_list * NBL)
+    The data must be a whole number of volumes.  dim[4..7] are updated if
+    the number of volumes differs from the template (to nt volumes, with
+    nu = nv = nw = 1), and cal_min/cal_max are set to the (scaled) data
+    range if the template left them both as 0.
+
+    \return 0 on success, 1 on failure
+
+    \sa nifti_volume_writer_open, nifti_volume_writer_append
+*//*-------------------------------------------------------------------------*/
+int nifti_volume_writer_close(nifti_volume_writer * W)
 {
-   znzFile loc_img = imgfile;   /* might be NULL, might point to open struct */
-   (void)nifti_image_write_engine(nim, write_opts, opts, &loc_img, NBL);
-   return loc_img;
+   nifti_image * nim;
+   znzFile       hfp = NULL;
+   FILE        * fp;
+   char        * hbuf;
+   int64_t       nvol, nvols, hlen, c;
+   double        lo, hi;
+   int           rv = 1;
+
+   if( !W ) return 1;
+   nim = W->nim;
+
+   if( znzclose(W->fp) != 0 ) W->failed = 1;
+
+   nvol = nim->nx * nim->ny * nim->nz;
+   if( W->failed || nvol <= 0 || W->nvox % nvol ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** NIFTI: volume writer for '%s' failed%s\n",
+                 nim->fname, W->failed ? "" : ", partial volume written");
+      goto done;
+   }
+
+   /* set the dimensions from the volumes written */
+   nvols = W->nvox / nvol;
+   for( c = 4, nvol = 1; c <= 7; c++ ) nvol *= nim->dim[c] > 0 ? nim->dim[c] : 1;
+   if( nvols != nvol || nim->dim[0] < 4 ){
+      nim->dim[4] = nvols;
+      nim->dim[5] = nim->dim[6] = nim->dim[7] = 1;
+      nim->dim[0] = nvols > 1 ? 4 : (nim->dim[0] < 3 ? nim->dim[0] : 3);
+      if( nim->dim[0] < 4 ) nim->dim[4] = 1;
+      if( nifti_update_dims_from_array(nim) ) goto done;
+   }
+
+   /* and the display range, from the data */
+   if( W->have_range && nim->cal_min == 0.0 && nim->cal_max == 0.0 ){
+      lo = W->dmin;  hi = W->dmax;
+      if( nim->scl_slope != 0.0 && nim->scl_slope == nim->scl_slope ){
+         lo = W->dmin * nim->scl_slope + nim->scl_inter;
+         hi = W->dmax * nim->scl_slope + nim->scl_inter;
+         if( lo > hi ){ double t = lo; lo = hi; hi = t; }
+      }
+      nim->cal_min = lo;
+      nim->cal_max = hi;
+   }
+
+   /* rewrite the header */
+   if( ! W->single ){
+      if( nifti_image_write_engine(nim, 0, "wb", &hfp, NULL) == 0 ) rv = 0;
+   } else if( (hbuf = nifti_vw_header_bytes(W, &hlen)) != NULL ){
+      if( W->gzhsize > 0 ){
+         if( znz_write_gz_stored(nim->fname, hbuf, hlen, "r+b") == W->gzhsize )
+            rv = 0;
+      } else if( (fp = fopen(nim->fname, "r+b")) != NULL ){
+         if( fwrite(hbuf, 1, hlen, fp) == (size_t)hlen ) rv = 0;
+         if( fclose(fp) != 0 ) rv = 1;
+      }
+      free(hbuf);
+   }
+   if( rv && NIFTI_OPTS.debug > 0 )
+      fprintf(stderr,"** NIFTI: failed to finalize header of '%s'\n",
+              nim->fname);
+   else if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d wrote %" PRId64 " volumes to '%s'\n",
+              nvols, nim->fname);
+
+ done:
+   nifti_image_free(nim);
+   free(W);
+
+   return rv;
 }
 
-#undef  ERREX
-#define ERREX(msg)                                                      \
- do{ fprintf(stderr,"** ERROR: nifti_image_write_engine: %s\n",(msg)) ; \
-     if( imgfile ) *imgfile = fp;                                       \
-     return 1 ; } while(0)
 
+/*---------------------------------------------------------------------------*/
+/*! append volumes to an existing (uncompressed, single file) dataset
 
-/* ----------------------------------------------------------------------*/
-/*! This writes the header (and optionally the image data) to file
- *
- * If imgfile points to a NULL znzFile, it modifies it to a valid and open
- * handle.  If it points to an non-NULL znzFile, it uses that as the open
- * image and simply modifies that structure.  This also depends on write_opts.
- *
- * \param nim        nifti_image to write to disk
- * \param write_opts flags whether to write data and/or close file (see below)
- * \param opts       file-open options, probably "wb" from nifti_image_write()
- * \param imgfile    pointer to optionally open znzFile, for writing image data
-                     (must not be NULL, contents might be NULL)
- * \param NBL        optional nifti_brick_list, containing the image data
-                     (may be NULL)
- *
- * Values for write_opts mode are based on two binary flags
- * ( 0/1 for no-write/write data, and 0/2 for close/leave-open files ) :
- *    -   0 = do not write data and close (do not open data file)
- *    -   1 = write data        and close
- *    -   2 = do not write data and leave data file open
- *    -   3 = write data        and leave data file open
- *
- * \sa nifti_image_write, nifti_image_write_hdr_img, nifti_image_free,
- *     nifti_set_filenames
-*//*---------------------------------------------------------------------*/
-static int nifti_image_write_engine(nifti_image *nim, int write_opts,
-        const char * opts, znzFile * imgfile, const nifti_brick_list * NBL)
-{
-   nifti_1_header n1hdr ;
-   nifti_2_header n2hdr ;
-   znzFile        fp=NULL;
-   int64_t        ss ;
-   int            write_data, leave_open;
-   int            nver, hsize;
-   char           func[] = { "nifti_image_write_engine" };
+    The nvols volumes of data (nx*ny*nz voxels each, in the dataset
+    datatype and the CPU byte order) are written after the existing data,
+    and only dim[0] and dim[4] are updated in the header, which is
+    otherwise left as it is.  So the cost is that of the new data, not of
+    the whole file.  The data is written before the header, so an
+    interrupted append leaves the old dataset intact.
 
-   write_data = write_opts & 1;  /* just separate the bits now */
-   leave_open = write_opts & 2;
+    The dataset must be a .nii file (NIFTI-1 or NIFTI-2, not compressed),
+    with nu = nv = nw = 1.  A NIFTI-1 dataset is limited to 32767 volumes.
+    Data is swapped to the file byte order, if that differs.
 
-   /* check for valid input */
-   if( ! nim || ! imgfile                 ) ERREX("NULL input") ;
-   if( ! nifti_validfilename(nim->fname)  ) ERREX("bad fname input") ;
-   if( write_data && ! nim->data && ! NBL ) ERREX("no image data") ;
+    e.g. for a growing real-time acquisition:
+         for( t = 0; have_volume(t); t++ )
+            if( nifti_image_append_volumes("epi.nii", get_volume(t), 1) )
+               handle_error();
 
-   if( write_data && NBL && ! nifti_NBL_matches_nim(nim, NBL) )
-      ERREX("NBL does not match nim");
+    \param fname  name of the existing dataset
+    \param data   nvols volumes of data to append
+    \param nvols  number of volumes to append
 
-   /* chit-chat */
-   if( g_opts.debug > 1 ){
-      fprintf(stderr,"-d writing nifti file '%s'...\n", nim->fname);
-      if( g_opts.debug > 2 )
-         fprintf(stderr,"-d nifti type %d, offset %" PRId64 "\n",
-                 nim->nifti_type, nim->iname_offset);
+    \return 0 on success, 1 on failure
+
+    \sa nifti_image_write, nifti_volume_writer_open
+*//*-------------------------------------------------------------------------*/
+int nifti_image_append_volumes(const char * fname, const void * data,
+                               int64_t nvols)
+{
+   nifti_image    * nim;
+   nifti_1_header * n1hdr = NULL;
+   nifti_2_header * n2hdr = NULL;
+   znzFile          fp = NULL;
+   char           * sbuf = NULL;
+   const char     * src;
+   int64_t          vbytes, nbytes, done, nt, ss;
+   int              swapped = 0, swap, nver, rv = 1;
+   char             func[] = { "nifti_image_append_volumes" };
+
+   if( !fname || !data || nvols < 0 ){
+      if( NIFTI_OPTS.debug > 0 ) fprintf(stderr,"** %s: bad inputs\n", func);
+      return 1;
    }
 
-   /* get to work */
+   nim = nifti_image_read(fname, 0);
+   if( !nim ) return 1;
 
-   /* if non-standard ASCII, just write output and return */
-   if( nim->nifti_type == NIFTI_FTYPE_ASCII ) {
-      *imgfile = nifti_write_ascii_image(nim,NBL,opts,write_data,leave_open);
-      return 0; /* write_ascii has no status, either */
+   if( (nim->nifti_type != NIFTI_FTYPE_NIFTI1_1 &&
+        nim->nifti_type != NIFTI_FTYPE_NIFTI2_1) ||
+       nifti_is_gzfile(nim->iname) ){
+      if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR(func,"can only append to uncompressed .nii files",fname);
+      nifti_image_free(nim);
+      return 1;
    }
-
-   /* create a header structure to write out */
-   if( nim->nifti_type == NIFTI_FTYPE_NIFTI2_1 ||
-            nim->nifti_type == NIFTI_FTYPE_NIFTI2_2 ) {
-      nifti_set_iname_offset(nim, 2);
-      if( nifti_convert_nim2n2hdr(nim, &n2hdr) ) {
-         *imgfile = NULL;
-         return 1;
-      }
-      nver = 2; /* we will write NIFTI-2 */
-      hsize = (int)sizeof(nifti_2_header);
-   } else {
-      nifti_set_iname_offset(nim, 1);
-      if( nifti_convert_nim2n1hdr(nim, &n1hdr) ) {
-         *imgfile = NULL;
-         return 1;
-      }
-      nver = 1;
-      hsize = (int)sizeof(nifti_1_header);  /* 5 Aug 2015 */
+   if( (nim->dim[0] > 4 && nim->nu * nim->nv * nim->nw > 1) ||
+       nim->iname_offset < 0 ){
+      if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR(func,"cannot append volumes to dataset",fname);
+      nifti_image_free(nim);
+      return 1;
    }
 
-   /* if writing to 2 files, make sure iname is set and different from fname */
-   if( (nim->nifti_type != NIFTI_FTYPE_NIFTI1_1) &&
-       (nim->nifti_type != NIFTI_FTYPE_NIFTI2_1) ){
-       if( nim->iname && strcmp(nim->iname,nim->fname) == 0 ){
-         free(nim->iname) ; nim->iname = NULL ;
-       }
-       if( nim->iname == NULL ){ /* then make a new one */
-         nim->iname = nifti_makeimgname(nim->fname,nim->nifti_type,0,0);
-         if( nim->iname == NULL ) {
-            *imgfile = NULL;
-            return 1;
-         }
-       }
+   nver   = nim->nifti_type == NIFTI_FTYPE_NIFTI2_1 ? 2 : 1;
+   vbytes = nim->nx * nim->ny * nim->nz * nim->nbyper;
+   nt     = nim->nvox / (nim->nx * nim->ny * nim->nz) + nvols;
+   swap   = nim->byteorder != nifti_short_order() && nim->swapsize > 1;
+
+   if( nver == 1 && nt > 32767 ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** %s: %" PRId64 " volumes exceed NIFTI-1 dims\n",
+                 func, nt);
+      nifti_image_free(nim);
+      return 1;
    }
 
-   /* if we have an imgfile and will also write the header there, use it */
-   if( ! znz_isnull(*imgfile) && (nim->nifti_type == NIFTI_FTYPE_NIFTI1_1 ||
-                                  nim->nifti_type == NIFTI_FTYPE_NIFTI2_1) ){
-      if( g_opts.debug > 2 ) fprintf(stderr,"+d using passed file for hdr\n");
-      fp = *imgfile;
-   } else {
-      /* we will write the header to a new file */
-      if( g_opts.debug > 2 )
-         fprintf(stderr,"+d opening output file %s [%s]\n",nim->fname,opts);
-      fp = znzopen( nim->fname , opts , nifti_is_gzfile(nim->fname) ) ;
-      if( znz_isnull(fp) ){
-         LNI_FERR(func,"cannot open output file",nim->fname);
-         *imgfile = fp;
-         return 1;
+   /* get the raw header, to change only the dimensions */
+   if( nver == 2 ) n2hdr = nifti_read_n2_hdr(nim->fname, &swapped, 1);
+   else            n1hdr = nifti_read_n1_hdr(nim->fname, &swapped, 1);
+   if( !n1hdr && !n2hdr ) goto done;
+
+   fp = znzopen(nim->iname, "r+b", 0);
+   if( znz_isnull(fp) ){
+      if( NIFTI_OPTS.debug > 0 ) LNI_FERR(func,"cannot open for update",fname);
+      goto done;
+   }
+
+   /* write the new data after the existing data */
+   if( znzseek(fp, (znz_off_t)(nim->iname_offset + nim->nvox * nim->nbyper),
+               SEEK_SET) < 0 ){
+      if( NIFTI_OPTS.debug > 0 ) LNI_FERR(func,"cannot seek to data end",fname);
+      goto done;
+   }
+
+   nbytes = nvols * vbytes;
+   if( swap && nbytes > 0 &&
+       !(sbuf = (char *)malloc(nbytes < NIFTI_PAR_CHUNK ? nbytes
+                                                        : NIFTI_PAR_CHUNK)) ){
+      fprintf(stderr,"** %s: failed to alloc swap buffer\n", func);
+      goto done;
+   }
+   for( done = 0; done < nbytes; done += ss ){
+      ss  = nbytes - done < NIFTI_PAR_CHUNK ? nbytes - done : NIFTI_PAR_CHUNK;
+      src = (const char *)data + done;
+      if( swap ){         /* chunks are a multiple of any swap size */
+         memcpy(sbuf, src, ss);
+         nifti_swap_Nbytes(ss / nim->swapsize, nim->swapsize, sbuf);
+         src = sbuf;
+      }
+      if( nifti_write_buffer(fp, src, ss) != ss ){
+         if( NIFTI_OPTS.debug > 0 )
+            LNI_FERR(func,"failed to append data",fname);
+         goto done;
       }
    }
 
-   /* write the header and extensions */
+   /* then update the header dimensions, in the file byte order */
+   if( nver == 2 ){
+      if( n2hdr->dim[0] < 4 ) n2hdr->dim[0] = 4;
+      n2hdr->dim[4] = nt;
+      if( swapped ) swap_nifti_header(n2hdr, 2);
+      ss = sizeof(nifti_2_header);
+      if( znzseek(fp, 0, SEEK_SET) == 0 &&
+          nifti_write_buffer(fp, n2hdr, ss) == ss ) rv = 0;
+   } else {
+      if( n1hdr->dim[0] < 4 ) n1hdr->dim[0] = 4;
+      n1hdr->dim[4] = (short)nt;
+      if( swapped ) swap_nifti_header(n1hdr, NIFTI_VERSION(*n1hdr));
+      ss = sizeof(nifti_1_header);
+      if( znzseek(fp, 0, SEEK_SET) == 0 &&
+          nifti_write_buffer(fp, n1hdr, ss) == ss ) rv = 0;
+   }
+   if( rv && NIFTI_OPTS.debug > 0 )
+      LNI_FERR(func,"failed to update header",fname);
+
+   if( NIFTI_OPTS.debug > 1 && !rv )
+      fprintf(stderr,"-d appended %" PRId64 " volumes to '%s', nt = %" PRId64
+              "\n", nvols, nim->iname, nt);
+
+ done:
+   if( !znz_isnull(fp) && znzclose(fp) != 0 ) rv = 1;
+   free(sbuf);
+   free(n1hdr);
+   free(n2hdr);
+   nifti_image_free(nim);
 
-   if( nver == 2 ) ss = znzwrite(&n2hdr , 1 , hsize , fp); /* write header */
-   else            ss = znzwrite(&n1hdr , 1 , hsize , fp); /* write header */
+   return rv;
+}
 
-   if( ss < hsize ){
-      LNI_FERR(func,"bad header write to output file",nim->fname);
-      znzclose(fp); *imgfile = fp; return 1;
-   }
 
-   /* write extensions; any errors will be printed */
-   if( nim->nifti_type != NIFTI_FTYPE_ANALYZE )
-      if( nifti_write_extensions(fp,nim) < 0 ) {
-         znzclose(fp); *imgfile = fp; return 1;
-      }
+/*---------------------------------------------------------------------------*/
+/* batch header scanning (nifti_scan_headers)
+
+   Paths are sorted by directory, so that each directory is listed once
+   (by the first worker to reach it), and header and image names are then
+   resolved by searching the sorted listing, rather than by probing the
+   file system for each candidate name.  Only the first block of each
+   header file is read (and inflated, for .gz), the header is converted
+   directly into a compact record, and extensions are not read.
+*//*-------------------------------------------------------------------------*/
 
-   /* if the header is all we want, we are done */
-   if( ! write_data && ! leave_open ){
-      if( g_opts.debug > 2 ) fprintf(stderr,"-d header is all we want: done\n");
-      znzclose(fp); *imgfile = fp; return 0;
-   }
+#define NIFTI_SCAN_CHUNK  64     /* paths per task for the scan workers  */
+#define NIFTI_SCAN_HBYTES ((long)sizeof(nifti_2_header) + 4)  /* + extender */
 
-   /* if multiple files (hdr/img), close fp and use (any) *imgfile for data */
-   if( (nim->nifti_type != NIFTI_FTYPE_NIFTI1_1) &&
-       (nim->nifti_type != NIFTI_FTYPE_NIFTI2_1) ){ /* get a new file pointer */
-      znzclose(fp);         /* first, close header file */
-      /* use any valid *imgfile for img */
-      if( ! znz_isnull(*imgfile) ){
-         if(g_opts.debug > 2) fprintf(stderr,"+d using passed file for img\n");
-         fp = *imgfile;
-      } else {
-         /* else we need a new img file pointer */
-         if( g_opts.debug > 2 )
-            fprintf(stderr,"+d opening img file '%s'\n", nim->iname);
-         fp = znzopen( nim->iname , opts , nifti_is_gzfile(nim->iname) ) ;
-         if( znz_isnull(fp) ) ERREX("cannot open image file") ;
-      }
-   }
+typedef struct {
+   char         ** names;        /* sorted listing of likely nifti files */
+   long            nnames;
+   int64_t         remain;       /* paths not yet scanned                */
+   int             listed;       /* listing was attempted                */
+#ifdef HAVE_PTHREAD
+   pthread_mutex_t lock;         /* held while listing                   */
+#endif
+} nifti_scan_group;
+
+typedef struct {
+   const char    * path;
+   int64_t         index;        /* index into the given list            */
+   size_t          dlen;         /* length of the directory prefix       */
+   int64_t         group;
+} nifti_scan_item;
+
+typedef struct {
+   nifti_scan_item     * items;  /* sorted by directory                  */
+   nifti_scan_group    * groups;
+   int64_t               nitems;
+   nifti_scan_callback   cb;
+   void                * udata;
+   nifti_context       * ctx;    /* context of the caller                */
+#ifdef HAVE_PTHREAD
+   pthread_mutex_t       lock;   /* for the fields below, and callbacks  */
+#endif
+   int64_t               next;   /* next chunk of items to scan          */
+   int64_t               ngood;  /* records with status 0                */
+   int                   stop;   /* set when a callback returns non-zero */
+} nifti_scan_job;
+
+#ifdef HAVE_PTHREAD
+#define NIFTI_SCAN_LOCK(m)   pthread_mutex_lock(m)
+#define NIFTI_SCAN_UNLOCK(m) pthread_mutex_unlock(m)
+#else
+#define NIFTI_SCAN_LOCK(m)
+#define NIFTI_SCAN_UNLOCK(m)
+#endif
 
-   /* have image pointer, ready to write */
+/* length of the directory part of path, including the final separator */
+static size_t nifti_scan_dirlen(const char * path)
+{
+   size_t len = strlen(path);
 
-   znzseek(fp, nim->iname_offset, SEEK_SET);  /* in any case, seek to offset */
+   while( len > 0 && path[len-1] != '/'
+#ifdef _WIN32
+                  && path[len-1] != '\\' && path[len-1] != ':'
+#endif
+        ) len--;
 
-   if( write_data ) nifti_write_all_data(fp,nim,NBL);
-   if( ! leave_open ) znzclose(fp);
+   return len;
+}
 
-   *imgfile = fp;
+/* sort paths by directory, then by their index in the list */
+static int nifti_scan_item_cmp(const void * a, const void * b)
+{
+   const nifti_scan_item * ia = (const nifti_scan_item *)a;
+   const nifti_scan_item * ib = (const nifti_scan_item *)b;
+   size_t                  len = ia->dlen < ib->dlen ? ia->dlen : ib->dlen;
+   int                     rv;
 
+   if( (rv = memcmp(ia->path, ib->path, len)) != 0 ) return rv;
+   if( ia->dlen != ib->dlen ) return ia->dlen < ib->dlen ? -1 : 1;
+   if( ia->index != ib->index ) return ia->index < ib->index ? -1 : 1;
    return 0;
 }
 
+static int nifti_scan_name_cmp(const void * a, const void * b)
+{
+   return strcmp(*(char * const *)a, *(char * const *)b);
+}
 
-/*----------------------------------------------------------------------*/
-/*! write a nifti_image to disk in ASCII format
-*//*--------------------------------------------------------------------*/
-znzFile nifti_write_ascii_image(nifti_image *nim, const nifti_brick_list * NBL,
-                              const char *opts, int write_data, int leave_open)
+/* might name be a nifti file?  (without complaining about it, unlike
+   nifti_find_file_extension) */
+static int nifti_scan_name_ok(const char * name)
 {
-   znzFile   fp;
-   char    * hstr;
+   const char * elist[4] = { ".nii", ".hdr", ".img", ".nia" };
+   size_t       len = strlen(name);
+   int          c;
 
-   hstr = nifti_image_to_ascii( nim ) ;  /* get header in ASCII form */
-   if( ! hstr ){ fprintf(stderr,"** failed image_to_ascii()\n"); return NULL; }
+   if( len > 7 && fileext_n_compare(name+len-3, ".gz", 3) == 0 ) len -= 3;
+   if( len < 5 ) return 0;
+   for( c = 0; c < 4; c++ )
+      if( fileext_n_compare(name+len-4, elist[c], 4) == 0 ) return 1;
+   return 0;
+}
 
-   fp = znzopen( nim->fname , opts , nifti_is_gzfile(nim->fname) ) ;
-   if( znz_isnull(fp) ){
-      free(hstr);
-      fprintf(stderr,"** NIFTI: failed to open '%s' for ascii write\n",
-              nim->fname);
-      return fp;
+/*----------------------------------------------------------------------
+ * nifti_scan_list_dir  - list and sort the likely nifti files of the
+ *                        directory of item (once per group)
+ *
+ * On failure (or without opendir), G->names is left NULL, and names
+ * are then resolved with nifti_fileexists().  Names are matched exactly,
+ * so nifti_scan_findname() falls back to probing when none match.
+ *----------------------------------------------------------------------*/
+static void nifti_scan_list_dir(nifti_scan_group * G,
+                                const nifti_scan_item * item)
+{
+   char * dname;
+
+   dname = (char *)malloc(item->dlen + 2);
+   if( !dname ) return;
+   if( item->dlen ){
+      memcpy(dname, item->path, item->dlen);
+      dname[item->dlen] = '\0';
+   } else strcpy(dname, ".");
+
+   G->nnames = znz_list_dir(dname, &G->names, nifti_scan_name_ok);
+   if( G->nnames < 0 ){
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"-- nifti_scan_headers: cannot list '%s'\n", dname);
+      G->names  = NULL;
+      G->nnames = 0;
+   } else if( !G->names ){    /* empty, but listed */
+      G->names = (char **)malloc(sizeof(char *));
+   } else
+      qsort(G->names, G->nnames, sizeof(char *), nifti_scan_name_cmp);
+
+   free(dname);
+}
+
+/* does fname (in the directory of G) exist?  (probe if there is no G) */
+static int nifti_scan_exists(const nifti_scan_group * G, const char * fname,
+                             size_t dlen)
+{
+   const char * name = fname + dlen;
+
+   if( !G || !G->names ) return nifti_fileexists(fname);
+
+   return bsearch(&name, G->names, G->nnames, sizeof(char *),
+                  nifti_scan_name_cmp) != NULL;
+}
+
+/*----------------------------------------------------------------------
+ * nifti_scan_findname  - find a header or image file, as with
+ *                        nifti_findhdrname() or nifti_findimgname()
+ *
+ * If nifti_type < 0, find a header file for path, else find the image
+ * file of a dataset of that type (with header file path).
+ *
+ * If no name is in the listing of G, the names are probed for with
+ * nifti_fileexists(), as nifti_image_read would (the listing is exact
+ * and case sensitive, while the file system might not be).
+ *
+ * return an allocated name, or NULL if not found
+ *----------------------------------------------------------------------*/
+static char * nifti_scan_findname(const nifti_scan_group * G,
+                                  const char * path, size_t dlen,
+                                  int nifti_type)
+{
+   char         elist[3][5] = { ".hdr", ".nii", ".img" };
+   char         extzip[4]   = ".gz";
+   char         extnia[5]   = ".nia";
+   char       * basename, * name;
+   const char * ext;
+   int          order[2], c;
+
+   if( !nifti_validfilename(path) ) return NULL;
+   ext = nifti_find_file_extension(path);
+
+   if( nifti_type < 0 ){
+      /* .img looks for .hdr first, else .nii first */
+      order[0] = 1;
+      if( ext && nifti_scan_exists(G, path, dlen) ){
+         if( fileext_n_compare(ext, ".img", 4) != 0 )
+            return nifti_strdup(path);
+         order[0] = 0;
+      }
+   } else if( nifti_type == NIFTI_FTYPE_NIFTI1_1 ||
+              nifti_type == NIFTI_FTYPE_NIFTI2_1 )
+      order[0] = 1;   /* .nii */
+   else
+      order[0] = 2;   /* .img */
+   order[1] = nifti_type < 0 ? 1 - order[0] : 3 - order[0];
+
+   if( ext && is_uppercase(ext) ){
+      for( c = 0; c < 3; c++ ) make_uppercase(elist[c]);
+      make_uppercase(extzip);
+      make_uppercase(extnia);
    }
 
-   znzputs(hstr,fp);                                               /* header */
-   nifti_write_extensions(fp,nim);                             /* extensions */
+   if( !(basename = nifti_makebasename(path)) ) return NULL;
+   name = (char *)calloc(sizeof(char), strlen(basename)+8);
+   if( !name ){ free(basename); return NULL; }
 
-   if ( write_data   ) { nifti_write_all_data(fp,nim,NBL); }         /* data */
-   if ( ! leave_open ) { znzclose(fp); }
-   free(hstr);
-   return fp;  /* returned but may be closed */
+   if( nifti_type == NIFTI_FTYPE_ASCII ){
+      strcpy(name, basename);
+      strcat(name, extnia);
+      if( nifti_scan_exists(G, name, dlen) ){ free(basename); return name; }
+   } else {
+      for( c = 0; c < 2; c++ ){
+         strcpy(name, basename);
+         strcat(name, elist[order[c]]);
+         if( nifti_scan_exists(G, name, dlen) ){ free(basename); return name; }
+#ifdef HAVE_ZLIB
+         strcat(name, extzip);
+         if( nifti_scan_exists(G, name, dlen) ){ free(basename); return name; }
+#endif
+      }
+   }
+
+   free(basename);
+   free(name);
+
+   if( G && G->names ) return nifti_scan_findname(NULL, path, dlen, nifti_type);
+
+   return NULL;
 }
 
+/* fill the record fields common to NIFTI-1 and NIFTI-2 headers, with
+   the same repairs as nifti_convert_n[12]hdr2nim */
+#undef  NIFTI_SCAN_FILL
+#define NIFTI_SCAN_FILL(rec, h, ni_ver)                                      \
+ do{ int c_;                                                                \
+     for( c_ = 2; c_ <= (h).dim[0]; c_++ )                                  \
+        if( (h).dim[c_] <= 0 ) (h).dim[c_] = 1;                             \
+     for( c_ = (h).dim[0]+1; c_ <= 7; c_++ )                                \
+        if( (h).dim[c_] != 1 && (h).dim[c_] != 0 ) (h).dim[c_] = 1;         \
+     for( c_ = 1; c_ <= (h).dim[0]; c_++ )                                  \
+        if( (h).pixdim[c_] == 0.0 || !IS_GOOD_FLOAT((h).pixdim[c_]) )       \
+           (h).pixdim[c_] = 1.0;                                            \
+     (rec)->nvox = 1;                                                       \
+     for( c_ = 0; c_ < 8; c_++ ){                                           \
+        (rec)->dim[c_]    = (h).dim[c_];                                    \
+        (rec)->pixdim[c_] = (h).pixdim[c_];                                 \
+        if( c_ >= 1 && c_ <= (h).dim[0] ) (rec)->nvox *= (h).dim[c_];       \
+     }                                                                      \
+     (rec)->datatype   = (h).datatype;                                      \
+     (rec)->vox_offset = (int64_t)(h).vox_offset;                           \
+     if( ni_ver ){                                                          \
+        (rec)->scl_slope   = FIXED_FLOAT((h).scl_slope);                    \
+        (rec)->scl_inter   = FIXED_FLOAT((h).scl_inter);                    \
+        (rec)->intent_code = (h).intent_code;                               \
+        (rec)->qform_code  = (h).qform_code;                                \
+        (rec)->sform_code  = (h).sform_code;                                \
+        (rec)->xyz_units   = XYZT_TO_SPACE((h).xyzt_units);                 \
+        (rec)->time_units  = XYZT_TO_TIME((h).xyzt_units);                  \
+     }                                                                      \
+ } while(0)
 
-/*--------------------------------------------------------------------------*/
-/*! Write a nifti_image to disk.
+/*----------------------------------------------------------------------
+ * nifti_scan_fill_rec  - fill rec from the nbytes of header file in buf
+ *
+ * return 0 on success, else a NIFTI_ERR_* code
+ *----------------------------------------------------------------------*/
+static int nifti_scan_fill_rec(nifti_header_rec * rec, const char * buf,
+                               long nbytes)
+{
+   nifti_1_header n1hdr;
+   nifti_2_header n2hdr;
+   long           hsize;
+   int            ni_ver, onefile, swapsize;
+
+   if( nbytes < (long)sizeof(nifti_1_header) ) return NIFTI_ERR_READ;
+
+   ni_ver = nifti_header_version(buf, (size_t)nbytes);
+   if( ni_ver == 0 || ni_ver == 1 ){
+      hsize = (long)sizeof(n1hdr);
+      memcpy(&n1hdr, buf, sizeof(n1hdr));
+      rec->swapped = need_nhdr_swap(n1hdr.dim[0], n1hdr.sizeof_hdr);
+      if( rec->swapped < 0 ) return NIFTI_ERR_HEADER;
+      if( rec->swapped ) swap_nifti_header(&n1hdr, ni_ver);
+      if( ! nifti_hdr1_looks_good(&n1hdr) || n1hdr.datatype == DT_BINARY ||
+          n1hdr.dim[1] <= 0 ) return NIFTI_ERR_HEADER;
+      onefile = ni_ver && NIFTI_ONEFILE(n1hdr);
+      if( ni_ver ) rec->nifti_type = onefile ? NIFTI_FTYPE_NIFTI1_1
+                                             : NIFTI_FTYPE_NIFTI1_2;
+      else         rec->nifti_type = NIFTI_FTYPE_ANALYZE;
+      NIFTI_SCAN_FILL(rec, n1hdr, ni_ver);
+   } else if( ni_ver == 2 ){
+      hsize = (long)sizeof(n2hdr);
+      if( nbytes < hsize ) return NIFTI_ERR_READ;
+      memcpy(&n2hdr, buf, sizeof(n2hdr));
+      rec->swapped = NIFTI2_NEEDS_SWAP(n2hdr);
+      if( rec->swapped ) swap_nifti_header(&n2hdr, ni_ver);
+      /* as with nifti_read_header, dim[0] must index dim[] and pixdim[] */
+      if( ! nifti_hdr2_looks_good(&n2hdr) || n2hdr.dim[1] <= 0 )
+         return NIFTI_ERR_HEADER;
+      onefile = NIFTI_ONEFILE(n2hdr);
+      rec->nifti_type = onefile ? NIFTI_FTYPE_NIFTI2_1 : NIFTI_FTYPE_NIFTI2_2;
+      NIFTI_SCAN_FILL(rec, n2hdr, ni_ver);
+   } else
+      return NIFTI_ERR_HEADER;
 
-   Since data is properly byte-swapped upon reading, it is assumed
-   to be in the byte-order of the current CPU at write time.  Thus,
-   nim->byte_order should match that of the current CPU.  Note that
-   the nifti_set_filenames() function takes the flag, set_byte_order.
+   nifti_datatype_sizes(rec->datatype, &rec->nbyper, &swapsize);
+   if( rec->nbyper == 0 ) return NIFTI_ERR_HEADER;
 
-   The following fields of nim affect how the output appears:
-    - nifti_type = 0 ==> ANALYZE-7.5 format file pair will be written
-    - nifti_type = 1 ==> NIFTI-1 format single file will be written
-                         (data offset will be 352+extensions)
-    - nifti_type = 2 ==> NIFTI_1 format file pair will be written
-    - nifti_type = 3 ==> NIFTI_1 ASCII single file will be written
-    - fname is the name of the output file (header or header+data)
-    - if a file pair is being written, iname is the name of the data file
-    - existing files WILL be overwritten with extreme prejudice
-    - if qform_code > 0, the quatern_*, qoffset_*, and qfac fields determine
-      the qform output, NOT the qto_xyz matrix; if you want to compute these
-      fields from the qto_xyz matrix, you can use the utility function
-      nifti_mat44_to_quatern()
+   if( onefile && rec->vox_offset < hsize ) rec->vox_offset = hsize;
 
-   \sa nifti_image_write_bricks, nifti_image_free, nifti_set_filenames,
-       nifti_image_write_hdr_img
-*//*------------------------------------------------------------------------*/
-void nifti_image_write( nifti_image *nim )
-{
-   (void)nifti_image_write_status(nim);
+   /* extensions are flagged by the first extender byte (if present) */
+   rec->has_ext = nbytes > hsize && buf[hsize] != 0;
+
+   return NIFTI_ERR_NONE;
 }
 
+/* fill rec from an ASCII (.nia) dataset, via nifti_image_read */
+static int nifti_scan_fill_ascii(nifti_header_rec * rec, const char * hname)
+{
+   nifti_image * nim;
+   int           c;
+
+   if( !(nim = nifti_image_read(hname, 0)) ) return NIFTI_ERR_HEADER;
+
+   rec->nifti_type  = nim->nifti_type;
+   rec->datatype    = nim->datatype;
+   rec->nbyper      = nim->nbyper;
+   rec->nvox        = nim->nvox;
+   for( c = 0; c < 8; c++ ){
+      rec->dim[c]    = nim->dim[c];
+      rec->pixdim[c] = nim->pixdim[c];
+   }
+   rec->scl_slope   = nim->scl_slope;
+   rec->scl_inter   = nim->scl_inter;
+   rec->intent_code = nim->intent_code;
+   rec->qform_code  = nim->qform_code;
+   rec->sform_code  = nim->sform_code;
+   rec->xyz_units   = nim->xyz_units;
+   rec->time_units  = nim->time_units;
+   rec->vox_offset  = nim->iname_offset;
+   rec->has_ext     = nim->num_ext > 0;
+
+   nifti_image_free(nim);
+
+   return NIFTI_ERR_NONE;
+}
+
+/* scan one path, and pass its record to the callback */
+static void nifti_scan_one(nifti_scan_job * job, nifti_scan_item * item)
+{
+   nifti_scan_group * G = job->groups + item->group;
+   nifti_header_rec   rec;
+   char               buf[NIFTI_SCAN_HBYTES];
+   char             * hname = NULL, * iname = NULL;
+   long               nbytes;
+
+   /* the first path of a directory lists it, the others wait for that */
+   NIFTI_SCAN_LOCK(&G->lock);
+   if( ! G->listed ){
+      nifti_scan_list_dir(G, item);
+      G->listed = 1;
+   }
+   NIFTI_SCAN_UNLOCK(&G->lock);
+
+   memset(&rec, 0, sizeof(rec));
+   rec.path  = item->path;
+   rec.index = item->index;
+
+   hname = nifti_scan_findname(G, item->path, item->dlen, -1);
+   if( !hname ){
+      if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR("nifti_scan_headers","failed to find header file for",
+                  item->path);
+      rec.status = NIFTI_ERR_NOFILE;
+   } else if( (nbytes = znz_read_head(hname, buf, sizeof(buf))) < 0 ){
+      if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR("nifti_scan_headers","failed to open header file",hname);
+      rec.status = NIFTI_ERR_OPEN;
+   } else {
+      if( nbytes >= 12 && strncmp(buf, "<nifti_image", 12) == 0 )
+         rec.status = nifti_scan_fill_ascii(&rec, hname);
+      else
+         rec.status = nifti_scan_fill_rec(&rec, buf, nbytes);
+      if( rec.status == NIFTI_ERR_NONE )
+         iname = nifti_scan_findname(G, hname, item->dlen, rec.nifti_type);
+      else if( NIFTI_OPTS.debug > 0 )
+         LNI_FERR("nifti_scan_headers","bad header in file",hname);
+   }
+   rec.hname = hname;
+   rec.iname = iname;
 
-/*--------------------------------------------------------------------------*/
-/*! Write a nifti_image to disk, returning 0 on success, else failure.
+   /* records are passed to the callback one at a time */
+   NIFTI_SCAN_LOCK(&job->lock);
+   if( ! job->stop ){
+      if( rec.status == NIFTI_ERR_NONE ) job->ngood++;
+      if( job->cb && job->cb(&rec, job->udata) ) job->stop = 1;
+   }
+   if( --G->remain == 0 ){   /* done with the listing */
+      znz_free_dir_list(G->names, G->nnames);
+      G->names  = NULL;
+      G->nnames = 0;
+   }
+   NIFTI_SCAN_UNLOCK(&job->lock);
 
-    This simple write function takes a nifti_image as input and returns
-    the status of the operation.  It is akin to nifti_image_write, but
-    returns the status.  Changing nifti_image_write from void to int
-    would have backward compatibility ramifications.
+   free(hname);
+   free(iname);
+}
 
-   \sa nifti_image_write_bricks, nifti_image_free, nifti_set_filenames,
-       nifti_image_write_engine, nifti_image_write
-*//*------------------------------------------------------------------------*/
-int nifti_image_write_status( nifti_image *nim )
+static void * nifti_scan_worker(void * arg)
 {
-   znzFile fp=NULL;   /* required for _engine, but promptly ignored */
-   int     rv;
+   nifti_scan_job * job = (nifti_scan_job *)arg;
+   int64_t          c, k, nchunks;
 
-   rv = nifti_image_write_engine(nim, 1, "wb", &fp, NULL);
+   g_cur_ctx = job->ctx;
 
-   if( fp ){ /* this should not happen, as we requested file closure */
-      if( g_opts.debug > 2 ) fprintf(stderr,"-d niw: done with znzFile\n");
-      free(fp);
+   nchunks = (job->nitems + NIFTI_SCAN_CHUNK - 1) / NIFTI_SCAN_CHUNK;
+   while( 1 ){
+      NIFTI_SCAN_LOCK(&job->lock);
+      c = job->stop ? nchunks : job->next++;
+      NIFTI_SCAN_UNLOCK(&job->lock);
+      if( c >= nchunks ) break;
+
+      for( k = c * NIFTI_SCAN_CHUNK;
+           k < (c+1) * NIFTI_SCAN_CHUNK && k < job->nitems; k++ )
+         nifti_scan_one(job, job->items + k);
    }
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"-d nifti_image_write_status: done, status %d\n", rv);
 
-   return rv;
+   return NULL;
 }
 
 
-/*----------------------------------------------------------------------*/
-/*! similar to nifti_image_write_status, but data is in NBL struct,
-    not nim->data
+/*---------------------------------------------------------------------------*/
+/*! read the headers of many datasets, on a pool of threads
+
+    For each path, the header file is found (as with nifti_image_read),
+    its header is read and a compact nifti_header_rec is passed to cb,
+    along with udata.  This is meant for indexing large archives, so it
+    avoids most of the per-file costs of nifti_image_read(fname, 0):
+
+       - each directory is listed once, and header and image file names
+         are then found in the listing, rather than by probing for each
+         candidate name (names missing from the listing are still probed,
+         so a path is found whenever nifti_image_read would find it)
+       - only the first block of each header file is read (and inflated,
+         for .gz files), without a gz stream
+       - extensions are not read, only flagged (rec->has_ext), so they
+         may be read later, by nifti_image_read, for the files of interest
+       - no nifti_image is allocated (except for ASCII datasets)
+
+    The callback is called once per path, including for failures (with
+    rec->status set to a NIFTI_ERR_* code and rec->hname/iname NULL if not
+    found).  Calls are made from the worker threads in no particular
+    order (use rec->index to match paths), but one at a time, so cb needs
+    no locking of its own.  The strings in rec are only valid during the
+    call.  If cb returns non-zero, scanning stops.
+
+    e.g.  static int add_rec(const nifti_header_rec * rec, void * db)
+          {
+             if( rec->status == 0 ) catalog_add(db, rec);
+             return 0;
+          }
+          ...
+          nifti_scan_headers(paths, npaths, 8, add_rec, db);
 
-   \return 0 on success, 1 on error
+    \param paths    list of dataset names (as for nifti_image_read)
+    \param npaths   number of paths
+    \param nthreads number of threads (< 1 means nifti_get_nthreads())
+    \param cb       function to call with each header record
+    \param udata    pointer passed to cb
 
-   \sa nifti_image_write, nifti_image_free, nifti_set_filenames, nifti_free_NBL
-*//*--------------------------------------------------------------------*/
-int nifti_image_write_bricks_status( nifti_image *nim,
-                                     const nifti_brick_list * NBL )
+    \return the number of headers read successfully, or -1 on failure
+
+    \sa nifti_image_read, nifti_read_header
+*//*-------------------------------------------------------------------------*/
+int64_t nifti_scan_headers(const char * const * paths, int64_t npaths,
+                           int nthreads, nifti_scan_callback cb, void * udata)
 {
-   znzFile fp=NULL;
-   int     rv;
+   nifti_scan_job   job;
+   int64_t          k, g, ngroups;
+   char             func[] = { "nifti_scan_headers" };
 
-   rv = nifti_image_write_engine(nim, 1, "wb", &fp, NBL);
-   if( fp ){
-      if( g_opts.debug > 2 ) fprintf(stderr,"-d niwb: done with znzFile\n");
-      free(fp);
+   if( npaths < 0 || (npaths > 0 && !paths) || !cb ){
+      if( NIFTI_OPTS.debug > 0 ) fprintf(stderr,"** %s: bad inputs\n", func);
+      nifti_set_last_error(NIFTI_ERR_INPUT);
+      return -1;
    }
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"-d niwb: done writing bricks, status %d\n", rv);
-   return rv;
-}
+   if( npaths == 0 ) return 0;
 
+   memset(&job, 0, sizeof(job));
+   job.nitems = npaths;
+   job.cb     = cb;
+   job.udata  = udata;
+   job.ctx    = g_cur_ctx;
 
-/*----------------------------------------------------------------------*/
-/*! similar to nifti_image_write, but data is in NBL struct, not nim->data
+   job.items = (nifti_scan_item *)calloc(npaths, sizeof(nifti_scan_item));
+   if( !job.items ){
+      fprintf(stderr,"** %s: failed to alloc %" PRId64 " items\n",
+              func, npaths);
+      nifti_set_last_error(NIFTI_ERR_NOMEM);
+      return -1;
+   }
 
-   \sa nifti_image_write, nifti_image_free, nifti_set_filenames, nifti_free_NBL
-*//*--------------------------------------------------------------------*/
-void nifti_image_write_bricks( nifti_image *nim, const nifti_brick_list * NBL )
-{
-   (void)nifti_image_write_bricks_status(nim, NBL);
+   /**- sort the paths by directory, and group them */
+   for( k = 0; k < npaths; k++ ){
+      job.items[k].path  = paths[k] ? paths[k] : "";
+      job.items[k].index = k;
+      job.items[k].dlen  = nifti_scan_dirlen(job.items[k].path);
+   }
+   qsort(job.items, npaths, sizeof(nifti_scan_item), nifti_scan_item_cmp);
+
+   for( k = 0, ngroups = 0; k < npaths; k++ ){
+      if( k == 0 || job.items[k].dlen != job.items[k-1].dlen ||
+          memcmp(job.items[k].path, job.items[k-1].path, job.items[k].dlen) )
+         ngroups++;
+      job.items[k].group = ngroups - 1;
+   }
+
+   job.groups = (nifti_scan_group *)calloc(ngroups, sizeof(nifti_scan_group));
+   if( !job.groups ){
+      fprintf(stderr,"** %s: failed to alloc %" PRId64 " groups\n",
+              func, ngroups);
+      nifti_set_last_error(NIFTI_ERR_NOMEM);
+      free(job.items);
+      return -1;
+   }
+   for( k = 0; k < npaths; k++ )
+      job.groups[job.items[k].group].remain++;
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"-d %s: %" PRId64 " paths in %" PRId64 " directories\n",
+              func, npaths, ngroups);
+
+   /**- scan, using this thread as one of the workers */
+   if( nthreads < 1 ) nthreads = nifti_get_nthreads();
+#ifdef HAVE_PTHREAD
+   {
+      pthread_t * tids;
+      int         c, nstarted = 0;
+      int64_t     nchunks = (npaths + NIFTI_SCAN_CHUNK - 1) / NIFTI_SCAN_CHUNK;
+
+      if( nthreads > nchunks ) nthreads = (int)nchunks;
+
+      pthread_mutex_init(&job.lock, NULL);
+      for( g = 0; g < ngroups; g++ )
+         pthread_mutex_init(&job.groups[g].lock, NULL);
+
+      tids = nthreads > 1 ?
+             (pthread_t *)malloc(nthreads * sizeof(pthread_t)) : NULL;
+      for( c = 1; tids && c < nthreads; c++ )
+         if( pthread_create(tids+nstarted, NULL, nifti_scan_worker, &job) == 0 )
+            nstarted++;
+      nifti_scan_worker(&job);
+      for( c = 0; c < nstarted; c++ )
+         pthread_join(tids[c], NULL);
+      free(tids);
+
+      for( g = 0; g < ngroups; g++ )
+         pthread_mutex_destroy(&job.groups[g].lock);
+      pthread_mutex_destroy(&job.lock);
+
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"-d %s: scanned using %d threads\n", func, nstarted+1);
+   }
+#else
+   nifti_scan_worker(&job);
+#endif
+
+   /**- free any listings left by stopping early */
+   for( g = 0; g < ngroups; g++ )
+      znz_free_dir_list(job.groups[g].names, job.groups[g].nnames);
+   free(job.groups);
+   free(job.items);
+
+   return job.ngood;
 }
 
 
@@ -8319,7 +11402,7 @@ char *nifti_image_to_ascii( const nifti_image *nim )
 
    if( nim == NULL ) return NULL ;   /* stupid caller */
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"+d converting %s to ASCII\n",nim->fname);
 
    const size_t bufLen = 65534; /* longer than needed, to be safe */
@@ -8821,7 +11904,7 @@ int nifti_nim_is_valid(nifti_image * nim, int complain)
       return 0;
    }
 
-   if( g_opts.debug > 2 ) fprintf(stderr,"-d nim_is_valid check...\n");
+   if( NIFTI_OPTS.debug > 2 ) fprintf(stderr,"-d nim_is_valid check...\n");
 
    /**- check that dim[] matches the individual values ndim, nx, ny, ... */
    if( ! nifti_nim_has_valid_dims(nim,complain) ){
@@ -8886,7 +11969,7 @@ int nifti_nim_has_valid_dims(nifti_image * nim, int complain)
                      nim->nt, nim->nu, nim->nv, nim->nw );
    }
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"-d check dim[%" PRId64 "] =", nim->dim[0]);
       for( c = 0; c < 7; c++ ) fprintf(stderr," %" PRId64 "", nim->dim[c]);
       fputc('\n', stderr);
@@ -8915,14 +11998,14 @@ int nifti_nim_has_valid_dims(nifti_image * nim, int complain)
    /**- if debug, warn about any remaining dim that is neither 0, nor 1 */
    /*   (values in dims above dim[0] are undefined, as reminded by Cinly
          Ooi and Alle Meije Wink)                   16 Nov 2005 [rickr] */
-   if( g_opts.debug > 1 )
+   if( NIFTI_OPTS.debug > 1 )
       for( c = nim->dim[0]+1; c <= 7; c++ )
          if( nim->dim[c] != 0 && nim->dim[c] != 1 )
             fprintf(stderr,"** NIFTI NVd warning: dim[%" PRId64 "] = %" PRId64
                     ", but ndim = %" PRId64 "\n",
                     c, nim->dim[c], nim->dim[0]);
 
-   if( g_opts.debug > 2 )
+   if( NIFTI_OPTS.debug > 2 )
       fprintf(stderr,"-d nim_has_valid_dims check, errs = %d\n", errs);
 
    /**- return invalid or valid */
@@ -8976,7 +12059,7 @@ int nifti_nim_has_valid_dims(nifti_image * nim, int complain)
              ret_val = nifti_read_collapsed_image(nim, dims, &data);
              if( ret_val > 0 ){
                 process_time_series(data);
-                free(data);
+                nifti_data_free(data);
              }
            }
 
@@ -8991,7 +12074,7 @@ int nifti_nim_has_valid_dims(nifti_image * nim, int complain)
                 ret_val = nifti_read_collapsed_image(nim, dims, &data);
                 if( ret_val > 0 ) process_slice(zslice, data);
              }
-             free(data);
+             nifti_data_free(data);
            }
 
     \return
@@ -9017,7 +12100,7 @@ int64_t nifti_read_collapsed_image( nifti_image * nim, const int64_t dims [8],
       return -1;
    }
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"-d read_collapsed_image:\n        dims =");
       for(c = 0; c < 8; c++) fprintf(stderr," %3" PRId64 "", dims[c]);
       fprintf(stderr,"\n   nim->dims =");
@@ -9026,45 +12109,155 @@ int64_t nifti_read_collapsed_image( nifti_image * nim, const int64_t dims [8],
    }
 
    /** - verify that dim[] makes sense */
-   if( ! nifti_nim_is_valid(nim, g_opts.debug > 0) ){
+   if( ! nifti_nim_is_valid(nim, NIFTI_OPTS.debug > 0) ){
       fprintf(stderr,"** NIFTI: invalid nim (file is '%s')\n", nim->fname );
       return -1;
    }
 
-   /** - verify that dims[] makes sense for this dataset */
-   for( c = 1; c <= nim->dim[0]; c++ ){
-      if( dims[c] >= nim->dim[c] ){
-         fprintf(stderr,"** nifti_RCI: dims[%" PRId64 "] >= nim->dim[%" PRId64
-                 "] (%" PRId64 ",%" PRId64 ")\n",
-                 c, c, dims[c], nim->dim[c]);
+   /** - verify that dims[] makes sense for this dataset */
+   for( c = 1; c <= nim->dim[0]; c++ ){
+      if( dims[c] >= nim->dim[c] ){
+         fprintf(stderr,"** nifti_RCI: dims[%" PRId64 "] >= nim->dim[%" PRId64
+                 "] (%" PRId64 ",%" PRId64 ")\n",
+                 c, c, dims[c], nim->dim[c]);
+         return -1;
+      }
+   }
+
+   /** - prepare pivot list - pivots are fixed indices */
+   if( make_pivot_list(nim, dims, pivots, prods, &nprods) < 0 ) return -1;
+
+   bytes = rci_alloc_mem(data, prods, nprods, nim->nbyper);
+   if( bytes < 0 ) return -1;
+
+   /** - open the image file for reading at the appropriate offset */
+   fp = nifti_image_load_prep( nim );
+   if( ! fp ){ nifti_data_free(*data);  *data = NULL;  return -1; }
+
+   /** - call the recursive reading function, passing nim, the pivot info,
+         location to store memory, and file pointer and position */
+   c = rci_read_data(nim, pivots, prods, nprods, dims, (char *)*data, fp,
+                     znztell(fp));
+   znzclose(fp);   /* in any case, close the file */
+   if( c < 0 ){ nifti_data_free(*data);  *data = NULL;  return -1; }
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d read %" PRId64 " bytes of collapsed image from %s\n",
+              bytes, nim->fname);
+
+   return bytes;
+}
+
+
+/*----------------------------------------------------------------------
+ * span planning for subregion reads
+ *
+ * Rows of a subregion are added in file order.  Rows that are adjacent
+ * in the file are merged into one span.  Nearby spans are grouped, and
+ * a group is read with a single call into a slab buffer, from which the
+ * spans are copied out.
+ *
+ * The cost model: grouping two spans costs reading the gap between them,
+ * and saves one read call.  For uncompressed files, a read call (and its
+ * seek) is taken to cost about as much as reading NIFTI_SPAN_GAP bytes.
+ * For compressed files, skipping data costs as much as reading it, so
+ * any gap is worth reading, and the file is then read in one forward
+ * pass, a slab at a time.
+ *----------------------------------------------------------------------*/
+static void nifti_span_init(nifti_span_plan * P, znzFile fp,
+                            nifti_image * nim, char * dest)
+{
+   P->fp       = fp;
+   P->nim      = nim;
+   P->max_slab = NIFTI_SPAN_SLAB;
+   P->max_gap  = znz_iscompressed(fp) ? NIFTI_SPAN_SLAB : NIFTI_SPAN_GAP;
+   P->dest     = dest;
+   P->slab     = NULL;
+   P->nspans   = 0;
+   P->nreads   = 0;
+}
+
+static void nifti_span_free(nifti_span_plan * P)
+{
+   free(P->slab);
+   P->slab = NULL;
+}
+
+/* read the current group of spans into dest, and start a new group */
+static int nifti_span_flush(nifti_span_plan * P)
+{
+   int64_t start, len, posn, nbad = 0;
+   int     c;
+
+   if( P->nspans == 0 ) return 0;
+
+   start = P->spans[0];
+   if( P->nspans == 1 ){
+      /* a single span is read directly */
+      len = P->spans[1];
+      if( nifti_read_blocks(P->fp, start, P->dest, len, P->nim,
+                            NIFTI_NAN_ZERO, &nbad) != len )
          return -1;
+   } else {
+      /* read the enclosing slab, and compact the spans into dest */
+      if( !P->slab && !(P->slab = (char *)malloc(P->max_slab)) ){
+         fprintf(stderr,"** NIFTI: failed to alloc subregion buffer\n");
+         return -1;
+      }
+      c   = P->nspans - 1;
+      len = P->spans[2*c] + P->spans[2*c+1] - start;
+      if( (int64_t)znzpread(P->fp, P->slab, (size_t)len, start) != len )
+         return -1;
+      for( c = 0, posn = 0; c < P->nspans; c++ ){
+         memcpy(P->dest + posn, P->slab + (P->spans[2*c] - start),
+                P->spans[2*c+1]);
+         posn += P->spans[2*c+1];
       }
+      len = posn;
+      nifti_fix_read_buffer(P->dest, len, P->nim, NIFTI_NAN_ZERO);
    }
 
-   /** - prepare pivot list - pivots are fixed indices */
-   if( make_pivot_list(nim, dims, pivots, prods, &nprods) < 0 ) return -1;
+   P->dest  += len;
+   P->nspans = 0;
+   P->nreads++;
 
-   bytes = rci_alloc_mem(data, prods, nprods, nim->nbyper);
-   if( bytes < 0 ) return -1;
+   return 0;
+}
 
-   /** - open the image file for reading at the appropriate offset */
-   fp = nifti_image_load_prep( nim );
-   if( ! fp ){ free(*data);  *data = NULL;  return -1; }     /* failure */
+/* add a row of len bytes at file offset off (rows come in file order) */
+static int nifti_span_add(nifti_span_plan * P, int64_t off, int64_t len)
+{
+   int64_t * last;
 
-   /** - call the recursive reading function, passing nim, the pivot info,
-         location to store memory, and file pointer and position */
-   c = rci_read_data(nim, pivots, prods, nprods, dims, (char *)*data, fp,
-                     znztell(fp));
-   znzclose(fp);   /* in any case, close the file */
-   if( c < 0 ){ free(*data);  *data = NULL;  return -1; }    /* failure */
+   if( P->nspans > 0 ){
+      last = P->spans + 2*(P->nspans-1);
 
-   if( g_opts.debug > 1 )
-      fprintf(stderr,"+d read %" PRId64 " bytes of collapsed image from %s\n",
-              bytes, nim->fname);
+      /* adjacent rows extend the last span (a lone span has no limit) */
+      if( off == last[0] + last[1] &&
+          (P->nspans == 1 || off + len - P->spans[0] <= P->max_slab) ){
+         last[1] += len;
+         return 0;
+      }
 
-   return bytes;
-}
+      /* nearby rows join the group, if the gap is worth reading */
+      if( off > last[0] + last[1] && off - (last[0] + last[1]) <= P->max_gap
+          && off + len - P->spans[0] <= P->max_slab
+          && P->nspans < NIFTI_SPAN_MAX ){
+         P->spans[2*P->nspans]   = off;
+         P->spans[2*P->nspans+1] = len;
+         P->nspans++;
+         return 0;
+      }
+
+      if( nifti_span_flush(P) ) return -1;
+   }
 
+   P->spans[0] = off;
+   P->spans[1] = len;
+   P->nspans   = 1;
+
+   return 0;
+}
 
 /* local function to find strides per dimension. assumes 7D size and
 ** stride array.
@@ -9118,7 +12311,7 @@ int64_t nifti_read_subregion_image( nifti_image * nim,
   int64_t i,j,k,l,m,n;          /* indices for dims */
   int64_t bytes = 0;            /* total # bytes read */
   int64_t total_alloc_size;     /* size of buffer allocation */
-  char   *readptr;              /* where in *data to read next */
+  nifti_span_plan plan;         /* merges rows into fewer reads */
   int64_t strides[7];           /* strides between dimensions */
   int64_t collapsed_dims[8];    /* for read_collapsed_image */
   int64_t *image_size;          /* pointer to dimensions in header */
@@ -9159,7 +12352,7 @@ int64_t nifti_read_subregion_image( nifti_image * nim,
   /* check region sizes for sanity */
   for(i = 0; i < nim->ndim; i++)
     if(start_index[i]  + region_size[i] > image_size[i]) {
-      if(g_opts.debug > 1)
+      if(NIFTI_OPTS.debug > 1)
         fprintf(stderr,"region doesn't fit within image size\n");
       return -1;
     }
@@ -9167,13 +12360,13 @@ int64_t nifti_read_subregion_image( nifti_image * nim,
   /* get the file open */
   fp = nifti_image_load_prep( nim );
   if(znz_isnull(fp)) {
-    if(g_opts.debug > 0)
+    if(NIFTI_OPTS.debug > 0)
       fprintf(stderr,"** nifti_read_subregion_image, failed load_prep\n");
     return -1;
   }
 
   /* the current offset is just past the nifti header, save
-   * location so that SEEK_SET can be used below
+   * location so that rows can be read relative to it
    */
   initial_offset = znztell(fp);
   /* get strides*/
@@ -9185,18 +12378,19 @@ int64_t nifti_read_subregion_image( nifti_image * nim,
   for(i = 0; i < nim->ndim; i++) total_alloc_size *= region_size[i];
 
   /* allocate buffer, if necessary */
-  if(! *data) *data = malloc(total_alloc_size);
+  if(! *data) *data = nifti_data_alloc_aligned(nifti_get_data_align(),
+                                               total_alloc_size);
 
   if(! *data) {
-    if(g_opts.debug > 1)
+    if(NIFTI_OPTS.debug > 1)
       fprintf(stderr,"allocation of %" PRId64 " bytes failed\n",
               total_alloc_size);
     znzclose(fp);
     return -1;
   }
 
-  /* point to start of data buffer as char * */
-  readptr = *((char **)data);
+  /* rows are planned into spans, which are read once each */
+  nifti_span_init(&plan, fp, nim, *((char **)data));
   {
   /* can't assume that start_index and region_size have any more than
   ** nim->ndim elements so make local copies, filled out to seven elements
@@ -9211,14 +12405,14 @@ int64_t nifti_read_subregion_image( nifti_image * nim,
     rs[i] = 1;
   }
 
-  /* loop through subregion and read a row at a time */
+  /* loop through subregion and add a row at a time, in file order */
   for(i = si[6]; i < (si[6] + rs[6]); i++) {
     for(j = si[5]; j < (si[5] + rs[5]); j++) {
       for(k = si[4]; k < (si[4] + rs[4]); k++) {
         for(l = si[3]; l < (si[3] + rs[3]); l++) {
           for(m = si[2]; m < (si[2] + rs[2]); m++) {
             for(n = si[1]; n < (si[1] + rs[1]); n++) {
-              int64_t nread,read_amount;
+              int64_t read_amount;
               offset = initial_offset +
                 (i * strides[6]) +
                 (j * strides[5]) +
@@ -9227,18 +12421,16 @@ int64_t nifti_read_subregion_image( nifti_image * nim,
                 (m * strides[2]) +
                 (n * strides[1]) +
                 (si[0] * strides[0]);
-              znzseek(fp, offset, SEEK_SET); /* seek to current row */
               read_amount = rs[0] * nim->nbyper; /* read a row of subregion */
-              nread = nifti_read_buffer(fp, readptr, read_amount, nim);
-              if(nread != read_amount) {
-                if(g_opts.debug > 0)
+              if(nifti_span_add(&plan, offset, read_amount)) {
+                if(NIFTI_OPTS.debug > 0)
                   fprintf(stderr,"read of %" PRId64 " bytes failed\n",
                           read_amount);
+                nifti_span_free(&plan);
                 znzclose(fp);
                 return -1;
               }
-            bytes += nread;
-            readptr += read_amount;
+            bytes += read_amount;
             }
           }
         }
@@ -9246,14 +12438,683 @@ int64_t nifti_read_subregion_image( nifti_image * nim,
     }
   }
   }
+  if(nifti_span_flush(&plan)) {
+    if(NIFTI_OPTS.debug > 0)
+      fprintf(stderr,"** failed to read subregion from '%s'\n", nim->iname);
+    nifti_span_free(&plan);
+    znzclose(fp);
+    return -1;
+  }
+  if(NIFTI_OPTS.debug > 1)
+    fprintf(stderr,"+d read %" PRId64 " subregion bytes in %" PRId64
+            " reads\n", bytes, plan.nreads);
+  nifti_span_free(&plan);
   znzclose(fp);
   return bytes;
 }
 
 
+/* compare rows of nifti_read_subregions by file offset */
+static int nifti_roi_row_compare(const void * a, const void * b)
+{
+   int64_t oa = ((const nifti_roi_row *)a)->off;
+   int64_t ob = ((const nifti_roi_row *)b)->off;
+   return (oa > ob) - (oa < ob);
+}
+
+/*---------------------------------------------------------------------------*/
+/*! read many subregions from a nifti image, with one pass over the file
+
+    This is like calling nifti_read_subregion_image once per region, but
+    the file is opened once, and the rows of all regions are sorted into a
+    single schedule by file offset.  Nearby rows are grouped as in
+    nifti_read_subregion_image, each group is read (and byte swapped) only
+    once, and its rows are copied out to every region that uses them, so
+    overlapping regions do not cost extra I/O.  Since the reads are made in
+    increasing offset order, a compressed file is read in a single forward
+    pass.
+
+    \param nim      given nifti_image struct, corresponding to the data file
+    \param nregions number of subregions to read
+    \param starts   starts[r] is the start_index of region r (nim->ndim values)
+    \param sizes    sizes[r] is the region_size of region r (nim->ndim values)
+    \param bufs     bufs[r] is where region r is returned (if bufs[r] is NULL,
+                    it will be allocated, otherwise it is assumed to be large
+                    enough)
+
+    \return
+        -  the total number of bytes returned over all regions, or < 0 on
+           failure (in which case any buffers allocated here are freed)
+        -  the read and byte-swapped data, in bufs
+
+    \sa nifti_read_subregion_image, nifti_read_collapsed_image
+*//*-------------------------------------------------------------------------*/
+int64_t nifti_read_subregions(nifti_image * nim, int nregions,
+                              const int64_t ** starts,
+                              const int64_t ** sizes, void ** bufs)
+{
+   nifti_roi_row * rows = NULL;
+   znzFile   fp;
+   char    * slab = NULL, * alloced = NULL;
+   int64_t   strides[7], si[7], rs[7], ind[7];
+   int64_t   nrows = 0, maxrow = 0, bytes = 0, nreads = 0;
+   int64_t   base, rlen, nrrows, gstart, gend, end, max_gap, max_slab;
+   int64_t   row, i, j;
+   int       r, d, rv = -1;
+
+   if( !nim || nregions <= 0 || !starts || !sizes || !bufs ){
+      fprintf(stderr,"** nifti_read_subregions: bad params\n");
+      return -1;
+   }
+
+   /* check the regions, and count their rows */
+   for( r = 0; r < nregions; r++ ){
+      if( !starts[r] || !sizes[r] ){
+         fprintf(stderr,"** nifti_read_subregions: missing region %d\n", r);
+         return -1;
+      }
+      nrrows = 1;
+      for( d = 0; d < nim->ndim; d++ ){
+         if( starts[r][d] < 0 || sizes[r][d] < 1 ||
+             starts[r][d] + sizes[r][d] > nim->dim[d+1] ){
+            if( NIFTI_OPTS.debug > 0 )
+               fprintf(stderr,"** region %d doesn't fit within image\n", r);
+            return -1;
+         }
+         if( d > 0 ) nrrows *= sizes[r][d];
+      }
+      rlen = sizes[r][0] * nim->nbyper;
+      if( rlen > maxrow ) maxrow = rlen;
+      nrows += nrrows;
+      bytes += nrrows * rlen;
+   }
+
+   rows    = (nifti_roi_row *)malloc(nrows * sizeof(nifti_roi_row));
+   alloced = (char *)calloc(nregions, sizeof(char));
+   if( !rows || !alloced ){
+      fprintf(stderr,"** nifti_read_subregions: failed to alloc %" PRId64
+              " rows\n", nrows);
+      free(rows); free(alloced);
+      return -1;
+   }
+
+   /* the schedule: every row of every region, in file order */
+   compute_strides(strides, &(nim->dim[1]), nim->nbyper);
+   for( r = 0, row = 0; r < nregions; r++ ){
+      for( d = 0; d < 7; d++ ){
+         si[d] = d < nim->ndim ? starts[r][d] : 0;
+         rs[d] = d < nim->ndim ? sizes[r][d]  : 1;
+         ind[d] = si[d];
+      }
+      rlen = rs[0] * nim->nbyper;
+      if( !bufs[r] ){
+         nrrows = rs[1]*rs[2]*rs[3]*rs[4]*rs[5]*rs[6];
+         if( !(bufs[r] = nifti_data_alloc_aligned(nifti_get_data_align(),
+                                                  nrrows * rlen)) ){
+            fprintf(stderr,"** nifti_read_subregions: failed to alloc %"
+                    PRId64 " bytes\n", nrrows * rlen);
+            goto done;
+         }
+         alloced[r] = 1;
+      }
+      for( i = 0; ; i++, row++ ){
+         rows[row].off = si[0] * strides[0];
+         for( d = 1; d < 7; d++ ) rows[row].off += ind[d] * strides[d];
+         rows[row].len  = rlen;
+         rows[row].dest = (char *)bufs[r] + i * rlen;
+
+         /* step to the next row of the region */
+         for( d = 1; d < 7; d++ ){
+            if( ++ind[d] < si[d] + rs[d] ) break;
+            ind[d] = si[d];
+         }
+         if( d == 7 ) { row++; break; }
+      }
+   }
+
+   qsort(rows, nrows, sizeof(nifti_roi_row), nifti_roi_row_compare);
+
+   fp = nifti_image_load_prep(nim);
+   if( znz_isnull(fp) ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_read_subregions, failed load_prep\n");
+      goto done;
+   }
+   base = znztell(fp);
+
+   /* group rows with the cost model of nifti_span_add */
+   max_slab = maxrow > NIFTI_SPAN_SLAB ? maxrow : NIFTI_SPAN_SLAB;
+   max_gap  = znz_iscompressed(fp) ? max_slab : NIFTI_SPAN_GAP;
+
+   for( i = 0; i < nrows; i = j ){
+      gstart = rows[i].off;
+      gend   = gstart + rows[i].len;
+      for( j = i+1; j < nrows; j++ ){
+         if( rows[j].off > gend + max_gap ) break;
+         end = rows[j].off + rows[j].len;
+         if( end > gend ){
+            if( end - gstart > max_slab ) break;
+            gend = end;
+         }
+      }
+
+      if( j == i+1 ){
+         /* a lone row is read directly */
+         if( (int64_t)znzpread(fp, rows[i].dest, (size_t)rows[i].len,
+                               base + gstart) != rows[i].len )
+            break;
+         nifti_fix_read_buffer(rows[i].dest, rows[i].len, nim,
+                               NIFTI_NAN_ZERO);
+      } else {
+         /* read the group once, and copy its rows to each region */
+         if( !slab && !(slab = (char *)malloc(max_slab)) ){
+            fprintf(stderr,"** NIFTI: failed to alloc subregion buffer\n");
+            break;
+         }
+         if( (int64_t)znzpread(fp, slab, (size_t)(gend - gstart),
+                               base + gstart) != gend - gstart )
+            break;
+         nifti_fix_read_buffer(slab, gend - gstart, nim, NIFTI_NAN_ZERO);
+         for( row = i; row < j; row++ )
+            memcpy(rows[row].dest, slab + (rows[row].off - gstart),
+                   rows[row].len);
+      }
+      nreads++;
+   }
+   znzclose(fp);
+
+   if( i < nrows ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** failed to read subregions from '%s'\n",
+                 nim->iname);
+   } else {
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"+d read %d subregions (%" PRId64 " bytes) in %"
+                 PRId64 " reads\n", nregions, bytes, nreads);
+      rv = 0;
+   }
+
+ done:
+   if( rv ){
+      for( r = 0; r < nregions; r++ )
+         if( alloced[r] ) { nifti_data_free(bufs[r]); bufs[r] = NULL; }
+   }
+   free(slab);
+   free(alloced);
+   free(rows);
+
+   return rv ? -1 : bytes;
+}
+
+/* compare voxels of nifti_read_timeseries by volume index */
+static int nifti_ts_vox_compare(const void * a, const void * b)
+{
+   int64_t ia = ((const nifti_ts_vox *)a)->index;
+   int64_t ib = ((const nifti_ts_vox *)b)->index;
+   return (ia > ib) - (ia < ib);
+}
+
+/* copy the time points [t0,t1) of the nt volumes at src (each nvol voxels
+   of the given type) into the voxel-major rows of dst, for the sorted
+   voxel list (so reads are in memory order, and each row piece stays in
+   cache while it is written) */
+#undef  NIFTI_TS_GATHER
+#define NIFTI_TS_GATHER(type)                                                \
+   do { const type * s_ = (const type *)src;  type * d_ = (type *)dst;       \
+        int64_t tb_, te_, t_, c_;                                            \
+        for( tb_ = 0; tb_ < nb; tb_ += NIFTI_TS_TBLOCK ){                    \
+           te_ = tb_ + NIFTI_TS_TBLOCK < nb ? tb_ + NIFTI_TS_TBLOCK : nb;    \
+           for( c_ = 0; c_ < nvox; c_++ ){                                   \
+              const type * sv_ = s_ + vox[c_].index;                         \
+              type       * dv_ = d_ + vox[c_].row * nt + t0;                 \
+              for( t_ = tb_; t_ < te_; t_++ ) dv_[t_] = sv_[t_ * nvol];      \
+           } } } while(0)
+
+static void nifti_ts_gather(const char * src, char * dst,
+                            const nifti_ts_vox * vox, int64_t nvox,
+                            int64_t nvol, int64_t nt, int64_t t0,
+                            int64_t nb, int nbyper)
+{
+   int64_t tb, te, t, c;
+
+   switch( nbyper ){
+      case 1: NIFTI_TS_GATHER(uint8_t);  break;
+      case 2: NIFTI_TS_GATHER(uint16_t); break;
+      case 4: NIFTI_TS_GATHER(uint32_t); break;
+      case 8: NIFTI_TS_GATHER(uint64_t); break;
+      default:  /* RGB, complex and long double types */
+         for( tb = 0; tb < nb; tb += NIFTI_TS_TBLOCK ){
+            te = tb + NIFTI_TS_TBLOCK < nb ? tb + NIFTI_TS_TBLOCK : nb;
+            for( c = 0; c < nvox; c++ )
+               for( t = tb; t < te; t++ )
+                  memcpy(dst + (vox[c].row * nt + t0 + t) * nbyper,
+                         src + (t * nvol + vox[c].index) * nbyper, nbyper);
+         }
+         break;
+   }
+}
+
+/*---------------------------------------------------------------------------*/
+/*! read the time series of many voxels, with one pass over the data
+
+    Rather than reading each time series separately (e.g. with
+    nifti_read_collapsed_image), the volumes are read in order, in batches
+    of about NIFTI_TS_BATCH bytes, and the voxel values are transposed
+    into a voxel-major matrix, so out[v*nt + t] is the value of voxel v at
+    time point t.  Here nt is the number of volumes (the product of
+    dimensions 4 through 7).  If nim->data is already loaded, it is used
+    and the file is not read.
+
+    \param nim      given nifti_image struct, corresponding to the data file
+    \param nvox     number of voxels
+    \param ijk_list i,j,k indices of the voxels, 3 values per voxel
+    \param out      pointer to data pointer (if *out is NULL, nvox*nt values
+                    will be allocated, otherwise it is assumed to be large
+                    enough)
+
+    \return
+        -  the total number of bytes returned, or < 0 on failure
+        -  the read and byte-swapped time series, in out
+
+    \sa nifti_read_collapsed_image, nifti_read_subregions
+*//*-------------------------------------------------------------------------*/
+int64_t nifti_read_timeseries(nifti_image * nim, int64_t nvox,
+                              const int64_t * ijk_list, void ** out)
+{
+   nifti_ts_vox * vox = NULL;
+   znzFile        fp;
+   char         * batch = NULL;
+   int64_t        nvol, nt, vbytes, bytes, nbatch, base, t0, nb, nread, c;
+   int            alloced = 0, nthreads, rv = -1;
+
+   if( !nim || nvox <= 0 || !ijk_list || !out ){
+      fprintf(stderr,"** nifti_read_timeseries: bad params\n");
+      return -1;
+   }
+
+   nvol   = nim->nx * nim->ny * nim->nz;
+   nt     = nvol > 0 ? nim->nvox / nvol : 0;
+   vbytes = nvol * nim->nbyper;
+   bytes  = nvox * nt * nim->nbyper;
+   if( nt <= 0 || nim->nbyper <= 0 ){
+      fprintf(stderr,"** nifti_read_timeseries: bad dims in '%s'\n",
+              nim->fname);
+      return -1;
+   }
+
+   /* check the voxels, and sort them by their index in a volume */
+   vox = (nifti_ts_vox *)malloc(nvox * sizeof(nifti_ts_vox));
+   if( !vox ){
+      fprintf(stderr,"** nifti_read_timeseries: failed to alloc %" PRId64
+              " voxels\n", nvox);
+      return -1;
+   }
+   for( c = 0; c < nvox; c++ ){
+      const int64_t * ijk = ijk_list + 3*c;
+      if( ijk[0] < 0 || ijk[0] >= nim->nx || ijk[1] < 0 ||
+          ijk[1] >= nim->ny || ijk[2] < 0 || ijk[2] >= nim->nz ){
+         if( NIFTI_OPTS.debug > 0 )
+            fprintf(stderr,"** voxel %" PRId64 " (%" PRId64 ",%" PRId64
+                    ",%" PRId64 ") is outside the image\n",
+                    c, ijk[0], ijk[1], ijk[2]);
+         free(vox);
+         return -1;
+      }
+      vox[c].index = ijk[0] + nim->nx * (ijk[1] + nim->ny * ijk[2]);
+      vox[c].row   = c;
+   }
+   qsort(vox, nvox, sizeof(nifti_ts_vox), nifti_ts_vox_compare);
+
+   if( ! *out ){
+      if( !(*out = nifti_data_alloc_aligned(nifti_get_data_align(),
+                                            bytes)) ){
+         fprintf(stderr,"** nifti_read_timeseries: failed to alloc %"
+                 PRId64 " bytes\n", bytes);
+         free(vox);
+         return -1;
+      }
+      alloced = 1;
+   }
+
+   /* if the data is already in memory, just transpose it */
+   if( nim->data ){
+      nifti_ts_gather((const char *)nim->data, (char *)*out, vox, nvox,
+                      nvol, nt, 0, nt, nim->nbyper);
+      free(vox);
+      return bytes;
+   }
+
+   fp = nifti_image_load_prep(nim);
+   if( znz_isnull(fp) ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_read_timeseries, failed load_prep\n");
+      goto done;
+   }
+
+   /* read the volumes in batches, in one forward pass */
+   nbatch = NIFTI_TS_BATCH / vbytes;
+   if( nbatch < 1  ) nbatch = 1;
+   if( nbatch > nt ) nbatch = nt;
+   batch = (char *)malloc(nbatch * vbytes);
+   if( !batch ){
+      fprintf(stderr,"** nifti_read_timeseries: failed to alloc %" PRId64
+              " bytes\n", nbatch * vbytes);
+      znzclose(fp);
+      goto done;
+   }
+
+   nthreads = nifti_get_nthreads();
+   base = znztell(fp);
+   for( t0 = 0; t0 < nt; t0 += nb ){
+      nb = nt - t0 < nbatch ? nt - t0 : nbatch;
+      if( nthreads > 1 && !znz_iscompressed(fp) &&
+          nb * vbytes >= NIFTI_PAR_MIN_LOAD )
+         nread = nifti_pread_parallel(fp, base + t0 * vbytes, batch,
+                                      nb * vbytes, nim, nthreads);
+      else
+         nread = nifti_pread_buffer(fp, base + t0 * vbytes, batch,
+                                    nb * vbytes, nim);
+      if( nread != nb * vbytes ) break;
+      nifti_ts_gather(batch, (char *)*out, vox, nvox, nvol, nt, t0, nb,
+                      nim->nbyper);
+   }
+   znzclose(fp);
+
+   if( t0 < nt ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** failed to read time series from '%s'\n",
+                 nim->iname);
+   } else {
+      if( NIFTI_OPTS.debug > 1 )
+         fprintf(stderr,"+d read %" PRId64 " time series of %" PRId64
+                 " volumes, %" PRId64 " volumes at a time\n",
+                 nvox, nt, nbatch);
+      rv = 0;
+   }
+
+ done:
+   if( rv && alloced ){ nifti_data_free(*out);  *out = NULL; }
+   free(batch);
+   free(vox);
+
+   return rv ? -1 : bytes;
+}
+
+/*----------------------------------------------------------------------
+ * volume reader: stream the volumes of an image, a batch at a time
+ *
+ * Batches are read into a ring of NIFTI_VR_NBUF buffers.  With pthreads,
+ * a background thread reads (decompresses and swaps) the next batches
+ * while the caller works on the current one, so at most NIFTI_VR_NBUF
+ * batches are in memory at a time.  The batch given to the caller is
+ * held until the next call to nifti_volume_reader_next.
+ *----------------------------------------------------------------------*/
+struct nifti_volume_reader {
+   nifti_image   * nim;
+   znzFile         fp;
+   int64_t         offset;              /* file offset of volume 0      */
+   int64_t         vbytes;              /* bytes per volume             */
+   int64_t         nvols;               /* total number of volumes      */
+   int64_t         batch;               /* volumes per buffer           */
+   char          * bufs[NIFTI_VR_NBUF];
+   int64_t         counts[NIFTI_VR_NBUF]; /* volumes in each buffer     */
+   int             head;                /* held, or next to be given    */
+   int             nready;              /* read and not yet given       */
+   int             held;                /* is the caller holding one    */
+   int             done, failed, stop;
+   int64_t         posn;                /* next volume to read          */
+#ifdef HAVE_PTHREAD
+   pthread_t       tid;
+   pthread_mutex_t lock;
+   pthread_cond_t  cond;
+   int             started;             /* is the thread running        */
+   nifti_context * ctx;                 /* context of the opening thread*/
+#endif
+};
+
+/* read the next batch into buffer ind, return its volume count (< 0 on
+   failure) */
+static int64_t nifti_vr_read_batch(nifti_volume_reader * R, int ind)
+{
+   int64_t nb = R->nvols - R->posn < R->batch ? R->nvols - R->posn
+                                              : R->batch;
+
+   if( nifti_pread_buffer(R->fp, R->offset + R->posn * R->vbytes,
+                          R->bufs[ind], nb * R->vbytes, R->nim)
+       != nb * R->vbytes ){
+      fprintf(stderr,"** NIFTI: failed to read volumes %" PRId64 "..%"
+              PRId64 " from '%s'\n", R->posn, R->posn + nb - 1,
+              R->nim->iname);
+      return -1;
+   }
+   R->posn += nb;
+
+   return nb;
+}
+
+#ifdef HAVE_PTHREAD
+/* the background reader: fill free buffers, in ring order */
+static void * nifti_vr_worker(void * arg)
+{
+   nifti_volume_reader * R = (nifti_volume_reader *)arg;
+   int64_t               nb;
+   int                   ind;
+
+   g_cur_ctx = R->ctx;
+   pthread_mutex_lock(&R->lock);
+   while( R->posn < R->nvols ){
+      while( R->nready + R->held >= NIFTI_VR_NBUF && !R->stop )
+         pthread_cond_wait(&R->cond, &R->lock);
+      if( R->stop ) break;
+      ind = (R->head + R->held + R->nready) % NIFTI_VR_NBUF;
+      pthread_mutex_unlock(&R->lock);
+
+      nb = nifti_vr_read_batch(R, ind);    /* the buffer is ours */
+
+      pthread_mutex_lock(&R->lock);
+      if( nb < 0 ){ R->failed = 1; break; }
+      R->counts[ind] = nb;
+      R->nready++;
+      pthread_cond_broadcast(&R->cond);
+   }
+   R->done = 1;
+   pthread_cond_broadcast(&R->cond);
+   pthread_mutex_unlock(&R->lock);
+
+   return NULL;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+/*! open a reader, to stream the volumes of an image in batches
+
+    The volumes (each nx*ny*nz voxels) are given in order, batch volumes
+    at a time, by nifti_volume_reader_next.  When pthreads are available,
+    later batches are read by a background thread while the caller works
+    on the current one.  Memory use is bounded by a few batches, so runs
+    larger than RAM may be processed.  If nim->data is loaded, batches
+    point into it, and nothing is read.
+
+    e.g. { nifti_volume_reader * R = nifti_volume_reader_open(nim, 4);
+           void * vols;
+           int64_t nv;
+           while( (nv = nifti_volume_reader_next(R, &vols)) > 0 )
+              process_volumes(vols, nv);
+           nifti_volume_reader_close(R);
+         }
+
+    \param nim    given nifti_image struct, corresponding to the data file
+    \param batch  number of volumes per batch (at least 1)
+
+    \return the reader, or NULL on failure
+
+    \sa nifti_volume_reader_next, nifti_volume_reader_close,
+        nifti_image_load_bricks
+*//*-------------------------------------------------------------------------*/
+nifti_volume_reader * nifti_volume_reader_open(nifti_image * nim,
+                                               int64_t batch)
+{
+   nifti_volume_reader * R;
+   int64_t               nvol;
+   int                   c;
+
+   if( !nim ){
+      fprintf(stderr,"** nifti_volume_reader_open: missing nim\n");
+      return NULL;
+   }
+
+   nvol = nim->nx * nim->ny * nim->nz;
+   if( nvol <= 0 || nim->nbyper <= 0 ){
+      fprintf(stderr,"** nifti_volume_reader_open: bad dims in '%s'\n",
+              nim->fname);
+      return NULL;
+   }
+
+   R = (nifti_volume_reader *)calloc(1, sizeof(nifti_volume_reader));
+   if( !R ){
+      fprintf(stderr,"** nifti_volume_reader_open: failed to alloc reader\n");
+      return NULL;
+   }
+   R->nim    = nim;
+   R->vbytes = nvol * nim->nbyper;
+   R->nvols  = nim->nvox / nvol;
+   R->batch  = batch < 1 ? 1 : batch > R->nvols ? R->nvols : batch;
+
+   /* data in memory is just handed out */
+   if( nim->data ) return R;
+
+   R->fp = nifti_image_load_prep(nim);
+   if( znz_isnull(R->fp) ){
+      if( NIFTI_OPTS.debug > 0 )
+         fprintf(stderr,"** nifti_volume_reader_open, failed load_prep\n");
+      free(R);
+      return NULL;
+   }
+   R->offset = znztell(R->fp);
+
+   for( c = 0; c < NIFTI_VR_NBUF; c++ )
+      if( !(R->bufs[c] = (char *)nifti_data_alloc_aligned(
+                             nifti_get_data_align(), R->batch * R->vbytes)) ){
+         fprintf(stderr,"** nifti_volume_reader_open: failed to alloc %"
+                 PRId64 " bytes\n", R->batch * R->vbytes);
+         nifti_volume_reader_close(R);
+         return NULL;
+      }
+
+#ifdef HAVE_PTHREAD
+   R->ctx = g_cur_ctx;
+   pthread_mutex_init(&R->lock, NULL);
+   pthread_cond_init(&R->cond, NULL);
+   R->started = pthread_create(&R->tid, NULL, nifti_vr_worker, R) == 0;
+   if( !R->started ){
+      pthread_mutex_destroy(&R->lock);
+      pthread_cond_destroy(&R->cond);
+   }
+#endif
+
+   if( NIFTI_OPTS.debug > 1 )
+      fprintf(stderr,"+d volume reader for '%s': %" PRId64 " volumes, %"
+              PRId64 " per batch\n", nim->iname, R->nvols, R->batch);
+
+   return R;
+}
+
+/*---------------------------------------------------------------------------*/
+/*! get the next batch of volumes from a volume reader
+
+    \param R     reader, from nifti_volume_reader_open
+    \param vols  set to the volume data (valid until the next call)
+
+    \return the number of volumes in the batch, 0 at the end, or < 0 on
+            failure
+
+    \sa nifti_volume_reader_open, nifti_volume_reader_close
+*//*-------------------------------------------------------------------------*/
+int64_t nifti_volume_reader_next(nifti_volume_reader * R, void ** vols)
+{
+   int64_t nb;
+
+   if( !R || !vols ) return -1;
+   *vols = NULL;
+
+   /* data in memory */
+   if( R->nim->data ){
+      nb = R->nvols - R->posn < R->batch ? R->nvols - R->posn : R->batch;
+      *vols = (char *)R->nim->data + R->posn * R->vbytes;
+      R->posn += nb;
+      if( nb == 0 ) *vols = NULL;
+      return nb;
+   }
+
+#ifdef HAVE_PTHREAD
+   if( R->started ){
+      pthread_mutex_lock(&R->lock);
+      if( R->held ){   /* release the last batch to the reader */
+         R->held = 0;
+         R->head = (R->head + 1) % NIFTI_VR_NBUF;
+         pthread_cond_broadcast(&R->cond);
+      }
+      while( R->nready == 0 && !R->done )
+         pthread_cond_wait(&R->cond, &R->lock);
+      if( R->nready > 0 ){
+         *vols = R->bufs[R->head];
+         nb    = R->counts[R->head];
+         R->nready--;
+         R->held = 1;
+      } else nb = R->failed ? -1 : 0;
+      pthread_mutex_unlock(&R->lock);
+      return nb;
+   }
+#endif
+
+   /* no background thread, so read the batch now */
+   if( R->failed ) return -1;
+   if( R->posn >= R->nvols ) return 0;
+   nb = nifti_vr_read_batch(R, 0);
+   if( nb < 0 ){ R->failed = 1; return -1; }
+   *vols = R->bufs[0];
+
+   return nb;
+}
+
+/*---------------------------------------------------------------------------*/
+/*! close a volume reader (at any point), and free its buffers
+
+    \sa nifti_volume_reader_open, nifti_volume_reader_next
+*//*-------------------------------------------------------------------------*/
+void nifti_volume_reader_close(nifti_volume_reader * R)
+{
+   int c;
+
+   if( !R ) return;
+
+#ifdef HAVE_PTHREAD
+   if( R->started ){
+      pthread_mutex_lock(&R->lock);
+      R->stop = 1;
+      pthread_cond_broadcast(&R->cond);
+      pthread_mutex_unlock(&R->lock);
+      pthread_join(R->tid, NULL);
+      pthread_mutex_destroy(&R->lock);
+      pthread_cond_destroy(&R->cond);
+   }
+#endif
+
+   if( R->fp ) znzclose(R->fp);
+   for( c = 0; c < NIFTI_VR_NBUF; c++ ) nifti_data_free(R->bufs[c]);
+   free(R);
+}
+
 /* read the data from the file pointed to by fp
 
-   - this a recursive function, so start with the base case
+   The collapsed image is a list of equal sized leaves (runs of
+   prods[nprods-1] voxels), in file order.  The leaf offsets come from an
+   odometer over the pivot levels, and are passed to a span planner, so
+   that leaves close together in the file (e.g. the time series of a
+   voxel in a small volume) are read as whole slabs, and a compressed
+   file is read in one forward pass.  Many leaves of an uncompressed file
+   may be read by several threads (see nifti_set_nthreads).
+
    - data is now (char *) for easy incrementing
 
    return 0 on success, < 0 on failure
@@ -9262,75 +13123,174 @@ static int rci_read_data(nifti_image * nim, int64_t * pivots, int64_t * prods,
                          int nprods, const int64_t dims[], char * data,
                          znzFile fp, int64_t base_offset)
 {
-   int64_t sublen, offset, read_size;
-   int     c;
+   rci_leaf_list L;
+   int64_t       sublen, nreads;
+   int           c, d, nthreads;
 
    /* bad check first - base_offset may not have been checked */
-   if( nprods <= 0 ){
+   if( nprods <= 0 || nprods > 8 ){
       fprintf(stderr,"** NIFTI rci_read_data, bad prods, %d\n", nprods);
       return -1;
    }
 
-   /* base case: actually read the data */
-   if( nprods == 1 ){
-      int64_t nread, bytes;
+   /* make sure things look good here */
+   if( pivots[nprods-1] != 0 ){
+      fprintf(stderr,"** NIFTI rciRD: final pivot == %" PRId64 "\n",
+              pivots[nprods-1]);
+      return -1;
+   }
+
+   /* each level steps over its pivot dimension, at index dims[pivot] */
+   L.nim    = nim;
+   L.fp     = fp;
+   L.data   = data;
+   L.base   = base_offset;
+   L.nlev   = nprods - 1;
+   L.nleaf  = 1;
+   for( c = 0; c < L.nlev; c++ ){
+      for( d = 1, sublen = 1; d < pivots[c]; d++ ) sublen *= nim->dim[d];
+      L.count[c] = prods[c];
+      L.step[c]  = sublen * nim->dim[pivots[c]] * nim->nbyper;
+      L.base    += sublen * dims[pivots[c]] * nim->nbyper;
+      L.nleaf   *= prods[c];
+   }
+   L.leaf = prods[nprods-1] * nim->nbyper;
+
+   nthreads = nifti_get_nthreads();
+   if( nthreads > 1 && !znz_iscompressed(fp) &&
+       (L.nleaf >= NIFTI_RCI_PAR_LEAVES ||
+        (L.nleaf > 1 && L.nleaf * L.leaf >= NIFTI_PAR_MIN_LOAD)) )
+      nreads = rci_read_parallel(&L, nthreads);
+   else
+      nreads = rci_read_leaves(&L, 0, L.nleaf);
+
+   if( nreads < 0 ){
+      fprintf(stderr,"** NIFTI rciRD: failed to read %" PRId64 " x %" PRId64
+              " bytes from '%s'\n", L.nleaf, L.leaf, nim->fname);
+      return -1;
+   } else if( NIFTI_OPTS.debug > 2 )
+      fprintf(stderr,"+d read %" PRId64 " leaves of %" PRId64
+              " bytes in %" PRId64 " reads\n", L.nleaf, L.leaf, nreads);
+
+   return 0;
+}
+
+/* read leaves [first, first+nleaf) of the list into their place in data
+
+   return the number of read calls, or < 0 on failure
+*/
+static int64_t rci_read_leaves(const rci_leaf_list * L, int64_t first,
+                               int64_t nleaf)
+{
+   nifti_span_plan plan;
+   int64_t         ind[8], offset, c, rem;
+   int             lev;
+
+   if( nleaf <= 0 ) return 0;
+
+   /* set the odometer to the first leaf (the last level is fastest) */
+   for( lev = L->nlev-1, rem = first; lev >= 0; lev-- ){
+      ind[lev] = rem % L->count[lev];
+      rem     /= L->count[lev];
+   }
 
-      /* make sure things look good here */
-      if( *pivots != 0 ){
-         fprintf(stderr,"** NIFTI rciRD: final pivot == %" PRId64 "\n",
-                 *pivots);
+   nifti_span_init(&plan, L->fp, L->nim, L->data + first * L->leaf);
+   for( c = 0; c < nleaf; c++ ){
+      for( lev = 0, offset = L->base; lev < L->nlev; lev++ )
+         offset += ind[lev] * L->step[lev];
+      if( nifti_span_add(&plan, offset, L->leaf) ){
+         nifti_span_free(&plan);
          return -1;
       }
+      for( lev = L->nlev-1; lev >= 0; lev-- ){
+         if( ++ind[lev] < L->count[lev] ) break;
+         ind[lev] = 0;
+      }
+   }
+   if( nifti_span_flush(&plan) ){
+      nifti_span_free(&plan);
+      return -1;
+   }
+   nifti_span_free(&plan);
 
-      /* so just seek and read (prods[0] * nbyper) bytes from the file */
-      znzseek(fp, base_offset, SEEK_SET);
-      bytes = prods[0] * nim->nbyper;
-      nread = nifti_read_buffer(fp, data, bytes, nim);
-      if( nread != bytes ){
-         fprintf(stderr,"** NIFTI rciRD: read only %" PRId64 " of %" PRId64
-                 " bytes from '%s'\n",
-                 nread, bytes, nim->fname);
-         return -1;
-      } else if( g_opts.debug > 3 )
-         fprintf(stderr,"+d successful read of %" PRId64
-                 " bytes at offset %" PRId64 "\n",
-                 bytes, base_offset);
+   return plan.nreads;
+}
 
-      return 0;  /* done with base case - return success */
-   }
+#ifdef HAVE_PTHREAD
+typedef struct {
+   const rci_leaf_list * L;
+   nifti_context       * ctx;           /* context of the caller    */
+   int64_t               first, nleaf;  /* range of leaves to read  */
+   int64_t               nreads;        /* result, < 0 on failure   */
+   int                   started;       /* was given its own thread */
+} rci_read_job;
+
+static void * rci_read_worker(void * arg)
+{
+   rci_read_job * job = (rci_read_job *)arg;
+   g_cur_ctx = job->ctx;
+   job->nreads = rci_read_leaves(job->L, job->first, job->nleaf);
+   return NULL;
+}
+#endif
 
-   /* not the base case, so do a set of reduced reads */
+/* read the leaves of an uncompressed file, split into nthreads ranges
 
-   /* compute size of sub-brick: all dimensions below pivot */
-   for( c = 1, sublen = 1; c < *pivots; c++ ) sublen *= nim->dim[c];
+   return the number of read calls, or < 0 on failure
+*/
+static int64_t rci_read_parallel(const rci_leaf_list * L, int nthreads)
+{
+#ifdef HAVE_PTHREAD
+   rci_read_job * jobs;
+   pthread_t    * tids;
+   int64_t        nreads = 0;
+   int            c;
 
-   /* compute number of values to read, i.e. remaining prods */
-   for( c = 1, read_size = 1; c < nprods; c++ ) read_size *= prods[c];
-   read_size *= nim->nbyper;  /* and multiply by bytes per voxel */
+   if( nthreads > L->nleaf ) nthreads = (int)L->nleaf;
+   jobs = (rci_read_job *)malloc(nthreads * sizeof(rci_read_job));
+   tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+   if( nthreads < 2 || !jobs || !tids ){
+      free(jobs);  free(tids);
+      return rci_read_leaves(L, 0, L->nleaf);
+   }
 
-   /* now repeatedly compute offsets, and recursively read */
-   for( c = 0; c < prods[0]; c++ ){
-      /* offset is (c * sub-block size (including pivot dim))   */
-      /*         + (dims[] index into pivot sub-block)          */
-      /* the unneeded multiplication is to make this more clear */
-      offset = (int64_t)c * sublen * nim->dim[*pivots] +
-               (int64_t)sublen * dims[*pivots];
-      offset *= nim->nbyper;
+   for( c = 0; c < nthreads; c++ ){
+      jobs[c].L      = L;
+      jobs[c].ctx    = g_cur_ctx;
+      jobs[c].first  = L->nleaf * c / nthreads;
+      jobs[c].nleaf  = L->nleaf * (c+1) / nthreads - jobs[c].first;
+      jobs[c].nreads = 0;
+      jobs[c].started = 0;
+   }
 
-      if( g_opts.debug > 3 )
-         fprintf(stderr,"-d reading %" PRId64 " bytes, foff %" PRId64
-                 " + %" PRId64 ", doff %" PRId64 "\n",
-                 read_size, base_offset, offset, c*read_size);
+   /* this thread takes the first range, and any that fail to start */
+   for( c = 1; c < nthreads; c++ )
+      jobs[c].started = pthread_create(tids+c, NULL, rci_read_worker,
+                                       jobs+c) == 0;
+   rci_read_worker(jobs);
+   for( c = 1; c < nthreads; c++ ){
+      if( jobs[c].started ) pthread_join(tids[c], NULL);
+      else                  rci_read_worker(jobs + c);
+   }
 
-      /* now read the next level down, adding this offset */
-      if( rci_read_data(nim, pivots+1, prods+1, nprods-1, dims,
-                    data + c * read_size, fp, base_offset + offset) < 0 )
-         return -1;
+   for( c = 0; c < nthreads; c++ ){
+      if( jobs[c].nreads < 0 ) { nreads = -1; break; }
+      nreads += jobs[c].nreads;
    }
 
-   return 0;
-}
+   if( NIFTI_OPTS.debug > 2 )
+      fprintf(stderr,"+d read %" PRId64 " leaves using %d threads\n",
+              L->nleaf, nthreads);
 
+   free(jobs);
+   free(tids);
+
+   return nreads;
+#else
+   (void)nthreads;
+   return rci_read_leaves(L, 0, L->nleaf);
+#endif
+}
 
 /* allocate memory for all collapsed image data
 
@@ -9355,18 +13315,18 @@ static int rci_alloc_mem(void **data, const int64_t prods[8], int nprods, int nb
    size *= nbyper;
 
    if( ! *data ){   /* then allocate what is needed */
-      if( g_opts.debug > 1 )
+      if( NIFTI_OPTS.debug > 1 )
          fprintf(stderr,"+d alloc %" PRId64
                  " (%" PRId64 " x %d) bytes for collapsed image\n",
                  size, size/nbyper, nbyper);
 
-      *data = malloc(size);   /* actually allocate the memory */
+      *data = nifti_data_alloc_aligned(nifti_get_data_align(), size);
       if( ! *data ){
         fprintf(stderr,"** NIFTI rci_am: failed to alloc %" PRId64
                 " bytes for data\n", size);
         return -1;
       }
-   } else if( g_opts.debug > 1 )
+   } else if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"-d rci_am: *data already set, need %" PRId64
               " x %d bytes\n",
               size/nbyper, nbyper);
@@ -9406,7 +13366,7 @@ static int make_pivot_list(nifti_image *nim, const int64_t dims[],
 
    *nprods = len;
 
-   if( g_opts.debug > 2 ){
+   if( NIFTI_OPTS.debug > 2 ){
       fprintf(stderr,"+d pivot list created, pivots :");
       for(dind = 0; dind < len; dind++)
          fprintf(stderr," %" PRId64 "", pivots[dind]);
@@ -9474,7 +13434,7 @@ int64_t * nifti_get_int64list( int64_t nvals , const char * str )
    ipos = 0 ;
    if( str[ipos] == '[' || str[ipos] == '{' ) ipos++ ;
 
-   if( g_opts.debug > 1 )
+   if( NIFTI_OPTS.debug > 1 )
       fprintf(stderr,"-d making int_list (vals = %" PRId64 ") from '%s'\n",
               nvals, str);
 
@@ -9619,7 +13579,7 @@ int64_t * nifti_get_int64list( int64_t nvals , const char * str )
 
    }  /* end of loop through selector string */
 
-   if( g_opts.debug > 1 ) {
+   if( NIFTI_OPTS.debug > 1 ) {
       fprintf(stderr,"+d int_list (vals = %" PRId64 "): ", subv[0]);
       for( ii = 1; ii <= subv[0]; ii++ )
          fprintf(stderr,"%" PRId64 " ", subv[ii]);
@@ -9760,7 +13720,7 @@ int nifti_test_datatype_sizes(int verb)
                 nbyper != nifti_type_list[c].nbyper ||
                 ssize != nifti_type_list[c].swapsize )
         {
-            if( verb || g_opts.debug > 2 )
+            if( verb || NIFTI_OPTS.debug > 2 )
                 fprintf(stderr, "** NIFTI type mismatch: "
                     "%s, %d, %d, %d : %d, %d\n",
                     nifti_type_list[c].name, nifti_type_list[c].type,
@@ -9772,7 +13732,7 @@ int nifti_test_datatype_sizes(int verb)
 
     if( errs )
         fprintf(stderr,"** nifti_test_datatype_sizes: found %d errors\n",errs);
-    else if( verb || g_opts.debug > 1 )
+    else if( verb || NIFTI_OPTS.debug > 1 )
         fprintf(stderr,"-- nifti_test_datatype_sizes: all OK\n");
 
     return errs;
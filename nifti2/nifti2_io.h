@@ -336,6 +336,53 @@ typedef struct {
   void   ** bricks;     /* array of pointers to data blocks             */
 } nifti_brick_list;
 
+/* opaque reader for nifti_volume_reader_open(), to stream volumes */
+typedef struct nifti_volume_reader nifti_volume_reader;
+
+/* opaque writer for nifti_volume_writer_open(), to write volumes */
+typedef struct nifti_volume_writer nifti_volume_writer;
+
+/* opaque library options (debug level, etc.), see nifti_context_new() */
+typedef struct nifti_context nifti_context;
+
+/* allocator for image data, extension data and bricks, see
+   nifti_set_allocator() (ctx is passed to each function) */
+typedef struct {
+  void * (*alloc)        (size_t nbytes, void * ctx);
+  void * (*alloc_aligned)(size_t align, size_t nbytes, void * ctx);
+  void   (*dealloc)      (void * ptr, void * ctx);
+  void   * ctx;
+} nifti_allocator;
+
+/* compact header record, for each file of nifti_scan_headers()
+   (the strings are only valid during the callback) */
+typedef struct {
+  const char * path;        /*!< path, as given in the list             */
+  int64_t      index;       /*!< index of path in the list              */
+  int          status;      /*!< 0, else a NIFTI_ERR_* code             */
+  const char * hname;       /*!< found header file, or NULL             */
+  const char * iname;       /*!< found image file (NULL if not found)   */
+  int          nifti_type;  /*!< NIFTI_FTYPE_* code                     */
+  int          swapped;     /*!< header is in the other byte order      */
+  int          datatype;    /*!< type of data in voxels: DT_* code      */
+  int          nbyper;      /*!< bytes per voxel                        */
+  int64_t      dim[8];      /*!< dim[0] = ndim, dim[1] = nx, etc.       */
+  int64_t      nvox;        /*!< number of voxels                       */
+  double       pixdim[8];   /*!< grid spacings                          */
+  double       scl_slope;   /*!< scaling parameter - slope              */
+  double       scl_inter;   /*!< scaling parameter - intercept          */
+  int          intent_code; /*!< statistic type (or something)          */
+  int          qform_code;  /*!< codes for (x,y,z) space meaning        */
+  int          sform_code;
+  int          xyz_units;   /*!< dx,dy,dz units: NIFTI_UNITS_* code     */
+  int          time_units;  /*!< dt       units: NIFTI_UNITS_* code     */
+  int64_t      vox_offset;  /*!< offset of the data in the image file   */
+  int          has_ext;     /*!< extensions flagged (not yet read)      */
+} nifti_header_rec;
+
+/* called by nifti_scan_headers() for each file, return 0 to continue */
+typedef int (*nifti_scan_callback)(const nifti_header_rec * rec, void * udata);
+
 
 /*****************************************************************************/
 /*------------------ NIfTI version of ANALYZE 7.5 structure -----------------*/
@@ -459,10 +506,15 @@ NI2_API nifti_image *nifti_image_read_bricks(const char *hname , int64_t nbricks
                                const int64_t *blist, nifti_brick_list * NBL);
 NI2_API int          nifti_image_load_bricks(nifti_image *nim , int64_t nbricks,
                                const int64_t *blist, nifti_brick_list * NBL);
+NI2_API int          nifti_image_load_bricks_ex(nifti_image *nim, int64_t nbricks,
+                               const int64_t *blist, nifti_brick_list * NBL,
+                               int flags);
 NI2_API void         nifti_free_NBL( nifti_brick_list * NBL );
 
 NI2_API nifti_image *nifti_image_read    ( const char *hname , int read_data);
 NI2_API int          nifti_image_load    ( nifti_image *nim);
+NI2_API int          nifti_image_load_as ( nifti_image *nim, int datatype,
+                                          int apply_scaling, void ** data);
 NI2_API void         nifti_image_unload  ( nifti_image *nim);
 NI2_API void         nifti_image_free    ( nifti_image *nim);
 
@@ -471,6 +523,17 @@ NI2_API int64_t      nifti_read_collapsed_image( nifti_image * nim,
 
 NI2_API int64_t      nifti_read_subregion_image(nifti_image *nim, const int64_t *start_index,
                                         const int64_t *region_size, void ** data);
+NI2_API int64_t      nifti_read_subregions(nifti_image *nim, int nregions,
+                                        const int64_t **starts,
+                                        const int64_t **sizes, void ** bufs);
+NI2_API int64_t      nifti_read_timeseries(nifti_image *nim, int64_t nvox,
+                                        const int64_t *ijk_list, void ** out);
+
+NI2_API nifti_volume_reader * nifti_volume_reader_open(nifti_image *nim,
+                                                       int64_t batch);
+NI2_API int64_t      nifti_volume_reader_next(nifti_volume_reader *R,
+                                              void ** vols);
+NI2_API void         nifti_volume_reader_close(nifti_volume_reader *R);
 
 NI2_API void         nifti_image_write( nifti_image * nim ) ;
 NI2_API int          nifti_image_write_status( nifti_image *nim ) ;  /* 7 Jun 2022 */
@@ -479,6 +542,16 @@ NI2_API void         nifti_image_write_bricks(nifti_image * nim,
                                       const nifti_brick_list * NBL);
 NI2_API int          nifti_image_write_bricks_status(nifti_image * nim,
                                              const nifti_brick_list * NBL);
+
+NI2_API nifti_volume_writer * nifti_volume_writer_open(const nifti_image *nim);
+NI2_API int          nifti_volume_writer_append(nifti_volume_writer *W,
+                                        const void * data, int64_t nvox);
+NI2_API int          nifti_volume_writer_close(nifti_volume_writer *W);
+NI2_API int          nifti_image_append_volumes(const char * fname,
+                                        const void * data, int64_t nvols);
+NI2_API int64_t      nifti_scan_headers(const char * const * paths,
+                                        int64_t npaths, int nthreads,
+                                        nifti_scan_callback cb, void * udata);
 NI2_API void         nifti_image_infodump( const nifti_image * nim ) ;
 
 NI2_API void         nifti_disp_lib_hist( int ver ) ;  /* to display library history */
@@ -512,6 +585,48 @@ NI2_API void   nifti_set_skip_blank_ext( int skip ) ;
 NI2_API void   nifti_set_allow_upper_fext( int allow ) ;
 NI2_API int    nifti_get_alter_cifti( void );
 NI2_API void   nifti_set_alter_cifti( int alter_cifti );
+NI2_API int    nifti_get_mmap_data( void );
+NI2_API void   nifti_set_mmap_data( int mmap_data );
+NI2_API int    nifti_get_nthreads( void );
+NI2_API void   nifti_set_nthreads( int nthreads );
+NI2_API int    nifti_get_data_align( void );
+NI2_API void   nifti_set_data_align( int align );
+
+/* per-thread options and errors */
+NI2_API nifti_context * nifti_context_new( void );
+NI2_API void   nifti_context_free( nifti_context * ctx );
+NI2_API nifti_context * nifti_set_thread_context( nifti_context * ctx );
+NI2_API void   nifti_context_set_debug_level( nifti_context * ctx, int level );
+NI2_API void   nifti_context_set_skip_blank_ext( nifti_context * ctx, int skip );
+NI2_API void   nifti_context_set_allow_upper_fext(nifti_context * ctx, int allow);
+NI2_API void   nifti_context_set_alter_cifti( nifti_context * ctx, int alter );
+NI2_API void   nifti_context_set_mmap_data( nifti_context * ctx, int mmap_data );
+NI2_API void   nifti_context_set_nthreads( nifti_context * ctx, int nthreads );
+NI2_API void   nifti_context_set_data_align( nifti_context * ctx, int align );
+NI2_API int    nifti_get_last_error( void );
+NI2_API void   nifti_clear_last_error( void );
+NI2_API const char * nifti_error_string( int code );
+
+/* allocator for image data, extension data and bricks */
+NI2_API int    nifti_set_allocator( const nifti_allocator * A );
+NI2_API void   nifti_get_allocator( nifti_allocator * A );
+NI2_API void * nifti_data_alloc( size_t nbytes );
+NI2_API void * nifti_data_alloc_aligned( size_t align, size_t nbytes );
+NI2_API void   nifti_data_free( void * ptr );
+
+NI2_API nifti_image * nifti_image_read_ctx( nifti_context * ctx,
+                                   const char * hname, int read_data );
+NI2_API int    nifti_image_load_ctx( nifti_context * ctx, nifti_image * nim );
+NI2_API int    nifti_image_write_status_ctx( nifti_context * ctx,
+                                   nifti_image * nim );
+NI2_API nifti_image * nifti_image_read_bricks_ctx( nifti_context * ctx,
+                                   const char * hname, int64_t nbricks,
+                                   const int64_t * blist,
+                                   nifti_brick_list * NBL );
+NI2_API int    nifti_image_load_bricks_ctx( nifti_context * ctx,
+                                   nifti_image * nim, int64_t nbricks,
+                                   const int64_t * blist,
+                                   nifti_brick_list * NBL );
 
 NI2_API int    nifti_alter_cifti_dims(nifti_image * nim);
 
@@ -527,6 +642,13 @@ NI2_API znzFile nifti_image_write_hdr_img2( nifti_image *nim , int write_opts ,
             const char* opts, znzFile imgfile, const nifti_brick_list * NBL);
 NI2_API int64_t nifti_read_buffer(znzFile fp, void* dataptr, int64_t ntot,
                          nifti_image *nim);
+NI2_API int64_t nifti_pread_buffer(znzFile fp, int64_t offset, void* dataptr,
+                         int64_t ntot, nifti_image *nim);
+NI2_API int64_t nifti_fix_nonfinite(void * data, int64_t nvox, int datatype,
+                         int nan_mode);
+NI2_API int64_t nifti_read_buffer2(znzFile fp, int64_t offset, void* dataptr,
+                         int64_t ntot, nifti_image *nim, int nan_mode,
+                         int64_t *nbad);
 NI2_API int     nifti_write_all_data(znzFile fp, nifti_image * nim,
                              const nifti_brick_list * NBL);
 NI2_API int64_t  nifti_write_buffer(znzFile fp, const void * buffer, int64_t numbytes);
@@ -701,6 +823,31 @@ NI2_API int    nifti_valid_header_size(int ni_ver, int whine);
 
 #define NIFTI_MAX_ECODE             44  /******* maximum extension code *******/
 
+/* nifti_set_mmap_data() modes: how nifti_image_load() may map data */
+#define NIFTI_MMAP_NONE       0         /* read data into allocated memory */
+#define NIFTI_MMAP_READONLY   1         /* share read-only file pages      */
+#define NIFTI_MMAP_PRIVATE    2         /* writable copy-on-write pages    */
+
+/* nifti_read_buffer2() modes: handling of non-finite float values */
+#define NIFTI_NAN_ZERO        0         /* set them to 0 (default)         */
+#define NIFTI_NAN_KEEP        1         /* leave them, without checking    */
+#define NIFTI_NAN_COUNT       2         /* leave them, but count them      */
+
+/* nifti_image_load_bricks_ex() flags */
+#define NIFTI_NBL_ARENA       1         /* bricks are one contiguous block */
+                                        /* (release only by nifti_free_NBL) */
+
+/* nifti_get_last_error() codes, for the last failure in this thread */
+#define NIFTI_ERR_NONE        0         /* no error                        */
+#define NIFTI_ERR_INPUT       1         /* bad function arguments          */
+#define NIFTI_ERR_NOFILE      2         /* dataset file not found          */
+#define NIFTI_ERR_OPEN        3         /* failed to open a file           */
+#define NIFTI_ERR_READ        4         /* failed or short read            */
+#define NIFTI_ERR_WRITE       5         /* failed or short write           */
+#define NIFTI_ERR_HEADER      6         /* bad or unsupported header       */
+#define NIFTI_ERR_NOMEM       7         /* memory allocation failure       */
+#define NIFTI_MAX_ERR         7         /* this should match the max code  */
+
 /* nifti_type file codes */
 #define NIFTI_FTYPE_ANALYZE   0         /* old ANALYZE */
 #define NIFTI_FTYPE_NIFTI1_1  1         /* NIFTI-1     */
@@ -720,6 +867,9 @@ typedef struct {
     int skip_blank_ext;      /*!< skip extender if no extensions  */
     int allow_upper_fext;    /*!< allow uppercase file extensions */
     int alter_cifti;         /*!< convert CIFTI dimensions        */
+    int mmap_data;           /*!< map image data (NIFTI_MMAP_*)   */
+    int nthreads;            /*!< threads for reading image data  */
+    int data_align;          /*!< image data alignment, 0: default*/
 } nifti_global_options;
 
 typedef struct {
@@ -0,0 +1,2185 @@
+/*
+ * test program for the NIFTI-2 library I/O paths
+ *
+ * usage: nifti2_tester001 TEST_NAME OUTPUT_DIR
+ *
+ * Each test writes its own small datasets under OUTPUT_DIR, reads them
+ * back and compares the data.  The return status is the number of errors.
+ */
+#include <nifti2_io.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+static int g_errors = 0;
+
+#define TEST_CHECK(cond, msg)                                           \
+   do { if( !(cond) ){                                                  \
+           fprintf(stderr,"** FAILURE (line %d): %s\n", __LINE__, msg); \
+           g_errors++; }                                                \
+   } while(0)
+
+/* create a float 4D image, filled with a ramp, and write it to prefix */
+static nifti_image * make_ramp_image(const char * dir, const char * name,
+                                     int datatype)
+{
+   int64_t       dims[8] = { 4, 11, 7, 5, 6, 1, 1, 1 };
+   nifti_image * nim;
+   char          prefix[1024];
+   int64_t       c;
+
+   nim = nifti_make_new_nim(dims, datatype, 1);
+   if( !nim ) return NULL;
+
+   for( c = 0; c < nim->nvox; c++ ) {
+      switch( datatype ) {
+         case DT_INT16:   ((short *)nim->data)[c] = (short)(c % 30000); break;
+         case DT_FLOAT64: ((double *)nim->data)[c] = 0.5 * (double)c;   break;
+         default:         ((float *)nim->data)[c] = 0.25f * (float)c;   break;
+      }
+   }
+
+   snprintf(prefix, sizeof(prefix), "%s/%s", dir, name);
+   if( nifti_set_filenames(nim, prefix, 0, 1) ||
+       nifti_image_write_status(nim) ) {
+      nifti_image_free(nim);
+      return NULL;
+   }
+
+   return nim;
+}
+
+/* read fname and compare the data against that of nim */
+static int compare_read(const nifti_image * nim, const char * fname)
+{
+   nifti_image * nin;
+   int           rv;
+
+   nin = nifti_image_read(fname, 1);
+   if( !nin || !nin->data ) {
+      nifti_image_free(nin);
+      return 1;
+   }
+
+   rv = nin->nvox != nim->nvox || nin->nbyper != nim->nbyper ||
+        memcmp(nin->data, nim->data, nim->nvox * nim->nbyper);
+   nifti_image_free(nin);
+
+   return rv;
+}
+
+/* write nim as a NIFTI-2 file in the opposite byte order, to fname */
+static int write_swapped(const nifti_image * nim, const char * fname)
+{
+   nifti_2_header   hdr;
+   znzFile          fp;
+   char             pad[4] = { 0, 0, 0, 0 };
+   char           * data;
+   size_t           nbytes = (size_t)(nim->nvox * nim->nbyper);
+   int              rv;
+
+   if( nifti_convert_nim2n2hdr(nim, &hdr) ) return 1;
+   hdr.vox_offset = sizeof(hdr) + 4;
+   nifti_swap_as_nifti2(&hdr);
+
+   data = (char *)malloc(nbytes);
+   if( !data ) return 1;
+   memcpy(data, nim->data, nbytes);
+   if( nim->swapsize > 1 )
+      nifti_swap_Nbytes(nbytes / nim->swapsize, nim->swapsize, data);
+
+   fp = znzopen(fname, "wb", nifti_is_gzfile(fname));
+   rv = znz_isnull(fp) ||
+        znzwrite(&hdr, 1, sizeof(hdr), fp) != sizeof(hdr) ||
+        znzwrite(pad, 1, 4, fp) != 4 ||
+        znzwrite(data, 1, nbytes, fp) != nbytes;
+   znzclose(fp);
+   free(data);
+
+   return rv;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_set_mmap_data: data is mapped, and can be released */
+static int test_mmap(const char * dir)
+{
+   nifti_image * nim, * nin;
+   int           mode;
+
+   nim = make_ramp_image(dir, "mmap_ramp.nii", DT_FLOAT32);
+   TEST_CHECK(nim != NULL, "create mmap_ramp.nii");
+   if( !nim ) return 1;
+
+   for( mode = NIFTI_MMAP_READONLY; mode <= NIFTI_MMAP_PRIVATE; mode++ ) {
+      nifti_set_mmap_data(mode);
+      TEST_CHECK(nifti_get_mmap_data() == mode, "set mmap mode");
+      TEST_CHECK(compare_read(nim, nim->fname) == 0, "mapped read data");
+   }
+
+   /* a private mapping is writable, but does not alter the file */
+   nin = nifti_image_read(nim->fname, 1);
+   TEST_CHECK(nin && nin->data, "private mapped read");
+   if( nin && nin->data ) {
+      ((float *)nin->data)[3] = -1.0f;
+      nifti_image_unload(nin);
+      TEST_CHECK(nin->data == NULL, "unload mapped data");
+      TEST_CHECK(nifti_image_load(nin) == 0, "reload mapped data");
+      TEST_CHECK(nin->data && ((float *)nin->data)[3] == 0.75f,
+                 "private mapping is not written back");
+   }
+   nifti_image_free(nin);
+
+   /* compressed files are read, as usual */
+   nifti_image_free(nim);
+   nim = make_ramp_image(dir, "mmap_ramp.nii.gz", DT_FLOAT32);
+   TEST_CHECK(nim && compare_read(nim, nim->fname) == 0, "mmap mode, gz");
+
+   nifti_set_mmap_data(NIFTI_MMAP_NONE);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* gzip file src to dst, flushing (Z_SYNC_FLUSH or Z_FULL_FLUSH) after
+   every 'every' bytes of input, or never if flush is Z_NO_FLUSH */
+static int gzip_with_flush(const char * src, const char * dst, int flush,
+                           int every)
+{
+   static unsigned char in[1<<16], out[1<<16];
+   z_stream  strm;
+   FILE    * fin, * fout;
+   size_t    nin;
+   int       since = 0, ret = Z_OK, rv = 0;
+
+   fin  = fopen(src, "rb");
+   fout = fopen(dst, "wb");
+   memset(&strm, 0, sizeof(strm));
+   if( !fin || !fout ||
+       deflateInit2(&strm, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK ){
+      if( fin )  fclose(fin);
+      if( fout ) fclose(fout);
+      return 1;
+   }
+
+   do {
+      nin = fread(in, 1, sizeof(in), fin);
+      strm.next_in  = in;
+      strm.avail_in = (unsigned)nin;
+      since += (int)nin;
+      do {
+         strm.next_out  = out;
+         strm.avail_out = sizeof(out);
+         if( nin == 0 ) ret = deflate(&strm, Z_FINISH);
+         else ret = deflate(&strm, (flush != Z_NO_FLUSH && since >= every) ?
+                                   flush : Z_NO_FLUSH);
+         if( fwrite(out, 1, sizeof(out)-strm.avail_out, fout)
+             != sizeof(out)-strm.avail_out ) rv = 1;
+      } while( strm.avail_out == 0 );
+      if( since >= every ) since = 0;
+   } while( nin > 0 && !rv );
+
+   if( ret != Z_STREAM_END ) rv = 1;
+   deflateEnd(&strm);
+   fclose(fin);
+   fclose(fout);
+
+   return rv;
+}
+
+/* parallel decompression of .nii.gz files, with and without flush points */
+static int test_gzpar(const char * dir)
+{
+   int64_t       dims[8] = { 4, 64, 64, 64, 20, 1, 1, 1 };
+   int           flush[3] = { Z_FULL_FLUSH, Z_SYNC_FLUSH, Z_NO_FLUSH };
+   nifti_image * nim;
+   znzFile       fp;
+   char          src[1024], dst[1024];
+   char        * buf;
+   size_t        nbytes, half;
+   int64_t       c;
+   int           ind;
+
+   nim = nifti_make_new_nim(dims, DT_FLOAT32, 1);
+   TEST_CHECK(nim != NULL, "create gzpar image");
+   if( !nim ) return 1;
+
+   /* noisy ramp, so the data does not compress too well */
+   for( c = 0; c < nim->nvox; c++ )
+      ((float *)nim->data)[c] = (float)(c % 4099) + (float)((c*2654435761u)%97);
+
+   snprintf(src, sizeof(src), "%s/gzpar.nii", dir);
+   TEST_CHECK(nifti_set_filenames(nim, src, 0, 1) == 0 &&
+              nifti_image_write_status(nim) == 0, "write gzpar.nii");
+
+   nbytes = nim->nvox * nim->nbyper;
+   buf = (char *)malloc(nbytes);
+   TEST_CHECK(buf != NULL, "alloc gzpar buffer");
+   if( !buf ) { nifti_image_free(nim); return 1; }
+
+   znz_set_nthreads(4);
+#ifdef HAVE_PTHREAD
+   TEST_CHECK(znz_get_nthreads() == 4, "set znz threads");
+#else
+   TEST_CHECK(znz_get_nthreads() == 1, "set znz threads, without pthreads");
+#endif
+
+   for( ind = 0; ind < 3; ind++ ) {
+      snprintf(dst, sizeof(dst), "%s/gzpar_%d.nii.gz", dir, ind);
+      TEST_CHECK(gzip_with_flush(src, dst, flush[ind], 1<<18) == 0,
+                 "gzip with flush");
+      TEST_CHECK(compare_read(nim, dst) == 0, "parallel gz read");
+
+      /* positions are kept across parallel reads */
+      fp = znzopen(dst, "rb", 1);
+      TEST_CHECK(!znz_isnull(fp), "znzopen gz");
+      if( znz_isnull(fp) ) continue;
+      half = nbytes / 8 * 7;   /* large enough for a parallel read */
+      TEST_CHECK(znzseek(fp, nim->iname_offset, SEEK_SET) >= 0 &&
+                 znzread(buf, 1, half, fp) == half &&
+                 znztell(fp) == (znz_off_t)(nim->iname_offset + half),
+                 "parallel read, then tell");
+      TEST_CHECK(znzread(buf+half, 1, nbytes-half, fp) == nbytes-half,
+                 "second read");
+      TEST_CHECK(memcmp(buf, nim->data, nbytes) == 0, "two part read data");
+      TEST_CHECK(znzseek(fp, nim->iname_offset+8, SEEK_SET) >= 0 &&
+                 znzread(buf, 1, 64, fp) == 64 &&
+                 memcmp(buf, (char *)nim->data+8, 64) == 0,
+                 "seek back and read");
+      znzclose(fp);
+   }
+
+   znz_set_nthreads(1);
+   free(buf);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/* parallel compression of .nii.gz output, read back serially */
+static int test_gzwrite(const char * dir)
+{
+   int64_t       dims[8] = { 4, 64, 64, 64, 20, 1, 1, 1 };
+   nifti_image * nim, * small;
+   znzFile       fp;
+   char          fname[1024];
+   char        * buf;
+   size_t        nbytes;
+   int64_t       c;
+   int           nt;
+
+   nim = nifti_make_new_nim(dims, DT_FLOAT32, 1);
+   TEST_CHECK(nim != NULL, "create gzwrite image");
+   if( !nim ) return 1;
+   for( c = 0; c < nim->nvox; c++ )
+      ((float *)nim->data)[c] = (float)(c % 4099) + (float)((c*2654435761u)%97);
+   nbytes = nim->nvox * nim->nbyper;
+
+   znz_set_nthreads(4);
+   small = make_ramp_image(dir, "gzwrite_small.nii.gz", DT_INT16);
+   snprintf(fname, sizeof(fname), "%s/gzwrite.nii.gz", dir);
+   TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+              nifti_image_write_status(nim) == 0, "parallel gz write");
+
+   /* read back with zlib alone, and then in parallel */
+   for( nt = 1; nt <= 4; nt += 3 ) {
+      znz_set_nthreads(nt);
+      TEST_CHECK(small && compare_read(small, small->fname) == 0,
+                 "read small parallel gz");
+      TEST_CHECK(compare_read(nim, fname) == 0, "read parallel gz");
+   }
+
+   /* explicit compression level, and forward seeks (a backward seek fails,
+      but only after the writes, as zlib would drop a pending forward seek) */
+   znz_set_nthreads(3);
+   snprintf(fname, sizeof(fname), "%s/gzwrite_level.gz", dir);
+   fp = znzopen(fname, "wb9", 1);
+   TEST_CHECK(!znz_isnull(fp), "open gz, level 9");
+   if( !znz_isnull(fp) ) {
+      TEST_CHECK(znzwrite(nim->data, 1, 100, fp) == 100 &&
+                 znzseek(fp, 1000, SEEK_SET) == 1000 &&
+                 znzwrite(nim->data, 1, nbytes, fp) == nbytes &&
+                 znzseek(fp, 10, SEEK_SET) < 0 &&
+                 znztell(fp) == (znz_off_t)(1000 + nbytes), "write and seek");
+      TEST_CHECK(znzclose(fp) == 0, "close parallel gz");
+   }
+   znz_set_nthreads(1);
+
+   buf = (char *)malloc(1000 + nbytes);
+   fp = znzopen(fname, "rb", 1);
+   TEST_CHECK(buf && !znz_isnull(fp), "read level 9 file");
+   if( buf && !znz_isnull(fp) ) {
+      TEST_CHECK(znzread(buf, 1, 1000+nbytes, fp) == 1000+nbytes &&
+                 memcmp(buf, nim->data, 100) == 0 &&
+                 buf[100] == 0 && buf[999] == 0 &&
+                 memcmp(buf+1000, nim->data, nbytes) == 0,
+                 "level 9 data");
+   }
+   znzclose(fp);
+
+   free(buf);
+   nifti_image_free(small);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/* read nbytes at offset of fname (compressed or not) into buf */
+static int read_at(znzFile fp, char * buf, size_t nbytes, znz_off_t offset)
+{
+   return znzseek(fp, offset, SEEK_SET) < 0 ||
+          znzread(buf, 1, nbytes, fp) != nbytes;
+}
+
+/* seeks in .nii.gz files use the access point index (and sidecar) */
+static int test_gzindex(const char * dir)
+{
+   int64_t       dims[8] = { 4, 64, 64, 64, 20, 1, 1, 1 };
+   nifti_image * nim;
+   znzFile       fp;
+   gzFile        gfp;
+   char          fname[1024], idxname[1024+4];
+   char          buf[4096];
+   const char  * data;
+   size_t        vsize, nbytes;
+   int64_t       c;
+   int           vol, npts;
+
+   nim = nifti_make_new_nim(dims, DT_FLOAT32, 1);
+   TEST_CHECK(nim != NULL, "create gzindex image");
+   if( !nim ) return 1;
+   for( c = 0; c < nim->nvox; c++ )
+      ((float *)nim->data)[c] = (float)(c % 4099) + (float)((c*2654435761u)%97);
+   data   = (const char *)nim->data;
+   nbytes = nim->nvox * nim->nbyper;
+   vsize  = nbytes / dims[4];
+
+   /* one ordinary gzip stream: volumes read backwards use the index */
+   znz_set_index_span(1<<20);
+   snprintf(fname, sizeof(fname), "%s/gzindex.nii.gz", dir);
+   snprintf(idxname, sizeof(idxname), "%s.idx", fname);
+   remove(idxname);
+   TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+              nifti_image_write_status(nim) == 0, "write gzindex.nii.gz");
+
+   fp = znzopen(fname, "rb", 1);
+   TEST_CHECK(znz_index_points(fp) == 0, "new index is empty");
+   for( vol = (int)dims[4]-1; vol >= 0; vol -= 3 )
+      TEST_CHECK(read_at(fp, buf, sizeof(buf), nim->iname_offset+vol*vsize)==0
+                 && memcmp(buf, data+vol*vsize, sizeof(buf)) == 0,
+                 "read volume backwards");
+   npts = znz_index_points(fp);
+   TEST_CHECK(npts > 5, "index was built");
+   TEST_CHECK(znzseek(fp, nim->iname_offset+nbytes-8, SEEK_SET) >= 0 &&
+              znzread(buf, 1, 16, fp) == 8 &&
+              znztell(fp) == (znz_off_t)(nim->iname_offset + nbytes) &&
+              znzread(buf, 1, 16, fp) == 0, "read past the end");
+   znzclose(fp);
+
+   /* the sidecar is written on close, and read on open */
+   znz_set_index_mode(ZNZ_INDEX_SIDECAR);
+   fp = znzopen(fname, "rb", 1);
+   TEST_CHECK(read_at(fp, buf, 64, nim->iname_offset+nbytes-64) == 0 &&
+              memcmp(buf, data+nbytes-64, 64) == 0, "read last bytes");
+   npts = znz_index_points(fp);
+   znzclose(fp);
+   fp = znzopen(fname, "rb", 1);
+   TEST_CHECK(znz_index_points(fp) == npts, "index read from sidecar");
+   for( vol = 1; vol < dims[4]; vol += 4 )
+      TEST_CHECK(read_at(fp, buf, sizeof(buf), nim->iname_offset+vol*vsize)==0
+                 && memcmp(buf, data+vol*vsize, sizeof(buf)) == 0,
+                 "read volume via sidecar");
+   znzclose(fp);
+   TEST_CHECK(compare_read(nim, fname) == 0, "read whole image, sidecar");
+
+   /* a sidecar for other data is ignored */
+   ((float *)nim->data)[0] = -1.0f;
+   TEST_CHECK(nifti_image_write_status(nim) == 0, "rewrite gzindex.nii.gz");
+   fp = znzopen(fname, "rb", 1);
+   TEST_CHECK(znz_index_points(fp) == 0, "stale sidecar is ignored");
+   znzclose(fp);
+   remove(idxname);
+   znz_set_index_mode(ZNZ_INDEX_MEMORY);
+
+   /* multiple gzip members */
+   snprintf(fname, sizeof(fname), "%s/gzindex_2member.gz", dir);
+   gfp = gzopen(fname, "wb");
+   TEST_CHECK(gfp && gzwrite(gfp, data, (unsigned)(nbytes/2)) > 0 &&
+              gzclose(gfp) == Z_OK, "write first member");
+   gfp = gzopen(fname, "ab");
+   TEST_CHECK(gfp && gzwrite(gfp, data+nbytes/2, (unsigned)(nbytes-nbytes/2))
+              > 0 && gzclose(gfp) == Z_OK, "append second member");
+   fp = znzopen(fname, "rb", 1);
+   TEST_CHECK(read_at(fp, buf, sizeof(buf), nbytes/2 - 100) == 0 &&
+              memcmp(buf, data+nbytes/2-100, sizeof(buf)) == 0 &&
+              read_at(fp, buf, 100, 5) == 0 && memcmp(buf, data+5, 100) == 0 &&
+              read_at(fp, buf, 100, nbytes-100) == 0 &&
+              memcmp(buf, data+nbytes-100, 100) == 0, "read across members");
+   znzclose(fp);
+
+   znz_set_index_span(ZNZ_INDEX_SPAN);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* znzpread: concurrent positional reads of one open file */
+typedef struct {
+   znzFile      fp;
+   const char * data;     /* expected file contents, from offset 0 */
+   size_t       vsize;    /* bytes per read                        */
+   int          nvols;
+   int          first;    /* first volume read by this thread      */
+   int          errors;
+} pread_job;
+
+static void * pread_worker(void * arg)
+{
+   pread_job * job = (pread_job *)arg;
+   char      * buf = (char *)malloc(job->vsize);
+   int         c, vol;
+
+   if( !buf ) { job->errors++; return NULL; }
+   for( c = 0; c < 2 * job->nvols; c++ ) {
+      vol = (job->first + 7 * c) % job->nvols;
+      if( znzpread(job->fp, buf, job->vsize, (znz_off_t)vol*job->vsize)
+             != job->vsize ||
+          memcmp(buf, job->data + vol*job->vsize, job->vsize) )
+         job->errors++;
+   }
+   free(buf);
+
+   return NULL;
+}
+
+static int test_pread(const char * dir)
+{
+   int64_t       dims[8] = { 4, 32, 32, 16, 24, 1, 1, 1 };
+   nifti_image * nim;
+   znzFile       fp;
+   pread_job     jobs[4];
+   char          fname[1024];
+   char        * data, * buf, * roi = NULL;
+   int64_t       start[4] = { 0, 0, 0, 5 }, size[4] = { 32, 32, 16, 3 };
+   size_t        vsize, nbytes, hsize;
+   int64_t       c;
+   int           gz, t;
+#ifdef HAVE_PTHREAD
+   pthread_t     tid[4];
+#endif
+
+   nim = nifti_make_new_nim(dims, DT_FLOAT32, 1);
+   TEST_CHECK(nim != NULL, "create pread image");
+   if( !nim ) return 1;
+   for( c = 0; c < nim->nvox; c++ )
+      ((float *)nim->data)[c] = (float)(c % 4099) + (float)((c*2654435761u)%97);
+   nbytes = nim->nvox * nim->nbyper;
+   vsize  = nbytes / dims[4];
+
+   for( gz = 0; gz <= 1; gz++ ) {
+      snprintf(fname, sizeof(fname), "%s/pread.nii%s", dir, gz ? ".gz" : "");
+      TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                 nifti_image_write_status(nim) == 0, "write pread image");
+
+      /* expected file contents: header, then data */
+      hsize = (size_t)nim->iname_offset;
+      data  = (char *)malloc(hsize + nbytes);
+      fp    = znzopen(fname, "rb", gz);
+      TEST_CHECK(data && !znz_isnull(fp) &&
+                 znzread(data, 1, hsize, fp) == hsize, "read pread header");
+      if( !data || znz_isnull(fp) ) { free(data); znzclose(fp); continue; }
+      memcpy(data + hsize, nim->data, nbytes);
+
+      /* the file position is neither used nor changed */
+      buf = data + hsize;
+      TEST_CHECK(znztell(fp) == (znz_off_t)hsize, "position after header");
+      {
+         char tmp[64];
+         TEST_CHECK(znzpread(fp, tmp, 64, hsize + 3*vsize) == 64 &&
+                    memcmp(tmp, buf + 3*vsize, 64) == 0 &&
+                    znztell(fp) == (znz_off_t)hsize, "pread at offset");
+         TEST_CHECK(znzread(tmp, 1, 64, fp) == 64 &&
+                    memcmp(tmp, buf, 64) == 0, "read after pread");
+         TEST_CHECK(znzpread(fp, tmp, 64, hsize + nbytes - 32) == 32,
+                    "short pread at the end");
+      }
+
+      /* several threads read volumes (offset by the header) at once */
+      for( t = 0; t < 4; t++ ) {
+         jobs[t].fp     = fp;
+         jobs[t].data   = data;
+         jobs[t].vsize  = vsize;
+         jobs[t].nvols  = (int)dims[4];
+         jobs[t].first  = 5 * t;
+         jobs[t].errors = 0;
+      }
+#ifdef HAVE_PTHREAD
+      for( t = 0; t < 4; t++ )
+         if( pthread_create(tid+t, NULL, pread_worker, jobs+t) ) {
+            pread_worker(jobs+t);
+            tid[t] = pthread_self();
+         }
+      for( t = 0; t < 4; t++ )
+         if( ! pthread_equal(tid[t], pthread_self()) )
+            pthread_join(tid[t], NULL);
+#else
+      for( t = 0; t < 4; t++ ) pread_worker(jobs+t);
+#endif
+      for( t = 0; t < 4; t++ )
+         TEST_CHECK(jobs[t].errors == 0, "concurrent pread");
+      znzclose(fp);
+      free(data);
+
+      /* subregion reads no longer seek */
+      TEST_CHECK(nifti_read_subregion_image(nim, start, size, (void **)&roi)
+                 == (int64_t)(3*vsize) &&
+                 memcmp(roi, (char *)nim->data + 5*vsize, 3*vsize) == 0,
+                 "read subregion");
+      free(roi);
+      roi = NULL;
+   }
+
+   /* znzpwrite on an uncompressed file, leaving the position alone */
+   snprintf(fname, sizeof(fname), "%s/pwrite.dat", dir);
+   fp = znzopen(fname, "wb", 0);
+   TEST_CHECK(!znz_isnull(fp), "open pwrite.dat");
+   if( !znz_isnull(fp) ) {
+      TEST_CHECK(znzwrite(nim->data, 1, 100, fp) == 100 &&
+                 znzpwrite(fp, (char *)nim->data + 1000, 50, 20) == 50 &&
+                 znztell(fp) == 100 &&
+                 znzwrite(nim->data, 1, 10, fp) == 10, "pwrite");
+      znzclose(fp);
+   }
+   buf = (char *)malloc(110);
+   fp = znzopen(fname, "rb", 0);
+   TEST_CHECK(buf && !znz_isnull(fp) && znzread(buf, 1, 110, fp) == 110 &&
+              memcmp(buf, nim->data, 20) == 0 &&
+              memcmp(buf+20, (char *)nim->data+1000, 50) == 0 &&
+              memcmp(buf+70, (char *)nim->data+70, 30) == 0 &&
+              memcmp(buf+100, nim->data, 10) == 0, "pwrite data");
+   znzclose(fp);
+   free(buf);
+
+   /* compressed output only allows writing at the current position */
+   snprintf(fname, sizeof(fname), "%s/pwrite.gz", dir);
+   fp = znzopen(fname, "wb", 1);
+   TEST_CHECK(!znz_isnull(fp) &&
+              znzpwrite(fp, nim->data, 100, 0) == 100 &&
+              znzpwrite(fp, nim->data, 100, 0) == 0, "pwrite gz");
+   znzclose(fp);
+
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_set_nthreads: large loads are read in chunks, on several threads */
+static int test_parload(const char * dir)
+{
+   int64_t       dims[8] = { 4, 64, 64, 64, 33, 1, 1, 1 };
+   nifti_image * nim, * nin;
+   char          fname[1024];
+   float       * fdata, zero = 0.0f;
+   int64_t       c;
+   int           swapped, nt;
+
+   nim = nifti_make_new_nim(dims, DT_FLOAT32, 1);
+   TEST_CHECK(nim != NULL, "create parload image");
+   if( !nim ) return 1;
+   fdata = (float *)nim->data;
+   for( c = 0; c < nim->nvox; c++ )
+      fdata[c] = (float)(c % 4099) + (float)((c*2654435761u)%97);
+
+   /* write with bad floats, which loading sets to 0 */
+   for( swapped = 0; swapped <= 1; swapped++ ) {
+      snprintf(fname, sizeof(fname), "%s/parload%s.nii", dir,
+               swapped ? "_swap" : "");
+      fdata[7] = fdata[nim->nvox-1] = 1.0f/zero;
+      fdata[(int64_t)1<<23] = zero/zero;
+      if( swapped )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped image");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write parload");
+      fdata[7] = fdata[nim->nvox-1] = fdata[(int64_t)1<<23] = 0.0f;
+
+      for( nt = 1; nt <= 5; nt += 4 ) {
+         nifti_set_nthreads(nt);
+         TEST_CHECK(nifti_get_nthreads() == nt, "set nthreads");
+         nin = nifti_image_read(fname, 1);
+         TEST_CHECK(nin && nin->data && nin->nvox == nim->nvox &&
+                    memcmp(nin->data, nim->data, nim->nvox*nim->nbyper) == 0,
+                    swapped ? "parallel load, swapped" : "parallel load");
+         nifti_image_free(nin);
+      }
+   }
+
+   /* a file that is too short fails to load */
+   nin = nifti_image_read(fname, 0);
+   TEST_CHECK(nin != NULL, "read parload header");
+   if( nin ) {
+      nin->nvox *= 2;
+      nin->dim[4] = nin->nt = dims[4] * 2;
+      TEST_CHECK(nifti_image_load(nin) < 0 && nin->data == NULL,
+                 "short parallel load fails");
+   }
+   nifti_image_free(nin);
+
+   nifti_set_nthreads(0);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_swap_Nbytes: vector kernels match a simple reversal */
+static int test_swap(void)
+{
+   unsigned char * buf, * ref;
+   int64_t         nvals[] = { 0, 1, 3, 4, 15, 16, 17, 63, 64, 65, 1000, 4099 };
+   int64_t         n, c;
+   int             sizes[] = { 2, 4, 8, 16 };
+   int             is, in, off;
+
+   buf = (unsigned char *)malloc(16 * 4099 + 32);
+   ref = (unsigned char *)malloc(16 * 4099 + 32);
+   TEST_CHECK(buf && ref, "alloc swap buffers");
+   if( !buf || !ref ) { free(buf); free(ref); return 1; }
+
+   for( is = 0; is < 4; is++ ) {
+      for( in = 0; in < (int)(sizeof(nvals)/sizeof(int64_t)); in++ ) {
+         n = nvals[in];
+         for( off = 0; off < 3; off++ ) {   /* vary the alignment */
+            for( c = 0; c < n * sizes[is] + 32; c++ )
+               buf[c] = ref[c] = (unsigned char)(c * 131 + is + off);
+            nifti_swap_Nbytes(n, sizes[is], buf + off);
+            TEST_CHECK(memcmp(buf, ref, off) == 0 &&
+                       memcmp(buf+off+n*sizes[is], ref+off+n*sizes[is], 16)
+                          == 0, "swap stays within the data");
+            for( c = 0; c < n * sizes[is]; c++ )
+               if( buf[off + c] != ref[off + (c / sizes[is]) * sizes[is] +
+                                       sizes[is] - 1 - c % sizes[is]] )
+                  break;
+            TEST_CHECK(c == n * sizes[is], "swapped bytes");
+         }
+      }
+   }
+
+   free(buf);
+   free(ref);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_read_buffer2: blocked reads, and each non-finite float policy */
+static int test_nanmode(const char * dir)
+{
+   int64_t       dims[8] = { 3, 64, 64, 40, 1, 1, 1, 1 };
+   int64_t       bad[4] = { 0, 65536, 65537, 163839 };  /* across blocks */
+   nifti_image * nim, * nin;
+   char          fname[1024];
+   double      * ddata, * buf, zero = 0.0;
+   int64_t       c, nbytes, nbad;
+   znzFile       fp;
+   int           ftype, mode, ok;
+
+   nim = nifti_make_new_nim(dims, DT_FLOAT64, 1);
+   TEST_CHECK(nim != NULL, "create nanmode image");
+   if( !nim ) return 1;
+   ddata  = (double *)nim->data;
+   nbytes = nim->nvox * nim->nbyper;
+   for( c = 0; c < nim->nvox; c++ ) ddata[c] = 0.5 * (double)c;
+   for( c = 0; c < 4; c++ ) ddata[bad[c]] = (c & 1) ? zero/zero : -1.0/zero;
+
+   buf = (double *)malloc(nbytes);
+   TEST_CHECK(buf != NULL, "alloc nanmode buffer");
+
+   /* native, swapped and compressed files */
+   for( ftype = 0; buf && ftype < 3; ftype++ ) {
+      snprintf(fname, sizeof(fname), "%s/nanmode%s", dir,
+               ftype == 0 ? ".nii" : ftype == 1 ? "_swap.nii" : ".nii.gz");
+      if( ftype == 1 )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped nanmode");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write nanmode");
+
+      nin = nifti_image_read(fname, 0);
+      fp  = znzopen(fname, "rb", nifti_is_gzfile(fname));
+      TEST_CHECK(nin && !znz_isnull(fp), "open nanmode");
+      if( !nin || znz_isnull(fp) ) { nifti_image_free(nin); znzclose(fp);
+                                     continue; }
+
+      for( mode = NIFTI_NAN_ZERO; mode <= NIFTI_NAN_COUNT; mode++ ) {
+         memset(buf, 0, nbytes);
+         nbad = -1;
+         TEST_CHECK(nifti_read_buffer2(fp, nin->iname_offset, buf, nbytes,
+                                       nin, mode, &nbad) == nbytes,
+                    "read_buffer2");
+         TEST_CHECK(nbad == (mode == NIFTI_NAN_KEEP ? 0 : 4), "bad count");
+         for( c = 0, ok = 1; c < nim->nvox; c++ ) {
+            if( c == bad[0] || c == bad[1] || c == bad[2] || c == bad[3] )
+               ok &= (mode == NIFTI_NAN_ZERO) ? buf[c] == 0.0
+                                              : buf[c] != buf[c] ||
+                                                buf[c] == -1.0/zero;
+            else
+               ok &= buf[c] == ddata[c];
+         }
+         TEST_CHECK(ok, "read_buffer2 values");
+      }
+
+      /* and sequentially, from the current position */
+      TEST_CHECK(znzseek(fp, nin->iname_offset, SEEK_SET) >= 0 &&
+                 nifti_read_buffer2(fp, -1, buf, nbytes, nin,
+                                    NIFTI_NAN_COUNT, &nbad) == nbytes &&
+                 nbad == 4 && buf[1] == ddata[1], "sequential read_buffer2");
+      TEST_CHECK(nifti_read_buffer2(fp, nin->iname_offset + 8, buf, nbytes,
+                                    nin, NIFTI_NAN_ZERO, &nbad) < 0,
+                 "short read_buffer2 fails");
+
+      znzclose(fp);
+      nifti_image_free(nin);
+   }
+
+   free(buf);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_fix_nonfinite: vector kernels match a scalar check */
+static int test_nonfinite(void)
+{
+   int      types[] = { NIFTI_TYPE_FLOAT32, NIFTI_TYPE_COMPLEX64,
+                        NIFTI_TYPE_FLOAT64, NIFTI_TYPE_COMPLEX128 };
+   int64_t  nvox[] = { 1, 7, 16, 33, 1000 };
+   double   zero = 0.0, special[6];
+   double * dar;
+   float  * far;
+   void   * data;
+   int64_t  nvals, nexp, c, nv;
+   int      it, in, mode, ok, isdbl;
+
+   special[0] = zero/zero;          special[1] = 1.0/zero;
+   special[2] = -1.0/zero;          special[3] = 3.0e38;      /* finite */
+   special[4] = 1.0e-310;           special[5] = -0.0;        /* finite */
+
+   data = malloc(2 * 1000 * sizeof(double) + 8);
+   TEST_CHECK(data != NULL, "alloc nonfinite data");
+   if( !data ) return 1;
+
+   for( it = 0; it < 4; it++ ) {
+      isdbl = types[it] == NIFTI_TYPE_FLOAT64 ||
+              types[it] == NIFTI_TYPE_COMPLEX128;
+      for( in = 0; in < 5; in++ ) {
+         nv    = nvox[in];
+         nvals = (types[it] == NIFTI_TYPE_COMPLEX64 ||
+                  types[it] == NIFTI_TYPE_COMPLEX128) ? 2*nv : nv;
+         for( mode = NIFTI_NAN_ZERO; mode <= NIFTI_NAN_COUNT; mode++ ) {
+            /* every 5th value is special, offset by one value */
+            far  = (float *)data + 1;
+            dar  = (double *)data + 1;
+            nexp = 0;
+            for( c = 0; c < nvals; c++ ) {
+               double val = (c % 5 == 2) ? special[(c/5) % 6] : (double)c;
+               if( isdbl ) dar[c] = val;
+               else        far[c] = (float)val;
+               if( c % 5 == 2 && (c/5) % 6 < 3 ) nexp++;
+            }
+            TEST_CHECK(nifti_fix_nonfinite(isdbl ? (void *)dar : (void *)far,
+                          nv, types[it], mode) ==
+                       (mode == NIFTI_NAN_KEEP ? 0 : nexp),
+                       "nonfinite count");
+            for( c = 0, ok = 1; c < nvals; c++ ) {
+               double val = isdbl ? dar[c] : (double)far[c];
+               if( c % 5 == 2 && (c/5) % 6 < 3 && mode == NIFTI_NAN_ZERO )
+                  ok &= val == 0.0;
+               else if( c % 5 == 2 && (c/5) % 6 < 3 )
+                  ok &= val != val || val == special[(c/5) % 6];
+               else if( c % 5 == 2 )
+                  ok &= val == (isdbl ? special[(c/5) % 6]
+                                      : (double)(float)special[(c/5) % 6]);
+               else
+                  ok &= val == (double)c;
+            }
+            TEST_CHECK(ok, "nonfinite values");
+         }
+      }
+   }
+
+   /* other types are left alone */
+   TEST_CHECK(nifti_fix_nonfinite(data, 10, NIFTI_TYPE_INT32,
+                                  NIFTI_NAN_ZERO) == 0, "nonfinite int32");
+
+   free(data);
+
+   return 0;
+}
+
+/* return value c of nim->data, as a double */
+static double get_val(const nifti_image * nim, int64_t c)
+{
+   switch( nim->datatype ) {
+      case DT_INT16:   return ((short *)nim->data)[c];
+      case DT_UINT8:   return ((unsigned char *)nim->data)[c];
+      case DT_INT32:   return ((int *)nim->data)[c];
+      case DT_FLOAT32: return ((float *)nim->data)[c];
+      case DT_FLOAT64: return ((double *)nim->data)[c];
+   }
+   return 0.0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_image_load_as: data is converted (and scaled) while reading */
+static int test_loadas(const char * dir)
+{
+   int64_t       dims[8] = { 4, 13, 11, 7, 30, 1, 1, 1 };
+   int           types[] = { DT_INT16, DT_UINT8, DT_INT32, DT_FLOAT64 };
+   const char  * fnames[] = { "loadas.nii", "loadas_swap.nii",
+                              "loadas.nii.gz" };
+   nifti_image * nim, * nin;
+   char          fname[1024];
+   float       * fbuf;
+   double      * dbuf, val;
+   int64_t       c;
+   int           it, ft, ok;
+
+   for( it = 0; it < 4; it++ ) {
+      nim = nifti_make_new_nim(dims, types[it], 1);
+      TEST_CHECK(nim != NULL, "create loadas image");
+      if( !nim ) return 1;
+      for( c = 0; c < nim->nvox; c++ )
+         switch( types[it] ) {
+            case DT_INT16:   ((short *)nim->data)[c] = (short)(c%3000 - 1000);
+                             break;
+            case DT_UINT8:   ((unsigned char *)nim->data)[c] =
+                                (unsigned char)(c % 251);  break;
+            case DT_INT32:   ((int *)nim->data)[c] = (int)(c * 7 - 20000);
+                             break;
+            default:         ((double *)nim->data)[c] = 0.25 * c;  break;
+         }
+      nim->scl_slope = 0.5;
+      nim->scl_inter = -3.0;
+
+      for( ft = 0; ft < 3; ft++ ) {
+         snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+         if( ft == 1 )
+            TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped loadas");
+         else
+            TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                       nifti_image_write_status(nim) == 0, "write loadas");
+
+         nin = nifti_image_read(fname, 0);
+         TEST_CHECK(nin && nin->scl_slope == 0.5, "read loadas header");
+         if( !nin ) continue;
+
+         /* scaled float32, allocated here */
+         fbuf = NULL;
+         TEST_CHECK(nifti_image_load_as(nin, NIFTI_TYPE_FLOAT32, 1,
+                                        (void **)&fbuf) == 0 && fbuf &&
+                    nin->data == NULL, "load_as float32");
+         for( c = 0, ok = fbuf != NULL; ok && c < nim->nvox; c++ ) {
+            val = get_val(nim, c) * 0.5 - 3.0;
+            ok  = fabs(fbuf[c] - val) <= 1e-6 * fabs(val);
+         }
+         TEST_CHECK(ok, "load_as float32 values");
+         free(fbuf);
+
+         /* unscaled float64, into a given buffer, from memory */
+         dbuf = (double *)malloc(nim->nvox * sizeof(double));
+         TEST_CHECK(dbuf && nifti_image_load_as(nin, NIFTI_TYPE_FLOAT64, 0,
+                                                (void **)&dbuf) == 0,
+                    "load_as float64");
+         for( c = 0, ok = dbuf != NULL; ok && c < nim->nvox; c++ )
+            ok = dbuf[c] == get_val(nim, c);
+         TEST_CHECK(ok, "load_as float64 values");
+         if( ft == 0 && dbuf ) {
+            TEST_CHECK(nifti_image_load(nin) == 0 &&
+                       nifti_image_load_as(nin, NIFTI_TYPE_FLOAT64, 1,
+                                           (void **)&dbuf) == 0 &&
+                       dbuf[5] == get_val(nim, 5) * 0.5 - 3.0,
+                       "load_as from loaded data");
+         }
+         free(dbuf);
+         nifti_image_free(nin);
+      }
+      nifti_image_free(nim);
+   }
+
+   /* complex data is not converted */
+   nim = nifti_make_new_nim(dims, DT_COMPLEX64, 1);
+   fbuf = NULL;
+   TEST_CHECK(nim && nifti_image_load_as(nim, NIFTI_TYPE_FLOAT32, 1,
+                                         (void **)&fbuf) < 0 && !fbuf,
+              "load_as complex fails");
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_read_subregion_image: merged row reads match the data */
+static int check_subregion(const nifti_image * nim, const char * fname,
+                           const int64_t * start, const int64_t * size)
+{
+   nifti_image * nin;
+   const short * sdata = (const short *)nim->data;
+   short       * roi = NULL;
+   int64_t       x, y, z, t, c = 0, nbytes;
+   int           ok;
+
+   nin = nifti_image_read(fname, 0);
+   if( !nin ) return 1;
+   nbytes = size[0] * size[1] * size[2] * size[3] * nin->nbyper;
+   ok = nifti_read_subregion_image(nin, start, size, (void **)&roi) == nbytes;
+   for( t = start[3]; ok && t < start[3] + size[3]; t++ )
+    for( z = start[2]; ok && z < start[2] + size[2]; z++ )
+     for( y = start[1]; ok && y < start[1] + size[1]; y++ )
+      for( x = start[0]; ok && x < start[0] + size[0]; x++ )
+         ok = roi[c++] == sdata[x + nim->nx*(y + nim->ny*(z + nim->nz*t))];
+   free(roi);
+   nifti_image_free(nin);
+
+   return !ok;
+}
+
+static int test_subregion(const char * dir)
+{
+   int64_t       dims[8] = { 4, 70, 60, 50, 8, 1, 1, 1 };
+   /* start and size: small rows, gaps across slices and volumes, whole
+      rows, a single column, and far apart volumes */
+   int64_t       regions[6][8] = {
+      { 10, 20, 5, 0,    5, 5, 5, 2 },
+      { 0, 10, 10, 1,    70, 40, 30, 3 },
+      { 30, 0, 0, 0,     1, 60, 50, 8 },
+      { 3, 3, 3, 0,      64, 54, 44, 8 },
+      { 69, 59, 49, 0,   1, 1, 1, 8 },
+      { 0, 0, 20, 2,     70, 60, 2, 4 } };
+   const char  * fnames[] = { "subreg.nii", "subreg_swap.nii",
+                              "subreg.nii.gz" };
+   nifti_image * nim;
+   char          fname[1024];
+   int64_t       c;
+   int           ft, r;
+
+   nim = nifti_make_new_nim(dims, DT_INT16, 1);
+   TEST_CHECK(nim != NULL, "create subregion image");
+   if( !nim ) return 1;
+   for( c = 0; c < nim->nvox; c++ )
+      ((short *)nim->data)[c] = (short)((c * 2654435761u) % 32000);
+
+   for( ft = 0; ft < 3; ft++ ) {
+      snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+      if( ft == 1 )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped subreg");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write subreg");
+      for( r = 0; r < 6; r++ )
+         TEST_CHECK(check_subregion(nim, fname, regions[r], regions[r]+4)
+                    == 0, fnames[ft]);
+   }
+
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_read_subregions: overlapping regions, read in one pass */
+static int test_subregions(const char * dir)
+{
+   int64_t       dims[8] = { 4, 70, 60, 50, 8, 1, 1, 1 };
+   /* start and size: overlapping cubes, a region inside another, one
+      that spans volumes, and a single voxel */
+   int64_t       regions[7][8] = {
+      { 10, 20, 5, 0,    5, 5, 5, 2 },
+      { 12, 22, 7, 1,    5, 5, 5, 1 },
+      { 8, 18, 3, 0,     12, 12, 12, 3 },
+      { 0, 10, 10, 1,    70, 40, 30, 3 },
+      { 30, 0, 0, 0,     1, 60, 50, 8 },
+      { 69, 59, 49, 7,   1, 1, 1, 1 },
+      { 0, 0, 20, 2,     70, 60, 2, 4 } };
+   const int64_t * starts[7], * sizes[7];
+   const char    * fnames[] = { "subregs.nii", "subregs_swap.nii",
+                                "subregs.nii.gz" };
+   const short   * sdata;
+   nifti_image   * nim, * nin;
+   void          * bufs[7];
+   short           own[5*5*5*2];
+   char            fname[1024];
+   int64_t         c, x, y, z, t, total, *st, *sz;
+   int             ft, r, ok;
+
+   nim = nifti_make_new_nim(dims, DT_INT16, 1);
+   TEST_CHECK(nim != NULL, "create subregions image");
+   if( !nim ) return 1;
+   sdata = (const short *)nim->data;
+   for( c = 0; c < nim->nvox; c++ )
+      ((short *)nim->data)[c] = (short)((c * 2654435761u) % 32000);
+
+   for( r = 0, total = 0; r < 7; r++ ) {
+      starts[r] = regions[r];
+      sizes[r]  = regions[r] + 4;
+      total += regions[r][4] * regions[r][5] * regions[r][6] * regions[r][7];
+   }
+   total *= nim->nbyper;
+
+   for( ft = 0; ft < 3; ft++ ) {
+      snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+      if( ft == 1 )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped subregs");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write subregs");
+
+      nin = nifti_image_read(fname, 0);
+      TEST_CHECK(nin != NULL, "read subregs header");
+      if( !nin ) continue;
+
+      /* the first buffer is given, the rest are allocated */
+      bufs[0] = own;
+      for( r = 1; r < 7; r++ ) bufs[r] = NULL;
+      TEST_CHECK(nifti_read_subregions(nin, 7, starts, sizes, bufs) == total,
+                 "read_subregions size");
+      for( r = 0; r < 7; r++ ) {
+         const short * roi = (const short *)bufs[r];
+         st = regions[r];  sz = regions[r] + 4;
+         ok = roi != NULL;  c = 0;
+         for( t = st[3]; ok && t < st[3] + sz[3]; t++ )
+          for( z = st[2]; ok && z < st[2] + sz[2]; z++ )
+           for( y = st[1]; ok && y < st[1] + sz[1]; y++ )
+            for( x = st[0]; ok && x < st[0] + sz[0]; x++ )
+               ok = roi[c++] ==
+                    sdata[x + nim->nx*(y + nim->ny*(z + nim->nz*t))];
+         TEST_CHECK(ok, fnames[ft]);
+         if( r > 0 ) free(bufs[r]);
+      }
+
+      /* a region outside the image fails, and allocates nothing */
+      regions[5][3] = 8;
+      for( r = 0; r < 7; r++ ) bufs[r] = NULL;
+      TEST_CHECK(nifti_read_subregions(nin, 7, starts, sizes, bufs) < 0 &&
+                 bufs[0] == NULL, "read_subregions bad region");
+      regions[5][3] = 7;
+
+      nifti_image_free(nin);
+   }
+
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_read_collapsed_image: leaves merged into slabs, or threaded */
+static int check_collapsed(const nifti_image * nim, nifti_image * nin,
+                           const int64_t * dims)
+{
+   const short * sdata = (const short *)nim->data;
+   short       * cdata = NULL;
+   int64_t       lo[4], hi[4], x, y, z, t, c = 0, nbytes = nin->nbyper;
+   int           d, ok;
+
+   for( d = 0; d < 4; d++ ){
+      lo[d] = dims[d+1] < 0 ? 0 : dims[d+1];
+      hi[d] = dims[d+1] < 0 ? nim->dim[d+1] : dims[d+1] + 1;
+      nbytes *= hi[d] - lo[d];
+   }
+   ok = nifti_read_collapsed_image(nin, dims, (void **)&cdata) == nbytes;
+   for( t = lo[3]; ok && t < hi[3]; t++ )
+    for( z = lo[2]; ok && z < hi[2]; z++ )
+     for( y = lo[1]; ok && y < hi[1]; y++ )
+      for( x = lo[0]; ok && x < hi[0]; x++ )
+         ok = cdata[c++] == sdata[x + nim->nx*(y + nim->ny*(z + nim->nz*t))];
+   free(cdata);
+
+   return !ok;
+}
+
+static int test_collapsed(const char * dir)
+{
+   /* small volumes (leaves are merged), and large ones (they are not) */
+   int64_t       idims[2][8] = { { 4, 20, 16, 12, 300, 1, 1, 1 },
+                                 { 4, 64, 64, 10, 40, 1, 1, 1 } };
+   /* a voxel time series, a volume, a slice, a row per slice and volume,
+      a single voxel, and the whole image */
+   int64_t       cdims[6][8] = { { 0, 5, 4, 7, -1, -1, -1, -1 },
+                                 { 0, -1, -1, -1, 17, -1, -1, -1 },
+                                 { 0, -1, -1, 3, -1, -1, -1, -1 },
+                                 { 0, -1, 9, -1, -1, -1, -1, -1 },
+                                 { 0, 19, 15, 9, 39, -1, -1, -1 },
+                                 { 0, -1, -1, -1, -1, -1, -1, -1 } };
+   const char  * fnames[] = { "collapsed.nii", "collapsed_swap.nii",
+                              "collapsed.nii.gz" };
+   nifti_image * nim, * nin;
+   char          fname[1024];
+   int64_t       c;
+   int           im, ft, r, nt;
+
+   for( im = 0; im < 2; im++ ) {
+      nim = nifti_make_new_nim(idims[im], DT_INT16, 1);
+      TEST_CHECK(nim != NULL, "create collapsed image");
+      if( !nim ) return 1;
+      for( c = 0; c < nim->nvox; c++ )
+         ((short *)nim->data)[c] = (short)((c * 2654435761u) % 32000);
+
+      for( ft = 0; ft < 3; ft++ ) {
+         snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+         if( ft == 1 )
+            TEST_CHECK(write_swapped(nim, fname) == 0,
+                       "write swapped collapsed");
+         else
+            TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                       nifti_image_write_status(nim) == 0, "write collapsed");
+         nin = nifti_image_read(fname, 0);
+         TEST_CHECK(nin != NULL, "read collapsed header");
+         if( !nin ) continue;
+         for( nt = 1; nt <= 4; nt += 3 ) {
+            nifti_set_nthreads(nt);
+            for( r = 0; r < 6; r++ )
+               TEST_CHECK(check_collapsed(nim, nin, cdims[r]) == 0,
+                          fnames[ft]);
+         }
+         nifti_set_nthreads(1);
+         nifti_image_free(nin);
+      }
+      nifti_image_free(nim);
+   }
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_read_timeseries: voxel-major time series, from one pass */
+static int check_timeseries(const nifti_image * nim, nifti_image * nin,
+                            int64_t nvox, const int64_t * ijk)
+{
+   const char * src = (const char *)nim->data;
+   char       * out = NULL;
+   int64_t      nvol = nim->nx * nim->ny * nim->nz, nt = nim->nvox / nvol;
+   int64_t      v, t, ind;
+   int          ok;
+
+   ok = nifti_read_timeseries(nin, nvox, ijk, (void **)&out)
+        == nvox * nt * nim->nbyper;
+   for( v = 0; ok && v < nvox; v++ ) {
+      ind = ijk[3*v] + nim->nx * (ijk[3*v+1] + nim->ny * ijk[3*v+2]);
+      for( t = 0; ok && t < nt; t++ )
+         ok = ! memcmp(out + (v * nt + t) * nim->nbyper,
+                       src + (t * nvol + ind) * nim->nbyper, nim->nbyper);
+   }
+   free(out);
+
+   return !ok;
+}
+
+static int test_timeseries(const char * dir)
+{
+   /* small int16 and RGB images, and a float image of over one batch */
+   int64_t       idims[3][8] = { { 4, 20, 16, 12, 300, 1, 1, 1 },
+                                 { 5, 9, 8, 7, 3, 4, 1, 1 },
+                                 { 4, 64, 64, 64, 70, 1, 1, 1 } };
+   int           itypes[3] = { DT_INT16, DT_RGB24, DT_FLOAT32 };
+   const char  * fnames[] = { "timeseries.nii", "timeseries_swap.nii",
+                              "timeseries.nii.gz" };
+   int64_t       ijk[3*200], bad[3] = { 0, 0, 7 };
+   nifti_image * nim, * nin;
+   char          fname[1024];
+   void        * out;
+   int64_t       c, nvox = 200;
+   int           im, ft, nt;
+
+   for( im = 0; im < 3; im++ ) {
+      nim = nifti_make_new_nim(idims[im], itypes[im], 1);
+      TEST_CHECK(nim != NULL, "create timeseries image");
+      if( !nim ) return 1;
+      for( c = 0; c < nim->nvox * nim->nbyper; c++ )
+         ((unsigned char *)nim->data)[c] = (unsigned char)(c*2654435761u>>7);
+      if( im == 2 )  /* keep the floats finite */
+         for( c = 0; c < nim->nvox; c++ )
+            ((float *)nim->data)[c] = (float)(c % 100003);
+
+      /* voxels in no order, with repeats and corners */
+      for( c = 0; c < nvox; c++ ) {
+         ijk[3*c]   = (c * 7) % nim->nx;
+         ijk[3*c+1] = (c * 5 + 3) % nim->ny;
+         ijk[3*c+2] = (c * 11 + 1) % nim->nz;
+      }
+      ijk[0] = ijk[1] = ijk[2] = 0;
+      ijk[3] = nim->nx-1;  ijk[4] = nim->ny-1;  ijk[5] = nim->nz-1;
+
+      /* data in memory is used directly */
+      TEST_CHECK(check_timeseries(nim, nim, nvox, ijk) == 0,
+                 "timeseries from memory");
+
+      for( ft = 0; ft < (im == 2 ? 1 : 3); ft++ ) {
+         snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+         if( ft == 1 )
+            TEST_CHECK(write_swapped(nim, fname) == 0,
+                       "write swapped timeseries");
+         else
+            TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                       nifti_image_write_status(nim) == 0,
+                       "write timeseries");
+         nin = nifti_image_read(fname, 0);
+         TEST_CHECK(nin != NULL, "read timeseries header");
+         if( !nin ) continue;
+         for( nt = 1; nt <= 4; nt += 3 ) {
+            nifti_set_nthreads(nt);
+            TEST_CHECK(check_timeseries(nim, nin, nvox, ijk) == 0,
+                       fnames[ft]);
+         }
+         nifti_set_nthreads(1);
+
+         /* a voxel outside the image fails */
+         bad[2] = nim->nz;
+         out = NULL;
+         TEST_CHECK(nifti_read_timeseries(nin, 1, bad, &out) < 0 && !out,
+                    "timeseries bad voxel");
+         nifti_image_free(nin);
+      }
+      nifti_image_free(nim);
+   }
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_image_load_bricks_ex: bricks in one aligned arena */
+static int check_arena(nifti_image * nin, const nifti_image * nim,
+                       int64_t nbricks, const int64_t * blist,
+                       int64_t align)
+{
+   nifti_brick_list NBL;
+   int64_t          c, b, bsize = nim->nx * nim->ny * nim->nz * nim->nbyper;
+   int              ok;
+
+   ok = nifti_image_load_bricks_ex(nin, nbricks, blist, &NBL,
+                                   NIFTI_NBL_ARENA) == (blist ? nbricks :
+                                   nim->nvox * nim->nbyper / bsize);
+   if( !ok ) return 1;
+   ok = NBL.bsize == bsize && ((uintptr_t)NBL.bricks[0] % align) == 0;
+   for( c = 0; ok && c < NBL.nbricks; c++ ) {
+      b  = blist ? blist[c] : c;
+      ok = (char *)NBL.bricks[c] == (char *)NBL.bricks[0] + c * bsize &&
+           ! memcmp(NBL.bricks[c], (char *)nim->data + b * bsize, bsize);
+   }
+   nifti_free_NBL(&NBL);
+
+   return !ok || NBL.bricks != NULL || NBL.nbricks != 0;
+}
+
+static int test_arena(const char * dir)
+{
+   /* a small image, and one large enough for a huge page arena */
+   int64_t          idims[2][8] = { { 4, 20, 16, 12, 30, 1, 1, 1 },
+                                    { 4, 64, 64, 64, 80, 1, 1, 1 } };
+   int64_t          blist[6] = { 7, 0, 5, 5, 29, 1 };
+   const char     * fnames[] = { "arena.nii", "arena_swap.nii",
+                                 "arena.nii.gz" };
+   nifti_brick_list NBL;
+   nifti_image    * nim, * nin;
+   char             fname[1024];
+   int64_t          c;
+   int              im, ft;
+
+   for( im = 0; im < 2; im++ ) {
+      nim = nifti_make_new_nim(idims[im], DT_INT16, 1);
+      TEST_CHECK(nim != NULL, "create arena image");
+      if( !nim ) return 1;
+      for( c = 0; c < nim->nvox; c++ )
+         ((short *)nim->data)[c] = (short)((c * 2654435761u) % 32000);
+
+      for( ft = 0; ft < (im == 1 ? 1 : 3); ft++ ) {
+         snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+         if( ft == 1 )
+            TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped arena");
+         else
+            TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                       nifti_image_write_status(nim) == 0, "write arena");
+         nin = nifti_image_read(fname, 0);
+         TEST_CHECK(nin != NULL, "read arena header");
+         if( !nin ) continue;
+
+         TEST_CHECK(check_arena(nin, nim, 0, NULL, im ? 1<<21 : 64) == 0,
+                    fnames[ft]);
+         TEST_CHECK(check_arena(nin, nim, 6, blist, 64) == 0, fnames[ft]);
+
+         /* bricks allocated one at a time are still freed each */
+         TEST_CHECK(nifti_image_load_bricks(nin, 6, blist, &NBL) == 6,
+                    "load bricks without arena");
+         nifti_free_NBL(&NBL);
+
+         /* an arena is released with its pointer list */
+         TEST_CHECK(nifti_image_load_bricks_ex(nin, 6, blist, &NBL,
+                                               NIFTI_NBL_ARENA) == 6,
+                    "load arena bricks");
+         nifti_free_NBL(&NBL);
+         nifti_image_free(nin);
+      }
+      nifti_image_free(nim);
+   }
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_image_load_bricks: long lists with runs and repeats */
+static int test_bricklist(const char * dir)
+{
+   int64_t          dims[8] = { 4, 20, 16, 12, 300, 1, 1, 1 };
+   const char     * fnames[] = { "bricklist.nii", "bricklist_swap.nii",
+                                 "bricklist.nii.gz" };
+   nifti_brick_list NBL;
+   nifti_image    * nim, * nin;
+   char             fname[1024];
+   int64_t        * blist, nbricks = 10000, bsize, c;
+   int              ft, arena, ok;
+
+   nim = nifti_make_new_nim(dims, DT_INT16, 1);
+   blist = (int64_t *)malloc(nbricks * sizeof(int64_t));
+   TEST_CHECK(nim != NULL && blist != NULL, "create bricklist image");
+   if( !nim || !blist ) return 1;
+   for( c = 0; c < nim->nvox; c++ )
+      ((short *)nim->data)[c] = (short)((c * 2654435761u) % 32000);
+   bsize = nim->nx * nim->ny * nim->nz * nim->nbyper;
+
+   /* runs of consecutive bricks, backwards runs, and random repeats */
+   for( c = 0; c < nbricks; c++ ) {
+      if( c < 600 )       blist[c] = c % 300;
+      else if( c < 900 )  blist[c] = 899 - c;
+      else                blist[c] = (c * 2654435761u >> 5) % 300;
+   }
+
+   for( ft = 0; ft < 3; ft++ ) {
+      snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+      if( ft == 1 )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped bricklist");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write bricklist");
+      nin = nifti_image_read(fname, 0);
+      TEST_CHECK(nin != NULL, "read bricklist header");
+      if( !nin ) continue;
+      for( arena = 0; arena <= NIFTI_NBL_ARENA; arena += NIFTI_NBL_ARENA ) {
+         ok = nifti_image_load_bricks_ex(nin, nbricks, blist, &NBL, arena)
+              == nbricks;
+         for( c = 0; ok && c < nbricks; c++ )
+            ok = ! memcmp(NBL.bricks[c], (char *)nim->data + blist[c]*bsize,
+                          bsize);
+         TEST_CHECK(ok, fnames[ft]);
+         nifti_free_NBL(&NBL);
+
+         /* and all bricks, in order */
+         ok = nifti_image_load_bricks_ex(nin, 0, NULL, &NBL, arena) == 300;
+         for( c = 0; ok && c < 300; c++ )
+            ok = ! memcmp(NBL.bricks[c], (char *)nim->data + c*bsize, bsize);
+         TEST_CHECK(ok, fnames[ft]);
+         nifti_free_NBL(&NBL);
+      }
+      nifti_image_free(nin);
+   }
+
+   free(blist);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_image_load_bricks: runs read by several threads */
+static int test_parbricks(const char * dir)
+{
+   int64_t          dims[8] = { 4, 64, 64, 64, 80, 1, 1, 1 };
+   const char     * fnames[] = { "parbricks.nii", "parbricks_swap.nii" };
+   nifti_brick_list NBL;
+   nifti_image    * nim, * nin;
+   char             fname[1024];
+   int64_t          blist[200], bsize, nbricks, c;
+   int              ft, arena, ok;
+
+   nim = nifti_make_new_nim(dims, DT_INT16, 1);
+   TEST_CHECK(nim != NULL, "create parbricks image");
+   if( !nim ) return 1;
+   for( c = 0; c < nim->nvox; c++ )
+      ((short *)nim->data)[c] = (short)((c * 2654435761u) % 32000);
+   bsize = nim->nx * nim->ny * nim->nz * nim->nbyper;
+
+   /* every brick, backwards, then a run and repeats */
+   for( c = 0; c < 80; c++ ) blist[c] = 79 - c;
+   for( c = 80; c < 200; c++ ) blist[c] = c < 120 ? c - 80 : (c * 7) % 80;
+
+   nifti_set_nthreads(4);
+   for( ft = 0; ft < 2; ft++ ) {
+      snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+      if( ft == 1 )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped parbricks");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write parbricks");
+      nin = nifti_image_read(fname, 0);
+      TEST_CHECK(nin != NULL, "read parbricks header");
+      if( !nin ) continue;
+      for( arena = 0; arena <= NIFTI_NBL_ARENA; arena += NIFTI_NBL_ARENA ) {
+         /* all bricks, then the list */
+         for( nbricks = 0; nbricks <= 200; nbricks += 200 ) {
+            ok = nifti_image_load_bricks_ex(nin, nbricks,
+                                            nbricks ? blist : NULL, &NBL,
+                                            arena) == (nbricks ? 200 : 80);
+            for( c = 0; ok && c < NBL.nbricks; c++ )
+               ok = ! memcmp(NBL.bricks[c], (char *)nim->data +
+                             (nbricks ? blist[c] : c) * bsize, bsize);
+            TEST_CHECK(ok, fnames[ft]);
+            nifti_free_NBL(&NBL);
+         }
+      }
+      nifti_image_free(nin);
+   }
+   nifti_set_nthreads(1);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_image_load_bricks: bricks larger than the read slab, serial and
+   parallel */
+static int test_bigbricks(const char * dir)
+{
+   /* 4.7 MB float bricks (more than a slab), and 3.1 MB short ones, */
+   /* with enough of them for a parallel read                         */
+   int64_t          idims[2][8] = { { 4, 128, 128, 72,  8, 1, 1, 1 },
+                                    { 4, 128, 128, 96, 12, 1, 1, 1 } };
+   int              dtypes[2] = { DT_FLOAT32, DT_INT16 };
+   int64_t          blist[12] = { 0, 1, 2, 2, 1, 2, 5, 6, 7, 3, 4, 4 };
+   nifti_brick_list NBL;
+   nifti_image    * nim, * nin;
+   char             fname[1024];
+   int64_t          bsize, nbricks, c;
+   int              im, arena, nthreads, ok;
+
+   for( im = 0; im < 2; im++ ) {
+      nim = nifti_make_new_nim(idims[im], dtypes[im], 1);
+      TEST_CHECK(nim != NULL, "create bigbricks image");
+      if( !nim ) return 1;
+      for( c = 0; c < nim->nvox; c++ ) {
+         if( im ) ((short *)nim->data)[c] = (short)((c*2654435761u) % 32000);
+         else     ((float *)nim->data)[c] = 0.25f * (float)(c % 1000003);
+      }
+      bsize = nim->nx * nim->ny * nim->nz * nim->nbyper;
+
+      snprintf(fname, sizeof(fname), "%s/bigbricks%d.nii", dir, im);
+      TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                 nifti_image_write_status(nim) == 0, "write bigbricks");
+      nin = nifti_image_read(fname, 0);
+      TEST_CHECK(nin != NULL, "read bigbricks header");
+      if( !nin ) { nifti_image_free(nim); continue; }
+
+      /* serially, then on several threads */
+      for( nthreads = 1; nthreads <= 4; nthreads += 3 ) {
+         nifti_set_nthreads(nthreads);
+         for( arena = 0; arena <= NIFTI_NBL_ARENA; arena += NIFTI_NBL_ARENA )
+            /* all bricks, then a list with consecutive entries */
+            for( nbricks = 0; nbricks <= 12; nbricks += 12 ) {
+               ok = nifti_image_load_bricks_ex(nin, nbricks,
+                                               nbricks ? blist : NULL, &NBL,
+                                               arena) == (nbricks ? 12 :
+                                                          nim->nt);
+               for( c = 0; ok && c < NBL.nbricks; c++ )
+                  ok = ! memcmp(NBL.bricks[c], (char *)nim->data +
+                                (nbricks ? blist[c] : c) * bsize, bsize);
+               TEST_CHECK(ok, fname);
+               nifti_free_NBL(&NBL);
+            }
+      }
+      nifti_set_nthreads(1);
+      nifti_image_free(nin);
+      nifti_image_free(nim);
+   }
+
+   return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/* nifti_volume_reader: volumes streamed in batches, with prefetch */
+static int check_volreader(const nifti_image * nim, nifti_image * nin,
+                           int64_t batch, int64_t stop)
+{
+   nifti_volume_reader * R;
+   void                * vols;
+   int64_t               nb, posn = 0;
+   int64_t               vbytes = nim->nx * nim->ny * nim->nz * nim->nbyper;
+   int                   ok = 1;
+
+   R = nifti_volume_reader_open(nin, batch);
+   if( !R ) return 1;
+   while( ok && posn < stop && (nb = nifti_volume_reader_next(R, &vols)) > 0 ){
+      ok = nb <= batch && ! memcmp(vols, (char *)nim->data + posn * vbytes,
+                                   nb * vbytes);
+      posn += nb;
+   }
+   if( stop >= nim->nt ) ok = ok && posn == nim->nt &&
+                              nifti_volume_reader_next(R, &vols) == 0;
+   nifti_volume_reader_close(R);
+
+   return !ok;
+}
+
+static int test_volreader(const char * dir)
+{
+   int64_t       dims[8] = { 4, 20, 16, 12, 50, 1, 1, 1 };
+   int64_t       batches[4] = { 1, 3, 50, 100 };
+   const char  * fnames[] = { "volreader.nii", "volreader_swap.nii",
+                              "volreader.nii.gz" };
+   nifti_image * nim, * nin;
+   char          fname[1024];
+   int64_t       c;
+   int           ft, b;
+
+   nim = nifti_make_new_nim(dims, DT_INT16, 1);
+   TEST_CHECK(nim != NULL, "create volreader image");
+   if( !nim ) return 1;
+   for( c = 0; c < nim->nvox; c++ )
+      ((short *)nim->data)[c] = (short)((c * 2654435761u) % 32000);
+
+   /* data in memory is handed out directly */
+   TEST_CHECK(check_volreader(nim, nim, 7, 50) == 0, "volreader memory");
+
+   for( ft = 0; ft < 3; ft++ ) {
+      snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+      if( ft == 1 )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped volreader");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write volreader");
+      nin = nifti_image_read(fname, 0);
+      TEST_CHECK(nin != NULL, "read volreader header");
+      if( !nin ) continue;
+      for( b = 0; b < 4; b++ )
+         TEST_CHECK(check_volreader(nim, nin, batches[b], 50) == 0,
+                    fnames[ft]);
+      /* closing early stops the reader */
+      TEST_CHECK(check_volreader(nim, nin, 2, 5) == 0, "volreader stop");
+      TEST_CHECK(check_volreader(nim, nin, 2, 0) == 0, "volreader no next");
+      nifti_image_free(nin);
+   }
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+static int test_volwriter(const char * dir)
+{
+   int64_t       dims[8] = { 4, 12, 10, 8, 3, 1, 1, 1 };
+   const char  * fnames[] = { "volwriter.nii", "volwriter.nii.gz",
+                              "volwriter.hdr", "volwriter2.nii",
+                              "volwriter2.nii.gz" };
+   nifti_image * nim, * nin;
+   nifti_volume_writer * W;
+   float       * data;
+   char          fname[1024];
+   int64_t       nvol, nt = 9, c, t;
+   int           ft;
+
+   nim = nifti_make_new_nim(dims, DT_FLOAT32, 0);
+   TEST_CHECK(nim != NULL, "create volwriter template");
+   if( !nim ) return 1;
+   nvol = nim->nx * nim->ny * nim->nz;
+   data = (float *)malloc(nt * nvol * sizeof(float));
+   if( !data ) { nifti_image_free(nim); return 1; }
+   for( c = 0; c < nt * nvol; c++ )
+      data[c] = (float)((c * 2654435761u) % 1000) - 250.0f;
+   data[5] = -300.0f;  data[nt*nvol-1] = 900.5f;
+   nifti_add_extension(nim, "volwriter", 10, NIFTI_ECODE_COMMENT);
+
+   for( ft = 0; ft < 5; ft++ ) {
+      snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+      TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0, fname);
+      nim->nifti_type = ft < 3 ? (ft == 2 ? NIFTI_FTYPE_NIFTI1_2
+                                          : NIFTI_FTYPE_NIFTI1_1)
+                               : NIFTI_FTYPE_NIFTI2_1;
+      W = nifti_volume_writer_open(nim);
+      TEST_CHECK(W != NULL, "open volwriter");
+      if( !W ) continue;
+      /* whole volumes, then slabs of 3 slices */
+      for( t = 0; t < 4; t++ )
+         TEST_CHECK(nifti_volume_writer_append(W, data + t*nvol, nvol) == 0,
+                    "append volume");
+      for( c = 4*nvol; c < nt*nvol; c += 3*nim->nx*nim->ny ) {
+         t = nt*nvol - c < 3*nim->nx*nim->ny ? nt*nvol - c : 3*nim->nx*nim->ny;
+         TEST_CHECK(nifti_volume_writer_append(W, data + c, t) == 0,
+                    "append slab");
+      }
+      TEST_CHECK(nifti_volume_writer_close(W) == 0, "close volwriter");
+
+      nin = nifti_image_read(fname, 1);
+      TEST_CHECK(nin != NULL, "read volwriter output");
+      if( !nin ) continue;
+      TEST_CHECK(nin->nt == nt && nin->dim[0] == 4 && nin->nvox == nt*nvol,
+                 "volwriter dims");
+      TEST_CHECK(nin->cal_min == -300.0f && nin->cal_max == 900.5f,
+                 "volwriter cal range");
+      TEST_CHECK(nin->num_ext == 1, "volwriter extension");
+      TEST_CHECK(memcmp(nin->data, data, nt*nvol*sizeof(float)) == 0,
+                 fnames[ft]);
+      nifti_image_free(nin);
+   }
+
+   /* a partial volume fails at close */
+   snprintf(fname, sizeof(fname), "%s/volwriter_part.nii", dir);
+   nifti_set_filenames(nim, fname, 0, 1);
+   nim->nifti_type = NIFTI_FTYPE_NIFTI1_1;
+   W = nifti_volume_writer_open(nim);
+   TEST_CHECK(W != NULL, "open partial volwriter");
+   if( W ) {
+      nifti_set_debug_level(0);
+      TEST_CHECK(nifti_volume_writer_append(W, data, nvol + 5) == 0,
+                 "append partial");
+      TEST_CHECK(nifti_volume_writer_close(W) == 1, "close partial volwriter");
+      nifti_set_debug_level(1);
+   }
+
+   free(data);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+static int test_append(const char * dir)
+{
+   int64_t       dims[8] = { 3, 10, 9, 8, 1, 1, 1, 1 };
+   const char  * fnames[] = { "append.nii", "append2.nii", "append_swap.nii" };
+   nifti_image * nim, * nin;
+   short       * data;
+   char          fname[1024];
+   int64_t       nvol, nt = 6, c;
+   int           ft;
+
+   nim = nifti_make_new_nim(dims, DT_INT16, 1);
+   TEST_CHECK(nim != NULL, "create append image");
+   if( !nim ) return 1;
+   nvol = nim->nvox;
+   data = (short *)malloc(nt * nvol * sizeof(short));
+   if( !data ) { nifti_image_free(nim); return 1; }
+   for( c = 0; c < nt * nvol; c++ )
+      data[c] = (short)((c * 2654435761u) % 32000);
+   memcpy(nim->data, data, nvol * sizeof(short));
+   nim->cal_max = 77.0;
+
+   for( ft = 0; ft < 3; ft++ ) {
+      snprintf(fname, sizeof(fname), "%s/%s", dir, fnames[ft]);
+      nim->nifti_type = ft ? NIFTI_FTYPE_NIFTI2_1 : NIFTI_FTYPE_NIFTI1_1;
+      if( ft == 2 )
+         TEST_CHECK(write_swapped(nim, fname) == 0, "write swapped append");
+      else
+         TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                    nifti_image_write_status(nim) == 0, "write append");
+
+      /* one volume, then several, then none */
+      TEST_CHECK(nifti_image_append_volumes(fname, data + nvol, 1) == 0,
+                 "append 1 volume");
+      TEST_CHECK(nifti_image_append_volumes(fname, data + 2*nvol, nt-2) == 0,
+                 "append volumes");
+      TEST_CHECK(nifti_image_append_volumes(fname, data, 0) == 0,
+                 "append 0 volumes");
+
+      nin = nifti_image_read(fname, 1);
+      TEST_CHECK(nin != NULL, "read appended image");
+      if( !nin ) continue;
+      TEST_CHECK(nin->dim[0] == 4 && nin->nt == nt && nin->nvox == nt*nvol,
+                 "append dims");
+      TEST_CHECK(nin->cal_max == 77.0, "append header kept");
+      TEST_CHECK(nifti_get_filesize(fname) ==
+                 nin->iname_offset + nt*nvol*(int64_t)sizeof(short),
+                 "append file size");
+      TEST_CHECK(memcmp(nin->data, data, nt*nvol*sizeof(short)) == 0,
+                 fnames[ft]);
+      nifti_image_free(nin);
+   }
+
+   /* compressed files are not appended to */
+   snprintf(fname, sizeof(fname), "%s/append.nii.gz", dir);
+   nim->nifti_type = NIFTI_FTYPE_NIFTI1_1;
+   TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+              nifti_image_write_status(nim) == 0, "write append gz");
+   nifti_set_debug_level(0);
+   TEST_CHECK(nifti_image_append_volumes(fname, data, 1) == 1,
+              "append to gz fails");
+   nifti_set_debug_level(1);
+
+   free(data);
+   nifti_image_free(nim);
+
+   return 0;
+}
+
+/* a thread writing and reading .hdr/.img pairs with its own context */
+typedef struct {
+   const char * dir;
+   int          id;
+   int          errors;
+} ctx_job;
+
+static void * context_worker(void * arg)
+{
+   ctx_job       * job = (ctx_job *)arg;
+   int64_t         dims[8] = { 3, 6, 5, 4, 1, 1, 1, 1 };
+   nifti_context * ctx;
+   nifti_image   * nim, * nin;
+   char            fname[1024];
+   int             skip = job->id & 1, c;
+
+   ctx = nifti_context_new();
+   nim = nifti_make_new_nim(dims, DT_FLOAT32, 1);
+   if( !ctx || !nim ) { job->errors++; goto done; }
+   nifti_context_set_debug_level(ctx, 0);
+   nifti_context_set_skip_blank_ext(ctx, skip);
+   nifti_set_thread_context(ctx);
+
+   snprintf(fname, sizeof(fname), "%s/context%d.hdr", job->dir, job->id);
+   for( c = 0; c < 50; c++ ) {
+      ((float *)nim->data)[c % nim->nvox] = (float)(job->id * 100 + c);
+      if( nifti_set_filenames(nim, fname, 0, 1) ||
+          nifti_image_write_status(nim) ) { job->errors++; break; }
+      /* a blank extender is only skipped by this thread (NIFTI-2) */
+      if( nifti_get_filesize(fname) != (skip ? 540 : 544) ) job->errors++;
+      nin = nifti_image_read(fname, 1);
+      if( !nin || memcmp(nin->data, nim->data, nim->nvox * nim->nbyper) )
+         job->errors++;
+      nifti_image_free(nin);
+      /* quiet failures, recorded for this thread */
+      nifti_clear_last_error();
+      if( nifti_image_read("no_such_dataset.nii", 0) ||
+          nifti_get_last_error() != NIFTI_ERR_NOFILE ) job->errors++;
+   }
+
+   if( nifti_set_thread_context(NULL) != ctx ) job->errors++;
+ done:
+   nifti_image_free(nim);
+   nifti_context_free(ctx);
+   return NULL;
+}
+
+static int test_context(const char * dir)
+{
+   int64_t         dims[8] = { 4, 64, 64, 32, 40, 1, 1, 1 };
+   ctx_job         jobs[4];
+   nifti_context * ctx;
+   nifti_image   * nim, * nin;
+   char            fname[1024];
+   int             t;
+#ifdef HAVE_PTHREAD
+   pthread_t       tid[4];
+   int             started[4];
+#endif
+
+   /* threads with different options */
+   for( t = 0; t < 4; t++ ) {
+      jobs[t].dir = dir;  jobs[t].id = t;  jobs[t].errors = 0;
+   }
+#ifdef HAVE_PTHREAD
+   for( t = 0; t < 4; t++ )
+      started[t] = pthread_create(tid+t, NULL, context_worker, jobs+t) == 0;
+   for( t = 0; t < 4; t++ )
+      if( started[t] ) pthread_join(tid[t], NULL);
+      else             context_worker(jobs+t);
+#else
+   for( t = 0; t < 4; t++ ) context_worker(jobs+t);
+#endif
+   for( t = 0; t < 4; t++ )
+      TEST_CHECK(jobs[t].errors == 0, "context thread");
+
+   /* the errors of other threads are not seen here */
+#ifdef HAVE_PTHREAD
+   TEST_CHECK(nifti_get_last_error() == NIFTI_ERR_NONE, "global last error");
+#endif
+   nifti_clear_last_error();
+
+   /* single calls with a context: quiet, and loading on 4 threads */
+   ctx = nifti_context_new();
+   TEST_CHECK(ctx != NULL, "context new");
+   if( !ctx ) return 1;
+   nifti_context_set_debug_level(ctx, 0);
+   nifti_context_set_nthreads(ctx, 4);
+
+   TEST_CHECK(nifti_image_read_ctx(ctx, "no_such_dataset", 0) == NULL &&
+              nifti_get_last_error() == NIFTI_ERR_NOFILE, "read_ctx error");
+   TEST_CHECK(strcmp(nifti_error_string(NIFTI_ERR_NOFILE),
+                     "dataset file not found") == 0, "error string");
+   nifti_clear_last_error();
+   TEST_CHECK(nifti_get_last_error() == NIFTI_ERR_NONE, "clear last error");
+
+   nim = nifti_make_new_nim(dims, DT_INT16, 1);
+   TEST_CHECK(nim != NULL, "create context image");
+   if( nim ) {
+      for( t = 0; t < (int)nim->nvox; t++ )
+         ((short *)nim->data)[t] = (short)(t % 30011);
+      snprintf(fname, sizeof(fname), "%s/context.nii", dir);
+      TEST_CHECK(nifti_set_filenames(nim, fname, 0, 1) == 0 &&
+                 nifti_image_write_status_ctx(ctx, nim) == 0, "write_ctx");
+      nin = nifti_image_read_ctx(ctx, fname, 0);
+      TEST_CHECK(nin && nifti_image_load_ctx(ctx, nin) == 0 &&
+                 memcmp(nin->data, nim->data, nim->nvox * nim->nbyper) == 0,
+                 "load_ctx");
+      nifti_image_free(nin);
+      nifti_image_free(nim);
+   }
+
+   /* with a thread context, the plain setters change that context */
+   nifti_set_thread_context(ctx);
+   nifti_set_data_align(256);
+   nifti_set_alter_cifti(1);
+   TEST_CHECK(nifti_get_data_align() == 256 && nifti_get_alter_cifti() == 1,
+              "set options of thread context");
+   nifti_set_thread_context(NULL);
+   TEST_CHECK(nifti_get_data_align() != 256 && nifti_get_alter_cifti() == 0,
+              "global options unchanged");
+   nifti_context_free(ctx);
+
+   return 0;
+}
+
+/* a counting allocator, keeping the raw pointer before each block */
+typedef struct {
+   int64_t nalloc, nlive, naligned;
+} alloc_count;
+
+static void * count_block(size_t align, size_t nbytes, alloc_count * A)
+{
+   char * raw, * p;
+
+   raw = (char *)malloc(nbytes + align + sizeof(void *));
+   if( !raw ) return NULL;
+   p = raw + sizeof(void *);
+   p += (align - ((size_t)p & (align - 1))) & (align - 1);
+   ((void **)p)[-1] = raw;
+   A->nalloc++;  A->nlive++;
+   return p;
+}
+
+static void * count_alloc(size_t nbytes, void * ctx)
+{
+   return count_block(sizeof(void *), nbytes, (alloc_count *)ctx);
+}
+
+static void * count_alloc_aligned(size_t align, size_t nbytes, void * ctx)
+{
+   ((alloc_count *)ctx)->naligned++;
+   return count_block(align, nbytes, (alloc_count *)ctx);
+}
+
+static void count_dealloc(void * ptr, void * ctx)
+{
+   ((alloc_count *)ctx)->nlive--;
+   free(((void **)ptr)[-1]);
+}
+
+static int test_allocator(const char * dir)
+{
+   alloc_count      counts = { 0, 0, 0 };
+   nifti_allocator  A = { count_alloc, count_alloc_aligned, count_dealloc,
+                          NULL };
+   nifti_image    * nim, * nin;
+   nifti_brick_list NBL, NBL2;
+   int64_t          blist[3] = { 4, 0, 2 };
+   int64_t          dims[8] = { 2, 3, 4, -1, -1, -1, -1, -1 };
+   int64_t          ijk[6] = { 1, 2, 3,  10, 6, 4 };
+   void           * data = NULL;
+   char             fname[1024];
+
+   A.ctx = &counts;
+   TEST_CHECK(nifti_set_allocator(&A) == 0, "set allocator");
+
+   nim = make_ramp_image(dir, "allocator.nii", DT_FLOAT32);
+   TEST_CHECK(nim != NULL, "allocator image");
+   if( nim ) {
+      TEST_CHECK(((size_t)nim->data & 63) == 0, "aligned new data");
+      TEST_CHECK(nifti_add_extension(nim, "allocated", 10,
+                                     NIFTI_ECODE_COMMENT) == 0, "add ext");
+      snprintf(fname, sizeof(fname), "%s/allocator.nii", dir);
+      TEST_CHECK(nifti_image_write_status(nim) == 0, "write allocator");
+
+      /* data and extensions from reading */
+      nin = nifti_image_read(fname, 1);
+      TEST_CHECK(nin && nin->num_ext == 1 && ((size_t)nin->data & 63) == 0 &&
+                 memcmp(nin->data, nim->data, nim->nvox * nim->nbyper) == 0,
+                 "read with allocator");
+      if( nin ) {
+         nifti_image_unload(nin);
+
+         /* bricks, separate and in an arena */
+         TEST_CHECK(nifti_image_load_bricks(nin, 3, blist, &NBL) == 3,
+                    "load bricks");
+         nifti_free_NBL(&NBL);
+         TEST_CHECK(nifti_image_load_bricks_ex(nin, 3, blist, &NBL,
+                                        NIFTI_NBL_ARENA) == 3, "load arena");
+         TEST_CHECK(nifti_image_load_bricks_ex(nin, 3, blist, &NBL2,
+                                        NIFTI_NBL_ARENA) == 3, "load arena");
+         nifti_free_NBL(&NBL);
+         nifti_free_NBL(&NBL2);
+
+         /* a list built by the caller, with allocated bricks */
+         NBL.nbricks = 2;
+         NBL.bsize   = 16;
+         NBL.bricks  = (void **)malloc(2 * sizeof(void *));
+         if( NBL.bricks ) {
+            NBL.bricks[0] = nifti_data_alloc(16);
+            NBL.bricks[1] = nifti_data_alloc(16);
+            nifti_free_NBL(&NBL);
+         }
+
+         /* returned buffers */
+         TEST_CHECK(nifti_read_collapsed_image(nin, dims, &data) > 0,
+                    "collapsed");
+         nifti_data_free(data);
+         data = NULL;
+         TEST_CHECK(nifti_read_timeseries(nin, 2, ijk, &data) > 0,
+                    "timeseries");
+         nifti_data_free(data);
+         nifti_image_free(nin);
+      }
+      nifti_image_free(nim);
+   }
+
+   /* new and read data, 2 extensions, 3 + 2 + 2 bricks, 2 buffers (all but
+      the extensions, the arenas and the caller's bricks are aligned) */
+   TEST_CHECK(counts.nalloc == 13 && counts.naligned == 7, "allocator used");
+   TEST_CHECK(counts.nlive == 0, "allocator balanced");
+
+   /* incomplete allocators are refused, NULL restores the default */
+   A.dealloc = NULL;
+   nifti_set_debug_level(0);
+   TEST_CHECK(nifti_set_allocator(&A) == 1, "refuse allocator");
+   nifti_set_debug_level(1);
+   TEST_CHECK(nifti_set_allocator(NULL) == 0, "restore allocator");
+   nifti_clear_last_error();
+
+   return 0;
+}
+
+static int test_aligned(const char * dir)
+{
+   nifti_image * nim, * nin;
+   char          fname[1024];
+   size_t        amask = 127;
+
+#ifndef HAVE_POSIX_MEMALIGN
+   amask = 0;     /* the default allocator only has malloc() alignment */
+#endif
+
+   TEST_CHECK(nifti_get_data_align() == 64, "default alignment");
+
+   nifti_set_data_align(128);
+   TEST_CHECK(nifti_get_data_align() == 128, "set alignment");
+   nim = make_ramp_image(dir, "aligned.nii", DT_INT16);
+   TEST_CHECK(nim != NULL, "aligned image");
+   if( nim ) {
+      TEST_CHECK(((size_t)nim->data & amask) == 0, "aligned new data");
+      TEST_CHECK(nifti_image_write_status(nim) == 0, "write aligned");
+      snprintf(fname, sizeof(fname), "%s/aligned.nii", dir);
+      nin = nifti_image_read(fname, 1);
+      TEST_CHECK(nin && ((size_t)nin->data & amask) == 0 &&
+                 memcmp(nin->data, nim->data, nim->nvox * nim->nbyper) == 0,
+                 "aligned read data");
+      nifti_image_free(nin);
+      nifti_image_free(nim);
+   }
+
+   /* alignments must be powers of 2 */
+   nifti_set_data_align(48);
+   TEST_CHECK(nifti_get_data_align() == 64, "invalid alignment");
+
+#ifdef HAVE_POSIX_MEMALIGN
+   {  /* large buffers are huge page aligned */
+      int64_t dims[8] = { 3, 256, 256, 160, 1, 1, 1, 1 };   /* 40 MB */
+      nim = nifti_make_new_nim(dims, DT_FLOAT32, 1);
+      TEST_CHECK(nim && ((size_t)nim->data & (2*1024*1024 - 1)) == 0,
+                 "huge page aligned");
+      nifti_image_free(nim);
+   }
+#endif
+
+   nifti_set_data_align(0);
+
+   return 0;
+}
+
+/* records from nifti_scan_headers, by path index */
+typedef struct {
+   nifti_header_rec recs[9];
+   char             hnames[9][1024];
+   char             inames[9][1024];
+   int              ncalls;
+} scan_result;
+
+static int scan_keep(const nifti_header_rec * rec, void * udata)
+{
+   scan_result * S = (scan_result *)udata;
+
+   S->ncalls++;
+   if( rec->index < 0 || rec->index >= 9 ) return 1;
+   S->recs[rec->index] = *rec;
+   snprintf(S->hnames[rec->index], 1024, "%s", rec->hname ? rec->hname : "");
+   snprintf(S->inames[rec->index], 1024, "%s", rec->iname ? rec->iname : "");
+   return 0;
+}
+
+static int scan_stop(const nifti_header_rec * rec, void * udata)
+{
+   (void)rec;
+   ((scan_result *)udata)->ncalls++;
+   return 1;
+}
+
+static int test_scan(const char * dir)
+{
+   nifti_image * nim;
+   scan_result * S;
+   const char  * names[9] = { "s_one.nii", "s_two.nii.gz", "s_pair.hdr",
+                              "s_one", "s_pair.img", "./s_sub.nii",
+                              "s_missing.nii", "s_junk.nii", "s_bad.nii" };
+   const char  * paths[9];    /* "./s_sub.nii" is in a second "directory" */
+   char          pbuf[9][1024];
+   FILE        * fp;
+   int64_t       dim0 = 40;
+   int           c, k;
+
+   nim = make_ramp_image(dir, "s_one.nii", DT_INT16);
+   TEST_CHECK(nim != NULL, "scan s_one");
+   if( nim ){   /* NIFTI-2, with an extension */
+      nim->nifti_type = NIFTI_FTYPE_NIFTI2_1;
+      nim->scl_slope  = 2.0;
+      TEST_CHECK(nifti_add_extension(nim, "scan", 5, NIFTI_ECODE_COMMENT) == 0,
+                 "scan ext");
+      snprintf(pbuf[0], sizeof(pbuf[0]), "%s/s_two.nii.gz", dir);
+      TEST_CHECK(nifti_set_filenames(nim, pbuf[0], 0, 1) == 0 &&
+                 nifti_image_write_status(nim) == 0, "scan s_two");
+      /* and a NIFTI-2 file with a corrupt dim[0] (dim[] is at offset 16) */
+      snprintf(pbuf[0], sizeof(pbuf[0]), "%s/s_bad.nii", dir);
+      TEST_CHECK(nifti_set_filenames(nim, pbuf[0], 0, 1) == 0 &&
+                 nifti_image_write_status(nim) == 0, "scan s_bad");
+      if( (fp = fopen(pbuf[0], "r+b")) != NULL ){
+         TEST_CHECK(fseek(fp, 16, SEEK_SET) == 0 &&
+                    fwrite(&dim0, sizeof(dim0), 1, fp) == 1, "scan dim0");
+         fclose(fp);
+      }
+      nifti_image_free(nim);
+   }
+   nim = make_ramp_image(dir, "s_pair.hdr", DT_FLOAT32);
+   TEST_CHECK(nim != NULL, "scan s_pair");
+   nifti_image_free(nim);
+   nim = make_ramp_image(dir, "s_sub.nii", DT_FLOAT64);
+   TEST_CHECK(nim != NULL, "scan s_sub");
+   nifti_image_free(nim);
+
+   snprintf(pbuf[0], sizeof(pbuf[0]), "%s/s_junk.nii", dir);
+   if( (fp = fopen(pbuf[0], "wb")) != NULL ){
+      for( c = 0; c < 600; c++ ) fputc('j', fp);
+      fclose(fp);
+   }
+
+   for( k = 0; k < 9; k++ ){
+      snprintf(pbuf[k], sizeof(pbuf[k]), "%s/%s", dir, names[k]);
+      paths[k] = pbuf[k];
+   }
+
+   S = (scan_result *)calloc(1, sizeof(scan_result));
+   if( !S ) return 1;
+
+   nifti_set_debug_level(0);   /* quiet, for the missing and bad files */
+   TEST_CHECK(nifti_scan_headers(paths, 9, 4, scan_keep, S) == 6, "scan");
+   TEST_CHECK(S->ncalls == 9, "scan calls");
+
+   /* compare the records with nifti_image_read */
+   for( k = 0; k < 6; k++ ){
+      nifti_header_rec * R = S->recs + k;
+
+      nim = nifti_image_read(paths[k], 0);
+      TEST_CHECK(nim && R->status == 0 && R->index == k, "scan status");
+      if( !nim ) continue;
+      TEST_CHECK(!strcmp(S->hnames[k], nim->fname), "scan hname");
+      TEST_CHECK(R->nifti_type == nim->nifti_type &&
+                 R->datatype == nim->datatype && R->nbyper == nim->nbyper &&
+                 R->nvox == nim->nvox && R->vox_offset == nim->iname_offset,
+                 "scan type");
+      for( c = 0; c < 8; c++ )
+         TEST_CHECK(R->dim[c] == nim->dim[c] &&
+                    R->pixdim[c] == nim->pixdim[c], "scan dims");
+      TEST_CHECK(R->scl_slope == nim->scl_slope &&
+                 R->has_ext == (nim->num_ext > 0), "scan scaling, ext");
+      nifti_image_free(nim);
+   }
+   TEST_CHECK(S->recs[1].nifti_type == NIFTI_FTYPE_NIFTI2_1 &&
+              S->recs[1].has_ext && S->recs[1].scl_slope == 2.0, "scan gz");
+   TEST_CHECK(!strcmp(S->hnames[4], S->hnames[2]) &&
+              strstr(S->inames[2], "s_pair.img") &&
+              !strcmp(S->inames[0], S->hnames[0]), "scan .img to .hdr");
+   TEST_CHECK(S->recs[6].status == NIFTI_ERR_NOFILE, "scan missing");
+   TEST_CHECK(S->recs[7].status == NIFTI_ERR_HEADER, "scan junk");
+   TEST_CHECK(S->recs[8].status == NIFTI_ERR_HEADER, "scan bad dim0");
+
+   /* stop after the first record */
+   S->ncalls = 0;
+   TEST_CHECK(nifti_scan_headers(paths, 9, 4, scan_stop, S) <= 1 &&
+              S->ncalls == 1, "scan stop");
+   nifti_set_debug_level(1);
+
+   free(S);
+
+   return 0;
+}
+
+int main(int argc, char * argv[])
+{
+   const char * test, * dir;
+
+   if( argc < 3 ) {
+      fprintf(stderr,"usage: %s TEST_NAME OUTPUT_DIR\n", argv[0]);
+      return 1;
+   }
+   test = argv[1];
+   dir  = argv[2];
+
+   nifti_set_debug_level(1);
+
+   if     ( ! strcmp(test, "mmap") )  test_mmap(dir);
+   else if( ! strcmp(test, "gzpar") ) test_gzpar(dir);
+   else if( ! strcmp(test, "gzwrite") ) test_gzwrite(dir);
+   else if( ! strcmp(test, "gzindex") ) test_gzindex(dir);
+   else if( ! strcmp(test, "pread") ) test_pread(dir);
+   else if( ! strcmp(test, "parload") ) test_parload(dir);
+   else if( ! strcmp(test, "swap") ) test_swap();
+   else if( ! strcmp(test, "nanmode") ) test_nanmode(dir);
+   else if( ! strcmp(test, "nonfinite") ) test_nonfinite();
+   else if( ! strcmp(test, "loadas") ) test_loadas(dir);
+   else if( ! strcmp(test, "subregion") ) test_subregion(dir);
+   else if( ! strcmp(test, "subregions") ) test_subregions(dir);
+   else if( ! strcmp(test, "collapsed") ) test_collapsed(dir);
+   else if( ! strcmp(test, "timeseries") ) test_timeseries(dir);
+   else if( ! strcmp(test, "arena") ) test_arena(dir);
+   else if( ! strcmp(test, "bricklist") ) test_bricklist(dir);
+   else if( ! strcmp(test, "parbricks") ) test_parbricks(dir);
+   else if( ! strcmp(test, "bigbricks") ) test_bigbricks(dir);
+   else if( ! strcmp(test, "volreader") ) test_volreader(dir);
+   else if( ! strcmp(test, "volwriter") ) test_volwriter(dir);
+   else if( ! strcmp(test, "append") ) test_append(dir);
+   else if( ! strcmp(test, "context") ) test_context(dir);
+   else if( ! strcmp(test, "allocator") ) test_allocator(dir);
+   else if( ! strcmp(test, "aligned") ) test_aligned(dir);
+   else if( ! strcmp(test, "scan") ) test_scan(dir);
+   else {
+      fprintf(stderr,"** unknown test '%s'\n", test);
+      return 1;
+   }
+
+   if( g_errors ) fprintf(stderr,"** %s: %d error(s)\n", test, g_errors);
+   else           printf("-- %s: success\n", test);
+
+   return g_errors;
+}
@@ -202,15 +202,18 @@ static const char * g_history[] =
   "2.13 27 Feb 2022 [rickr]\n"
   "   - add -copy_image (w/data conversion)\n"
   "   - add -convert2dtype, -convert_verify, -convert_fail_choice\n",
+  "2.14 16 Oct 2026\n"
+  "   - add -build_index and -query_index, for a columnar header index\n",
   "----------------------------------------------------------------------\n"
 };
-static char g_version[] = "2.13";
-static char g_version_date[] = "February 27, 2022";
+static char g_version[] = "2.14";
+static char g_version_date[] = "October 16, 2026";
 static int  g_debug = 1;
 
 #include <limits.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/stat.h>
 
 #include "nifti2_io.h"
 #include "nifti_tool.h"
@@ -285,6 +288,8 @@ int main( int argc, char * argv[] )
    if( opts.cci )             FREE_RETURN( act_cci(&opts) );
    if( opts.copy_image )      FREE_RETURN( act_copy(&opts) );
    if( opts.dts || opts.dci ) FREE_RETURN( act_disp_ci(&opts) );
+   if( opts.build_index )     FREE_RETURN( act_build_index(&opts) );
+   if( opts.query_index )     FREE_RETURN( act_query_index(&opts) );
 
    /* perform modifications early, in case we allow multiple actions */
    if( opts.strip     && ((rv = act_strip    (&opts)) != 0) ) FREE_RETURN(rv);
@@ -431,6 +436,13 @@ int process_opts( int argc, char * argv[], nt_opts * opts )
          if( add_int(&opts->etypes, NIFTI_ECODE_COMMENT) ) return -1;
          opts->add_exts = 1;
       }
+      else if( ! strcmp(argv[ac], "-build_index") )
+      {
+         ac++;
+         CHECK_NEXT_OPT(ac, argc, "-build_index");
+         opts->index = argv[ac];
+         opts->build_index = 1;
+      }
       else if( ! strcmp(argv[ac], "-check_hdr") )
          opts->check_hdr = 1;
       else if( ! strcmp(argv[ac], "-check_nim") )
@@ -649,6 +661,13 @@ int process_opts( int argc, char * argv[], nt_opts * opts )
          CHECK_NEXT_OPT(ac, argc, "-prefix");
          opts->prefix = argv[ac];
       }
+      else if( ! strcmp(argv[ac], "-query_index") )
+      {
+         ac++;
+         CHECK_NEXT_OPT(ac, argc, "-query_index");
+         opts->index = argv[ac];
+         opts->query_index = 1;
+      }
       else if( ! strcmp(argv[ac], "-quiet") )
          opts->debug = 0;
       else if( ! strcmp(argv[ac], "-rm_ext") )
@@ -682,6 +701,12 @@ int process_opts( int argc, char * argv[], nt_opts * opts )
          opts->swap_hdr = 1;
       else if( ! strcmp(argv[ac], "-swap_as_old") )
          opts->swap_old = 1;
+      else if( ! strcmp(argv[ac], "-where") )
+      {
+         ac++;
+         CHECK_NEXT_OPT(ac, argc, "-where");
+         if( add_string(&opts->wlist, argv[ac]) ) return -1; /* add cond */
+      }
       else
       {
          fprintf(stderr,"** unknown option: '%s'\n", argv[ac]);
@@ -746,6 +771,8 @@ int verify_opts( nt_opts * opts, char * prog )
    ac += (opts->cbl                                            ) ? 1 : 0;
    ac += (opts->cci                                            ) ? 1 : 0;
    ac += (opts->dts       || opts->dci                         ) ? 1 : 0;
+   ac +=  opts->build_index;
+   ac +=  opts->query_index;
 
    if( ac < 1 )
    {
@@ -761,7 +788,7 @@ int verify_opts( nt_opts * opts, char * prog )
          "** only one action option is allowed, please use only one of:\n"
          "        '-add_...', '-check_...', '-diff_...', '-disp_...',\n"
          "        '-mod_...', '-strip', '-dts', '-cbl', '-cci'\n"
-         "        '-copy_image'\n"
+         "        '-copy_image', '-build_index', '-query_index'\n"
          "   (see '%s -help' for details)\n", prog);
       return 1;
    }
@@ -824,7 +851,23 @@ int verify_opts( nt_opts * opts, char * prog )
       errs++;
    }
 
-   if( opts->infiles.len <= 0 ) /* in any case */
+   if( opts->wlist.len > 0 && ! opts->query_index )
+   {
+      fprintf(stderr,"** option '-where' must only be used with"
+                     " '-query_index'\n");
+      errs++;
+   }
+
+   /* a query reads only the index */
+   if( opts->query_index )
+   {
+      if( opts->infiles.len > 0 )
+      {
+         fprintf(stderr,"** -infiles is invalid when using -query_index\n");
+         errs++;
+      }
+   }
+   else if( opts->infiles.len <= 0 ) /* in any case */
    {
       fprintf(stderr,"** missing input files (see -infiles option)\n");
       errs++;
@@ -1041,7 +1084,8 @@ int use_full(void)
    "   - copy a dataset by selecting a list of volumes from the original\n"
    "   - copy a dataset, collapsing any dimensions, each to a single index\n"
    "   - display a time series for a voxel, or more generally, the data\n"
-   "       from any collapsed image, in ASCII text\n");
+   "       from any collapsed image, in ASCII text\n"
+   "   - index the headers of many datasets, and search that index\n");
    printf(
    "\n"
    "  This program can be used to display information from nifti datasets,\n"
@@ -1162,6 +1206,10 @@ int use_full(void)
    "    nifti_tool -diff_hdr1 [-field FIELDNAME] [...] -infiles f1 f2\n"
    "    nifti_tool -diff_hdr2 [-field FIELDNAME] [...] -infiles f1 f2\n"
    "    nifti_tool -diff_nim  [-field FIELDNAME] [...] -infiles f1 f2\n"
+   "\n");
+   printf(
+   "    nifti_tool -build_index INDEX -infiles f1 ...\n"
+   "    nifti_tool -query_index INDEX [-where COND] [-field FIELDNAME] [...]\n"
    "\n"
    "  ------------------------------\n");
 
@@ -1289,6 +1337,14 @@ int use_full(void)
    "                    -convert_fail_choice fail\n"
    "\n"
    );
+   printf(
+   "    I. index many datasets, then search the index:\n"
+   "\n"
+   "      1. nifti_tool -build_index all.ntx -infiles */*.nii */*.nii.gz\n"
+   "      2. nifti_tool -query_index all.ntx -where datatype=FLOAT32 \\\n"
+   "                    -where 'dim4 > 100' -field dim4 -field pixdim4\n"
+   "\n"
+   );
    printf("  ------------------------------\n");
    printf(
    "\n"
@@ -1912,6 +1968,59 @@ int use_full(void)
    "\n"
    "  ------------------------------\n");
 
+   printf(
+   "\n"
+   "  options for header indices:\n"
+   "\n"
+   "    -build_index INDEX : write (or update) a header index for datasets\n"
+   "\n"
+   "       This action reads the headers of the '-infiles' datasets (on\n"
+   "       multiple threads, where available), and writes selected fields,\n"
+   "       along with the header file size and modification time, to the\n"
+   "       INDEX file.  The fields are stored by column, so that searching\n"
+   "       many datasets reads only the fields in question.\n"
+   "\n"
+   "       If INDEX already exists, only datasets that are new, or whose\n"
+   "       header files have a different size or time, are read again.\n"
+   "       The new index holds exactly the given datasets, less any that\n"
+   "       cannot be read.\n"
+   "\n"
+   "       The index is in the byte order of the computer that wrote it.\n"
+   "\n"
+   "       e.g. nifti_tool -build_index all.ntx -infiles */*.nii\n"
+   "\n");
+   printf(
+   "    -query_index INDEX : list the indexed datasets matching conditions\n"
+   "\n"
+   "       Show the datasets in INDEX that match all of the '-where'\n"
+   "       conditions (or every dataset, if there are none).  For each\n"
+   "       '-field' option, the value of that index field is shown after\n"
+   "       the dataset name.\n"
+   "\n"
+   "       The index fields are:\n"
+   "\n"
+   "          datatype, bitpix, dim0 ... dim7, pixdim0 ... pixdim7,\n"
+   "          vox_offset, scl_slope, scl_inter, intent_code, qform_code,\n"
+   "          sform_code, xyzt_units, nifti_type, has_ext,\n"
+   "          file_size, mtime\n"
+   "\n"
+   "       e.g. nifti_tool -query_index all.ntx -where 'pixdim1 < 2' \\\n"
+   "                       -field pixdim1 -field file_size\n"
+   "\n");
+   printf(
+   "    -where COND        : a condition for -query_index\n"
+   "\n"
+   "       COND has the form 'FIELD OP VALUE', where FIELD is one of the\n"
+   "       index fields, and OP is one of  =  !=  <  <=  >  >=.\n"
+   "       For datatype, VALUE may be a name, such as FLOAT32.  Equality\n"
+   "       of floating point fields allows for a relative error of 1e-6.\n"
+   "\n"
+   "       Multiple '-where' options must all be satisfied.\n"
+   "\n"
+   "       e.g. -where datatype=INT16 -where 'dim0 >= 4'\n"
+   "\n"
+   "  ------------------------------\n");
+
    printf(
    "\n"
    "  miscellaneous options:\n"
@@ -2179,7 +2288,9 @@ int disp_nt_opts( const char *mesg, nt_opts * opts)
                   "   swap_old             = %d\n"
                   "   cbl, cci             = %d, %d\n"
                   "   dts, dci_lines       = %d, %d\n"
-                  "   make_im              = %d\n",
+                  "   make_im              = %d\n"
+                  "   build_index          = %d\n"
+                  "   query_index          = %d\n",
             (void *)opts,
             opts->check_hdr, opts->check_nim,
             opts->diff_hdr1, opts->diff_hdr2,
@@ -2190,7 +2301,8 @@ int disp_nt_opts( const char *mesg, nt_opts * opts)
             opts->mod_hdr, opts->mod_hdr2, opts->mod_nim,
             opts->swap_hdr, opts->swap_ana, opts->swap_old,
             opts->cbl, opts->cci,
-            opts->dts, opts->dci_lines, opts->make_im );
+            opts->dts, opts->dci_lines, opts->make_im,
+            opts->build_index, opts->query_index );
 
    fprintf(stderr,"   ci_dims[8]          = ");
    disp_raw_data(opts->ci_dims, DT_INT64, 8, ' ', 1);
@@ -2201,9 +2313,11 @@ int disp_nt_opts( const char *mesg, nt_opts * opts)
                   "   new_datatype        = %d\n"
                   "   debug, keep_hist    = %d, %d\n"
                   "   overwrite           = %d\n"
-                  "   prefix              = '%s'\n",
+                  "   prefix              = '%s'\n"
+                  "   index               = '%s'\n",
             opts->new_datatype, opts->debug, opts->keep_hist, opts->overwrite,
-            opts->prefix ? opts->prefix : "(NULL)" );
+            opts->prefix ? opts->prefix : "(NULL)",
+            opts->index ? opts->index : "(NULL)" );
 
    fprintf(stderr,"   elist   (length %d)  :\n", opts->elist.len);
    for( c = 0; c < opts->elist.len; c++ )
@@ -2221,6 +2335,10 @@ int disp_nt_opts( const char *mesg, nt_opts * opts)
    for( c = 0; c < opts->vlist.len; c++ )
        fprintf(stderr,"      %d : %s\n", c, opts->vlist.list[c]);
 
+   fprintf(stderr,"   wlist   (length %d)  :\n", opts->wlist.len);
+   for( c = 0; c < opts->wlist.len; c++ )
+       fprintf(stderr,"      %d : %s\n", c, opts->wlist.list[c]);
+
    fprintf(stderr,"   infiles (length %d)  :\n", opts->infiles.len);
    for( c = 0; c < opts->infiles.len; c++ )
        fprintf(stderr,"      %d : %s\n", c, opts->infiles.list[c]);
@@ -2590,7 +2708,7 @@ int remove_ext_list( nifti_image * nim, const char ** elist, int len )
          disp_nifti1_extension("+d removing ext: ",nim->ext_list+ec,-1);
 
       /* delete this data, and shift the list down (yeah, inefficient) */
-      free( nim->ext_list[ec].edata );
+      nifti_data_free( nim->ext_list[ec].edata );
 
       /* move anything above down one */
       for( c = ec+1; c < nim->num_ext; c++ )
@@ -4099,7 +4217,7 @@ static int convert_datatype(nifti_image * nim, nifti_brick_list * NBL,
    /* destroy old data if conversion failed and choice == 2 */
    if( rv > 0 && fail_choice == 2 ) {
       if( g_debug > 2 ) fprintf(stderr,"-- convert_RD: destroying new data\n");
-      free(newdata);
+      nifti_data_free(newdata);
       newdata = NULL;
 
       return 1;        /* return failure */
@@ -4108,7 +4226,7 @@ static int convert_datatype(nifti_image * nim, nifti_brick_list * NBL,
    /* else, for conversion failure or success, keep data and return success */
    if( g_debug > 2 ) fprintf(stderr,"-- convert_RD: keeping new data\n");
 
-   free(nim->data);
+   nifti_image_unload(nim);   /* data may be mapped, or from an allocator */
    nim->data = newdata;
    nim->datatype = new_type;
    nifti_datatype_sizes(new_type, &(nim->nbyper), NULL);
@@ -4249,14 +4367,16 @@ static int convert_raw_data(void ** retdata, void * olddata, int old_type,
       return -1;
    }
 
-   /* allocate new memory (calloc, in case of partial filling) */
+   /* allocate new memory (cleared, in case of partial filling), as the
+    * library would, since it will become nim->data or a brick */
    nifti_datatype_sizes(new_type, &nbyper, NULL);   /* get nbyper */
-   newdata = calloc(nvox, nbyper);
+   newdata = nifti_data_alloc_aligned(nifti_get_data_align(), nvox * nbyper);
    if( !newdata ) {
       fprintf(stderr,"** failed to alloc for %" PRId64 " %s elements\n",
               nvox, typestr);
       return -1;
    }
+   memset(newdata, 0, nvox * nbyper);
 
    /* ----------------------------------------------------------------------
     * Enter the dragon.
@@ -5389,7 +5509,7 @@ static int convert_raw_data(void ** retdata, void * olddata, int old_type,
       fprintf(stderr, "** CND: did not try to convert %s to %s\n",
               nifti_datatype_to_string(old_type),
               nifti_datatype_to_string(new_type));
-      free(newdata);
+      nifti_data_free(newdata);
       return -1;
    }
 
@@ -6719,13 +6839,13 @@ int act_disp_ci( nt_opts * opts )
       if( len64 < 0 || !data )
       {
          fprintf(stderr,"** FAILURE for dataset '%s'\n", nim->fname);
-         free(data);
+         nifti_data_free(data);
          data = NULL;
          err++;
       } else if ( len64/nim->nbyper > INT_MAX ) {
          fprintf(stderr,"** %" PRId64 " is too many values to display\n",
                  len64/nim->nbyper);
-         if( data ) { free(data); data = NULL; }
+         if( data ) { nifti_data_free(data); data = NULL; }
          err++;
       }
 
@@ -6748,7 +6868,7 @@ int act_disp_ci( nt_opts * opts )
       nifti_image_free(nim);
    }
 
-   free(data);
+   nifti_data_free(data);
 
    return 0;
 }
@@ -6995,7 +7115,7 @@ int nt_run_misc_nim_tests(nifti_image * nim)
       printf("== subregion: rv=%" PRId64 ", dptr=%p, data=",
              rval, (void *)dptr);
       if( dptr ) disp_raw_data((char *)dptr, nim->datatype, 1, ' ', 1);
-      free(dptr);
+      nifti_data_free(dptr);
    }
 
    /* test expansion of ints, as 32-bits, not usually used */
@@ -7324,6 +7444,609 @@ int act_cci( nt_opts * opts )
 }
 
 
+/*----------------------------------------------------------------------
+ * header index: build and query
+ *
+ * An index file holds selected header fields (as with nifti_header_rec),
+ * plus the header file size and mtime, for many datasets.  The fields
+ * are stored by column, each as nrows 8-byte values (int64_t or double,
+ * in the byte order of the writer), so queries are tight loops over
+ * only the columns in question.
+ *
+ *    char     magic[8]          "NTINDEX1"
+ *    int32    order             1, to detect the byte order
+ *    int32    ncols
+ *    int64    nrows
+ *    int64    nnbytes           size of the name block
+ *    ncols *  { char name[24]; int32 is_float; int32 pad; }
+ *    ncols *  nrows values
+ *    names:   nrows * { infile name, NUL, header name, NUL }
+ *----------------------------------------------------------------------*/
+
+static const nt_index_col g_index_cols[NT_INDEX_NCOLS] = {
+   { "datatype",    0 }, { "bitpix",      0 },
+   { "dim0",        0 }, { "dim1",        0 }, { "dim2",        0 },
+   { "dim3",        0 }, { "dim4",        0 }, { "dim5",        0 },
+   { "dim6",        0 }, { "dim7",        0 },
+   { "pixdim0",     1 }, { "pixdim1",     1 }, { "pixdim2",     1 },
+   { "pixdim3",     1 }, { "pixdim4",     1 }, { "pixdim5",     1 },
+   { "pixdim6",     1 }, { "pixdim7",     1 },
+   { "vox_offset",  0 }, { "scl_slope",   1 }, { "scl_inter",   1 },
+   { "intent_code", 0 }, { "qform_code",  0 }, { "sform_code",  0 },
+   { "xyzt_units",  0 }, { "nifti_type",  0 }, { "has_ext",     0 },
+   { "file_size",   0 }, { "mtime",       0 }
+};
+
+/* column indices, for filling rows */
+#define NT_IC_DATATYPE    0
+#define NT_IC_BITPIX      1
+#define NT_IC_DIM         2
+#define NT_IC_PIXDIM     10
+#define NT_IC_VOX_OFFSET 18
+#define NT_IC_SCL_SLOPE  19
+#define NT_IC_SCL_INTER  20
+#define NT_IC_INTENT     21
+#define NT_IC_QFORM      22
+#define NT_IC_SFORM      23
+#define NT_IC_XYZT       24
+#define NT_IC_NTYPE      25
+#define NT_IC_HAS_EXT    26
+#define NT_IC_FSIZE      27
+#define NT_IC_MTIME      28
+
+#define NT_INDEX_MAGIC   "NTINDEX1"
+
+#define NT_ICOL_I(ind,c) ((int64_t *)(ind)->col[c])
+#define NT_ICOL_F(ind,c) ((double  *)(ind)->col[c])
+
+/* find a column by name, return its index or -1 */
+static int nt_index_col_find(const char * name)
+{
+   int c;
+   for( c = 0; c < NT_INDEX_NCOLS; c++ )
+      if( ! strcmp(name, g_index_cols[c].name) ) return c;
+   return -1;
+}
+
+/* allocate (or grow) an index for nalloc rows, return 0 on success */
+static int nt_index_alloc(nt_index * ind, int64_t nalloc)
+{
+   void  * ptr;
+   int     c;
+
+   for( c = 0; c < NT_INDEX_NCOLS; c++ ){
+      if( (ptr = realloc(ind->col[c], nalloc * 8)) == NULL ) return 1;
+      ind->col[c] = ptr;
+   }
+   if( (ptr = realloc(ind->path, nalloc * sizeof(char *))) == NULL ) return 1;
+   ind->path = (char **)ptr;
+   if( (ptr = realloc(ind->hname, nalloc * sizeof(char *))) == NULL ) return 1;
+   ind->hname = (char **)ptr;
+
+   for( ; ind->nalloc < nalloc; ind->nalloc++ )
+      ind->path[ind->nalloc] = ind->hname[ind->nalloc] = NULL;
+
+   return 0;
+}
+
+static void nt_index_free(nt_index * ind)
+{
+   int64_t r;
+   int     c;
+
+   for( r = 0; r < ind->nalloc; r++ ){
+      free(ind->path[r]);
+      free(ind->hname[r]);
+   }
+   for( c = 0; c < NT_INDEX_NCOLS; c++ ) free(ind->col[c]);
+   free(ind->path);
+   free(ind->hname);
+   memset(ind, 0, sizeof(*ind));
+}
+
+/* copy row 'from' of src to row 'to' of dest (names are moved) */
+static void nt_index_move_row(nt_index * dest, int64_t to,
+                              nt_index * src, int64_t from)
+{
+   int c;
+
+   for( c = 0; c < NT_INDEX_NCOLS; c++ )
+      memcpy((char *)dest->col[c] + to*8, (char *)src->col[c] + from*8, 8);
+
+   free(dest->path[to]);
+   free(dest->hname[to]);
+   dest->path[to]    = src->path[from];
+   dest->hname[to]   = src->hname[from];
+   src->path[from]   = NULL;
+   src->hname[from]  = NULL;
+}
+
+/*----------------------------------------------------------------------
+ * read an index file, return 0 on success, 1 if it does not exist,
+ * -1 on failure
+ *----------------------------------------------------------------------*/
+static int nt_index_read(const char * fname, nt_index * ind)
+{
+   FILE    * fp;
+   char      magic[8], cname[24], * names = NULL, * cp, * end;
+   int32_t   order, ncols, ival[2];
+   int64_t   nrows, nnbytes, r;
+   int       c, rv = -1;
+
+   memset(ind, 0, sizeof(*ind));
+
+   if( (fp = fopen(fname, "rb")) == NULL ) return 1;
+
+   if( fread(magic, 1, 8, fp) != 8 || memcmp(magic, NT_INDEX_MAGIC, 8) ||
+       fread(&order, 4, 1, fp) != 1 || fread(&ncols, 4, 1, fp) != 1 ||
+       fread(&nrows, 8, 1, fp) != 1 || fread(&nnbytes, 8, 1, fp) != 1 ){
+      fprintf(stderr,"** '%s' is not a nifti_tool header index\n", fname);
+      fclose(fp);
+      return -1;
+   }
+   if( order != 1 ){
+      fprintf(stderr,"** index '%s' has the other byte order, please rebuild\n",
+              fname);
+      fclose(fp);
+      return -1;
+   }
+
+   /* the columns must match (otherwise, the index should be rebuilt) */
+   for( c = 0; c < ncols; c++ ){
+      if( fread(cname, 1, 24, fp) != 24 || fread(ival, 4, 2, fp) != 2 ){
+         fprintf(stderr,"** short read of index '%s'\n", fname);
+         fclose(fp);
+         return -1;
+      }
+      cname[23] = '\0';
+      if( ncols != NT_INDEX_NCOLS || strcmp(cname, g_index_cols[c].name) ||
+          ival[0] != g_index_cols[c].is_float ){
+         fprintf(stderr,"** index '%s' has unknown columns, please rebuild\n",
+                 fname);
+         fclose(fp);
+         return -1;
+      }
+   }
+
+   if( nrows < 0 || nnbytes < 0 || nt_index_alloc(ind, nrows > 0 ? nrows : 1)
+       || (names = (char *)malloc(nnbytes + 1)) == NULL ){
+      fprintf(stderr,"** failed to alloc index of %" PRId64 " rows\n", nrows);
+      fclose(fp);
+      free(names);
+      nt_index_free(ind);
+      return -1;
+   }
+
+   for( c = 0; c < NT_INDEX_NCOLS; c++ )
+      if( (int64_t)fread(ind->col[c], 8, nrows, fp) != nrows ) break;
+   if( c == NT_INDEX_NCOLS && (int64_t)fread(names, 1, nnbytes, fp) == nnbytes ){
+      names[nnbytes] = '\0';
+      end = names + nnbytes;
+      for( r = 0, cp = names; r < nrows && cp < end; r++ ){
+         ind->path[r]  = nifti_strdup(cp);   cp += strlen(cp) + 1;
+         if( cp >= end ) break;
+         ind->hname[r] = nifti_strdup(cp);   cp += strlen(cp) + 1;
+      }
+      if( r == nrows ){ ind->nrows = nrows; rv = 0; }
+   }
+   fclose(fp);
+   free(names);
+
+   if( rv ){
+      fprintf(stderr,"** short or bad read of index '%s'\n", fname);
+      nt_index_free(ind);
+   } else if( g_debug > 1 )
+      fprintf(stderr,"-- read index '%s', %" PRId64 " rows\n", fname, nrows);
+
+   return rv;
+}
+
+/*----------------------------------------------------------------------
+ * write the index (to a temporary file, then renamed over fname)
+ *----------------------------------------------------------------------*/
+static int nt_index_write(const char * fname, const nt_index * ind)
+{
+   FILE    * fp;
+   char    * tname, cname[24];
+   int32_t   order = 1, ncols = NT_INDEX_NCOLS, ival[2];
+   int64_t   nnbytes = 0, r;
+   int       c, errs = 0;
+
+   for( r = 0; r < ind->nrows; r++ )
+      nnbytes += (int64_t)(strlen(ind->path[r]) + strlen(ind->hname[r]) + 2);
+
+   tname = (char *)malloc(strlen(fname) + 8);
+   if( !tname ) return 1;
+   sprintf(tname, "%s.tmp", fname);
+
+   if( (fp = fopen(tname, "wb")) == NULL ){
+      NTL_FERR("nt_index_write", "cannot open for writing", tname);
+      free(tname);
+      return 1;
+   }
+
+   errs += fwrite(NT_INDEX_MAGIC, 1, 8, fp) != 8;
+   errs += fwrite(&order, 4, 1, fp) != 1;
+   errs += fwrite(&ncols, 4, 1, fp) != 1;
+   errs += fwrite(&ind->nrows, 8, 1, fp) != 1;
+   errs += fwrite(&nnbytes, 8, 1, fp) != 1;
+   for( c = 0; c < NT_INDEX_NCOLS; c++ ){
+      memset(cname, 0, sizeof(cname));
+      strncpy(cname, g_index_cols[c].name, sizeof(cname)-1);
+      ival[0] = g_index_cols[c].is_float;
+      ival[1] = 0;
+      errs += fwrite(cname, 1, 24, fp) != 24;
+      errs += fwrite(ival, 4, 2, fp) != 2;
+   }
+   for( c = 0; c < NT_INDEX_NCOLS; c++ )
+      errs += (int64_t)fwrite(ind->col[c], 8, ind->nrows, fp) != ind->nrows;
+   for( r = 0; r < ind->nrows; r++ ){
+      errs += fputs(ind->path[r], fp) < 0 || fputc('\0', fp) == EOF;
+      errs += fputs(ind->hname[r], fp) < 0 || fputc('\0', fp) == EOF;
+   }
+   errs += fclose(fp) != 0;
+
+   if( errs || rename(tname, fname) != 0 ){
+      /* rename() does not replace existing files everywhere */
+      if( !errs && remove(fname) == 0 && rename(tname, fname) == 0 )
+         errs = 0;
+      else {
+         NTL_FERR("nt_index_write", "failed to write index", fname);
+         remove(tname);
+         free(tname);
+         return 1;
+      }
+   }
+   free(tname);
+
+   return 0;
+}
+
+/* rows of the new index to fill from nifti_scan_headers */
+typedef struct {
+   nt_index * ind;
+   int64_t  * rows;    /* row of the new index, per scanned path */
+   char     * good;    /* per row, was the scan successful       */
+   int64_t    nfailed;
+} nt_index_scan;
+
+static int nt_index_add_rec(const nifti_header_rec * rec, void * udata)
+{
+   nt_index_scan * S = (nt_index_scan *)udata;
+   nt_index      * ind = S->ind;
+   int64_t         row = S->rows[rec->index];
+   struct stat     st;
+   int             c;
+
+   if( rec->status || stat(rec->hname, &st) != 0 ){
+      if( g_debug > 0 )
+         fprintf(stderr,"** cannot index '%s' (%s)\n", rec->path,
+                 nifti_error_string(rec->status ? rec->status
+                                                : NIFTI_ERR_OPEN));
+      S->nfailed++;
+      return 0;
+   }
+
+   NT_ICOL_I(ind, NT_IC_DATATYPE)[row]   = rec->datatype;
+   NT_ICOL_I(ind, NT_IC_BITPIX)[row]     = 8 * rec->nbyper;
+   for( c = 0; c < 8; c++ ){
+      NT_ICOL_I(ind, NT_IC_DIM+c)[row]    = rec->dim[c];
+      NT_ICOL_F(ind, NT_IC_PIXDIM+c)[row] = rec->pixdim[c];
+   }
+   NT_ICOL_I(ind, NT_IC_VOX_OFFSET)[row] = rec->vox_offset;
+   NT_ICOL_F(ind, NT_IC_SCL_SLOPE)[row]  = rec->scl_slope;
+   NT_ICOL_F(ind, NT_IC_SCL_INTER)[row]  = rec->scl_inter;
+   NT_ICOL_I(ind, NT_IC_INTENT)[row]     = rec->intent_code;
+   NT_ICOL_I(ind, NT_IC_QFORM)[row]      = rec->qform_code;
+   NT_ICOL_I(ind, NT_IC_SFORM)[row]      = rec->sform_code;
+   NT_ICOL_I(ind, NT_IC_XYZT)[row]       = rec->xyz_units | rec->time_units;
+   NT_ICOL_I(ind, NT_IC_NTYPE)[row]      = rec->nifti_type;
+   NT_ICOL_I(ind, NT_IC_HAS_EXT)[row]    = rec->has_ext;
+   NT_ICOL_I(ind, NT_IC_FSIZE)[row]      = (int64_t)st.st_size;
+   NT_ICOL_I(ind, NT_IC_MTIME)[row]      = (int64_t)st.st_mtime;
+
+   free(ind->hname[row]);
+   ind->hname[row] = nifti_strdup(rec->hname);
+   S->good[row] = ind->hname[row] != NULL;
+
+   return 0;
+}
+
+/* for sorting and searching old index rows by infile name */
+typedef struct {
+   const char * path;
+   int64_t      row;
+} nt_index_key;
+
+static int nt_index_key_cmp(const void * a, const void * b)
+{
+   return strcmp(((const nt_index_key *)a)->path,
+                 ((const nt_index_key *)b)->path);
+}
+
+/*----------------------------------------------------------------------
+ * build (or update) the header index opts->index from opts->infiles
+ *
+ * Rows of an existing index are reused when the header file size and
+ * mtime are unchanged, so only new or modified files are read.
+ *----------------------------------------------------------------------*/
+int act_build_index( nt_opts * opts )
+{
+   nt_index        old, ind;
+   nt_index_scan   S;
+   nt_index_key  * keys = NULL, key, * kp;
+   const char   ** spaths = NULL;
+   struct stat     st;
+   int64_t         nfiles = opts->infiles.len, nscan = 0, nkeep = 0, r, k;
+   int             rv;
+
+   memset(&ind, 0, sizeof(ind));
+   memset(&S, 0, sizeof(S));
+
+   if( (rv = nt_index_read(opts->index, &old)) < 0 ){
+      fprintf(stderr,"   (remove '%s' to build a new index)\n", opts->index);
+      return 1;
+   }
+
+   if( nt_index_alloc(&ind, nfiles > 0 ? nfiles : 1) ||
+       (S.rows = (int64_t *)malloc(nfiles * sizeof(int64_t))) == NULL ||
+       (S.good = (char *)calloc(nfiles, 1)) == NULL ||
+       (spaths = (const char **)malloc(nfiles * sizeof(char *))) == NULL ||
+       (old.nrows > 0 &&
+        (keys = (nt_index_key *)malloc(old.nrows*sizeof(*keys))) == NULL) ){
+      fprintf(stderr,"** failed to alloc index for %" PRId64 " files\n",
+              nfiles);
+      rv = 1;
+      goto build_done;
+   }
+
+   /* sort the old rows by name */
+   for( r = 0; r < old.nrows; r++ ){
+      keys[r].path = old.path[r];
+      keys[r].row  = r;
+   }
+   if( old.nrows > 0 )
+      qsort(keys, old.nrows, sizeof(*keys), nt_index_key_cmp);
+
+   /* keep unchanged rows, and list the other files to scan */
+   for( k = 0; k < nfiles; k++ ){
+      key.path = opts->infiles.list[k];
+      kp = old.nrows > 0 ? (nt_index_key *)bsearch(&key, keys, old.nrows,
+                                         sizeof(*keys), nt_index_key_cmp)
+                         : NULL;
+      if( kp && old.path[kp->row] && stat(old.hname[kp->row], &st) == 0 &&
+          (int64_t)st.st_size  == NT_ICOL_I(&old, NT_IC_FSIZE)[kp->row] &&
+          (int64_t)st.st_mtime == NT_ICOL_I(&old, NT_IC_MTIME)[kp->row] ){
+         nt_index_move_row(&ind, k, &old, kp->row);
+         S.good[k] = 1;
+         nkeep++;
+         continue;
+      }
+      if( (ind.path[k] = nifti_strdup(opts->infiles.list[k])) == NULL ){
+         rv = 1;
+         goto build_done;
+      }
+      S.rows[nscan] = k;
+      spaths[nscan++] = opts->infiles.list[k];
+   }
+
+   /* read the headers of new and changed files */
+   S.ind = &ind;
+   if( nscan > 0 &&
+       nifti_scan_headers(spaths, nscan, 0, nt_index_add_rec, &S) < 0 ){
+      rv = 1;
+      goto build_done;
+   }
+
+   /* drop failures, and write */
+   for( r = 0, ind.nrows = 0; r < nfiles; r++ )
+      if( S.good[r] ){
+         if( ind.nrows < r ) nt_index_move_row(&ind, ind.nrows, &ind, r);
+         ind.nrows++;
+      }
+
+   rv = nt_index_write(opts->index, &ind);
+
+   if( !rv && g_debug > 0 )
+      printf("+ index '%s': %" PRId64 " files (%" PRId64 " unchanged, %"
+             PRId64 " read, %" PRId64 " failed)\n", opts->index, ind.nrows,
+             nkeep, nscan - S.nfailed, S.nfailed);
+
+build_done:
+   free(keys);
+   free(spaths);
+   free(S.rows);
+   free(S.good);
+   nt_index_free(&old);
+   nt_index_free(&ind);
+
+   return rv;
+}
+
+/*----------------------------------------------------------------------
+ * parse a condition 'FIELD OP VALUE', e.g. 'dim0=4' or 'pixdim4 < 2.5'
+ *
+ * VALUE may be a datatype name for the datatype field, e.g. FLOAT32.
+ * return 0 on success
+ *----------------------------------------------------------------------*/
+static int nt_index_parse_cond(const char * str, nt_index_cond * cond)
+{
+   const char * ops[6] = { "<=", ">=", "!=", "=", "<", ">" };
+   const char * cp, * vp;
+   char         name[32], tname[64];
+   char       * endp;
+   size_t       len;
+   int          c;
+
+   /* the field name ends at the first operator character */
+   cp = str + strcspn(str, "<>!=");
+   if( ! *cp ){
+      fprintf(stderr,"** no operator in condition '%s'\n", str);
+      return 1;
+   }
+
+   while( isspace((unsigned char)*str) ) str++;
+   for( len = (size_t)(cp - str); len > 0 && isspace((unsigned char)str[len-1]);
+        len-- ) ;
+   if( len == 0 || len >= sizeof(name) ){
+      fprintf(stderr,"** bad field in condition '%s'\n", str);
+      return 1;
+   }
+   memcpy(name, str, len);
+   name[len] = '\0';
+
+   if( (cond->col = nt_index_col_find(name)) < 0 ){
+      fprintf(stderr,"** unknown index field '%s' (see -help)\n", name);
+      return 1;
+   }
+
+   for( c = 0; c < 6; c++ )
+      if( ! strncmp(cp, ops[c], strlen(ops[c])) ) break;
+   if( c == 6 ){
+      fprintf(stderr,"** bad operator in condition '%s'\n", str);
+      return 1;
+   }
+   cond->op = c;
+   vp = cp + strlen(ops[c]);
+   while( isspace((unsigned char)*vp) ) vp++;
+
+   cond->val = strtod(vp, &endp);
+   if( endp == vp || *endp != '\0' ){
+      /* maybe a datatype name, with or without DT_ or NIFTI_TYPE_ */
+      c = -1;
+      if( cond->col == NT_IC_DATATYPE && strlen(vp) < sizeof(tname) - 4 ){
+         c = nifti_datatype_from_string(vp);
+         if( c == DT_UNKNOWN ){
+            sprintf(tname, "DT_%s", vp);
+            c = nifti_datatype_from_string(tname);
+         }
+      }
+      if( c <= DT_UNKNOWN ){
+         fprintf(stderr,"** bad value in condition '%s'\n", str);
+         return 1;
+      }
+      cond->val = c;
+   }
+
+   return 0;
+}
+
+/* apply 'mask &= (col OP val)' over all rows */
+#define NT_INDEX_SCAN(type, op) do {                                    \
+      const type * v_ = (const type *)ind->col[cond->col];              \
+      type         x_ = (type)cond->val;                                \
+      for( r = 0; r < ind->nrows; r++ ) mask[r] &= (v_[r] op x_);       \
+   } while(0)
+
+/* apply one condition to the mask of matching rows */
+static void nt_index_apply_cond(const nt_index * ind,
+                                const nt_index_cond * cond, char * mask)
+{
+   int64_t r;
+
+   if( g_index_cols[cond->col].is_float ){
+      /* float header fields: test equality with a relative tolerance */
+      const double * v = (const double *)ind->col[cond->col];
+      double         x = cond->val, tol = 1e-6 * fabs(cond->val);
+
+      switch( cond->op ){
+         case 0: NT_INDEX_SCAN(double, <=); break;
+         case 1: NT_INDEX_SCAN(double, >=); break;
+         case 2: for( r = 0; r < ind->nrows; r++ )
+                    mask[r] &= (fabs(v[r] - x) > tol);
+                 break;
+         case 3: for( r = 0; r < ind->nrows; r++ )
+                    mask[r] &= (fabs(v[r] - x) <= tol);
+                 break;
+         case 4: NT_INDEX_SCAN(double, < ); break;
+         case 5: NT_INDEX_SCAN(double, > ); break;
+      }
+   } else {
+      switch( cond->op ){
+         case 0: NT_INDEX_SCAN(int64_t, <=); break;
+         case 1: NT_INDEX_SCAN(int64_t, >=); break;
+         case 2: NT_INDEX_SCAN(int64_t, !=); break;
+         case 3: NT_INDEX_SCAN(int64_t, ==); break;
+         case 4: NT_INDEX_SCAN(int64_t, < ); break;
+         case 5: NT_INDEX_SCAN(int64_t, > ); break;
+      }
+   }
+}
+
+/*----------------------------------------------------------------------
+ * list the datasets in opts->index matching all -where conditions
+ *
+ * With -field options, the values of those fields are shown as well.
+ *----------------------------------------------------------------------*/
+int act_query_index( nt_opts * opts )
+{
+   nt_index        ind;
+   nt_index_cond * conds = NULL;
+   char          * mask = NULL;
+   int           * fcols = NULL;
+   int64_t         r, nmatch = 0;
+   int             c, rv = 1;
+
+   if( nt_index_read(opts->index, &ind) != 0 ){
+      fprintf(stderr,"** failed to read index '%s'\n", opts->index);
+      return 1;
+   }
+
+   if( (opts->wlist.len > 0 && (conds = (nt_index_cond *)
+                  malloc(opts->wlist.len * sizeof(nt_index_cond))) == NULL) ||
+       (opts->flist.len > 0 && (fcols = (int *)
+                  malloc(opts->flist.len * sizeof(int))) == NULL) ||
+       (mask = (char *)malloc(ind.nrows > 0 ? ind.nrows : 1)) == NULL ){
+      fprintf(stderr,"** failed to alloc for query\n");
+      goto query_done;
+   }
+
+   for( c = 0; c < opts->wlist.len; c++ )
+      if( nt_index_parse_cond(opts->wlist.list[c], conds + c) )
+         goto query_done;
+   for( c = 0; c < opts->flist.len; c++ )
+      if( (fcols[c] = nt_index_col_find(opts->flist.list[c])) < 0 ){
+         fprintf(stderr,"** unknown index field '%s' (see -help)\n",
+                 opts->flist.list[c]);
+         goto query_done;
+      }
+
+   /* scan the columns of the conditions */
+   memset(mask, 1, ind.nrows);
+   for( c = 0; c < opts->wlist.len; c++ )
+      nt_index_apply_cond(&ind, conds + c, mask);
+
+   for( r = 0; r < ind.nrows; r++ ){
+      if( ! mask[r] ) continue;
+      nmatch++;
+      fputs(ind.path[r], stdout);
+      for( c = 0; c < opts->flist.len; c++ ){
+         if( g_index_cols[fcols[c]].is_float ){
+            char str[32];
+            sprintf(str, "%f", NT_ICOL_F(&ind, fcols[c])[r]);
+            clear_float_zeros(str);
+            printf("  %s", str);
+         } else
+            printf("  %" PRId64, NT_ICOL_I(&ind, fcols[c])[r]);
+      }
+      fputc('\n', stdout);
+   }
+
+   if( g_debug > 1 )
+      fprintf(stderr,"-- %" PRId64 " of %" PRId64 " datasets match\n",
+              nmatch, ind.nrows);
+   rv = 0;
+
+query_done:
+   free(conds);
+   free(fcols);
+   free(mask);
+   nt_index_free(&ind);
+
+   return rv;
+}
+
+
 /*----------------------------------------------------------------------
  * free all of the lists in the struct
  * note: strings were not allocated
@@ -7336,6 +8059,7 @@ static int free_opts_mem( nt_opts * nopt )
     free(nopt->etypes.list);
     free(nopt->flist.list);
     free(nopt->vlist.list);
+    free(nopt->wlist.list);
     free(nopt->infiles.list);
 
     return 0;
@@ -7625,13 +8349,16 @@ nifti_image * nt_read_bricks(nt_opts * opts, char * fname, int len,
 
     /* now allocate the data pointers */
     for( c = 0; c < len; c++ ) {
-        NBL->bricks[c] = calloc(1, NBL->bsize);
+        /* bricks are freed by nifti_free_NBL, via nifti_data_free */
+        NBL->bricks[c] = nifti_data_alloc_aligned(nifti_get_data_align(),
+                                                  NBL->bsize);
         if( !NBL->bricks[c] ){
             fprintf(stderr,
                     "** NRB: failed to alloc brick %d of %" PRId64 " bytes\n",
                     c, NBL->bsize);
             nifti_free_NBL(NBL); nifti_image_free(nim); return NULL;
         }
+        memset(NBL->bricks[c], 0, NBL->bsize);
     }
 
     return nim;
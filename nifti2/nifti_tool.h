@@ -52,6 +52,8 @@ typedef struct{
    int      copy_image;          /* straight read (no cci)        */
    int      dts, dci, dci_lines; /* display collapsed img flags   */
    int      make_im;             /* create a new image on the fly */
+   int      build_index;         /* build/update a header index   */
+   int      query_index;         /* search a header index         */
    int64_t  ci_dims[8];          /* user dims list (last 7 valid) */
    int64_t  new_dim[8];          /* user dim list for new image   */
    int      new_datatype;        /* datatype for new image        */
@@ -61,10 +63,12 @@ typedef struct{
    int      debug, keep_hist;    /* debug level and history flag  */
    int      overwrite;           /* overwrite flag                */
    char *   prefix;              /* for output file               */
+   char *   index;               /* header index file name        */
    str_list elist;               /* extension strings             */
    int_list etypes;              /* extension type list           */
    str_list flist;               /* fields (to display or modify) */
    str_list vlist;               /* values (to set fields to)     */
+   str_list wlist;               /* index query conditions        */
    str_list infiles;             /* input files                   */
    char     command[NT_CMD_LEN]; /* for inserting the command     */
 } nt_opts;
@@ -136,6 +140,32 @@ typedef struct {
 
 #define NT_MAKE_IM_NAME "MAKE_IM"
 
+/*----------------------------------------------------------------------
+ * header index (actions build_index, query_index): each column holds
+ * one 8-byte value (int64_t or double) per dataset
+ *----------------------------------------------------------------------*/
+
+#define NT_INDEX_NCOLS    29        /* number of header index columns   */
+
+typedef struct {
+   const char * name;            /* field name, as used with -where     */
+   int          is_float;        /* column of doubles, else of int64_t  */
+} nt_index_col;
+
+typedef struct {
+   int64_t   nrows;              /* number of datasets                  */
+   int64_t   nalloc;             /* number of rows allocated            */
+   void    * col[NT_INDEX_NCOLS];/* column data, nrows values each      */
+   char   ** path;               /* dataset names, as given             */
+   char   ** hname;              /* header file names (for stat)        */
+} nt_index;
+
+typedef struct {
+   int       col;                /* column index                        */
+   int       op;                 /* <=, >=, !=, =, <, >  (0..5)         */
+   double    val;                /* value to compare with               */
+} nt_index_cond;
+
 /* ================================================================= */
 /* data conversionn operations                                       */
 
@@ -255,6 +285,7 @@ typedef struct {
 /*-----  prototypes  ---------------------------------------------------*/
 /*----------------------------------------------------------------------*/
 NI2_API int    act_add_exts   ( nt_opts * opts );
+NI2_API int    act_build_index( nt_opts * opts );  /* write header index */
 NI2_API int    act_cbl        ( nt_opts * opts );  /* copy brick list */
 NI2_API int    act_cci        ( nt_opts * opts );  /* copy collapsed dimensions */
 NI2_API int    act_copy       ( nt_opts * opts );  /* straight library copy */
@@ -275,6 +306,7 @@ NI2_API int    act_disp_ts    ( nt_opts * opts );  /* display time series */
 NI2_API int    act_mod_hdrs   ( nt_opts * opts );
 NI2_API int    act_mod_hdr2s  ( nt_opts * opts );
 NI2_API int    act_mod_nims   ( nt_opts * opts );
+NI2_API int    act_query_index( nt_opts * opts );  /* search header index */
 NI2_API int    act_swap_hdrs  ( nt_opts * opts );
 NI2_API int    act_rm_ext     ( nt_opts * opts );
 NI2_API int    act_run_misc_tests( nt_opts * opts );
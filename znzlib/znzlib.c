@@ -24,6 +24,28 @@ NB: seeks for writable files with compression are quite restricted
 #include "znzlib.h"
 #include "znzlib_version.h"
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_PREAD
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_OPENDIR
+#include <dirent.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#define ZNZ_LOCK(m)   pthread_mutex_lock(m)
+#define ZNZ_UNLOCK(m) pthread_mutex_unlock(m)
+#else
+#define ZNZ_LOCK(m)
+#define ZNZ_UNLOCK(m)
+#endif
+
 /*
 znzlib.c  (zipped or non-zipped library)
 
@@ -40,6 +62,96 @@ znzlib.c  (zipped or non-zipped library)
 */
 
 
+#ifdef HAVE_ZLIB
+/* state for gzip files opened for reading (see gzip reading, below) */
+#define ZNZ_WINSIZE       32768         /* deflate history window        */
+#define ZNZ_PAR_MIN_READ  (1<<24)       /* min bytes for a parallel read */
+#define ZNZ_PAR_CHUNK     (1<<20)       /* min compressed partition size */
+#define ZNZ_IN_BUFSIZE    (1<<18)       /* compressed input buffer size  */
+#define ZNZ_SCRATCH_SIZE  (1<<16)       /* output space for skipped data */
+
+typedef struct {            /* place to restart inflate in a gzip file */
+  znz_off_t       in;       /* compressed offset of the next full byte */
+  znz_off_t       out;      /* corresponding uncompressed offset       */
+  int             bits;     /* bits of the byte before 'in' to use     */
+  unsigned        wlen;     /* history length                          */
+  unsigned char * window;   /* previous wlen bytes of output           */
+} znz_access_point;
+
+struct znz_gzreader {
+  char          * path;     /* compressed file name                        */
+  FILE          * fp;       /* compressed file, read by the cursor         */
+  znz_off_t       csize;    /* compressed file size                        */
+  znz_off_t       upos;     /* logical (uncompressed) file position        */
+
+  /* inflate cursor, which need not be at upos */
+  z_stream        strm;
+  unsigned char * inbuf;
+  unsigned char * scratch;  /* output for skipped data                     */
+  znz_off_t       cin;      /* compressed offset just past inbuf data      */
+  znz_off_t       cout;     /* uncompressed offset of the cursor           */
+  int             in_member;/* in deflate data, else at a gzip header      */
+  int             at_end;   /* no more data at the cursor                  */
+  int             error;    /* bad data: the cursor must be restarted      */
+  unsigned long   crc;      /* crc32 of the member, if crc_ok              */
+  int             crc_ok;   /* member was inflated from its start          */
+  znz_off_t       mstart;   /* uncompressed offset of the member           */
+
+  /* access point index, sorted by uncompressed offset */
+  znz_access_point * points;
+  int             npoints, nalloc;
+  int             dirty;    /* points were added since the sidecar was read */
+
+  /* parallel decompression */
+  int             no_par;   /* parallel reads are not possible or useful   */
+  int             nparts;   /* number of partitions, -1 if not yet scanned */
+  znz_off_t     * cstart;   /* compressed offset of each partition         */
+  znz_off_t     * uoff;     /* uncompressed offset of each, -1 if unknown  */
+  unsigned char * indep;    /* partition is known to need no history       */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;     /* for the cursor, index and partitions        */
+#endif
+};
+
+/* state for gzip files written with parallel compression */
+#define ZNZ_BLOCKSIZE     (1<<17)       /* input per compressed block    */
+
+struct znz_gzwriter {
+  FILE          * fp;       /* raw output file                             */
+  int             level;    /* compression level                           */
+  int             nthreads;
+  int             error;    /* a write has failed                          */
+  znz_off_t       upos;     /* uncompressed bytes written                  */
+  unsigned long   crc;      /* crc32 of all data                           */
+  unsigned char * pend;     /* data waiting for a full batch of blocks     */
+  size_t          npend;
+  size_t          batch;    /* bytes per batch (nthreads * 4 blocks)       */
+  unsigned char * obuf;     /* compressed blocks of one batch              */
+  size_t        * olen;
+  unsigned long * bcrc;
+  size_t          ocap;     /* space per compressed block                  */
+  unsigned char   window[ZNZ_WINSIZE];   /* end of previous input          */
+  unsigned        wlen;
+};
+
+static struct znz_gzreader * znz_gzreader_new(const char * path);
+static void znz_gzreader_free(struct znz_gzreader * zr);
+static znz_off_t znz_gz_read_at(struct znz_gzreader * zr,
+                                unsigned char * buf, znz_off_t nbytes,
+                                znz_off_t posn);
+static int  znz_gz_par_read(struct znz_gzreader * zr, char * buf,
+                            size_t nbytes, znz_off_t posn, size_t * nread);
+static znz_off_t znz_gz_pread(struct znz_gzreader * zr, char * buf,
+                              size_t nbytes, znz_off_t posn);
+static struct znz_gzwriter * znz_gzwriter_new(const char * path,
+                                              const char * mode);
+static int    znz_gzwriter_close(struct znz_gzwriter * zw);
+static size_t znz_gzwriter_write(struct znz_gzwriter * zw,
+                                 const unsigned char * buf, size_t nbytes);
+static znz_off_t znz_gzwriter_seek(struct znz_gzwriter * zw,
+                                   znz_off_t offset, int whence);
+#endif
+
 /* Note extra argument (use_compression) where
    use_compression==0 is no compression
    use_compression!=0 uses zlib (gzip) compression
@@ -59,9 +171,22 @@ znzFile znzopen(const char *path, const char *mode, int use_compression)
 #ifdef HAVE_ZLIB
   file->zfptr = NULL;
 
+  file->zread = NULL;
+  file->zwrite = NULL;
+
   if (use_compression) {
     file->withz = 1;
-    if((file->zfptr = gzopen(path,mode)) == NULL) {
+    if (znz_get_nthreads() > 1 && strspn(mode,"wab0123456789") == strlen(mode)
+                               && !strchr(mode,'r')) {
+        /* compress in parallel blocks */
+        if((file->zwrite = znz_gzwriter_new(path,mode)) == NULL) {
+            free(file);
+            file = NULL;
+        }
+    } else if (strchr(mode,'r') && !strchr(mode,'+') &&
+               (file->zread = znz_gzreader_new(path)) != NULL) {
+        /* gzip data is inflated here, with an index */
+    } else if((file->zfptr = gzopen(path,mode)) == NULL) {
         free(file);
         file = NULL;
     }
@@ -116,6 +241,8 @@ int Xznzclose(znzFile * file)
   if (*file!=NULL) {
 #ifdef HAVE_ZLIB
     if ((*file)->zfptr!=NULL)  { retval = gzclose((*file)->zfptr); }
+    znz_gzreader_free((*file)->zread);
+    if ((*file)->zwrite!=NULL) { retval = znz_gzwriter_close((*file)->zwrite); }
 #endif
     if ((*file)->nzfptr!=NULL) { retval = fclose((*file)->nzfptr); }
 
@@ -139,6 +266,25 @@ size_t znzread(void* buf, size_t size, size_t nmemb, znzFile file)
 
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) return 0;   /* opened for writing */
+  if (file->zread!=NULL) {
+    struct znz_gzreader * zr = file->zread;
+    znz_off_t             nread;
+
+    ZNZ_LOCK(&zr->lock);
+    nread = znz_gz_pread(zr, cbuf, remain, zr->upos);
+    if( nread > 0 ) zr->upos += nread;
+    ZNZ_UNLOCK(&zr->lock);
+
+    if( nread < 0 ) return 0;
+    remain -= (size_t)nread;
+
+    /* warn of a short read that will seem complete */
+    if( remain > 0 && remain < size )
+       fprintf(stderr,"** znzread: read short by %u bytes\n",(unsigned)remain);
+
+    return nmemb - remain/size;   /* return number of members processed */
+  }
   if (file->zfptr!=NULL) {
     /* gzread/write take unsigned int length, so maybe read in int pieces
        (noted by M Hanke, example given by M Adler)   6 July 2010 [rickr] */
@@ -173,6 +319,10 @@ size_t znzwrite(const void* buf, size_t size, size_t nmemb, znzFile file)
 
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) {
+    remain -= znz_gzwriter_write(file->zwrite,(const unsigned char *)buf,remain);
+    return nmemb - (remain+size-1)/size;
+  }
   if (file->zfptr!=NULL) {
     while( remain > 0 ) {
        n2write = (remain < ZNZ_MAX_BLOCK_SIZE) ? (unsigned)remain : ZNZ_MAX_BLOCK_SIZE;
@@ -202,6 +352,15 @@ znz_off_t znzseek(znzFile file, znz_off_t offset, int whence)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) return znz_gzwriter_seek(file->zwrite,offset,whence);
+  if (file->zread!=NULL) {
+    /* just note the position, as with gzseek (SEEK_END is not allowed) */
+    znz_off_t posn = (whence == SEEK_CUR) ? file->zread->upos + offset
+                                          : offset;
+    if (whence == SEEK_END || posn < 0) return -1;
+    file->zread->upos = posn;
+    return posn;
+  }
   if (file->zfptr!=NULL) return (znz_off_t) gzseek(file->zfptr,offset,whence);
 #endif
   return fseek(file->nzfptr,offset,whence);
@@ -217,6 +376,10 @@ int znzrewind(znzFile stream)
      if (stream->zfptr!=NULL) return gzrewind(stream->zfptr);
   */
 
+  if (stream->zwrite!=NULL) {
+    return (int)znz_gzwriter_seek(stream->zwrite, 0L, SEEK_SET);
+  }
+  if (stream->zread!=NULL) { stream->zread->upos = 0; return 0; }
   if (stream->zfptr!=NULL) return (int)gzseek(stream->zfptr, 0L, SEEK_SET);
 #endif
   rewind(stream->nzfptr);
@@ -227,6 +390,8 @@ znz_off_t znztell(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) return file->zwrite->upos;
+  if (file->zread!=NULL) return file->zread->upos;
   if (file->zfptr!=NULL) return (znz_off_t) gztell(file->zfptr);
 #endif
   return ftell(file->nzfptr);
@@ -236,16 +401,409 @@ int znzputs(const char * str, znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) {
+    size_t len = strlen(str);
+    if (znz_gzwriter_write(file->zwrite,(const unsigned char *)str,len) < len)
+      return -1;
+    return (int)len;
+  }
+  if (file->zread!=NULL) return -1;   /* opened for reading */
   if (file->zfptr!=NULL) return gzputs(file->zfptr,str);
 #endif
   return fputs(str,file->nzfptr);
 }
 
+int znz_iscompressed(znzFile file)
+{
+  return file != NULL && file->withz;
+}
+
+/* stored deflate blocks hold at most 65535 bytes each */
+#define ZNZ_STORED_MAX 65535
+
+long znz_write_gz_stored(const char * path, const void * buf, size_t nbytes,
+                         const char * mode)
+{
+#ifdef HAVE_ZLIB
+  /* gzip header: deflate, no flags or mtime, unknown OS */
+  static const unsigned char ghdr[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0,
+                                          255 };
+  const unsigned char * cp = (const unsigned char *)buf;
+  unsigned char         bhdr[5], trailer[8];
+  unsigned long         crc;
+  size_t                len, remain = nbytes;
+  long                  total = 0;
+  FILE                * fp;
+  int                   c;
+
+  if (!path || (!buf && nbytes > 0) || !mode) return -1;
+  if ((fp = fopen(path, mode)) == NULL) return -1;
+
+  if (fwrite(ghdr, 1, 10, fp) != 10) { fclose(fp); return -1; }
+  total += 10;
+
+  do {
+    len = remain > ZNZ_STORED_MAX ? ZNZ_STORED_MAX : remain;
+    bhdr[0] = (unsigned char)(len == remain);   /* BFINAL, BTYPE 00 */
+    bhdr[1] = (unsigned char)(len & 0xff);
+    bhdr[2] = (unsigned char)(len >> 8);
+    bhdr[3] = (unsigned char)(~len & 0xff);
+    bhdr[4] = (unsigned char)((~len >> 8) & 0xff);
+    if (fwrite(bhdr, 1, 5, fp) != 5 ||
+        (len > 0 && fwrite(cp, 1, len, fp) != len)) {
+      fclose(fp);
+      return -1;
+    }
+    total  += 5 + (long)len;
+    cp     += len;
+    remain -= len;
+  } while (remain > 0);
+
+  crc = crc32(0L, (const Bytef *)buf, 0);
+  for (cp = (const unsigned char *)buf, remain = nbytes; remain > 0;
+       cp += len, remain -= len) {
+    len = remain > (1u<<30) ? (1u<<30) : remain;
+    crc = crc32(crc, (const Bytef *)cp, (uInt)len);
+  }
+  for (c = 0; c < 4; c++) {
+    trailer[c]   = (unsigned char)((crc >> (8*c)) & 0xff);
+    trailer[c+4] = (unsigned char)(((unsigned long)nbytes >> (8*c)) & 0xff);
+  }
+  if (fwrite(trailer, 1, 8, fp) != 8) { fclose(fp); return -1; }
+  total += 8;
+
+  if (fclose(fp) != 0) return -1;
+
+  return total;
+#else
+  (void)path; (void)buf; (void)nbytes; (void)mode;
+  return -1;
+#endif
+}
+
+/* bytes read from the start of a file at a time, by znz_read_head() */
+#define ZNZ_HEAD_BLOCK 4096
+
+long znz_read_head(const char * path, void * buf, size_t nbytes)
+{
+  unsigned char   inbuf[ZNZ_HEAD_BLOCK];
+  size_t          nin;
+  long            nout;
+  FILE          * fp;
+
+  if (!path || (!buf && nbytes > 0)) return -1;
+  if ((fp = fopen(path, "rb")) == NULL) return -1;
+  setvbuf(fp, NULL, _IONBF, 0);     /* every read here is a full block */
+
+  nin = fread(inbuf, 1, sizeof(inbuf), fp);
+
+#ifdef HAVE_ZLIB
+  if (nin >= 2 && inbuf[0] == 0x1f && inbuf[1] == 0x8b) {
+    z_stream zs;
+    int      rv = Z_OK;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15+16) != Z_OK) { fclose(fp); return -1; }
+    zs.next_in   = inbuf;
+    zs.avail_in  = (uInt)nin;
+    zs.next_out  = (Bytef *)buf;
+    zs.avail_out = (uInt)nbytes;
+
+    /* inflate only until buf is full, reading more input as needed */
+    while (zs.avail_out > 0) {
+      if (zs.avail_in == 0) {
+        nin = fread(inbuf, 1, sizeof(inbuf), fp);
+        if (nin == 0) break;
+        zs.next_in  = inbuf;
+        zs.avail_in = (uInt)nin;
+      }
+      rv = inflate(&zs, Z_SYNC_FLUSH);
+      if (rv == Z_STREAM_END) {
+        /* the data may continue in a following gzip member */
+        if (zs.avail_in == 0 && (nin = fread(inbuf, 1, sizeof(inbuf), fp))) {
+          zs.next_in  = inbuf;
+          zs.avail_in = (uInt)nin;
+        }
+        if (zs.avail_in == 0 || inflateReset(&zs) != Z_OK) break;
+      } else if (rv != Z_OK) break;
+    }
+    nout = (long)(nbytes - zs.avail_out);
+    inflateEnd(&zs);
+    fclose(fp);
+    return (rv == Z_OK || rv == Z_STREAM_END || nout > 0) ? nout : -1;
+  }
+#endif
+
+  /* uncompressed: use the first block, then read any remainder */
+  nout = (long)(nin < nbytes ? nin : nbytes);
+  memcpy(buf, inbuf, (size_t)nout);
+  if ((size_t)nout < nbytes && nin == sizeof(inbuf))
+    nout += (long)fread((char *)buf + nout, 1, nbytes - (size_t)nout, fp);
+  fclose(fp);
+
+  return nout;
+}
+
+long znz_list_dir(const char * dname, char *** names,
+                  int (*keep)(const char * name))
+{
+#ifdef HAVE_OPENDIR
+  DIR           * dp;
+  struct dirent * de;
+  char         ** list = NULL, ** tmp;
+  long            nnames = 0, nalloc = 0;
+  size_t          len;
+
+  if (!dname || !names) return -1;
+  *names = NULL;
+  if ((dp = opendir(dname)) == NULL) return -1;
+
+  while ((de = readdir(dp)) != NULL) {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+    if (keep && !keep(de->d_name)) continue;
+    if (nnames == nalloc) {
+      nalloc = nalloc ? 2*nalloc : 64;
+      if ((tmp = (char **)realloc(list, nalloc * sizeof(char *))) == NULL)
+        break;
+      list = tmp;
+    }
+    len = strlen(de->d_name) + 1;
+    if ((list[nnames] = (char *)malloc(len)) == NULL) break;
+    memcpy(list[nnames++], de->d_name, len);
+  }
+  closedir(dp);
+
+  if (de != NULL) {              /* allocation failure */
+    znz_free_dir_list(list, nnames);
+    return -1;
+  }
+
+  *names = list;
+  return nnames;
+#else
+  (void)dname; (void)keep;
+  if (names) *names = NULL;
+  return -1;
+#endif
+}
+
+void znz_free_dir_list(char ** names, long nnames)
+{
+  long c;
+
+  if (!names) return;
+  for (c = 0; c < nnames; c++) free(names[c]);
+  free(names);
+}
+
+#ifdef HAVE_PTHREAD
+/* serialize positional i/o that must move a shared file position */
+static pthread_mutex_t g_znz_plock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* read nbytes at offset, without using or changing the file position
+
+   Uncompressed files use pread() when available.  Otherwise, the position
+   is saved and restored around the read, under a lock.
+*/
+size_t znzpread(znzFile file, void * buf, size_t nbytes, znz_off_t offset)
+{
+  size_t nread = 0;
+
+  if (file==NULL || buf==NULL || offset<0) { return 0; }
+#ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) return 0;   /* opened for writing */
+  if (file->zread!=NULL) {
+    struct znz_gzreader * zr = file->zread;
+    znz_off_t             rv;
+
+    ZNZ_LOCK(&zr->lock);
+    rv = znz_gz_pread(zr, (char *)buf, nbytes, offset);
+    ZNZ_UNLOCK(&zr->lock);
+    return rv < 0 ? 0 : (size_t)rv;
+  }
+  if (file->zfptr!=NULL) {
+    z_off_t oposn;
+    int     nr;
+
+    ZNZ_LOCK(&g_znz_plock);
+    oposn = gztell(file->zfptr);
+    if (gzseek(file->zfptr, (z_off_t)offset, SEEK_SET) == (z_off_t)offset) {
+      while (nread < nbytes) {
+        unsigned chunk = (nbytes-nread > ZNZ_MAX_BLOCK_SIZE) ?
+                         ZNZ_MAX_BLOCK_SIZE : (unsigned)(nbytes-nread);
+        nr = gzread(file->zfptr, (char *)buf + nread, chunk);
+        if (nr <= 0) break;
+        nread += (size_t)nr;
+        if ((unsigned)nr < chunk) break;
+      }
+    }
+    gzseek(file->zfptr, oposn, SEEK_SET);
+    ZNZ_UNLOCK(&g_znz_plock);
+    return nread;
+  }
+#endif
+#ifdef HAVE_PREAD
+  {
+    int fd = fileno(file->nzfptr);
+    while (nread < nbytes) {
+      ssize_t nr = pread(fd, (char *)buf + nread, nbytes - nread,
+                         (off_t)(offset + (znz_off_t)nread));
+      if (nr < 0 && errno == EINTR) continue;
+      if (nr <= 0) break;
+      nread += (size_t)nr;
+    }
+  }
+#else
+  {
+    long oposn;
+
+    ZNZ_LOCK(&g_znz_plock);
+    oposn = ftell(file->nzfptr);
+    if (fseek(file->nzfptr, (long)offset, SEEK_SET) == 0)
+      nread = fread(buf, 1, nbytes, file->nzfptr);
+    fseek(file->nzfptr, oposn, SEEK_SET);
+    ZNZ_UNLOCK(&g_znz_plock);
+  }
+#endif
+  return nread;
+}
+
+/* write nbytes at offset, without using or changing the file position
+
+   Compressed output is sequential, so offset must then be the current
+   position (and the position does advance).
+*/
+size_t znzpwrite(znzFile file, const void * buf, size_t nbytes,
+                 znz_off_t offset)
+{
+  size_t nwritten = 0;
+
+  if (file==NULL || buf==NULL || offset<0) { return 0; }
+#ifdef HAVE_ZLIB
+  if (file->zread!=NULL) return 0;    /* opened for reading */
+  if (file->zwrite!=NULL || file->zfptr!=NULL) {
+    if (znztell(file) != offset) {
+      fprintf(stderr,"** znzpwrite: compressed output must be sequential\n");
+      return 0;
+    }
+    return znzwrite(buf, 1, nbytes, file);
+  }
+#endif
+#ifdef HAVE_PREAD
+  {
+    int fd = fileno(file->nzfptr);
+
+    /* buffered data must reach the file first */
+    if (fflush(file->nzfptr) != 0) return 0;
+    while (nwritten < nbytes) {
+      ssize_t nw = pwrite(fd, (const char *)buf + nwritten,
+                          nbytes - nwritten,
+                          (off_t)(offset + (znz_off_t)nwritten));
+      if (nw < 0 && errno == EINTR) continue;
+      if (nw <= 0) break;
+      nwritten += (size_t)nw;
+    }
+  }
+#else
+  {
+    long oposn;
+
+    ZNZ_LOCK(&g_znz_plock);
+    oposn = ftell(file->nzfptr);
+    if (fseek(file->nzfptr, (long)offset, SEEK_SET) == 0)
+      nwritten = fwrite(buf, 1, nbytes, file->nzfptr);
+    fseek(file->nzfptr, oposn, SEEK_SET);
+    ZNZ_UNLOCK(&g_znz_plock);
+  }
+#endif
+  return nwritten;
+}
+
+/* return whether znzmmap() is available in this build */
+int znz_have_mmap(void)
+{
+#ifdef HAVE_MMAP
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+#ifdef HAVE_MMAP
+/* mmap() offsets must be multiples of the page size */
+static size_t znz_page_offset(size_t posn)
+{
+  long pagesize = sysconf(_SC_PAGESIZE);
+  if( pagesize <= 0 ) pagesize = 4096;
+  return posn % (size_t)pagesize;
+}
+#endif
+
+/* map length bytes of an uncompressed file, starting at offset
+
+   The returned address need not be page aligned, since the mapping is
+   made from the page containing offset.  Return NULL on failure (or if
+   the file is compressed, or mmap is not available).
+*/
+void * znzmmap(znzFile file, znz_off_t offset, size_t length, int mode)
+{
+#ifdef HAVE_MMAP
+  size_t  delta;
+  int     prot, flags;
+  char  * base;
+
+  if (file==NULL || file->nzfptr==NULL || offset<0 || length==0) return NULL;
+  if (mode != ZNZ_MMAP_READONLY && mode != ZNZ_MMAP_PRIVATE) return NULL;
+
+  delta = znz_page_offset((size_t)offset);
+  if (mode == ZNZ_MMAP_PRIVATE) {
+    prot  = PROT_READ | PROT_WRITE;
+    flags = MAP_PRIVATE;
+  } else {
+    prot  = PROT_READ;
+    flags = MAP_SHARED;
+  }
+
+  base = (char *)mmap(NULL, length+delta, prot, flags, fileno(file->nzfptr),
+                      offset-(znz_off_t)delta);
+  if (base == (char *)MAP_FAILED) return NULL;
+
+  return (void *)(base + delta);
+#else
+  (void)file; (void)offset; (void)length; (void)mode;
+  return NULL;
+#endif
+}
+
+/* release a mapping from znzmmap(), return 0 on success */
+int znzmunmap(void * addr, size_t length)
+{
+#ifdef HAVE_MMAP
+  size_t delta;
+
+  if (addr==NULL) return -1;
+  delta = znz_page_offset((size_t)addr);
+  return munmap((char *)addr - delta, length + delta);
+#else
+  (void)addr; (void)length;
+  return -1;
+#endif
+}
+
 #ifdef COMPILE_NIFTIUNUSED_CODE
 char * znzgets(char* str, int size, znzFile file)
 {
   if (file==NULL) { return NULL; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) return NULL;
+  if (file->zread!=NULL) {
+    int len = 0, c = 0;
+    while (len < size-1 && c != '\n' && (c = znzgetc(file)) >= 0)
+      str[len++] = (char)c;
+    if (size > 0) str[len] = '\0';
+    return len > 0 ? str : NULL;
+  }
   if (file->zfptr!=NULL) return gzgets(file->zfptr,str,size);
 #endif
   return fgets(str,size,file->nzfptr);
@@ -256,6 +814,7 @@ int znzflush(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL || file->zread!=NULL) return 0;
   if (file->zfptr!=NULL) return gzflush(file->zfptr,Z_SYNC_FLUSH);
 #endif
   return fflush(file->nzfptr);
@@ -266,6 +825,9 @@ int znzeof(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) return 0;
+  if (file->zread!=NULL)
+    return file->zread->at_end && file->zread->upos >= file->zread->cout;
   if (file->zfptr!=NULL) return gzeof(file->zfptr);
 #endif
   return feof(file->nzfptr);
@@ -276,6 +838,11 @@ int znzputc(int c, znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) {
+    unsigned char uc = (unsigned char)c;
+    return znz_gzwriter_write(file->zwrite,&uc,1) == 1 ? (int)uc : -1;
+  }
+  if (file->zread!=NULL) return -1;
   if (file->zfptr!=NULL) return gzputc(file->zfptr,c);
 #endif
   return fputc(c,file->nzfptr);
@@ -286,6 +853,13 @@ int znzgetc(znzFile file)
 {
   if (file==NULL) { return 0; }
 #ifdef HAVE_ZLIB
+  if (file->zwrite!=NULL) return -1;
+  if (file->zread!=NULL) {
+    unsigned char uc;
+    if (znz_gz_read_at(file->zread,&uc,1,file->zread->upos) != 1) return -1;
+    file->zread->upos++;
+    return uc;
+  }
   if (file->zfptr!=NULL) return gzgetc(file->zfptr);
 #endif
   return fgetc(file->nzfptr);
@@ -298,9 +872,12 @@ int znzprintf(znzFile stream, const char *format, ...)
   char *tmpstr;
   va_list va;
   if (stream==NULL) { return 0; }
+#ifdef HAVE_ZLIB
+  if (stream->zread!=NULL) { return -1; }
+#endif
   va_start(va, format);
 #ifdef HAVE_ZLIB
-  if (stream->zfptr!=NULL) {
+  if (stream->zfptr!=NULL || stream->zwrite!=NULL) {
     int size;  /* local to HAVE_ZLIB block */
     size = strlen(format) + 1000000;  /* overkill I hope */
     tmpstr = (char *)calloc(1, size);
@@ -309,7 +886,8 @@ int znzprintf(znzFile stream, const char *format, ...)
        return retval;
     }
     vsprintf(tmpstr,format,va);
-    retval=gzprintf(stream->zfptr,"%s",tmpstr);
+    if (stream->zwrite!=NULL) retval=znzputs(tmpstr,stream);
+    else retval=gzprintf(stream->zfptr,"%s",tmpstr);
     free(tmpstr);
   } else
 #endif
@@ -322,3 +900,1287 @@ int znzprintf(znzFile stream, const char *format, ...)
 #endif
 
 #endif
+
+
+/*----------------------------------------------------------------------
+ * number of threads for parallel decompression
+ *----------------------------------------------------------------------*/
+
+static int g_znz_nthreads = 0;       /* 0: not yet set */
+
+/* set the number of threads to use (values < 1 are taken as 1) */
+void znz_set_nthreads(int nthreads)
+{
+  g_znz_nthreads = (nthreads < 1) ? 1 : nthreads;
+}
+
+/* return the number of threads to use
+
+   If not set, the default comes from the ZNZ_NUM_THREADS environment
+   variable, else 1.  Without thread support, this is always 1.
+*/
+#ifdef HAVE_PTHREAD
+/* the environment default, set once (threads may ask at the same time) */
+static pthread_once_t g_znz_nthreads_once = PTHREAD_ONCE_INIT;
+
+static void znz_init_nthreads(void)
+{
+  if (g_znz_nthreads == 0) {
+    const char * env = getenv("ZNZ_NUM_THREADS");
+    int          nt  = env ? atoi(env) : 1;
+    g_znz_nthreads = (nt < 1) ? 1 : nt;
+  }
+}
+#endif
+
+int znz_get_nthreads(void)
+{
+#ifdef HAVE_PTHREAD
+  pthread_once(&g_znz_nthreads_once, znz_init_nthreads);
+  return g_znz_nthreads;
+#else
+  return 1;
+#endif
+}
+
+
+
+/*----------------------------------------------------------------------
+ * random access index for gzip files (see reading gzip files, below)
+ *----------------------------------------------------------------------*/
+
+static int       g_znz_index_mode = ZNZ_INDEX_MEMORY;
+static znz_off_t g_znz_index_span = ZNZ_INDEX_SPAN;
+
+/* set whether gzip files opened for reading are indexed, and whether the
+   index is kept in a sidecar file (ZNZ_INDEX_NONE, _MEMORY or _SIDECAR) */
+void znz_set_index_mode(int mode)
+{
+  if (mode >= ZNZ_INDEX_NONE && mode <= ZNZ_INDEX_SIDECAR)
+    g_znz_index_mode = mode;
+}
+
+int znz_get_index_mode(void)
+{
+  return g_znz_index_mode;
+}
+
+/* set the (approximate) uncompressed distance between access points */
+void znz_set_index_span(znz_off_t span)
+{
+  if (span > 0) g_znz_index_span = span;
+}
+
+znz_off_t znz_get_index_span(void)
+{
+  return g_znz_index_span;
+}
+
+/* return the number of access points in the index of a gzip file opened
+   for reading, or -1 if it is not indexed */
+int znz_index_points(znzFile file)
+{
+#ifdef HAVE_ZLIB
+  if (file != NULL && file->zread != NULL) return file->zread->npoints;
+#endif
+  (void)file;
+  return -1;
+}
+
+
+#ifdef HAVE_ZLIB
+/*----------------------------------------------------------------------
+ * reading gzip files
+
+   Gzip files opened for reading are inflated here, rather than through
+   gzread(), by a cursor on the compressed data.  As the cursor passes
+   deflate block boundaries, it records access points (the compressed
+   and uncompressed offsets, along with the previous 32 KB of output, as
+   in zlib's zran.c) every g_znz_index_span bytes.  A seek is then just
+   a change of position, and a later read restarts the cursor from the
+   nearest access point, rather than from the start of the file.
+
+   The index may be saved in a sidecar file (FILE.gz.idx) when the file
+   is closed, and read back when it is next opened.
+
+   Files that do not start with a gzip header (which gzread() passes
+   through as they are) still use a gzFile.
+ *----------------------------------------------------------------------*/
+
+static int  znz_gz_read_sidecar(struct znz_gzreader * zr);
+static void znz_gz_write_sidecar(struct znz_gzreader * zr);
+
+static struct znz_gzreader * znz_gzreader_new(const char * path)
+{
+  struct znz_gzreader * zr;
+  unsigned char         magic[2];
+
+  zr = (struct znz_gzreader *)calloc(1, sizeof(struct znz_gzreader));
+  if (zr == NULL) return NULL;
+  zr->nparts  = -1;
+  zr->path    = (char *)malloc(strlen(path)+1);
+  zr->inbuf   = (unsigned char *)malloc(ZNZ_IN_BUFSIZE);
+  zr->scratch = (unsigned char *)malloc(ZNZ_SCRATCH_SIZE);
+  zr->fp      = fopen(path, "rb");
+  if (!zr->path || !zr->inbuf || !zr->scratch || !zr->fp ||
+      fread(magic, 1, 2, zr->fp) != 2 || magic[0] != 0x1f || magic[1] != 0x8b
+      || fseek(zr->fp, 0, SEEK_END) || (zr->csize = ftell(zr->fp)) < 0
+      || inflateInit2(&zr->strm, -15) != Z_OK) {
+    if (zr->fp) fclose(zr->fp);
+    free(zr->path); free(zr->inbuf); free(zr->scratch); free(zr);
+    return NULL;
+  }
+  strcpy(zr->path, path);
+  zr->error = 1;            /* cursor starts at the beginning, when used */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&zr->lock, NULL);
+#endif
+
+  if (g_znz_index_mode == ZNZ_INDEX_SIDECAR) znz_gz_read_sidecar(zr);
+
+  return zr;
+}
+
+static void znz_gzreader_free(struct znz_gzreader * zr)
+{
+  int ind;
+
+  if (zr == NULL) return;
+  if (g_znz_index_mode == ZNZ_INDEX_SIDECAR && zr->dirty)
+    znz_gz_write_sidecar(zr);
+
+  for (ind = 0; ind < zr->npoints; ind++) free(zr->points[ind].window);
+  free(zr->points);
+  inflateEnd(&zr->strm);
+  fclose(zr->fp);
+  free(zr->path);
+  free(zr->inbuf);
+  free(zr->scratch);
+  free(zr->cstart);
+  free(zr->uoff);
+  free(zr->indep);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&zr->lock);
+#endif
+  free(zr);
+}
+
+/* return the index of the last access point at or before out, else -1 */
+static int znz_gz_find_point(const struct znz_gzreader * zr, znz_off_t out)
+{
+  int lo = 0, hi = zr->npoints - 1, mid;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (zr->points[mid].out <= out) lo = mid + 1;
+    else                            hi = mid - 1;
+  }
+  return hi;
+}
+
+/* add an access point, unless one is within span before it (the start
+   of the file counts as one), or after it */
+static void znz_gz_add_point(struct znz_gzreader * zr, znz_off_t in,
+                             znz_off_t out, int bits,
+                             const unsigned char * window, unsigned wlen,
+                             znz_off_t span)
+{
+  znz_access_point * pts;
+  unsigned char    * wcopy;
+  int                ind;
+
+  if (g_znz_index_mode == ZNZ_INDEX_NONE || span <= 0) return;
+
+  ind = znz_gz_find_point(zr, out);
+  if (out - (ind >= 0 ? zr->points[ind].out : 0) < span) return;
+  ind++;                                /* insert at ind */
+  if (ind < zr->npoints && zr->points[ind].out - out < span)
+    return;
+
+  if (zr->npoints == zr->nalloc) {
+    pts = (znz_access_point *)realloc(zr->points,
+                   (zr->nalloc ? 2*zr->nalloc : 16) * sizeof(znz_access_point));
+    if (pts == NULL) return;
+    zr->points  = pts;
+    zr->nalloc  = zr->nalloc ? 2*zr->nalloc : 16;
+  }
+  wcopy = (unsigned char *)malloc(wlen ? wlen : 1);
+  if (wcopy == NULL) return;
+  memcpy(wcopy, window, wlen);
+
+  memmove(zr->points+ind+1, zr->points+ind,
+          (zr->npoints-ind) * sizeof(znz_access_point));
+  zr->points[ind].in     = in;
+  zr->points[ind].out    = out;
+  zr->points[ind].bits   = bits;
+  zr->points[ind].wlen   = wlen;
+  zr->points[ind].window = wcopy;
+  zr->npoints++;
+  zr->dirty = 1;
+}
+
+/* refill the cursor input, returning 0 at the end of the file */
+static int znz_gz_fill(struct znz_gzreader * zr)
+{
+  size_t n = fread(zr->inbuf, 1, ZNZ_IN_BUFSIZE, zr->fp);
+
+  zr->cin += (znz_off_t)n;
+  zr->strm.next_in  = zr->inbuf;
+  zr->strm.avail_in = (unsigned)n;
+  return n > 0;
+}
+
+/* return the next compressed byte, or -1 at the end of the file */
+static int znz_gz_getbyte(struct znz_gzreader * zr)
+{
+  if (zr->strm.avail_in == 0 && !znz_gz_fill(zr)) return -1;
+  zr->strm.avail_in--;
+  return *zr->strm.next_in++;
+}
+
+/* read a gzip member header at the cursor, return 0 on success, 1 if
+   there is no further member (trailing data is ignored, as by zlib)
+   or -1 on error */
+static int znz_gz_member_start(struct znz_gzreader * zr)
+{
+  int c, flags, len, ind;
+
+  if (znz_gz_getbyte(zr) != 0x1f || znz_gz_getbyte(zr) != 0x8b) return 1;
+  if (znz_gz_getbyte(zr) != 8) return -1;
+  flags = znz_gz_getbyte(zr);
+  if (flags < 0 || (flags & 0xe0)) return -1;
+  for (ind = 0; ind < 6; ind++)                 /* MTIME, XFL, OS */
+    if (znz_gz_getbyte(zr) < 0) return -1;
+
+  if (flags & 4) {                              /* FEXTRA */
+    len = znz_gz_getbyte(zr);
+    c   = znz_gz_getbyte(zr);
+    if (len < 0 || c < 0) return -1;
+    for (len += c << 8; len > 0; len--)
+      if (znz_gz_getbyte(zr) < 0) return -1;
+  }
+  if (flags & 8)                                /* FNAME */
+    while ((c = znz_gz_getbyte(zr)) != 0) if (c < 0) return -1;
+  if (flags & 16)                               /* FCOMMENT */
+    while ((c = znz_gz_getbyte(zr)) != 0) if (c < 0) return -1;
+  if (flags & 2)                                /* FHCRC */
+    if (znz_gz_getbyte(zr) < 0 || znz_gz_getbyte(zr) < 0) return -1;
+
+  if (inflateReset(&zr->strm) != Z_OK) return -1;
+  zr->in_member = 1;
+  zr->crc_ok    = 1;
+  zr->crc       = crc32(0L, Z_NULL, 0);
+  zr->mstart    = zr->cout;
+
+  return 0;
+}
+
+/* move the cursor to access point pt, or to the start of the file */
+static int znz_gz_restart(struct znz_gzreader * zr,
+                          const znz_access_point * pt)
+{
+  znz_off_t in = pt ? pt->in - (pt->bits ? 1 : 0) : 0;
+  int       c;
+
+  zr->error = zr->at_end = zr->in_member = 0;
+  zr->strm.avail_in = 0;
+  zr->cin  = in;
+  zr->cout = pt ? pt->out : 0;
+  if (fseek(zr->fp, in, SEEK_SET)) return 1;
+  if (pt == NULL) return 0;     /* the header is read when inflating */
+
+  if (inflateReset(&zr->strm) != Z_OK) return 1;
+  if (pt->bits) {
+    if ((c = znz_gz_getbyte(zr)) < 0) return 1;
+    if (inflatePrime(&zr->strm, pt->bits, c >> (8 - pt->bits)) != Z_OK)
+      return 1;
+  }
+  if (pt->wlen &&
+      inflateSetDictionary(&zr->strm, pt->window, pt->wlen) != Z_OK)
+    return 1;
+  zr->in_member = 1;
+  zr->crc_ok    = 0;            /* the member CRC cannot be checked */
+
+  return 0;
+}
+
+/* at a block boundary, add an access point if one is due */
+static void znz_gz_checkpoint(struct znz_gzreader * zr)
+{
+#if ZLIB_VERNUM >= 0x1280
+  znz_off_t span = g_znz_index_span;
+  unsigned  wlen = ZNZ_WINSIZE;
+  int       ind;
+
+  if (g_znz_index_mode == ZNZ_INDEX_NONE || span <= 0) return;
+  ind = znz_gz_find_point(zr, zr->cout);
+  if (zr->cout - (ind >= 0 ? zr->points[ind].out : 0) < span)
+    return;
+
+  /* the scratch space does not hold anything needed, now */
+  if (inflateGetDictionary(&zr->strm, zr->scratch, &wlen) != Z_OK) return;
+  znz_gz_add_point(zr, zr->cin - zr->strm.avail_in, zr->cout,
+                   zr->strm.data_type & 7, zr->scratch, wlen, span);
+#else
+  (void)zr;   /* inflateGetDictionary() is needed for an index */
+#endif
+}
+
+/* inflate up to nbytes at the cursor into buf (or discard them, if buf
+   is NULL), returning the number of bytes, or -1 on error */
+static znz_off_t znz_gz_inflate(struct znz_gzreader * zr,
+                                unsigned char * buf, znz_off_t nbytes)
+{
+  unsigned char * out;
+  unsigned long   tcrc, tlen;
+  znz_off_t       done = 0, left;
+  unsigned        avail;
+  int             ret, ind, c;
+
+  while (done < nbytes && !zr->at_end) {
+    if (!zr->in_member) {
+      ret = znz_gz_member_start(zr);
+      if (ret > 0) { zr->at_end = 1; break; }
+      if (ret < 0) {
+        fprintf(stderr,"** znz: bad gzip header in %s\n", zr->path);
+        zr->error = zr->at_end = 1;
+        return -1;
+      }
+    }
+    if (zr->strm.avail_in == 0 && !znz_gz_fill(zr)) {
+      fprintf(stderr,"** znz: unexpected end of gzip file %s\n", zr->path);
+      zr->error = zr->at_end = 1;
+      break;                                /* return the data so far */
+    }
+
+    left = nbytes - done;
+    if (buf) {
+      out   = buf + done;
+      avail = (left < ZNZ_MAX_BLOCK_SIZE) ? (unsigned)left : ZNZ_MAX_BLOCK_SIZE;
+    } else {
+      out   = zr->scratch;
+      avail = (left < ZNZ_SCRATCH_SIZE) ? (unsigned)left : ZNZ_SCRATCH_SIZE;
+    }
+    zr->strm.next_out  = out;
+    zr->strm.avail_out = avail;
+
+    ret = inflate(&zr->strm, Z_BLOCK);
+
+    avail -= zr->strm.avail_out;
+    if (zr->crc_ok) zr->crc = crc32(zr->crc, out, avail);
+    zr->cout += avail;
+    done     += avail;
+
+    if (ret == Z_STREAM_END) {              /* check the member trailer */
+      tcrc = tlen = 0;
+      for (ind = 0; ind < 8; ind++) {
+        if ((c = znz_gz_getbyte(zr)) < 0) break;
+        if (ind < 4) tcrc |= (unsigned long)c << (8*ind);
+        else         tlen |= (unsigned long)c << (8*(ind-4));
+      }
+      if (ind < 8 || (zr->crc_ok && (tcrc != zr->crc ||
+               tlen != ((unsigned long)(zr->cout - zr->mstart) & 0xffffffffUL)))) {
+        fprintf(stderr,"** znz: gzip trailer mismatch in %s\n", zr->path);
+        zr->error = zr->at_end = 1;
+        return -1;
+      }
+      zr->in_member = 0;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      fprintf(stderr,"** znz: gzip data error in %s\n", zr->path);
+      zr->error = zr->at_end = 1;
+      return -1;
+    } else if ((zr->strm.data_type & 0xc0) == 0x80) {
+      znz_gz_checkpoint(zr);                /* between blocks */
+    }
+  }
+
+  return done;
+}
+
+/* read nbytes at uncompressed offset posn, returning the number read
+   (short at the end of the data) or -1 on error */
+static znz_off_t znz_gz_read_at(struct znz_gzreader * zr,
+                                unsigned char * buf, znz_off_t nbytes,
+                                znz_off_t posn)
+{
+  znz_off_t nskip;
+  int       ind = znz_gz_find_point(zr, posn);
+
+  /* restart from the nearest access point, if it is not behind us */
+  if (zr->error || posn < zr->cout ||
+      (ind >= 0 && zr->points[ind].out > zr->cout)) {
+    if (znz_gz_restart(zr, ind >= 0 ? zr->points + ind : NULL)) {
+      fprintf(stderr,"** znz: failed to seek in %s\n", zr->path);
+      zr->error = 1;
+      return -1;
+    }
+  }
+
+  if (posn > zr->cout) {
+    nskip = znz_gz_inflate(zr, NULL, posn - zr->cout);
+    if (nskip < 0) return -1;
+    if (zr->cout < posn) return 0;      /* beyond the end */
+  }
+
+  return znz_gz_inflate(zr, buf, nbytes);
+}
+
+/* read nbytes at offset posn, in parallel if possible
+   (the caller should hold the reader lock) */
+static znz_off_t znz_gz_pread(struct znz_gzreader * zr, char * buf,
+                              size_t nbytes, znz_off_t posn)
+{
+  size_t ndone;
+
+  if (znz_gz_par_read(zr, buf, nbytes, posn, &ndone) == 0)
+    return (znz_off_t)ndone;
+  return znz_gz_read_at(zr, (unsigned char *)buf, (znz_off_t)nbytes, posn);
+}
+
+/* index sidecar files: FILE.idx holds the compressed file size and its
+   last 8 bytes (the gzip trailer), the index span and the access points,
+   with their windows compressed (all integers are little-endian) */
+#define ZNZ_INDEX_MAGIC  "ZNZIDX1\n"
+
+static char * znz_gz_sidecar_name(const struct znz_gzreader * zr)
+{
+  char * name = (char *)malloc(strlen(zr->path) + 5);
+  if (name) { strcpy(name, zr->path); strcat(name, ".idx"); }
+  return name;
+}
+
+static int znz_put_le(FILE * fp, znz_off_t val, int nbytes)
+{
+  unsigned char b[8];
+  int           ind;
+
+  for (ind = 0; ind < nbytes; ind++) { b[ind] = (unsigned char)(val & 0xff); val >>= 8; }
+  return fwrite(b, 1, nbytes, fp) != (size_t)nbytes;
+}
+
+static int znz_get_le(FILE * fp, znz_off_t * val, int nbytes)
+{
+  unsigned char b[8];
+  int           ind;
+
+  if (fread(b, 1, nbytes, fp) != (size_t)nbytes) return 1;
+  for (*val = 0, ind = nbytes-1; ind >= 0; ind--) *val = (*val << 8) | b[ind];
+  return 0;
+}
+
+/* the last 8 bytes of the compressed file, to recognize it later */
+static int znz_gz_file_tail(struct znz_gzreader * zr, unsigned char * tail)
+{
+  zr->error = 1;                        /* the cursor file position moves */
+  return zr->csize < 8 || fseek(zr->fp, zr->csize - 8, SEEK_SET) ||
+         fread(tail, 1, 8, zr->fp) != 8;
+}
+
+static void znz_gz_write_sidecar(struct znz_gzreader * zr)
+{
+  unsigned char   tail[8], * cbuf;
+  uLongf          clen;
+  FILE          * fp;
+  char          * name;
+  int             ind, bad;
+
+  cbuf = (unsigned char *)malloc(compressBound(ZNZ_WINSIZE));
+  name = znz_gz_sidecar_name(zr);
+  if (!cbuf || !name || znz_gz_file_tail(zr, tail) ||
+      (fp = fopen(name, "wb")) == NULL) {
+    free(cbuf); free(name);
+    return;
+  }
+
+  bad = fwrite(ZNZ_INDEX_MAGIC, 1, 8, fp) != 8 ||
+        znz_put_le(fp, zr->csize, 8) || fwrite(tail, 1, 8, fp) != 8 ||
+        znz_put_le(fp, g_znz_index_span, 8) || znz_put_le(fp, zr->npoints, 4);
+  for (ind = 0; ind < zr->npoints && !bad; ind++) {
+    znz_access_point * pt = zr->points + ind;
+    clen = compressBound(ZNZ_WINSIZE);
+    bad = compress(cbuf, &clen, pt->window, pt->wlen) != Z_OK ||
+          znz_put_le(fp, pt->in, 8) || znz_put_le(fp, pt->out, 8) ||
+          znz_put_le(fp, pt->bits, 1) || znz_put_le(fp, pt->wlen, 4) ||
+          znz_put_le(fp, (znz_off_t)clen, 4) ||
+          fwrite(cbuf, 1, clen, fp) != clen;
+  }
+  if (fclose(fp) || bad) remove(name);
+  else                   zr->dirty = 0;
+
+  free(cbuf);
+  free(name);
+}
+
+/* read the access points from any matching sidecar file
+   return 0 if they were read */
+static int znz_gz_read_sidecar(struct znz_gzreader * zr)
+{
+  unsigned char   tail[8], ftail[8], magic[8], * cbuf, * win;
+  znz_off_t       csize, span, npts, in, out, bits, wlen, clen;
+  uLongf          ulen;
+  FILE          * fp;
+  char          * name;
+  int             ind, bad;
+
+  name = znz_gz_sidecar_name(zr);
+  fp   = name ? fopen(name, "rb") : NULL;
+  free(name);
+  if (fp == NULL) return 1;
+
+  cbuf = (unsigned char *)malloc(compressBound(ZNZ_WINSIZE));
+  win  = (unsigned char *)malloc(ZNZ_WINSIZE);
+  bad  = !cbuf || !win || znz_gz_file_tail(zr, tail) ||
+         fread(magic, 1, 8, fp) != 8 || memcmp(magic, ZNZ_INDEX_MAGIC, 8) ||
+         znz_get_le(fp, &csize, 8) || csize != zr->csize ||
+         fread(ftail, 1, 8, fp) != 8 || memcmp(ftail, tail, 8) ||
+         znz_get_le(fp, &span, 8) || znz_get_le(fp, &npts, 4);
+
+  for (ind = 0; ind < npts && !bad; ind++) {
+    bad = znz_get_le(fp, &in, 8) || znz_get_le(fp, &out, 8) ||
+          znz_get_le(fp, &bits, 1) || znz_get_le(fp, &wlen, 4) ||
+          znz_get_le(fp, &clen, 4) || bits > 7 || wlen > ZNZ_WINSIZE ||
+          clen > (znz_off_t)compressBound(ZNZ_WINSIZE) ||
+          fread(cbuf, 1, (size_t)clen, fp) != (size_t)clen;
+    ulen = ZNZ_WINSIZE;
+    if (!bad) bad = uncompress(win, &ulen, cbuf, (uLong)clen) != Z_OK ||
+                    ulen != (uLongf)wlen;
+    /* points are kept, even if the span has since changed */
+    if (!bad && zr->npoints > 0 && out <= zr->points[zr->npoints-1].out)
+      bad = 1;
+    if (!bad)   /* a span of 1, so each saved point is kept */
+      znz_gz_add_point(zr, in, out, (int)bits, win, (unsigned)wlen, 1);
+  }
+
+  fclose(fp);
+  free(cbuf);
+  free(win);
+  zr->dirty = bad;      /* rewrite a bad sidecar */
+
+  return bad;
+}
+
+/*----------------------------------------------------------------------
+ * parallel decompression of gzip files
+
+   A deflate stream cannot generally be decoded starting in the middle,
+   since blocks may refer back to the previous 32 KB of output.  But
+   writers that flush (pigz, or zlib with Z_SYNC_FLUSH or Z_FULL_FLUSH)
+   leave byte-aligned empty stored blocks (00 00 ff ff) in the stream,
+   after which decoding can be speculatively restarted.
+
+   So large reads are split into partitions at such markers.  Worker
+   threads inflate the partitions without history, while the calling
+   thread commits them in order, re-inflating any partition that failed
+   (e.g. it needed history) using the preceding 32 KB as a dictionary.
+   Every partition must end exactly on a block boundary, and if the
+   stream is decoded from the start, the CRC and length in the gzip
+   trailer are verified.  Partition starts are added to the index.
+
+   If anything is unexpected, the parallel read is abandoned and the data
+   is read by the cursor, as usual.
+ *----------------------------------------------------------------------*/
+
+#ifdef HAVE_PTHREAD
+
+/* return the offset of the deflate data in a gzip file, or -1 */
+static znz_off_t znz_gz_header_len(FILE * fp)
+{
+  unsigned char hdr[10];
+  int           flags, c;
+  znz_off_t     len = 10;
+
+  if (fread(hdr, 1, 10, fp) != 10) return -1;
+  if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != 8) return -1;
+  flags = hdr[3];
+  if (flags & 0xe0) return -1;
+
+  if (flags & 4) {                         /* FEXTRA */
+    if (fread(hdr, 1, 2, fp) != 2) return -1;
+    len += 2 + (hdr[0] | (hdr[1] << 8));
+    if (fseek(fp, len, SEEK_SET)) return -1;
+  }
+  if (flags & 8) {                         /* FNAME */
+    do { c = getc(fp); len++; } while (c != 0 && c != EOF);
+    if (c == EOF) return -1;
+  }
+  if (flags & 16) {                        /* FCOMMENT */
+    do { c = getc(fp); len++; } while (c != 0 && c != EOF);
+    if (c == EOF) return -1;
+  }
+  if (flags & 2) len += 2;                 /* FHCRC */
+
+  return len;
+}
+
+/* split the deflate data at flush markers, at least ZNZ_PAR_CHUNK apart
+   (the partition list is kept with the reader)
+   return 0 on success */
+static int znz_gz_partition(struct znz_gzreader * zr)
+{
+  FILE          * fp;
+  unsigned char * buf;
+  znz_off_t       hlen, posn, last, * list, * tmp;
+  size_t          nbuf, i;
+  int             nalloc = 64, nparts = 1, keep = 0;
+
+  fp = fopen(zr->path, "rb");
+  if (fp == NULL) return 1;
+
+  hlen = znz_gz_header_len(fp);
+  buf  = (unsigned char *)malloc(ZNZ_IN_BUFSIZE);
+  list = (znz_off_t *)malloc(nalloc * sizeof(znz_off_t));
+  if (hlen < 0 || buf == NULL || list == NULL || fseek(fp, hlen, SEEK_SET)) {
+    fclose(fp); free(buf); free(list);
+    return 1;
+  }
+
+  list[0] = last = posn = hlen;   /* posn: file offset of buf[keep] */
+  while ((nbuf = fread(buf+keep, 1, ZNZ_IN_BUFSIZE-keep, fp)) > 0) {
+    nbuf += keep;
+    for (i = 0; i + 3 < nbuf; i++) {
+      if (buf[i] || buf[i+1] || buf[i+2] != 0xff || buf[i+3] != 0xff)
+        continue;
+      if (posn - keep + (znz_off_t)i + 4 - last < ZNZ_PAR_CHUNK) continue;
+
+      last = posn - keep + (znz_off_t)i + 4;
+      if (nparts == nalloc) {
+        nalloc *= 2;
+        tmp = (znz_off_t *)realloc(list, nalloc * sizeof(znz_off_t));
+        if (tmp == NULL) { fclose(fp); free(buf); free(list); return 1; }
+        list = tmp;
+      }
+      list[nparts++] = last;
+    }
+    /* keep the last 3 bytes, in case a marker spans buffers */
+    posn += nbuf - keep;
+    keep = nbuf < 3 ? (int)nbuf : 3;
+    memmove(buf, buf + nbuf - keep, keep);
+  }
+  fclose(fp);
+  free(buf);
+
+  zr->csize  = posn;
+  zr->cstart = list;
+  zr->uoff   = (znz_off_t *)malloc((nparts+1) * sizeof(znz_off_t));
+  zr->indep  = (unsigned char *)calloc(nparts+1, 1);
+  if (zr->uoff == NULL || zr->indep == NULL) return 1;
+  for (i = 0; i <= (size_t)nparts; i++) zr->uoff[i] = -1;
+  zr->uoff[0]  = 0;
+  zr->indep[0] = 1;
+  zr->nparts   = nparts;
+
+  return 0;
+}
+
+#define ZNZ_PART_TODO  0    /* not yet taken by a worker       */
+#define ZNZ_PART_BUSY  1    /* being inflated                  */
+#define ZNZ_PART_OK    2    /* ended exactly on block boundary */
+#define ZNZ_PART_END   3    /* reached the end of the stream   */
+#define ZNZ_PART_FAIL  4    /* failed, maybe needs history     */
+
+typedef struct {
+  unsigned char * out;      /* inflated data                    */
+  size_t          len, cap;
+  unsigned long   crc;      /* crc32 of out                     */
+  znz_off_t       cend;     /* end of deflate data, if PART_END */
+  int             status;
+} znz_part;
+
+/* shared state of one parallel read */
+typedef struct {
+  struct znz_gzreader * zr;
+  znz_part            * slots;    /* ring, indexed by partition % nslots */
+  int                   nslots;
+  int                   next;     /* next partition to hand out          */
+  int                   commit;   /* partition being committed           */
+  int                   stop;     /* workers should quit                 */
+  pthread_mutex_t       lock;
+  pthread_cond_t        cond;
+} znz_par_job;
+
+/* inflate partition k into part, using an optional dictionary
+
+   fp is a private handle on the compressed file, strm is an initialized
+   raw inflate stream and inbuf has ZNZ_IN_BUFSIZE bytes.
+   return the resulting status (ZNZ_PART_OK, _END or _FAIL) */
+static int znz_inflate_part(struct znz_gzreader * zr, int k, FILE * fp,
+                            z_stream * strm, unsigned char * inbuf,
+                            const unsigned char * dict, unsigned dictlen,
+                            znz_part * part)
+{
+  znz_off_t       cpos = zr->cstart[k], cend;
+  unsigned char * tmp;
+  size_t          n, newcap;
+  unsigned        avail;
+  int             ret;
+
+  cend = (k+1 < zr->nparts) ? zr->cstart[k+1] : zr->csize;
+  part->len = 0;
+  part->crc = crc32(0L, Z_NULL, 0);
+
+  if (inflateReset(strm) != Z_OK) return ZNZ_PART_FAIL;
+  if (dictlen > 0 && inflateSetDictionary(strm, dict, dictlen) != Z_OK)
+    return ZNZ_PART_FAIL;
+  if (fseek(fp, cpos, SEEK_SET)) return ZNZ_PART_FAIL;
+  strm->avail_in = 0;
+
+  for (;;) {
+    if (strm->avail_in == 0 && cpos < cend) {
+      n = (cend-cpos < ZNZ_IN_BUFSIZE) ? (size_t)(cend-cpos) : ZNZ_IN_BUFSIZE;
+      if (fread(inbuf, 1, n, fp) != n) return ZNZ_PART_FAIL;
+      cpos += n;
+      strm->next_in  = inbuf;
+      strm->avail_in = (unsigned)n;
+    }
+
+    if (part->len == part->cap) {
+      newcap = part->cap ? 2*part->cap : 4*(size_t)(cend-zr->cstart[k]);
+      tmp = (unsigned char *)realloc(part->out, newcap);
+      if (tmp == NULL) return ZNZ_PART_FAIL;
+      part->out = tmp;
+      part->cap = newcap;
+    }
+    n = part->cap - part->len;
+    avail = (n < ZNZ_MAX_BLOCK_SIZE) ? (unsigned)n : ZNZ_MAX_BLOCK_SIZE;
+    strm->next_out  = part->out + part->len;
+    strm->avail_out = avail;
+
+    ret = inflate(strm, Z_BLOCK);
+
+    n = avail - strm->avail_out;
+    part->crc = crc32(part->crc, part->out + part->len, (unsigned)n);
+    part->len += n;
+
+    if (ret == Z_STREAM_END) {
+      part->cend = cpos - strm->avail_in;
+      return ZNZ_PART_END;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) return ZNZ_PART_FAIL;
+
+    /* all input is used: we must be between blocks, with no bits left */
+    if (strm->avail_in == 0 && cpos >= cend) {
+      if ((strm->data_type & 0xff) == 128) return ZNZ_PART_OK;
+      if (strm->avail_out > 0) return ZNZ_PART_FAIL;
+    }
+  }
+}
+
+static void * znz_par_worker(void * arg)
+{
+  znz_par_job   * job = (znz_par_job *)arg;
+  znz_part      * part;
+  FILE          * fp;
+  unsigned char * inbuf;
+  z_stream        strm;
+  int             k, status, ok;
+
+  memset(&strm, 0, sizeof(strm));
+  fp    = fopen(job->zr->path, "rb");
+  inbuf = (unsigned char *)malloc(ZNZ_IN_BUFSIZE);
+  ok    = fp && inbuf && inflateInit2(&strm, -15) == Z_OK;
+
+  pthread_mutex_lock(&job->lock);
+  while (ok) {
+    while (!job->stop && job->next < job->zr->nparts &&
+           job->next >= job->commit + job->nslots)
+      pthread_cond_wait(&job->cond, &job->lock);
+    if (job->stop || job->next >= job->zr->nparts) break;
+
+    k = job->next++;
+    part = job->slots + k % job->nslots;
+    part->status = ZNZ_PART_BUSY;
+    pthread_mutex_unlock(&job->lock);
+
+    status = znz_inflate_part(job->zr, k, fp, &strm, inbuf, NULL, 0, part);
+
+    pthread_mutex_lock(&job->lock);
+    part->status = status;
+    pthread_cond_broadcast(&job->cond);
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  if (ok) inflateEnd(&strm);
+  if (fp) fclose(fp);
+  free(inbuf);
+
+  return NULL;
+}
+
+/* read the 32-bit little-endian value at offset posn of fp */
+static int znz_read_le32(FILE * fp, znz_off_t posn, unsigned long * val)
+{
+  unsigned char b[4];
+  if (fseek(fp, posn, SEEK_SET) || fread(b, 1, 4, fp) != 4) return 1;
+  *val = (unsigned long)b[0] | ((unsigned long)b[1] << 8) |
+         ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 24);
+  return 0;
+}
+
+/* try to read nbytes at offset posn using several threads
+
+   On success, set *nread and return 0.  Otherwise, return 1, so the data
+   can be read by the cursor.
+*/
+static int znz_gz_par_read(struct znz_gzreader * zr, char * buf,
+                           size_t nbytes, znz_off_t posn, size_t * nread)
+{
+  znz_par_job    job;
+  znz_part     * part;
+  pthread_t    * tids = NULL;
+  FILE         * fp = NULL;
+  unsigned char* inbuf = NULL;
+  unsigned char  window[ZNZ_WINSIZE];
+  unsigned       wlen = 0, keep;
+  z_stream       strm;
+  znz_off_t      upos, uend, ubeg, lo, hi;
+  unsigned long  crc, tcrc, tlen;
+  int            nthreads, nstarted = 0, k, k0, status, rv = 1, done = 0;
+  int            nfail = 0, i, have_hist;
+
+  nthreads = znz_get_nthreads();
+  if (zr->no_par || nthreads < 2 || nbytes < ZNZ_PAR_MIN_READ) return 1;
+  upos = posn;
+
+  if (zr->nparts < 0 && znz_gz_partition(zr)) { zr->no_par = 1; return 1; }
+  if (zr->nparts < 2) { zr->no_par = 1; return 1; }  /* no flush points */
+
+  /* start from the last known independent partition at or before upos */
+  for (k0 = 0, k = 1; k < zr->nparts && zr->uoff[k] >= 0; k++)
+    if (zr->indep[k] && zr->uoff[k] <= upos) k0 = k;
+
+  memset(&job, 0, sizeof(job));
+  memset(&strm, 0, sizeof(strm));
+  job.zr     = zr;
+  job.nslots = 2 * nthreads;
+  job.next   = job.commit = k0;
+  job.slots  = (znz_part *)calloc(job.nslots, sizeof(znz_part));
+  tids       = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+  fp         = fopen(zr->path, "rb");
+  inbuf      = (unsigned char *)malloc(ZNZ_IN_BUFSIZE);
+  if (!job.slots || !tids || !fp || !inbuf ||
+      inflateInit2(&strm, -15) != Z_OK) {
+    free(job.slots); free(tids); free(inbuf);
+    if (fp) fclose(fp);
+    return 1;
+  }
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.cond, NULL);
+
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(tids+nstarted, NULL, znz_par_worker, &job) == 0)
+      nstarted++;
+
+  crc  = crc32(0L, Z_NULL, 0);
+  uend = upos + (znz_off_t)nbytes;
+  ubeg = zr->uoff[k0];
+  have_hist = (k0 == 0);        /* window holds all history */
+  *nread = 0;
+
+  for (k = k0; k < zr->nparts && !done; k++) {
+    part = job.slots + k % job.nslots;
+
+    /* wait for the partition, or inflate it here if workers quit */
+    pthread_mutex_lock(&job.lock);
+    if (nstarted == 0 || (job.stop && job.next <= k)) {
+      job.next = k+1;
+      part->status = ZNZ_PART_FAIL;
+    }
+    while (part->status == ZNZ_PART_TODO || part->status == ZNZ_PART_BUSY)
+      pthread_cond_wait(&job.cond, &job.lock);
+    status = part->status;
+    pthread_mutex_unlock(&job.lock);
+
+    if (status == ZNZ_PART_FAIL) {
+      status = znz_inflate_part(zr, k, fp, &strm, inbuf, window, wlen, part);
+      if (status == ZNZ_PART_FAIL) break;
+      /* if nothing decodes without history, stop the workers */
+      if (++nfail >= 4 && nfail == k - k0 + 1) {
+        pthread_mutex_lock(&job.lock);
+        job.stop = 1;
+        pthread_mutex_unlock(&job.lock);
+        zr->no_par = 1;
+      }
+    } else {
+      zr->indep[k] = 1;
+    }
+
+    /* copy any overlap with the requested range */
+    lo = (ubeg > upos) ? ubeg : upos;
+    hi = ubeg + (znz_off_t)part->len;
+    if (hi > uend) hi = uend;
+    if (hi > lo) {
+      memcpy(buf + (lo - upos), part->out + (lo - ubeg), (size_t)(hi - lo));
+      *nread = (size_t)(hi - upos);
+    }
+    if (k0 == 0) crc = crc32_combine(crc, part->crc, (z_off_t)part->len);
+
+    /* keep the last 32 KB of output, as a dictionary */
+    if (part->len >= ZNZ_WINSIZE) {
+      memcpy(window, part->out + part->len - ZNZ_WINSIZE, ZNZ_WINSIZE);
+      wlen = ZNZ_WINSIZE;
+    } else {
+      keep = (wlen + part->len > ZNZ_WINSIZE) ?
+             ZNZ_WINSIZE - (unsigned)part->len : wlen;
+      memmove(window, window + wlen - keep, keep);
+      memcpy(window + keep, part->out, part->len);
+      wlen = keep + (unsigned)part->len;
+    }
+
+    ubeg += (znz_off_t)part->len;
+    zr->uoff[k+1] = ubeg;
+    if (wlen == ZNZ_WINSIZE) have_hist = 1;
+    if (have_hist && status == ZNZ_PART_OK && k+1 < zr->nparts)
+      znz_gz_add_point(zr, zr->cstart[k+1], ubeg, 0, window, wlen,
+                       g_znz_index_span);
+
+    if (status == ZNZ_PART_END) {
+      /* verify the trailer, if the whole stream was seen */
+      if (znz_read_le32(fp, part->cend, &tcrc) ||
+          znz_read_le32(fp, part->cend+4, &tlen)) break;
+      if (k0 == 0 && (tcrc != crc || tlen != ((unsigned long)ubeg & 0xffffffffUL))) {
+        fprintf(stderr,"** znz: gzip trailer mismatch in %s\n", zr->path);
+        break;
+      }
+      /* data beyond a short stream might be another gzip member */
+      if (ubeg < uend && part->cend + 8 < zr->csize) break;
+      done = 1;
+    } else if (k+1 == zr->nparts) {
+      break;                             /* stream ended without a trailer */
+    } else if (ubeg >= uend) {
+      done = 1;
+    }
+
+    /* release the slot */
+    pthread_mutex_lock(&job.lock);
+    part->status = ZNZ_PART_TODO;
+    job.commit = k+1;
+    pthread_cond_broadcast(&job.cond);
+    pthread_mutex_unlock(&job.lock);
+  }
+
+  /* stop and join the workers */
+  pthread_mutex_lock(&job.lock);
+  job.stop = 1;
+  pthread_cond_broadcast(&job.cond);
+  pthread_mutex_unlock(&job.lock);
+  for (i = 0; i < nstarted; i++) pthread_join(tids[i], NULL);
+
+  if (done) {
+    rv = 0;
+  } else {
+    zr->no_par = 1;    /* do not try again with this file */
+  }
+
+  for (i = 0; i < job.nslots; i++) free(job.slots[i].out);
+  free(job.slots);
+  free(tids);
+  free(inbuf);
+  fclose(fp);
+  inflateEnd(&strm);
+  pthread_mutex_destroy(&job.lock);
+  pthread_cond_destroy(&job.cond);
+
+  return rv;
+}
+
+#else  /* HAVE_PTHREAD */
+
+static int znz_gz_par_read(struct znz_gzreader * zr, char * buf,
+                           size_t nbytes, znz_off_t posn, size_t * nread)
+{
+  (void)zr; (void)buf; (void)nbytes; (void)posn; (void)nread;
+  return 1;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/*----------------------------------------------------------------------
+ * parallel compression of gzip files opened for writing
+
+   As with pigz, data is deflated in blocks of ZNZ_BLOCKSIZE bytes, each
+   primed with the previous 32 KB of input as a dictionary and ended with
+   a sync flush, so that the blocks concatenate into a single deflate
+   stream.  A batch of blocks (4 per thread) is compressed at a time and
+   then written in order, between the usual gzip header and trailer.
+   The flush markers also allow parallel decompression of the result.
+ *----------------------------------------------------------------------*/
+
+/* one batch of blocks to compress */
+typedef struct {
+  struct znz_gzwriter * zw;
+  const unsigned char * data;
+  size_t                len;
+  int                   nblocks;
+  int                   next;     /* next block to compress  */
+  int                   ndone;    /* blocks compressed       */
+  int                   last;     /* batch ends the stream   */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t       lock;
+#endif
+} znz_deflate_job;
+
+static void znz_gzwriter_free(struct znz_gzwriter * zw)
+{
+  if (zw == NULL) return;
+  free(zw->pend);
+  free(zw->obuf);
+  free(zw->olen);
+  free(zw->bcrc);
+  free(zw);
+}
+
+/* open path for writing, and write the gzip header
+
+   mode is as for gzopen, though only 'w', 'a', 'b' and a compression
+   level are used */
+static struct znz_gzwriter * znz_gzwriter_new(const char * path,
+                                              const char * mode)
+{
+  struct znz_gzwriter * zw;
+  unsigned char         hdr[10];
+  const char          * cp;
+  int                   nblocks;
+
+  zw = (struct znz_gzwriter *)calloc(1, sizeof(struct znz_gzwriter));
+  if (zw == NULL) return NULL;
+
+  zw->level = Z_DEFAULT_COMPRESSION;
+  for (cp = mode; *cp; cp++)
+    if (*cp >= '0' && *cp <= '9') zw->level = *cp - '0';
+  zw->nthreads = znz_get_nthreads();
+  zw->batch    = (size_t)zw->nthreads * 4 * ZNZ_BLOCKSIZE;
+  zw->ocap     = deflateBound(NULL, ZNZ_BLOCKSIZE) + 64;
+  zw->crc      = crc32(0L, Z_NULL, 0);
+
+  nblocks  = zw->nthreads * 4;
+  zw->pend = (unsigned char *)malloc(zw->batch);
+  zw->obuf = (unsigned char *)malloc(nblocks * zw->ocap);
+  zw->olen = (size_t *)malloc(nblocks * sizeof(size_t));
+  zw->bcrc = (unsigned long *)malloc(nblocks * sizeof(unsigned long));
+  if (!zw->pend || !zw->obuf || !zw->olen || !zw->bcrc) {
+    fprintf(stderr,"** ERROR: znzopen failed to alloc gzip buffers\n");
+    znz_gzwriter_free(zw);
+    return NULL;
+  }
+
+  zw->fp = fopen(path, strchr(mode,'a') ? "ab" : "wb");
+  if (zw->fp == NULL) { znz_gzwriter_free(zw); return NULL; }
+
+  /* gzip header: no name or time, and the OS as in zlib */
+  memset(hdr, 0, sizeof(hdr));
+  hdr[0] = 0x1f;  hdr[1] = 0x8b;  hdr[2] = Z_DEFLATED;
+  hdr[8] = (zw->level == 9) ? 2 : (zw->level == 1) ? 4 : 0;
+  hdr[9] = 3;
+  if (fwrite(hdr, 1, 10, zw->fp) != 10) zw->error = 1;
+
+  return zw;
+}
+
+static void * znz_deflate_worker(void * arg)
+{
+  znz_deflate_job     * job = (znz_deflate_job *)arg;
+  struct znz_gzwriter * zw  = job->zw;
+  const unsigned char * in, * dict;
+  z_stream              strm;
+  size_t                n;
+  unsigned              dictlen;
+  int                   ind, flush, ret;
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, zw->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)
+      != Z_OK) return NULL;   /* other threads will do the work */
+
+  for (;;) {
+    ZNZ_LOCK(&job->lock);
+    ind = job->next++;
+    ZNZ_UNLOCK(&job->lock);
+    if (ind >= job->nblocks) break;
+
+    in = job->data + (size_t)ind * ZNZ_BLOCKSIZE;
+    n  = job->len - (size_t)ind * ZNZ_BLOCKSIZE;
+    if (n > ZNZ_BLOCKSIZE) n = ZNZ_BLOCKSIZE;
+    if (ind > 0) { dict = in - ZNZ_WINSIZE;  dictlen = ZNZ_WINSIZE; }
+    else         { dict = zw->window;        dictlen = zw->wlen;    }
+    flush = (job->last && ind == job->nblocks-1) ? Z_FINISH : Z_SYNC_FLUSH;
+
+    if (deflateReset(&strm) != Z_OK) break;
+    if (dictlen > 0 && deflateSetDictionary(&strm, dict, dictlen) != Z_OK)
+      break;
+    strm.next_in   = (Bytef *)in;
+    strm.avail_in  = (unsigned)n;
+    strm.next_out  = zw->obuf + (size_t)ind * zw->ocap;
+    strm.avail_out = (unsigned)zw->ocap;
+    ret = deflate(&strm, flush);
+    if (flush == Z_FINISH ? ret != Z_STREAM_END :
+        (ret != Z_OK || strm.avail_in > 0 || strm.avail_out == 0)) break;
+
+    zw->olen[ind] = zw->ocap - strm.avail_out;
+    zw->bcrc[ind] = crc32(0L, in, (unsigned)n);
+
+    ZNZ_LOCK(&job->lock);
+    job->ndone++;
+    ZNZ_UNLOCK(&job->lock);
+  }
+
+  deflateEnd(&strm);
+  return NULL;
+}
+
+/* compress and write len bytes of data, ending the stream if last
+   return 0 on success */
+static int znz_gzwriter_batch(struct znz_gzwriter * zw,
+                              const unsigned char * data, size_t len,
+                              int last)
+{
+  static const unsigned char final_block[2] = { 3, 0 };
+  znz_deflate_job job;
+  size_t          n, keep;
+  int             ind;
+#ifdef HAVE_PTHREAD
+  pthread_t     * tids;
+  int             nstarted = 0;
+#endif
+
+  /* after a sync flush, the stream may still need an empty final block */
+  if (len == 0) {
+    if (last && fwrite(final_block, 1, 2, zw->fp) != 2) return 1;
+    return 0;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.zw      = zw;
+  job.data    = data;
+  job.len     = len;
+  job.nblocks = (int)((len + ZNZ_BLOCKSIZE - 1) / ZNZ_BLOCKSIZE);
+  job.last    = last;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&job.lock, NULL);
+  tids = (pthread_t *)malloc(zw->nthreads * sizeof(pthread_t));
+  if (tids)
+    for (ind = 1; ind < zw->nthreads && ind < job.nblocks; ind++)
+      if (pthread_create(tids+nstarted, NULL, znz_deflate_worker, &job) == 0)
+        nstarted++;
+#endif
+
+  znz_deflate_worker(&job);         /* this thread works, too */
+
+#ifdef HAVE_PTHREAD
+  for (ind = 0; ind < nstarted; ind++) pthread_join(tids[ind], NULL);
+  free(tids);
+  pthread_mutex_destroy(&job.lock);
+#endif
+
+  if (job.ndone != job.nblocks) {
+    fprintf(stderr,"** znz: failed to compress data\n");
+    return 1;
+  }
+
+  for (ind = 0; ind < job.nblocks; ind++) {
+    n = len - (size_t)ind * ZNZ_BLOCKSIZE;
+    if (n > ZNZ_BLOCKSIZE) n = ZNZ_BLOCKSIZE;
+    if (fwrite(zw->obuf + (size_t)ind * zw->ocap, 1, zw->olen[ind], zw->fp)
+        != zw->olen[ind]) return 1;
+    zw->crc = crc32_combine(zw->crc, zw->bcrc[ind], (z_off_t)n);
+  }
+
+  /* keep the last 32 KB of input, as the next dictionary */
+  if (len >= ZNZ_WINSIZE) {
+    memcpy(zw->window, data + len - ZNZ_WINSIZE, ZNZ_WINSIZE);
+    zw->wlen = ZNZ_WINSIZE;
+  } else {
+    keep = (zw->wlen + len > ZNZ_WINSIZE) ? ZNZ_WINSIZE - len : zw->wlen;
+    memmove(zw->window, zw->window + zw->wlen - keep, keep);
+    memcpy(zw->window + keep, data, len);
+    zw->wlen = (unsigned)(keep + len);
+  }
+
+  return 0;
+}
+
+/* buffer or compress nbytes of buf, returning the number accepted */
+static size_t znz_gzwriter_write(struct znz_gzwriter * zw,
+                                 const unsigned char * buf, size_t nbytes)
+{
+  size_t n, done = 0;
+
+  if (zw->error) return 0;
+
+  /* first complete any pending batch */
+  if (zw->npend > 0) {
+    n = zw->batch - zw->npend;
+    if (n > nbytes) n = nbytes;
+    memcpy(zw->pend + zw->npend, buf, n);
+    zw->npend += n;
+    done = n;
+    if (zw->npend == zw->batch) {
+      if (znz_gzwriter_batch(zw, zw->pend, zw->batch, 0)) {
+        zw->error = 1;
+        return 0;
+      }
+      zw->npend = 0;
+    }
+  }
+
+  /* compress whole batches in place, and keep the rest */
+  while (nbytes - done >= zw->batch) {
+    if (znz_gzwriter_batch(zw, buf + done, zw->batch, 0)) {
+      zw->error = 1;
+      zw->upos += done;
+      return done;
+    }
+    done += zw->batch;
+  }
+  if (done < nbytes) {
+    memcpy(zw->pend + zw->npend, buf + done, nbytes - done);
+    zw->npend += nbytes - done;
+  }
+
+  zw->upos += nbytes;
+  return nbytes;
+}
+
+/* as with gzseek for writing, only forward seeks are allowed (writing
+   zeros), returning the new position or -1 */
+static znz_off_t znz_gzwriter_seek(struct znz_gzwriter * zw,
+                                   znz_off_t offset, int whence)
+{
+  static const unsigned char zeros[4096] = { 0 };
+  znz_off_t posn;
+  size_t    n;
+
+  if (whence == SEEK_END) return -1;
+  posn = (whence == SEEK_CUR) ? zw->upos + offset : offset;
+  if (posn < zw->upos) return -1;
+
+  while (zw->upos < posn) {
+    n = (posn - zw->upos < 4096) ? (size_t)(posn - zw->upos) : 4096;
+    if (znz_gzwriter_write(zw, zeros, n) < n) return -1;
+  }
+
+  return posn;
+}
+
+/* flush the remaining data and trailer, close the file and free zw
+   return 0 on success (else -1) */
+static int znz_gzwriter_close(struct znz_gzwriter * zw)
+{
+  unsigned char trailer[8];
+  unsigned long isize = (unsigned long)zw->upos & 0xffffffffUL;
+  int           ind, rv = zw->error;
+
+  if (!rv) rv = znz_gzwriter_batch(zw, zw->pend, zw->npend, 1);
+  if (!rv) {
+    for (ind = 0; ind < 4; ind++) {
+      trailer[ind]   = (unsigned char)((zw->crc >> (8*ind)) & 0xff);
+      trailer[ind+4] = (unsigned char)((isize >> (8*ind)) & 0xff);
+    }
+    if (fwrite(trailer, 1, 8, zw->fp) != 8) rv = 1;
+  }
+  if (fclose(zw->fp)) rv = 1;
+  znz_gzwriter_free(zw);
+
+  return rv ? -1 : 0;
+}
+
+#endif /* HAVE_ZLIB */
@@ -100,11 +100,16 @@ extern "C" {
   #endif
 #endif
 
+struct znz_gzreader;   /* private state for reading gzip files      */
+struct znz_gzwriter;   /* private state for parallel compression      */
+
 struct znzptr {
   int withz;
   FILE* nzfptr;
 #ifdef HAVE_ZLIB
   gzFile zfptr;
+  struct znz_gzreader * zread;
+  struct znz_gzwriter * zwrite;  /* used instead of zfptr, if set */
 #endif
 } ;
 
@@ -142,6 +147,99 @@ ZNZ_API znz_off_t znztell(znzFile file);
 
 ZNZ_API int znzputs(const char *str, znzFile file);
 
+/* return whether file was opened with compression */
+ZNZ_API int znz_iscompressed(znzFile file);
+
+/* Positional reads and writes, as with pread() and pwrite().  The file
+   position is neither used nor changed, so several threads may read from
+   one open file at once.  Uncompressed files use pread/pwrite, where
+   available, while gzip reads are serialized (and use the index).  Gzip
+   output is sequential, so znzpwrite only works at the current position.
+   Return the number of bytes read or written.
+*/
+ZNZ_API size_t znzpread(znzFile file, void * buf, size_t nbytes,
+                        znz_off_t offset);
+
+ZNZ_API size_t znzpwrite(znzFile file, const void * buf, size_t nbytes,
+                         znz_off_t offset);
+
+/* Number of threads used for parallel (de)compression (default 1, or the
+   value of the ZNZ_NUM_THREADS environment variable).  Large reads from
+   gzip files use several threads, if the stream has flush points.  Gzip
+   files opened for writing while this is above 1 are compressed in
+   parallel blocks, as with pigz.
+*/
+ZNZ_API void   znz_set_nthreads(int nthreads);
+
+ZNZ_API int    znz_get_nthreads(void);
+
+/* Gzip files opened for reading are indexed (every span bytes) as they
+   are read, so that later seeks need not restart decompression from the
+   beginning.  With ZNZ_INDEX_SIDECAR, the index is also saved to (and
+   read from) FILE.idx, e.g. image.nii.gz.idx.
+   Set the mode and span before any threads use znzlib, as they are
+   global and not locked.
+*/
+#define ZNZ_INDEX_NONE    0
+#define ZNZ_INDEX_MEMORY  1     /* default */
+#define ZNZ_INDEX_SIDECAR 2
+#define ZNZ_INDEX_SPAN    (1<<22)
+
+ZNZ_API void      znz_set_index_mode(int mode);
+
+ZNZ_API int       znz_get_index_mode(void);
+
+ZNZ_API void      znz_set_index_span(znz_off_t span);
+
+ZNZ_API znz_off_t znz_get_index_span(void);
+
+ZNZ_API int       znz_index_points(znzFile file);
+
+/* Memory mapping of a region of an open, uncompressed file.
+   mode is ZNZ_MMAP_READONLY (shared, read-only pages) or ZNZ_MMAP_PRIVATE
+   (writable, copy-on-write pages that are never written back to the file).
+   The mapping does not depend on the file staying open, and must be
+   released with znzmunmap(), using the same length.
+*/
+#define ZNZ_MMAP_READONLY 1
+#define ZNZ_MMAP_PRIVATE  2
+
+ZNZ_API int    znz_have_mmap(void);
+
+ZNZ_API void * znzmmap(znzFile file, znz_off_t offset, size_t length, int mode);
+
+ZNZ_API int    znzmunmap(void * addr, size_t length);
+
+/* Write buf as a single gzip member of stored (uncompressed) deflate
+   blocks, at the start of path.  mode "wb" creates the file, and "r+b"
+   overwrites the start of an existing one.  The member size depends only
+   on nbytes, so a header written this way may later be rewritten in
+   place, while compressed data is appended (mode "ab") as a following
+   member.  Return the member size, or -1 on failure.
+*/
+ZNZ_API long   znz_write_gz_stored(const char * path, const void * buf,
+                                   size_t nbytes, const char * mode);
+
+/* Read the first nbytes of path into buf, decompressing it if it is
+   gzipped (judged by content, not name).  Only as much of the file is
+   read and inflated as needed, and no znzFile (or gz stream buffers) are
+   allocated, making this cheap for reading many headers.  Return the
+   number of bytes read (less than nbytes for a short file), or -1 on
+   failure.
+*/
+ZNZ_API long   znz_read_head(const char * path, void * buf, size_t nbytes);
+
+/* List the entries of directory dname (except "." and ".."), keeping
+   only names for which keep() returns non-zero (if keep is not NULL).
+   The names are returned in *names (unsorted), to be freed with
+   znz_free_dir_list().  Return the number of names, or -1 on failure
+   (or if directory listing is not supported).
+*/
+ZNZ_API long   znz_list_dir(const char * dname, char *** names,
+                            int (*keep)(const char * name));
+
+ZNZ_API void   znz_free_dir_list(char ** names, long nnames);
+
 #ifdef COMPILE_NIFTIUNUSED_CODE
 ZNZ_API char * znzgets(char* str, int size, znzFile file);
 